@@ -1,5 +1,7 @@
 #include "atomic.h"
 
+#if defined(_WIN32)
+
 #define WIN32_LEAN_AND_MEAN
 #include <windows.h>
 
@@ -27,3 +29,65 @@ void atomic_store(int* address, int value)
 {
 	*(volatile int*)address = value;
 }
+
+void* atomic_exchange_pointer(void** address, void* value)
+{
+	return InterlockedExchangePointer(address, value);
+}
+
+void* atomic_load_pointer(void** address)
+{
+	return *(void* volatile*)address;
+}
+
+void atomic_store_pointer(void** address, void* value)
+{
+	*(void* volatile*)address = value;
+}
+
+#else
+
+#include <stdbool.h>
+
+int atomic_increment(int* address)
+{
+	return __atomic_fetch_add(address, 1, __ATOMIC_SEQ_CST);
+}
+
+int atomic_decrement(int* address)
+{
+	return __atomic_fetch_sub(address, 1, __ATOMIC_SEQ_CST);
+}
+
+int atomic_compare_and_exchange(int* dest, int compare, int exchange)
+{
+	__atomic_compare_exchange_n(dest, &compare, exchange, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+	return compare;
+}
+
+int atomic_load(int* address)
+{
+	return __atomic_load_n(address, __ATOMIC_ACQUIRE);
+}
+
+void atomic_store(int* address, int value)
+{
+	__atomic_store_n(address, value, __ATOMIC_RELEASE);
+}
+
+void* atomic_exchange_pointer(void** address, void* value)
+{
+	return __atomic_exchange_n(address, value, __ATOMIC_SEQ_CST);
+}
+
+void* atomic_load_pointer(void** address)
+{
+	return __atomic_load_n(address, __ATOMIC_ACQUIRE);
+}
+
+void atomic_store_pointer(void** address, void* value)
+{
+	__atomic_store_n(address, value, __ATOMIC_RELEASE);
+}
+
+#endif
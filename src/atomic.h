@@ -27,3 +27,17 @@ int atomic_load(int* address);
 // Writes an integer.
 // Paired with an atomic_load, can guarantee ordering and visibility.
 void atomic_store(int* address, int value);
+
+// Swap a pointer atomically.
+// Returns the old value of the pointer.
+// Performs the following operation atomically:
+//   void* old_value = *address; *address = value; return old_value;
+void* atomic_exchange_pointer(void** address, void* value);
+
+// Reads a pointer from an address.
+// All writes that occurred before the last atomic_store_pointer to this address are visible.
+void* atomic_load_pointer(void** address);
+
+// Writes a pointer.
+// Paired with an atomic_load_pointer, can guarantee ordering and visibility.
+void atomic_store_pointer(void** address, void* value);
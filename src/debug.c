@@ -3,12 +3,26 @@
 #include <stdarg.h>
 #include <stdio.h>
 
+#if defined(_WIN32)
 #define WIN32_LEAN_AND_MEAN
 #include <windows.h>
 #include <DbgHelp.h>
+#else
+#include <execinfo.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#endif
 
 static uint32_t s_mask = 0xffffffff;
 
+void debug_set_print_mask(uint32_t mask)
+{
+	s_mask = mask;
+}
+
+#if defined(_WIN32)
+
 static LONG debug_exception_handler(LPEXCEPTION_POINTERS info)
 {
 	// XXX: MS uses 0xE06D7363 to indicate C++ language exception.
@@ -48,11 +62,6 @@ void debug_install_exception_handler()
 	AddVectoredExceptionHandler(TRUE, debug_exception_handler);
 }
 
-void debug_set_print_mask(uint32_t mask)
-{
-	s_mask = mask;
-}
-
 void debug_print(uint32_t type, _Printf_format_string_ const char* format, ...)
 {
 	if ((s_mask & type) == 0)
@@ -121,3 +130,82 @@ void callstack_printer(uint32_t type, void* stack[], size_t count) {
 	}
 	SymCleanup(process);
 }
+
+#else
+
+static void debug_signal_handler(int signal_number)
+{
+	debug_print(k_print_error, "Caught signal %d!\n", signal_number);
+
+	void* stack[32];
+	int count = backtrace(stack, 32);
+	backtrace_symbols_fd(stack, count, 2);
+
+	// Let the default action produce a core dump.
+	signal(signal_number, SIG_DFL);
+	raise(signal_number);
+}
+
+void debug_install_exception_handler()
+{
+	signal(SIGSEGV, debug_signal_handler);
+	signal(SIGBUS, debug_signal_handler);
+	signal(SIGFPE, debug_signal_handler);
+	signal(SIGILL, debug_signal_handler);
+}
+
+void debug_print(uint32_t type, _Printf_format_string_ const char* format, ...)
+{
+	if ((s_mask & type) == 0)
+	{
+		return;
+	}
+
+	va_list args;
+	va_start(args, format);
+	char buffer[256];
+	vsnprintf(buffer, sizeof(buffer), format, args);
+	va_end(args);
+
+	fputs(buffer, stdout);
+	fflush(stdout);
+}
+
+int debug_backtrace(void** stack, int stack_capacity)
+{
+	// Skip this function's own frame to match CaptureStackBackTrace(1, ...).
+	void* frames[64];
+	int count = backtrace(frames, stack_capacity + 1 < 64 ? stack_capacity + 1 : 64);
+	if (count <= 1)
+	{
+		return 0;
+	}
+	memcpy(stack, frames + 1, sizeof(void*) * (count - 1));
+	return count - 1;
+}
+
+void callstack_printer(uint32_t type, void* stack[], size_t count)
+{
+	size_t used = 0;
+	while (used < count && stack[used])
+	{
+		used++;
+	}
+
+	char** symbols = backtrace_symbols(stack, (int)used);
+	if (!symbols)
+	{
+		return;
+	}
+	for (size_t i = 0; i < used; i++)
+	{
+		debug_print(type, "[%d] %s\n", (int)i, symbols[i]);
+		if (strstr(symbols[i], "(main+"))
+		{
+			break;
+		}
+	}
+	free(symbols);
+}
+
+#endif
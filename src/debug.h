@@ -1,7 +1,12 @@
 #pragma once
 
+#include <stddef.h>
 #include <stdint.h>
 
+#if !defined(_MSC_VER)
+#define _Printf_format_string_
+#endif
+
 // Debugging Support
 
 // Flags for debug_print().
@@ -1,5 +1,7 @@
 #include "event.h"
 
+#if defined(_WIN32)
+
 #define WIN32_LEAN_AND_MEAN
 #include <windows.h>
 
@@ -28,3 +30,60 @@ bool event_is_raised(event_t* event)
 {
 	return WaitForSingleObject(event, 0) == WAIT_OBJECT_0;
 }
+
+#else
+
+#include <pthread.h>
+#include <stdlib.h>
+
+// Manual-reset event: stays raised once signaled.
+typedef struct event_t
+{
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	bool raised;
+} event_t;
+
+event_t* event_create()
+{
+	event_t* event = calloc(1, sizeof(event_t));
+	pthread_mutex_init(&event->mutex, NULL);
+	pthread_cond_init(&event->cond, NULL);
+	event->raised = false;
+	return event;
+}
+
+void event_destroy(event_t* event)
+{
+	pthread_cond_destroy(&event->cond);
+	pthread_mutex_destroy(&event->mutex);
+	free(event);
+}
+
+void event_signal(event_t* event)
+{
+	pthread_mutex_lock(&event->mutex);
+	event->raised = true;
+	pthread_cond_broadcast(&event->cond);
+	pthread_mutex_unlock(&event->mutex);
+}
+
+void event_wait(event_t* event)
+{
+	pthread_mutex_lock(&event->mutex);
+	while (!event->raised)
+	{
+		pthread_cond_wait(&event->cond, &event->mutex);
+	}
+	pthread_mutex_unlock(&event->mutex);
+}
+
+bool event_is_raised(event_t* event)
+{
+	pthread_mutex_lock(&event->mutex);
+	bool raised = event->raised;
+	pthread_mutex_unlock(&event->mutex);
+	return raised;
+}
+
+#endif
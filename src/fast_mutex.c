@@ -0,0 +1,83 @@
+#include "fast_mutex.h"
+
+#include "heap.h"
+
+#if defined(_WIN32)
+
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+
+typedef struct fast_mutex_t
+{
+	heap_t* heap;
+	SRWLOCK lock;
+} fast_mutex_t;
+
+fast_mutex_t* fast_mutex_create(heap_t* heap)
+{
+	fast_mutex_t* mutex = heap_alloc(heap, sizeof(fast_mutex_t), 8);
+	mutex->heap = heap;
+	InitializeSRWLock(&mutex->lock);
+	return mutex;
+}
+
+void fast_mutex_destroy(fast_mutex_t* mutex)
+{
+	heap_free(mutex->heap, mutex);
+}
+
+void fast_mutex_lock(fast_mutex_t* mutex)
+{
+	AcquireSRWLockExclusive(&mutex->lock);
+}
+
+bool fast_mutex_try_lock(fast_mutex_t* mutex)
+{
+	return TryAcquireSRWLockExclusive(&mutex->lock) != 0;
+}
+
+void fast_mutex_unlock(fast_mutex_t* mutex)
+{
+	ReleaseSRWLockExclusive(&mutex->lock);
+}
+
+#else
+
+#include <pthread.h>
+
+typedef struct fast_mutex_t
+{
+	heap_t* heap;
+	pthread_mutex_t mutex;
+} fast_mutex_t;
+
+fast_mutex_t* fast_mutex_create(heap_t* heap)
+{
+	fast_mutex_t* mutex = heap_alloc(heap, sizeof(fast_mutex_t), 8);
+	mutex->heap = heap;
+	pthread_mutex_init(&mutex->mutex, NULL);
+	return mutex;
+}
+
+void fast_mutex_destroy(fast_mutex_t* mutex)
+{
+	pthread_mutex_destroy(&mutex->mutex);
+	heap_free(mutex->heap, mutex);
+}
+
+void fast_mutex_lock(fast_mutex_t* mutex)
+{
+	pthread_mutex_lock(&mutex->mutex);
+}
+
+bool fast_mutex_try_lock(fast_mutex_t* mutex)
+{
+	return pthread_mutex_trylock(&mutex->mutex) == 0;
+}
+
+void fast_mutex_unlock(fast_mutex_t* mutex)
+{
+	pthread_mutex_unlock(&mutex->mutex);
+}
+
+#endif
@@ -0,0 +1,29 @@
+#pragma once
+
+#include <stdbool.h>
+
+// Non-recursive mutex thread synchronization
+//
+// Cheaper than mutex_t: uncontended lock and unlock stay in user mode.
+// A thread must not lock a fast mutex it already holds.
+
+// Handle to a fast mutex.
+typedef struct fast_mutex_t fast_mutex_t;
+
+typedef struct heap_t heap_t;
+
+// Creates a new fast mutex.
+fast_mutex_t* fast_mutex_create(heap_t* heap);
+
+// Destroys a previously created fast mutex.
+void fast_mutex_destroy(fast_mutex_t* mutex);
+
+// Locks a fast mutex. May block if another thread holds it.
+void fast_mutex_lock(fast_mutex_t* mutex);
+
+// Attempts to lock a fast mutex without blocking.
+// Returns true if the lock was acquired.
+bool fast_mutex_try_lock(fast_mutex_t* mutex);
+
+// Unlocks a fast mutex.
+void fast_mutex_unlock(fast_mutex_t* mutex);
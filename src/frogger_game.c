@@ -1,5 +1,6 @@
 #include "ecs.h"
 #include "fs.h"
+#include "fs_watch.h"
 #include "gpu.h"
 #include "heap.h"
 #include "render.h"
@@ -63,6 +64,16 @@ typedef struct audio_listener_component_t {
 }audio_listener_component_t;
 
 
+// One complete set of shaders. Hot reload fills the spare set, then swaps.
+typedef struct frogger_shaders_t
+{
+	gpu_shader_info_t cube;
+	gpu_shader_info_t rect;
+	fs_work_t* vertex_work;
+	fs_work_t* fragment_work;
+	fs_work_t* fragment_traffic_work;
+} frogger_shaders_t;
+
 typedef struct frogger_game_t
 {
 	heap_t* heap;
@@ -92,11 +103,18 @@ typedef struct frogger_game_t
 
 	gpu_mesh_info_t cube_mesh;
 	gpu_mesh_info_t rect_mesh;
-	gpu_shader_info_t cube_shader;
-	gpu_shader_info_t rect_shader;
-	fs_work_t* vertex_shader_work;
-	fs_work_t* fragment_shader_traffic_work;
-	fs_work_t* fragment_shader_work;
+	// The render keys its pipelines on shader info addresses, so a reload
+	// goes into the other set rather than over the one being drawn.
+	frogger_shaders_t shaders[2];
+	int shader_set;
+	fs_watch_t* watch;
+	// Shader reads finish here, so a frame drains them in one go rather
+	// than polling each work.
+	fs_completion_t* shader_completion;
+	int shaders_pending;
+	bool shaders_changed;
+	bool shaders_loading;
+	int frames_since_swap;
 
 	
 } frogger_game_t;
@@ -107,6 +125,7 @@ float right = 80.0f / 4.0f;
 float top = 45.0f / 4.0f;
 static void load_resources(frogger_game_t* game);
 static void unload_resources(frogger_game_t* game);
+static void update_hot_reload(frogger_game_t* game);
 static void spawn_player(frogger_game_t* game, int index);
 static void spawn_enemy(frogger_game_t* game, int index, int row, int order);
 static void spawn_camera(frogger_game_t* game);
@@ -198,34 +217,175 @@ void frogger_game_update(frogger_game_t* game)
 {
 	timer_object_update(game->timer);
 	ecs_update(game->ecs);
+	update_hot_reload(game);
 	update_players(game);
 	draw_models(game);
 	render_push_done(game->render);
 }
 
-static void load_resources(frogger_game_t* game)
+enum
+{
+	// Frames a retired shader set is left alone before it is reused, so the
+	// render has stopped drawing with it and dropped its pipelines.
+	k_shader_reload_min_frames = 16,
+};
+
+static const char* k_shader_paths[] =
+{
+	"shaders/triangle.vert.spv",
+	"shaders/triangle.frag.spv",
+	"shaders/traffic.frag.spv",
+};
+
+// Queue reads of every shader into a set. Files that haven't changed come
+// straight from the fs cache. Each read is posted to the shader completion
+// channel when it finishes.
+static void load_shaders(frogger_game_t* game, frogger_shaders_t* shaders)
+{
+	fs_work_options_t options = { .completion = game->shader_completion };
+	shaders->vertex_work = fs_read_shared(game->fs, k_shader_paths[0], false, &options);
+	shaders->fragment_work = fs_read_shared(game->fs, k_shader_paths[1], false, &options);
+	shaders->fragment_traffic_work = fs_read_shared(game->fs, k_shader_paths[2], false, &options);
+	game->shaders_pending = _countof(k_shader_paths);
+}
+
+// Pop whatever shader reads have finished without blocking.
+// Returns true once every read of the loading set is in.
+static bool drain_shaders(frogger_game_t* game)
+{
+	fs_work_t* works[_countof(k_shader_paths)];
+	game->shaders_pending -= fs_completion_drain(game->shader_completion, works, _countof(works));
+	return game->shaders_pending == 0;
+}
+
+// Block until every read of the loading set is in. A work must be popped
+// from its channel before it is destroyed.
+static void wait_shaders(frogger_game_t* game)
+{
+	for (; game->shaders_pending > 0; game->shaders_pending--)
+	{
+		fs_completion_wait(game->shader_completion);
+	}
+}
+
+static void unload_shaders(frogger_shaders_t* shaders)
 {
-	game->vertex_shader_work = fs_read(game->fs, "shaders/triangle.vert.spv", game->heap, false, false);
+	fs_work_destroy(shaders->vertex_work);
+	fs_work_destroy(shaders->fragment_work);
+	fs_work_destroy(shaders->fragment_traffic_work);
+	memset(shaders, 0, sizeof(*shaders));
+}
+
+// A file caught half saved must not reach the GPU: check for SPIR-V's magic.
+static bool is_spirv(fs_work_t* work)
+{
+	const uint32_t* words = fs_work_get_buffer(work);
+	size_t size = fs_work_get_size(work);
+	return fs_work_get_result(work) == 0 && words && size >= sizeof(uint32_t) && size % sizeof(uint32_t) == 0 && words[0] == 0x07230203;
+}
 
-	game->fragment_shader_work = fs_read(game->fs, "shaders/triangle.frag.spv", game->heap, false, false);
-	game->fragment_shader_traffic_work = fs_read(game->fs, "shaders/traffic.frag.spv", game->heap, false, false);
-	game->cube_shader = (gpu_shader_info_t)
+// Fill in a set's shader infos once its reads are done.
+// Returns false if any shader is missing or malformed.
+static bool build_shaders(frogger_shaders_t* shaders)
+{
+	shaders->cube = (gpu_shader_info_t)
 	{
-		.vertex_shader_data = fs_work_get_buffer(game->vertex_shader_work),
-		.vertex_shader_size = fs_work_get_size(game->vertex_shader_work),
-		.fragment_shader_data = fs_work_get_buffer(game->fragment_shader_work),
-		.fragment_shader_size = fs_work_get_size(game->fragment_shader_work),
+		.vertex_shader_data = fs_work_get_buffer(shaders->vertex_work),
+		.vertex_shader_size = fs_work_get_size(shaders->vertex_work),
+		.fragment_shader_data = fs_work_get_buffer(shaders->fragment_work),
+		.fragment_shader_size = fs_work_get_size(shaders->fragment_work),
 		.uniform_buffer_count = 1,
 	};
 
-	game->rect_shader = (gpu_shader_info_t)
+	shaders->rect = (gpu_shader_info_t)
 	{
-		.vertex_shader_data = fs_work_get_buffer(game->vertex_shader_work),
-		.vertex_shader_size = fs_work_get_size(game->vertex_shader_work),
-		.fragment_shader_data = fs_work_get_buffer(game->fragment_shader_traffic_work),
-		.fragment_shader_size = fs_work_get_size(game->fragment_shader_traffic_work),
+		.vertex_shader_data = fs_work_get_buffer(shaders->vertex_work),
+		.vertex_shader_size = fs_work_get_size(shaders->vertex_work),
+		.fragment_shader_data = fs_work_get_buffer(shaders->fragment_traffic_work),
+		.fragment_shader_size = fs_work_get_size(shaders->fragment_traffic_work),
 		.uniform_buffer_count = 1,
 	};
+	return is_spirv(shaders->vertex_work) && is_spirv(shaders->fragment_work) && is_spirv(shaders->fragment_traffic_work);
+}
+
+static void on_shader_changed(const char* path, void* user)
+{
+	frogger_game_t* game = user;
+	debug_print(k_print_info, "frogger: %s changed, reloading shaders\n", path);
+	game->shaders_changed = true;
+}
+
+// Reloads shaders into the spare set in the background and swaps every model
+// over once they are all in.
+static void update_hot_reload(frogger_game_t* game)
+{
+	fs_watch_update(game->watch);
+	game->frames_since_swap++;
+
+	frogger_shaders_t* current = &game->shaders[game->shader_set];
+	frogger_shaders_t* spare = &game->shaders[game->shader_set ^ 1];
+	if (game->shaders_changed && !game->shaders_loading && game->frames_since_swap > k_shader_reload_min_frames)
+	{
+		unload_shaders(spare);
+		load_shaders(game, spare);
+		game->shaders_changed = false;
+		game->shaders_loading = true;
+	}
+	if (!game->shaders_loading || !drain_shaders(game))
+	{
+		return;
+	}
+
+	game->shaders_loading = false;
+	if (!build_shaders(spare))
+	{
+		debug_print(k_print_warning, "frogger: shader reload failed, keeping the previous shaders\n");
+		return;
+	}
+	uint64_t k_model_query_mask = 1ULL << game->model_type;
+	for (ecs_query_t query = ecs_query_create(game->ecs, k_model_query_mask);
+		ecs_query_is_valid(game->ecs, &query);
+		ecs_query_next(game->ecs, &query))
+	{
+		model_component_t* model_comp = ecs_query_get_component(game->ecs, &query, game->model_type);
+		if (model_comp->shader_info == &current->cube)
+		{
+			model_comp->shader_info = &spare->cube;
+		}
+		else if (model_comp->shader_info == &current->rect)
+		{
+			model_comp->shader_info = &spare->rect;
+		}
+	}
+	game->shader_set ^= 1;
+	game->frames_since_swap = 0;
+}
+
+static void load_resources(frogger_game_t* game)
+{
+	memset(game->shaders, 0, sizeof(game->shaders));
+	game->shader_set = 0;
+	game->shaders_changed = false;
+	game->shaders_loading = false;
+	game->shader_completion = fs_completion_create(game->heap);
+	frogger_shaders_t* shaders = &game->shaders[game->shader_set];
+	load_shaders(game, shaders);
+	wait_shaders(game);
+	if (!build_shaders(shaders))
+	{
+		debug_print(k_print_error, "frogger: failed to load shaders\n");
+	}
+
+	// Start at the limit, so the first change reloads at once.
+	game->frames_since_swap = k_shader_reload_min_frames;
+	game->watch = fs_watch_create(game->heap, 0);
+	for (int i = 0; i < _countof(k_shader_paths); ++i)
+	{
+		if (!fs_watch_add(game->watch, k_shader_paths[i], on_shader_changed, game))
+		{
+			debug_print(k_print_warning, "frogger: not watching %s for changes\n", k_shader_paths[i]);
+		}
+	}
 
 	static vec3f_t cube_verts[] =
 	{
@@ -300,9 +460,12 @@ static void load_resources(frogger_game_t* game)
 
 static void unload_resources(frogger_game_t* game)
 {
-	fs_work_destroy(game->fragment_shader_work);
-	fs_work_destroy(game->vertex_shader_work);
-	fs_work_destroy(game->fragment_shader_traffic_work);
+	fs_watch_destroy(game->watch);
+	// A reload may still be in flight.
+	wait_shaders(game);
+	unload_shaders(&game->shaders[0]);
+	unload_shaders(&game->shaders[1]);
+	fs_completion_destroy(game->shader_completion);
 }
 
 static void spawn_player(frogger_game_t* game, int index)
@@ -327,7 +490,7 @@ static void spawn_player(frogger_game_t* game, int index)
 
 	model_component_t* model_comp = ecs_entity_get_component(game->ecs, game->player_ent, game->model_type, true);
 	model_comp->mesh_info = &game->cube_mesh;
-	model_comp->shader_info = &game->cube_shader;
+	model_comp->shader_info = &game->shaders[game->shader_set].cube;
 
 	speed_component_t* speed_comp = ecs_entity_get_component(game->ecs, game->player_ent, game->speed_type, true);
 	speed_comp->speed = 1.0f;
@@ -368,7 +531,7 @@ static void spawn_enemy(frogger_game_t* game, int index, int row, int order) {
 
 	model_component_t* model_comp = ecs_entity_get_component(game->ecs, game->player_ent, game->model_type, true);
 	model_comp->mesh_info = &game->rect_mesh;
-	model_comp->shader_info = &game->rect_shader;
+	model_comp->shader_info = &game->shaders[game->shader_set].rect;
 
 	refresh_component_t* refresh_comp = ecs_entity_get_component(game->ecs, game->player_ent, game->refresh_type, true);
 	refresh_comp->rate = 0.25f;
@@ -1,29 +1,130 @@
 #include "fs.h"
 
+#include "atomic.h"
+#include "debug.h"
 #include "event.h"
+#include "fs_cache.h"
+#include "fs_container.h"
+#include "fs_pak.h"
+#include "fs_path.h"
 #include "heap.h"
+#include "mpsc_queue.h"
 #include "queue.h"
+#include "rwlock.h"
+#include "semaphore.h"
+#include "spinlock.h"
 #include "thread.h"
+#include "timer.h"
+#include "trace.h"
+#include "uring.h"
 #include "lz4/lz4.h"
 
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
+#if defined(_WIN32)
 #define WIN32_LEAN_AND_MEAN
 #include <windows.h>
+typedef HANDLE fs_os_file_t;
+#else
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define __min(a, b) (((a) < (b)) ? (a) : (b))
+typedef int fs_os_file_t;
+#endif
+
+enum
+{
+	k_fs_default_queue_capacity = 64,
+	k_fs_default_file_threads = 2,
+	k_fs_max_threads = 8,
+	k_fs_default_stream_chunk_size = 64 * 1024,
+	// Block table entries a compressed stream reads at a time.
+	k_fs_stream_table_batch = 256,
+	k_fs_default_ring_depth = 64,
+	k_fs_max_ring_depth = 4096,
+	// Registered buffers the io_uring backend reads small files into.
+	k_fs_ring_buffer_count = 32,
+	k_fs_ring_buffer_size = 64 * 1024,
+	// Largest single io_uring transfer; longer ones are resubmitted.
+	k_fs_ring_max_transfer = 0x40000000,
+	k_fs_max_packs = 16,
+};
+
+// Numbers temporary files. Process-wide, with the process ID in the name too,
+// so atomic writes to one path from any file systems never collide.
+static int s_fs_temp_count;
+
+// Bounded queues, one per priority, popped most urgent first.
+// items counts entries across all of them so poppers can block on it.
+typedef struct fs_queue_t
+{
+	queue_t* levels[k_fs_priority_count];
+	semaphore_t* items;
+	// Held while scanning the levels for an item; see fs_queue_take().
+	spinlock_t* take_lock;
+	// Set by fs_destroy() once the queues are empty; pops then return NULL.
+	int stopping;
+} fs_queue_t;
+
+// A mounted pak: its open file and table of contents.
+typedef struct fs_pack_t
+{
+	fs_os_file_t file;
+	fs_pak_entry_t* toc;
+	uint32_t entry_count;
+} fs_pack_t;
 
 typedef struct fs_t
 {
 	heap_t* heap;
-	queue_t* file_queue;
-	thread_t* file_thread;
-	queue_t* compress_queue;
-	thread_t* compress_thread;
+	fs_queue_t* file_queue;
+	thread_t* file_threads[k_fs_max_threads];
+	int file_thread_count;
+	fs_queue_t* compress_queue;
+	thread_t* compress_threads[k_fs_max_threads];
+	int compress_thread_count;
+	uint32_t block_size;
+	// Shared compression dictionary, a copy of the one in the options.
+	void* dictionary;
+	uint32_t dictionary_size;
+	uint32_t dictionary_id;
+	trace_t* trace;
+	// io_uring backend. Only the ring thread touches these.
+	uring_t* ring;
+	uint32_t ring_depth;
+	char* ring_buffers;
+	bool ring_buffers_registered;
+	int ring_free_buffers[k_fs_ring_buffer_count];
+	int ring_free_buffer_count;
+	// Mounted paks, searched newest first. Mounting takes the lock exclusive.
+	rwlock_t* packs_lock;
+	fs_pack_t packs[k_fs_max_packs];
+	int pack_count;
+	// Every path a work has named, so works carry IDs rather than strings.
+	fs_path_table_t* paths;
+	// Contents handed out by fs_read_shared().
+	fs_cache_t* cache;
+	// Works queued but not yet complete, plus one held by the fs_t itself
+	// until fs_destroy(). Whoever drops it to zero signals idle.
+	int pending;
+	event_t* idle;
 } fs_t;
 
 typedef enum fs_work_op_t
 {
 	k_fs_work_op_read,
 	k_fs_work_op_write,
+	k_fs_work_op_read_block,
+	k_fs_work_op_read_stream,
+	k_fs_work_op_read_many,
+	k_fs_work_op_prefetch,
 } fs_work_op_t;
 
 typedef enum fs_compress_op_t
@@ -32,339 +133,2742 @@ typedef enum fs_compress_op_t
 	k_fs_work_op_decompress,
 } fs_compress_op_t;
 
+// One unit of work for the compress pool.
+// A block index of -1 plans the work and fans its blocks out across the pool.
+typedef struct fs_codec_task_t
+{
+	struct fs_work_t* work;
+	int block_index;
+} fs_codec_task_t;
 
 typedef struct fs_work_t
 {
 	heap_t* heap;
 	fs_work_op_t op;
-	char path[1024];
+	// Interned in the file system's path table; see fs_work_path().
+	fs_path_id_t path;
 	bool null_terminate;
 	fs_compress_op_t use_compression;
+	// For compressed writes, the LZ4 level; see fs_work_options_t.
+	int compression_level;
+	// Whether blocks are coded against the file system's dictionary.
+	bool use_dictionary;
+	// For compressed writes; see fs_work_options_t.
+	fs_record_coding_t record_coding;
+	uint32_t record_size;
+	// For writes; see fs_work_options_t.
+	fs_write_mode_t write_mode;
+	bool sync;
+	// For compressed reads; see fs_work_options_t.
+	bool skip_verify;
+	fs_priority_t priority;
+	// Timer ticks after which queued work is dropped, or zero.
+	uint64_t deadline;
+	// Set by fs_work_cancel(); checked between steps.
+	int cancelled;
 	void* buffer;
 	size_t size;
 	size_t compression_size;
 	event_t* done;
-	event_t* com_done;
 	int result;
 	fs_t* fs;
+	fs_completion_t* completion;
+	mpsc_node_t completion_node;
+	void* user_data;
+	fs_codec_task_t plan_task;
+	fs_codec_task_t* tasks;
+	// Blocks not yet coded. Whichever thread codes the last one moves the work on.
+	int blocks_remaining;
+	// Container being built, or the decompressed output.
+	void* codec_buffer;
+	// For writes with record coding: the coded copy blocks are compressed from.
+	void* filter_buffer;
+	// For fs_read_block(): the requested block, its table entry and the
+	// container's header, whose version decides the checksum and whose
+	// filter is undone after.
+	uint32_t block_index;
+	fs_container_block_t block;
+	uint32_t block_raw_size;
+	fs_container_header_t block_header;
+	// For fs_read_stream().
+	size_t stream_chunk_size;
+	fs_stream_func_t stream_function;
+	void* stream_user;
+	// For fs_read_shared(): the version read and, once done, the cache entry
+	// the buffer belongs to.
+	bool shared;
+	fs_cache_key_t cache_key;
+	fs_cache_entry_t* cache_entry;
+	// For fs_read_many(): the caller's results and one plain read per file,
+	// in a single allocation with their sort order. Each child points back at
+	// its batch and has no event of its own.
+	fs_read_result_t* batch_results;
+	struct fs_work_t* batch_children;
+	struct fs_batch_order_t* batch_order;
+	int batch_count;
+	int batch_remaining;
+	struct fs_work_t* parent;
+	// For fs_prefetch_manifest(), whose files are a batch as above once the
+	// manifest has been read.
+	struct fs_prefetch_t* prefetch;
+	// Chains batches waiting for the io_uring thread to finish starting another.
+	struct fs_work_t* batch_next;
+	// Caller-owned memory from fs_read_into() and fs_work_options_t, used in
+	// place of heap allocations and never freed here. Scratch is handed out
+	// front to back.
+	void* destination;
+	size_t destination_size;
+	char* scratch;
+	size_t scratch_size;
+	size_t scratch_used;
+	// For the io_uring backend: the open file, where the data starts in it,
+	// bytes moved so far and the registered buffer in use, or -1.
+	// Pak files are shared, so only files the work opened are closed.
+	fs_os_file_t ring_file;
+	bool ring_owns_file;
+	uint64_t ring_base;
+	uint64_t ring_offset;
+	int ring_buffer;
 } fs_work_t;
 
+// State of an fs_prefetch_manifest() work. Files report in under the lock
+// as they finish, on whichever thread finishes them.
+typedef struct fs_prefetch_t
+{
+	fs_prefetch_target_t target;
+	spinlock_t* lock;
+	fs_prefetch_progress_t progress;
+	// Expected size of each file of the batch, by index.
+	uint64_t* sizes;
+} fs_prefetch_t;
+
+// Sort key for one file of a batch: roughly where its bytes are on disk.
+typedef struct fs_batch_order_t
+{
+	// Pak index, or UINT32_MAX for loose files, which sort after paks.
+	uint32_t pack;
+	uint64_t location;
+	const char* path;
+	int index;
+} fs_batch_order_t;
+
+typedef struct fs_map_t
+{
+	heap_t* heap;
+	const void* data;
+	size_t size;
+#if defined(_WIN32)
+	HANDLE file;
+	HANDLE mapping;
+#endif
+} fs_map_t;
+
+typedef struct fs_completion_t
+{
+	heap_t* heap;
+	mpsc_queue_t* queue;
+	// Counts works pushed but not yet popped, so waiters can block.
+	semaphore_t* ready;
+} fs_completion_t;
+
 static int file_thread_func(void* user);
 
+static int fs_os_open_read(const char* path, fs_os_file_t* file, uint64_t* size);
+
+static int fs_os_stat(const char* path, uint64_t* size, uint64_t* modified);
+
+static uint64_t fs_os_locality(const char* path);
+
+static int fs_os_read_at(fs_os_file_t file, uint64_t offset, void* buffer, size_t size, size_t* bytes_read);
+
+static void fs_os_close(fs_os_file_t file);
+
+static int fs_os_flush(fs_os_file_t file);
+// Identifies this process in temporary file names.
+static uint32_t fs_os_process_id();
+
+static void fs_work_complete(fs_work_t* work);
+
+static void fs_work_free(fs_work_t* work, void* block);
+
+static int file_ring_func(void* user);
+
 static int file_compress_func(void* user);
 
 
 
-fs_t* fs_create(heap_t* heap, int queue_capacity)
+static fs_queue_t* fs_queue_create(heap_t* heap, int capacity)
 {
-	fs_t* fs = heap_alloc(heap, sizeof(fs_t), 8);
-	fs->heap = heap;
-	fs->file_queue = queue_create(heap, queue_capacity);
-	fs->file_thread = thread_create(file_thread_func, fs);
-	fs->compress_queue = queue_create(heap, queue_capacity);
-	fs->compress_thread = thread_create(file_compress_func, fs);
-	return fs;
+	fs_queue_t* queue = heap_alloc(heap, sizeof(fs_queue_t), 8);
+	for (int i = 0; i < k_fs_priority_count; ++i)
+	{
+		queue->levels[i] = queue_create(heap, capacity);
+	}
+	queue->items = semaphore_create(0, capacity * k_fs_priority_count + k_fs_max_threads);
+	queue->take_lock = spinlock_create(heap);
+	queue->stopping = 0;
+	return queue;
 }
 
-void fs_destroy(fs_t* fs)
+// Wakes every thread blocked on the queue. It must be empty.
+static void fs_queue_stop(fs_queue_t* queue, int thread_count)
 {
-	queue_push(fs->file_queue, NULL);
-	thread_destroy(fs->file_thread);
-	queue_destroy(fs->file_queue);
-	queue_push(fs->compress_queue, NULL);
-	thread_destroy(fs->compress_thread);
-	queue_destroy(fs->compress_queue); 
-	heap_free(fs->heap, fs);
+	atomic_store(&queue->stopping, 1);
+	for (int i = 0; i < thread_count; ++i)
+	{
+		semaphore_release(queue->items);
+	}
 }
 
-fs_work_t* fs_read(fs_t* fs, const char* path, heap_t* heap, bool null_terminate, bool use_compression)
+static void fs_queue_destroy(heap_t* heap, fs_queue_t* queue)
 {
-	fs_work_t* work = heap_alloc(fs->heap, sizeof(fs_work_t), 8);
-	work->heap = heap;
-	work->op = k_fs_work_op_read;
-	strcpy_s(work->path, sizeof(work->path), path);
-	work->buffer = NULL;
-	work->size = 0;
-	work->done = event_create();
-	work->com_done = event_create();
-	work->result = 0;
-	work->null_terminate = null_terminate;
-	if (use_compression) {
-		work->use_compression = k_fs_work_op_decompress;
-	}
-	else {
-		//set action to opposite to avoid any misuses
-		work->use_compression = k_fs_work_op_compress;
+	for (int i = 0; i < k_fs_priority_count; ++i)
+	{
+		queue_destroy(queue->levels[i]);
 	}
+	semaphore_destroy(queue->items);
+	spinlock_destroy(queue->take_lock);
+	heap_free(heap, queue);
+}
 
-	work->fs = fs;
-	queue_push(fs->file_queue, work);
-	return work;
+// Blocks if that priority's queue is full.
+static void fs_queue_push(fs_queue_t* queue, fs_priority_t priority, void* item)
+{
+	queue_push(queue->levels[priority], item);
+	semaphore_release(queue->items);
 }
 
-fs_work_t* fs_write(fs_t* fs, const char* path, const void* buffer, size_t size, bool use_compression)
+static bool fs_queue_try_push(fs_queue_t* queue, fs_priority_t priority, void* item)
 {
-	fs_work_t* work = heap_alloc(fs->heap, sizeof(fs_work_t), 8);
-	work->heap = fs->heap;
-	work->op = k_fs_work_op_write;
-	strcpy_s(work->path, sizeof(work->path), path);
-	work->buffer = (void*)buffer;
-	work->size = size;
-	work->done = event_create();
-	work->result = 0;
-	work->null_terminate = false;
-	
-	work->com_done = event_create();
-	work->fs = fs;
-	if (use_compression)
-	{
-		// HOMEWORK 2: Queue file write work on compression queue!
-		work->use_compression = k_fs_work_op_compress;
-		queue_push(fs->compress_queue, work);
-		event_wait(work->com_done);
-		queue_push(fs->file_queue, work);
-	}
-	else
+	if (!queue_try_push(queue->levels[priority], item))
 	{
-		//set action to opposite to avoid any misuses
-		work->use_compression = k_fs_work_op_decompress;
-		event_signal(work->com_done);
-		queue_push(fs->file_queue, work);
+		return false;
 	}
-
-	return work;
+	semaphore_release(queue->items);
+	return true;
 }
 
-bool fs_work_is_done(fs_work_t* work)
+// Takes the most urgent item once a count has been acquired for it.
+// Every counted item is already in a queue. Scans take turns, so none can
+// take the item another was heading for, and one pass always finds one.
+static void* fs_queue_take(fs_queue_t* queue)
 {
-	return work ? event_is_raised(work->done) : true;
+	static const fs_priority_t k_order[] = { k_fs_priority_high, k_fs_priority_normal, k_fs_priority_low };
+	if (atomic_load(&queue->stopping))
+	{
+		// Put the count back: the io_uring thread also polls with
+		// fs_queue_try_pop(), which must not use up the wakeup its blocking
+		// pop needs to see the stop.
+		semaphore_release(queue->items);
+		return NULL;
+	}
+	void* item = NULL;
+	spinlock_lock(queue->take_lock);
+	for (int i = 0; i < k_fs_priority_count && !item; ++i)
+	{
+		item = queue_try_pop(queue->levels[k_order[i]]);
+	}
+	spinlock_unlock(queue->take_lock);
+	return item;
 }
 
-void fs_work_wait(fs_work_t* work)
+// Blocks until there is an item. Returns NULL once the queue is stopped.
+static void* fs_queue_pop(fs_queue_t* queue)
 {
-	if (work)
-	{
-		event_wait(work->done);
-	}
+	semaphore_acquire(queue->items);
+	return fs_queue_take(queue);
 }
 
-int fs_work_get_result(fs_work_t* work)
+static void* fs_queue_try_pop(fs_queue_t* queue)
 {
-	fs_work_wait(work);
-	return work ? work->result : -1;
+	return semaphore_try_acquire(queue->items) ? fs_queue_take(queue) : NULL;
 }
 
-void* fs_work_get_buffer(fs_work_t* work)
+static int fs_clamp_thread_count(int count, int fallback)
 {
-	fs_work_wait(work);
-	return work ? work->buffer : NULL;
+	count = count > 0 ? count : fallback;
+	return count < k_fs_max_threads ? count : k_fs_max_threads;
 }
 
-size_t fs_work_get_size(fs_work_t* work)
+fs_t* fs_create(heap_t* heap, int queue_capacity)
 {
-	fs_work_wait(work);
-	return work ? work->size : 0;
+	return fs_create_ex(heap, &(fs_options_t) { .queue_capacity = queue_capacity });
 }
 
-void fs_work_destroy(fs_work_t* work)
+fs_t* fs_create_ex(heap_t* heap, const fs_options_t* options)
 {
-	if (work)
+	fs_options_t defaults = { 0 };
+	options = options ? options : &defaults;
+
+	fs_t* fs = heap_alloc(heap, sizeof(fs_t), 8);
+	fs->heap = heap;
+	fs->pending = 1;
+	fs->idle = event_create();
+	fs->packs_lock = rwlock_create(heap);
+	fs->pack_count = 0;
+	fs->paths = fs_path_table_create(heap, options->max_paths);
+	fs->cache = fs_cache_create(heap, options->cache_budget);
+
+	int queue_capacity = options->queue_capacity > 0 ? options->queue_capacity : k_fs_default_queue_capacity;
+	fs->file_queue = fs_queue_create(heap, queue_capacity);
+	fs->compress_queue = fs_queue_create(heap, queue_capacity);
+
+	fs->ring = NULL;
+	if (options->backend == k_fs_backend_io_uring)
 	{
-		event_wait(work->done);
-		event_destroy(work->done);
-		heap_free(work->heap, work);
+		uint32_t depth = options->ring_depth > 0 ? options->ring_depth : k_fs_default_ring_depth;
+		fs->ring_depth = depth < k_fs_max_ring_depth ? depth : k_fs_max_ring_depth;
+		fs->ring = uring_create(heap, fs->ring_depth);
+	}
+
+	if (fs->ring)
+	{
+		// One thread drives the ring; the kernel provides the parallelism.
+		fs->ring_buffers = heap_alloc(heap, (size_t)k_fs_ring_buffer_count * k_fs_ring_buffer_size, 4096);
+		fs->ring_buffers_registered = uring_register_buffers(fs->ring, fs->ring_buffers, k_fs_ring_buffer_size, k_fs_ring_buffer_count);
+		fs->ring_free_buffer_count = fs->ring_buffers_registered ? k_fs_ring_buffer_count : 0;
+		for (int i = 0; i < fs->ring_free_buffer_count; ++i)
+		{
+			fs->ring_free_buffers[i] = i;
+		}
+		fs->file_thread_count = 1;
+		fs->file_threads[0] = thread_create_ex(file_ring_func, fs, &(thread_options_t) { .name = "fs ring" });
+	}
+	else
+	{
+		fs->file_thread_count = fs_clamp_thread_count(options->file_thread_count, k_fs_default_file_threads);
+		for (int i = 0; i < fs->file_thread_count; ++i)
+		{
+			fs->file_threads[i] = thread_create_ex(file_thread_func, fs, &(thread_options_t) { .name = "fs file" });
+		}
+	}
+	fs->block_size = fs_container_clamp_block_size(options->compress_block_size);
+	fs->dictionary = NULL;
+	fs->dictionary_size = 0;
+	fs->dictionary_id = 0;
+	if (options->dictionary && options->dictionary_size > 0)
+	{
+		fs->dictionary = heap_alloc(heap, options->dictionary_size, 8);
+		memcpy(fs->dictionary, options->dictionary, options->dictionary_size);
+		fs->dictionary_size = options->dictionary_size;
+		fs->dictionary_id = fs_container_dictionary_id(fs->dictionary, fs->dictionary_size);
+	}
+	fs->trace = options->trace;
+	fs->compress_thread_count = fs_clamp_thread_count(options->compress_thread_count, thread_get_core_count());
+	for (int i = 0; i < fs->compress_thread_count; ++i)
+	{
+		fs->compress_threads[i] = thread_create_ex(file_compress_func, fs, &(thread_options_t) { .name = "fs compress" });
 	}
+	return fs;
 }
 
-static void file_read(fs_work_t* work)
+void fs_destroy(fs_t* fs)
 {
-	wchar_t wide_path[1024];
-	if (MultiByteToWideChar(CP_UTF8, 0, work->path, -1, wide_path, sizeof(wide_path)) <= 0)
+	// Work moves between the two pools, so neither can stop until both are idle.
+	if (atomic_decrement(&fs->pending) > 1)
 	{
-		work->result = -1;
-		return;
+		event_wait(fs->idle);
 	}
+	event_destroy(fs->idle);
 
-	HANDLE handle = CreateFile(wide_path, GENERIC_READ, FILE_SHARE_READ, NULL,
-		OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
-	if (handle == INVALID_HANDLE_VALUE)
+	fs_queue_stop(fs->file_queue, fs->file_thread_count);
+	for (int i = 0; i < fs->file_thread_count; ++i)
 	{
-		work->result = GetLastError();
-		return;
+		thread_destroy(fs->file_threads[i]);
 	}
+	fs_queue_destroy(fs->heap, fs->file_queue);
 
-	if (!GetFileSizeEx(handle, (PLARGE_INTEGER)&work->size))
+	fs_queue_stop(fs->compress_queue, fs->compress_thread_count);
+	for (int i = 0; i < fs->compress_thread_count; ++i)
 	{
-		work->result = GetLastError();
-		CloseHandle(handle);
-		return;
+		thread_destroy(fs->compress_threads[i]);
 	}
+	fs_queue_destroy(fs->heap, fs->compress_queue);
 
-	work->buffer = heap_alloc(work->heap, work->null_terminate ? work->size + 1 : work->size, 8);
+	if (fs->ring)
+	{
+		uring_destroy(fs->ring);
+		heap_free(fs->heap, fs->ring_buffers);
+	}
 
-	DWORD bytes_read = 0;
-	if (!ReadFile(handle, work->buffer, (DWORD)work->size, &bytes_read, NULL))
+	for (int i = 0; i < fs->pack_count; ++i)
 	{
-		work->result = GetLastError();
-		CloseHandle(handle);
-		return;
+		fs_os_close(fs->packs[i].file);
+		heap_free(fs->heap, fs->packs[i].toc);
 	}
+	rwlock_destroy(fs->packs_lock);
+	fs_cache_destroy(fs->cache);
+	fs_path_table_destroy(fs->paths);
+	heap_free(fs->heap, fs->dictionary);
+	heap_free(fs->heap, fs);
+}
 
-	work->size = bytes_read;
-	
+bool fs_is_io_uring(fs_t* fs)
+{
+	return fs->ring != NULL;
+}
 
-	CloseHandle(handle);
+bool fs_mount(fs_t* fs, const char* pak_path)
+{
+	fs_os_file_t file = 0;
+	uint64_t file_size = 0;
+	if (fs_os_open_read(pak_path, &file, &file_size) != 0)
+	{
+		return false;
+	}
 
-	if (work->use_compression == k_fs_work_op_decompress)
+	fs_pak_header_t header = { 0 };
+	size_t bytes_read = 0;
+	fs_pak_entry_t* toc = NULL;
+	size_t toc_size = 0;
+	bool ok = fs_os_read_at(file, 0, &header, sizeof(header), &bytes_read) == 0 && bytes_read == sizeof(header) &&
+		fs_pak_check_header(&header);
+	if (ok)
 	{
-		// HOMEWORK 2: Queue file read work on decompression queue!
-		queue_push(work->fs->compress_queue, work);
-		event_wait(work->com_done);
-		if (work->null_terminate)
-		{
-			((char*)work->buffer)[work->size] = 0;
-		}
-		event_signal(work->done);
+		toc_size = sizeof(fs_pak_entry_t) * (size_t)header.entry_count;
+		ok = header.toc_offset <= file_size && toc_size <= file_size - header.toc_offset;
 	}
-	else
+	if (ok)
 	{
-		event_signal(work->com_done);
-		if (work->null_terminate)
-		{
-			((char*)work->buffer)[work->size] = 0;
-		}
-		event_signal(work->done);
+		toc = heap_alloc(fs->heap, toc_size ? toc_size : 1, 8);
+		ok = fs_os_read_at(file, header.toc_offset, toc, toc_size, &bytes_read) == 0 && bytes_read == toc_size;
 	}
-}
 
-static void file_write(fs_work_t* work)
-{
-	wchar_t wide_path[1024];
-	if (MultiByteToWideChar(CP_UTF8, 0, work->path, -1, wide_path, sizeof(wide_path)) <= 0)
+	rwlock_lock_exclusive(fs->packs_lock);
+	ok = ok && fs->pack_count < k_fs_max_packs;
+	if (ok)
 	{
-		work->result = -1;
-		return;
+		fs->packs[fs->pack_count++] = (fs_pack_t) { .file = file, .toc = toc, .entry_count = header.entry_count };
 	}
+	rwlock_unlock_exclusive(fs->packs_lock);
 
-	HANDLE handle = CreateFile(wide_path, GENERIC_WRITE, FILE_SHARE_WRITE, NULL,
-		CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
-	if (handle == INVALID_HANDLE_VALUE)
+	if (!ok)
 	{
-		work->result = GetLastError();
-		return;
+		heap_free(fs->heap, toc);
+		fs_os_close(file);
 	}
+	return ok;
+}
+
+// The string a work's path ID stands for.
+static const char* fs_work_path(fs_work_t* work)
+{
+	return fs_path_get_string(work->fs->paths, work->path);
+}
 
+// Find a path, by its fs_pak_hash_path() hash, in the mounted paks, newest first.
+// Returns the index of the pak it is in, or -1.
+static int fs_pack_resolve(fs_t* fs, uint64_t path_hash, fs_os_file_t* file, fs_pak_entry_t* entry)
+{
+	if (atomic_load(&fs->pack_count) == 0)
+	{
+		return -1;
+	}
 
-	if (work->use_compression == k_fs_work_op_compress) {
-		DWORD bytes_written = 0;
-		if (!WriteFile(handle, work->buffer, (DWORD)work->compression_size, &bytes_written, NULL))
+	int found = -1;
+	rwlock_lock_shared(fs->packs_lock);
+	for (int i = fs->pack_count - 1; i >= 0 && found < 0; --i)
+	{
+		const fs_pak_entry_t* match = fs_pak_find(fs->packs[i].toc, fs->packs[i].entry_count, path_hash);
+		if (match)
 		{
-			work->result = GetLastError();
-			CloseHandle(handle);
-			return;
+			*file = fs->packs[i].file;
+			*entry = *match;
+			found = i;
 		}
+	}
+	rwlock_unlock_shared(fs->packs_lock);
+	return found;
+}
 
-		work->compression_size = bytes_written;
+// A work's path ID. If the table is full the ID is k_fs_path_invalid, and
+// fs_work_try_drop() fails the work before it runs.
+static fs_path_id_t fs_work_intern(fs_t* fs, const char* path)
+{
+	fs_path_id_t id = fs_path_intern(fs->paths, path);
+	if (id == k_fs_path_invalid)
+	{
+		debug_print(k_print_error, "fs: path table full, failing work on %s\n", path);
+	}
+	return id;
+}
 
-		heap_free(work->heap, work->buffer);
+// Common setup for every work. Counts it as pending; the caller queues it.
+// The work comes from the same heap fs_work_destroy() frees it to.
+static fs_work_t* fs_work_create(fs_t* fs, fs_work_op_t op, const char* path, heap_t* heap, const fs_work_options_t* options)
+{
+	fs_work_t* work = heap_alloc(heap, sizeof(fs_work_t), 8);
+	memset(work, 0, sizeof(*work));
+	work->heap = heap;
+	work->op = op;
+	work->path = fs_work_intern(fs, path);
+	work->done = event_create();
+	work->fs = fs;
+	work->completion = options ? options->completion : NULL;
+	work->user_data = options ? options->user_data : NULL;
+	work->priority = options && options->priority < k_fs_priority_count ? options->priority : k_fs_priority_normal;
+	work->compression_level = options ? options->compression_level : 0;
+	work->use_dictionary = options && options->use_dictionary && fs->dictionary;
+	work->record_coding = options ? options->record_coding : k_fs_record_none;
+	work->record_size = options ? options->record_size : 0;
+	work->write_mode = options ? options->write_mode : k_fs_write_in_place;
+	work->sync = options && options->sync;
+	work->skip_verify = options && options->skip_verify;
+	if (options && options->deadline_ms)
+	{
+		work->deadline = timer_get_ticks() + options->deadline_ms * timer_get_ticks_per_second() / 1000;
 	}
-	else {
-		DWORD bytes_written = 0;
-		if (!WriteFile(handle, work->buffer, (DWORD)work->size, &bytes_written, NULL))
-		{
-			work->result = GetLastError();
-			CloseHandle(handle);
-			return;
-		}
+	if (options && options->scratch)
+	{
+		work->scratch = options->scratch;
+		work->scratch_size = options->scratch_size;
+	}
+	work->plan_task = (fs_codec_task_t) { .work = work, .block_index = -1 };
+	atomic_increment(&fs->pending);
+	return work;
+}
 
-		work->size = bytes_written;
+fs_work_t* fs_read(fs_t* fs, const char* path, heap_t* heap, bool null_terminate, bool use_compression)
+{
+	return fs_read_ex(fs, path, heap, null_terminate, use_compression, NULL);
+}
 
+fs_work_t* fs_read_ex(fs_t* fs, const char* path, heap_t* heap, bool null_terminate, bool use_compression, const fs_work_options_t* options)
+{
+	fs_work_t* work = fs_work_create(fs, k_fs_work_op_read, path, heap, options);
+	work->null_terminate = null_terminate;
+	if (use_compression) {
+		work->use_compression = k_fs_work_op_decompress;
+	}
+	else {
+		//set action to opposite to avoid any misuses
+		work->use_compression = k_fs_work_op_compress;
 	}
-	CloseHandle(handle);
+	fs_queue_push(fs->file_queue, work->priority, work);
+	return work;
+}
 
-	event_signal(work->done);
+fs_work_t* fs_read_into(fs_t* fs, const char* path, heap_t* heap, void* buffer, size_t capacity, bool null_terminate, bool use_compression,
+	const fs_work_options_t* options)
+{
+	fs_work_t* work = fs_work_create(fs, k_fs_work_op_read, path, heap, options);
+	work->destination = buffer;
+	work->destination_size = capacity;
+	work->null_terminate = null_terminate;
+	work->use_compression = use_compression ? k_fs_work_op_decompress : k_fs_work_op_compress;
+	fs_queue_push(fs->file_queue, work->priority, work);
+	return work;
 }
 
-static int file_thread_func(void* user)
+// Compressed bytes first, then the block tasks, so scratch sizes add up.
+static size_t fs_scratch_size(size_t data_size, uint32_t block_count)
 {
-	fs_t* fs = user;
-	while (true)
+	return ((data_size + 7) & ~(size_t)7) + sizeof(fs_codec_task_t) * block_count;
+}
+
+int fs_get_read_size(fs_t* fs, const char* path, bool use_compression, fs_read_size_t* size)
+{
+	*size = (fs_read_size_t) { 0 };
+	fs_os_file_t file;
+	fs_pak_entry_t entry;
+	uint64_t base = 0;
+	uint64_t stored_size = 0;
+	bool owns_file = true;
+	if (fs_pack_resolve(fs, fs_pak_hash_path(path), &file, &entry) >= 0)
 	{
-		fs_work_t* work = queue_pop(fs->file_queue);
-		if (work == NULL)
+		owns_file = false;
+		base = entry.offset;
+		stored_size = entry.size;
+		use_compression = entry.codec == k_fs_pak_codec_container;
+	}
+	else
+	{
+		int result = fs_os_open_read(path, &file, &stored_size);
+		if (result)
 		{
-			break;
+			return result;
 		}
-		
-		switch (work->op)
+	}
+
+	int result = 0;
+	if (!use_compression)
+	{
+		size->size = (size_t)stored_size;
+	}
+	else
+	{
+		// The header, or the legacy format's 4-byte size.
+		fs_container_header_t header = { 0 };
+		size_t bytes_read = 0;
+		result = fs_os_read_at(file, base, &header, stored_size < sizeof(header) ? (size_t)stored_size : sizeof(header), &bytes_read);
+		if (!result && bytes_read >= k_fs_container_v1_header_size && fs_container_check_header(&header))
 		{
-		case k_fs_work_op_read:
-			file_read(work);
-			break;
-		case k_fs_work_op_write:
-			file_write(work);
-			break;
+			size->size = (size_t)header.size;
+			size->scratch_size = fs_scratch_size((size_t)stored_size, header.block_count);
+		}
+		else if (!result)
+		{
+			int legacy_size = -1;
+			if (bytes_read >= sizeof(int))
+			{
+				memcpy(&legacy_size, &header, sizeof(int));
+			}
+			result = legacy_size < 0 ? -1 : 0;
+			size->size = legacy_size < 0 ? 0 : (size_t)legacy_size;
+			size->scratch_size = legacy_size < 0 ? 0 : fs_scratch_size((size_t)stored_size, 0);
 		}
 	}
-	return 0;
+	if (owns_file)
+	{
+		fs_os_close(file);
+	}
+	return result;
 }
 
+size_t fs_get_write_scratch_size(fs_t* fs, size_t size)
+{
+	return fs_scratch_size(fs_container_bound(size, fs->block_size), fs_container_block_count(size, fs->block_size));
+}
 
+// One plain read of a batch, sharing the batch's priority and deadline.
+static void fs_batch_child_init(fs_work_t* batch, fs_work_t* child, fs_path_id_t path, heap_t* heap, bool null_terminate, bool use_compression)
+{
+	memset(child, 0, sizeof(*child));
+	child->heap = heap;
+	child->op = k_fs_work_op_read;
+	child->path = path;
+	child->null_terminate = null_terminate;
+	child->use_compression = use_compression ? k_fs_work_op_decompress : k_fs_work_op_compress;
+	child->priority = batch->priority;
+	child->deadline = batch->deadline;
+	child->fs = batch->fs;
+	child->plan_task = (fs_codec_task_t) { .work = child, .block_index = -1 };
+	child->parent = batch;
+}
 
-static void file_compress(fs_work_t* work) {
-	void* buffer_temp = heap_alloc(work->heap, work->size + sizeof(int), 8);
-	int compressed_size = LZ4_compress_default((char*)work->buffer, (char*)buffer_temp + sizeof(int), (int)work->size, (int)work->size);
-	
-	if (compressed_size != 0) {
-		
-		*(int*)buffer_temp = (int) work->size;
-		work->compression_size = compressed_size + sizeof(int);
-		work->buffer = buffer_temp;
+fs_work_t* fs_read_many(fs_t* fs, const char* const* paths, int count, heap_t* heap, bool null_terminate, bool use_compression,
+	fs_read_result_t* results, const fs_work_options_t* options)
+{
+	fs_work_t* work = fs_work_create(fs, k_fs_work_op_read_many, "", heap, options);
+	if (count <= 0)
+	{
+		fs_work_complete(work);
+		return work;
 	}
-	else {
-		heap_free(work->heap, buffer_temp);
+
+	work->batch_results = results;
+	work->batch_count = count;
+	work->batch_remaining = count;
+	work->batch_children = heap_alloc(heap, (sizeof(fs_work_t) + sizeof(fs_batch_order_t)) * count, 8);
+	work->batch_order = (fs_batch_order_t*)(work->batch_children + count);
+	for (int i = 0; i < count; ++i)
+	{
+		fs_batch_child_init(work, &work->batch_children[i], fs_work_intern(fs, paths[i]), heap, null_terminate, use_compression);
+		results[i] = (fs_read_result_t) { 0 };
 	}
-	//work->size = compressed_size;
-	event_signal(work->com_done);
+	fs_queue_push(fs->file_queue, work->priority, work);
+	return work;
 }
 
-static void file_decompress(fs_work_t* work) {
-	int decompressed_size = *(int*)(work->buffer);
-	char* buffer_temp = heap_alloc(work->heap, work->null_terminate ? (decompressed_size + 1) : decompressed_size, 8);
-	char* compressed = (char*)work->buffer + sizeof(int);
-	int compressed_size = (int)(work->size - sizeof(int));
-	int decompress_size = LZ4_decompress_safe(compressed, buffer_temp, compressed_size, decompressed_size);
-	if (decompress_size > 0) {
-		work->size = decompress_size;
-		heap_free(work->heap, work->buffer);
-		work->buffer = buffer_temp;
-
+// Which version of a file a shared read would see: its modification time and
+// size on disk, or for pak entries, where in which pak they are.
+static bool fs_source_key(fs_work_t* work, bool use_compression, fs_cache_key_t* key)
+{
+	fs_t* fs = work->fs;
+	fs_os_file_t file;
+	fs_pak_entry_t entry;
+	int pack = fs_pack_resolve(fs, fs_path_get_hash(fs->paths, work->path), &file, &entry);
+	key->decompressed = pack >= 0 ? entry.codec == k_fs_pak_codec_container : use_compression;
+	if (pack >= 0)
+	{
+		// Paks never change while mounted.
+		key->version = (1ull << 63) | ((uint64_t)pack << 48) | entry.offset;
+		key->file_size = entry.size;
+		return true;
 	}
-	else {
-		heap_free(work->heap, buffer_temp);
+	return fs_os_stat(fs_work_path(work), &key->file_size, &key->version) == 0;
+}
+
+// Looks a shared read up in the cache, on the file thread, as the key means
+// asking the OS about the file. On a hit the work completes with the cached
+// buffer; returns false if it still has to be read.
+static bool fs_shared_try_hit(fs_work_t* work)
+{
+	fs_t* fs = work->fs;
+	bool found = fs_source_key(work, work->use_compression == k_fs_work_op_decompress, &work->cache_key);
+	work->cache_entry = found ? fs_cache_acquire(fs->cache, work->path, &work->cache_key) : NULL;
+	if (!work->cache_entry)
+	{
+		// A file that can't be found is read anyway, so it fails the usual way.
+		// Should it turn up in the meantime, its zeroed key won't match later reads.
+		return false;
 	}
-	event_signal(work->com_done);
+	work->buffer = (void*)fs_cache_entry_get_data(work->cache_entry);
+	work->size = fs_cache_entry_get_size(work->cache_entry);
+	fs_work_complete(work);
+	return true;
 }
 
-static int file_compress_func(void* user) {
+fs_work_t* fs_read_shared(fs_t* fs, const char* path, bool use_compression, const fs_work_options_t* options)
+{
+	fs_work_t* work = fs_work_create(fs, k_fs_work_op_read, path, fs_cache_get_heap(fs->cache), options);
+	work->null_terminate = true;
+	work->use_compression = use_compression ? k_fs_work_op_decompress : k_fs_work_op_compress;
+	work->shared = true;
+	fs_queue_push(fs->file_queue, work->priority, work);
+	return work;
+}
+
+size_t fs_get_cache_size(fs_t* fs)
+{
+	return fs_cache_get_size(fs->cache);
+}
+
+fs_work_t* fs_prefetch_manifest(fs_t* fs, const char* manifest_path, fs_prefetch_target_t target, const fs_work_options_t* options)
+{
+	fs_work_t* work = fs_work_create(fs, k_fs_work_op_prefetch, manifest_path, fs->heap, options);
+	// Warming a cache must never hold up reads someone is waiting on.
+	work->priority = k_fs_priority_low;
+	work->prefetch = heap_alloc(fs->heap, sizeof(fs_prefetch_t), 8);
+	*work->prefetch = (fs_prefetch_t) { .target = target, .lock = spinlock_create(fs->heap) };
+	fs_queue_push(fs->file_queue, work->priority, work);
+	return work;
+}
+
+void fs_work_get_prefetch_progress(fs_work_t* work, fs_prefetch_progress_t* progress)
+{
+	*progress = (fs_prefetch_progress_t) { 0 };
+	if (work->prefetch)
+	{
+		spinlock_lock(work->prefetch->lock);
+		*progress = work->prefetch->progress;
+		spinlock_unlock(work->prefetch->lock);
+	}
+}
+
+fs_work_t* fs_read_block(fs_t* fs, const char* path, heap_t* heap, uint32_t block_index)
+{
+	fs_work_t* work = fs_work_create(fs, k_fs_work_op_read_block, path, heap, NULL);
+	work->use_compression = k_fs_work_op_decompress;
+	work->block_index = block_index;
+	fs_queue_push(fs->file_queue, work->priority, work);
+	return work;
+}
+
+fs_work_t* fs_read_stream(fs_t* fs, const char* path, bool use_compression, size_t chunk_size, fs_stream_func_t function, void* user)
+{
+	fs_work_t* work = fs_work_create(fs, k_fs_work_op_read_stream, path, fs->heap, NULL);
+	work->use_compression = use_compression ? k_fs_work_op_decompress : k_fs_work_op_compress;
+	work->stream_chunk_size = chunk_size ? chunk_size : k_fs_default_stream_chunk_size;
+	work->stream_function = function;
+	work->stream_user = user;
+	fs_queue_push(fs->file_queue, work->priority, work);
+	return work;
+}
+
+fs_work_t* fs_write(fs_t* fs, const char* path, const void* buffer, size_t size, bool use_compression)
+{
+	return fs_write_ex(fs, path, buffer, size, use_compression, NULL);
+}
+
+fs_work_t* fs_write_ex(fs_t* fs, const char* path, const void* buffer, size_t size, bool use_compression, const fs_work_options_t* options)
+{
+	fs_work_t* work = fs_work_create(fs, k_fs_work_op_write, path, fs->heap, options);
+	work->buffer = (void*)buffer;
+	work->size = size;
+	if (use_compression && work->write_mode != k_fs_write_append)
+	{
+		// The compress pool hands the work on to the file threads when it is done,
+		// so the caller never waits on the compression itself.
+		work->use_compression = k_fs_work_op_compress;
+		fs_queue_push(fs->compress_queue, work->priority, &work->plan_task);
+	}
+	else
+	{
+		//set action to opposite to avoid any misuses
+		work->use_compression = k_fs_work_op_decompress;
+		fs_queue_push(fs->file_queue, work->priority, work);
+	}
+
+	return work;
+}
+
+bool fs_work_is_done(fs_work_t* work)
+{
+	return work ? event_is_raised(work->done) : true;
+}
+
+void fs_work_wait(fs_work_t* work)
+{
+	if (work)
+	{
+		event_wait(work->done);
+	}
+}
+
+bool fs_work_cancel(fs_work_t* work)
+{
+	if (!work)
+	{
+		return false;
+	}
+	atomic_store(&work->cancelled, 1);
+	return !event_is_raised(work->done);
+}
+
+int fs_work_get_result(fs_work_t* work)
+{
+	fs_work_wait(work);
+	return work ? work->result : -1;
+}
+
+void* fs_work_get_buffer(fs_work_t* work)
+{
+	fs_work_wait(work);
+	return work ? work->buffer : NULL;
+}
+
+size_t fs_work_get_size(fs_work_t* work)
+{
+	fs_work_wait(work);
+	return work ? work->size : 0;
+}
+
+void* fs_work_get_user_data(fs_work_t* work)
+{
+	return work ? work->user_data : NULL;
+}
+
+void fs_work_destroy(fs_work_t* work)
+{
+	if (work)
+	{
+		event_wait(work->done);
+		if (work->cache_entry)
+		{
+			fs_cache_release(work->fs->cache, work->cache_entry);
+		}
+		heap_free(work->heap, work->batch_children);
+		if (work->prefetch)
+		{
+			spinlock_destroy(work->prefetch->lock);
+			heap_free(work->heap, work->prefetch);
+		}
+		event_destroy(work->done);
+		heap_free(work->heap, work);
+	}
+}
+
+fs_map_t* fs_map(fs_t* fs, const char* path)
+{
+	fs_map_t* map = heap_alloc(fs->heap, sizeof(fs_map_t), 8);
+	memset(map, 0, sizeof(*map));
+	map->heap = fs->heap;
+
+#if defined(_WIN32)
+	wchar_t wide_path[1024];
+	if (MultiByteToWideChar(CP_UTF8, 0, path, -1, wide_path, _countof(wide_path)) <= 0)
+	{
+		heap_free(map->heap, map);
+		return NULL;
+	}
+
+	map->file = CreateFile(wide_path, GENERIC_READ, FILE_SHARE_READ, NULL,
+		OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	LARGE_INTEGER file_size = { 0 };
+	if (map->file == INVALID_HANDLE_VALUE || !GetFileSizeEx(map->file, &file_size))
+	{
+		if (map->file != INVALID_HANDLE_VALUE)
+		{
+			CloseHandle(map->file);
+		}
+		heap_free(map->heap, map);
+		return NULL;
+	}
+	map->size = (size_t)file_size.QuadPart;
+
+	// Windows can't map an empty file; an empty view needs no mapping anyway.
+	if (map->size > 0)
+	{
+		map->mapping = CreateFileMapping(map->file, NULL, PAGE_READONLY, 0, 0, NULL);
+		map->data = map->mapping ? MapViewOfFile(map->mapping, FILE_MAP_READ, 0, 0, 0) : NULL;
+		if (!map->data)
+		{
+			if (map->mapping)
+			{
+				CloseHandle(map->mapping);
+			}
+			CloseHandle(map->file);
+			heap_free(map->heap, map);
+			return NULL;
+		}
+	}
+#else
+	int fd = open(path, O_RDONLY);
+	struct stat info;
+	if (fd < 0 || fstat(fd, &info) != 0)
+	{
+		if (fd >= 0)
+		{
+			close(fd);
+		}
+		heap_free(map->heap, map);
+		return NULL;
+	}
+	map->size = (size_t)info.st_size;
+
+	// The mapping keeps the file alive, so the descriptor can go straight away.
+	if (map->size > 0)
+	{
+		void* data = mmap(NULL, map->size, PROT_READ, MAP_SHARED, fd, 0);
+		if (data == MAP_FAILED)
+		{
+			close(fd);
+			heap_free(map->heap, map);
+			return NULL;
+		}
+		map->data = data;
+	}
+	close(fd);
+#endif
+	return map;
+}
+
+const void* fs_map_get_data(fs_map_t* map)
+{
+	return map ? map->data : NULL;
+}
+
+size_t fs_map_get_size(fs_map_t* map)
+{
+	return map ? map->size : 0;
+}
+
+void fs_unmap(fs_map_t* map)
+{
+	if (!map)
+	{
+		return;
+	}
+#if defined(_WIN32)
+	if (map->data)
+	{
+		UnmapViewOfFile(map->data);
+		CloseHandle(map->mapping);
+	}
+	CloseHandle(map->file);
+#else
+	if (map->data)
+	{
+		munmap((void*)map->data, map->size);
+	}
+#endif
+	heap_free(map->heap, map);
+}
+
+fs_completion_t* fs_completion_create(heap_t* heap)
+{
+	fs_completion_t* completion = heap_alloc(heap, sizeof(fs_completion_t), 8);
+	completion->heap = heap;
+	completion->queue = mpsc_queue_create(heap);
+	completion->ready = semaphore_create(0, INT_MAX);
+	return completion;
+}
+
+void fs_completion_destroy(fs_completion_t* completion)
+{
+	semaphore_destroy(completion->ready);
+	mpsc_queue_destroy(completion->queue);
+	heap_free(completion->heap, completion);
+}
+
+// The semaphore says a work was pushed, but its producer may still be linking it in.
+// The spin always ends: fs_work_complete() releases the semaphore only after
+// mpsc_queue_push() has swapped the node in as the tail, so all that is left
+// is the producer's store to the previous node's next pointer.
+static fs_work_t* fs_completion_take(fs_completion_t* completion)
+{
+	mpsc_node_t* node;
+	while (!(node = mpsc_queue_pop(completion->queue)))
+	{
+		thread_sleep(0);
+	}
+	return mpsc_node_container(node, fs_work_t, completion_node);
+}
+
+fs_work_t* fs_completion_pop(fs_completion_t* completion)
+{
+	return semaphore_try_acquire(completion->ready) ? fs_completion_take(completion) : NULL;
+}
+
+fs_work_t* fs_completion_wait(fs_completion_t* completion)
+{
+	semaphore_acquire(completion->ready);
+	return fs_completion_take(completion);
+}
+
+int fs_completion_drain(fs_completion_t* completion, fs_work_t** works, int capacity)
+{
+	int count = 0;
+	while (count < capacity && semaphore_try_acquire(completion->ready))
+	{
+		works[count++] = fs_completion_take(completion);
+	}
+	return count;
+}
+
+// Lets go of a prefetched file, which the shared cache keeps if it was read
+// for it, and counts it done.
+static void fs_prefetch_child_complete(fs_work_t* batch, fs_work_t* child)
+{
+	fs_prefetch_t* prefetch = batch->prefetch;
+	if (child->cache_entry)
+	{
+		fs_cache_release(child->fs->cache, child->cache_entry);
+		child->cache_entry = NULL;
+	}
+	else
+	{
+		fs_work_free(child, child->buffer);
+	}
+	child->buffer = NULL;
+
+	spinlock_lock(prefetch->lock);
+	prefetch->progress.files_done++;
+	prefetch->progress.bytes_done += prefetch->sizes[child - batch->batch_children];
+	if (child->result)
+	{
+		prefetch->progress.failures++;
+		batch->result = batch->result ? batch->result : child->result;
+	}
+	spinlock_unlock(prefetch->lock);
+}
+
+// Records one file of a batch. The last one finishes the batch.
+static void fs_batch_child_complete(fs_work_t* child)
+{
+	fs_work_t* batch = child->parent;
+	if (batch->prefetch)
+	{
+		fs_prefetch_child_complete(batch, child);
+	}
+	else
+	{
+		batch->batch_results[child - batch->batch_children] = (fs_read_result_t)
+		{
+			.buffer = child->buffer,
+			.size = child->size,
+			.result = child->result,
+		};
+	}
+	// The decrement publishes this result to whichever child finishes last.
+	if (atomic_decrement(&batch->batch_remaining) != 1)
+	{
+		return;
+	}
+	for (int i = 0; batch->batch_results && i < batch->batch_count && !batch->result; ++i)
+	{
+		batch->result = batch->batch_results[i].result;
+	}
+	fs_work_complete(batch);
+}
+
+// Marks work finished: wakes waiters and posts it to its completion channel.
+// Waiters may destroy the work once done is raised, so read everything first.
+static void fs_work_complete(fs_work_t* work)
+{
+	fs_t* fs = work->fs;
+	if (work->shared && !work->cache_entry)
+	{
+		// Hand the buffer to the cache. Whatever a failed read leaves behind
+		// is freed, as the caller never owns a shared buffer.
+		if (work->result)
+		{
+			fs_work_free(work, work->buffer);
+			work->buffer = NULL;
+			work->size = 0;
+		}
+		else
+		{
+			work->cache_entry = fs_cache_insert(fs->cache, work->path, &work->cache_key, work->buffer, work->size);
+			work->buffer = (void*)fs_cache_entry_get_data(work->cache_entry);
+		}
+	}
+	// Prefetched files may be shared reads, so this comes after the cache.
+	if (work->parent)
+	{
+		fs_batch_child_complete(work);
+		return;
+	}
+	fs_completion_t* completion = work->completion;
+	event_signal(work->done);
+	if (completion)
+	{
+		mpsc_queue_push(completion->queue, &work->completion_node);
+		semaphore_release(completion->ready);
+	}
+	if (atomic_decrement(&fs->pending) == 1)
+	{
+		event_signal(fs->idle);
+	}
+}
+
+// Whether memory is the caller's, from fs_read_into() or the options' scratch.
+static bool fs_work_is_caller_memory(fs_work_t* work, const void* block)
+{
+	return (block && block == work->destination) ||
+		((const char*)block >= work->scratch && (const char*)block < work->scratch + work->scratch_size);
+}
+
+// Frees memory from fs_work_alloc(); the caller's memory is left alone.
+static void fs_work_free(fs_work_t* work, void* block)
+{
+	if (!fs_work_is_caller_memory(work, block))
+	{
+		heap_free(work->heap, block);
+	}
+}
+
+// Memory for a work's output, or for scratch, such as the compressed file.
+// Caller memory is used when given; if it is too small, this returns NULL
+// and sets k_fs_result_too_small.
+static void* fs_work_alloc(fs_work_t* work, size_t size, bool scratch)
+{
+	if (!scratch && work->destination)
+	{
+		if (size > work->destination_size)
+		{
+			work->result = k_fs_result_too_small;
+			return NULL;
+		}
+		return work->destination;
+	}
+	if (scratch && work->scratch)
+	{
+		size_t offset = (work->scratch_used + 7) & ~(size_t)7;
+		if (offset + size > work->scratch_size)
+		{
+			work->result = k_fs_result_too_small;
+			return NULL;
+		}
+		work->scratch_used = offset + size;
+		return work->scratch + offset;
+	}
+	return heap_alloc(work->heap, size ? size : 1, 8);
+}
+
+// Room for the file as stored: scratch if it will be decompressed,
+// otherwise the output, with space for the terminator.
+static void* fs_work_alloc_file(fs_work_t* work)
+{
+	if (work->use_compression == k_fs_work_op_decompress)
+	{
+		return fs_work_alloc(work, work->size, true);
+	}
+	return fs_work_alloc(work, work->null_terminate ? work->size + 1 : work->size, false);
+}
+
+// Cancelling a batch cancels each of its files.
+static bool fs_work_is_cancelled(fs_work_t* work)
+{
+	return atomic_load(&work->cancelled) || (work->parent && atomic_load(&work->parent->cancelled));
+}
+
+// Finishes a work that was cancelled, that is being taken off a queue after
+// its deadline, or whose path could not be interned, instead of running it. Reads lose their buffer; writes leave
+// the caller's buffer alone but free a compressed copy.
+static bool fs_work_try_drop(fs_work_t* work)
+{
+	// A batch always runs: each file drops itself and still reports a result.
+	if (work->op == k_fs_work_op_read_many)
+	{
+		return false;
+	}
+
+	int result = 0;
+	if (work->path == k_fs_path_invalid)
+	{
+		result = k_fs_result_no_path;
+	}
+	else if (fs_work_is_cancelled(work))
+	{
+		result = k_fs_result_cancelled;
+	}
+	else if (work->deadline && timer_get_ticks() > work->deadline)
+	{
+		result = k_fs_result_expired;
+	}
+	if (!result)
+	{
+		return false;
+	}
+
+	if (work->op == k_fs_work_op_write)
+	{
+		if (work->use_compression == k_fs_work_op_compress && work->codec_buffer)
+		{
+			fs_work_free(work, work->codec_buffer);
+		}
+	}
+	else
+	{
+		fs_work_free(work, work->buffer);
+		work->buffer = NULL;
+		work->size = 0;
+	}
+	work->result = result;
+	fs_work_complete(work);
+	return true;
+}
+
+// Thin platform file layer.
+// Functions return zero on success, otherwise an OS error code.
+
+static int fs_os_open_read(const char* path, fs_os_file_t* file, uint64_t* size)
+{
+#if defined(_WIN32)
+	wchar_t wide_path[1024];
+	if (MultiByteToWideChar(CP_UTF8, 0, path, -1, wide_path, _countof(wide_path)) <= 0)
+	{
+		return -1;
+	}
+
+	HANDLE handle = CreateFile(wide_path, GENERIC_READ, FILE_SHARE_READ, NULL,
+		OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (handle == INVALID_HANDLE_VALUE)
+	{
+		return GetLastError();
+	}
+
+	LARGE_INTEGER file_size;
+	if (!GetFileSizeEx(handle, &file_size))
+	{
+		int result = GetLastError();
+		CloseHandle(handle);
+		return result;
+	}
+
+	*file = handle;
+	*size = file_size.QuadPart;
+	return 0;
+#else
+	int fd = open(path, O_RDONLY);
+	if (fd < 0)
+	{
+		return errno;
+	}
+
+	struct stat info;
+	if (fstat(fd, &info) != 0)
+	{
+		int result = errno;
+		close(fd);
+		return result;
+	}
+
+	*file = fd;
+	*size = (uint64_t)info.st_size;
+	return 0;
+#endif
+}
+
+static int fs_os_stat(const char* path, uint64_t* size, uint64_t* modified)
+{
+#if defined(_WIN32)
+	wchar_t wide_path[1024];
+	if (MultiByteToWideChar(CP_UTF8, 0, path, -1, wide_path, _countof(wide_path)) <= 0)
+	{
+		return -1;
+	}
+
+	WIN32_FILE_ATTRIBUTE_DATA info;
+	if (!GetFileAttributesEx(wide_path, GetFileExInfoStandard, &info))
+	{
+		return GetLastError();
+	}
+	*size = ((uint64_t)info.nFileSizeHigh << 32) | info.nFileSizeLow;
+	*modified = ((uint64_t)info.ftLastWriteTime.dwHighDateTime << 32) | info.ftLastWriteTime.dwLowDateTime;
+	return 0;
+#else
+	struct stat info;
+	if (stat(path, &info) != 0)
+	{
+		return errno;
+	}
+	*size = (uint64_t)info.st_size;
+	*modified = (uint64_t)info.st_mtim.tv_sec * 1000000000ull + (uint64_t)info.st_mtim.tv_nsec;
+	return 0;
+#endif
+}
+
+// Something that orders files roughly by where they sit on disk.
+// Zero if unknown, which leaves them in path order.
+static uint64_t fs_os_locality(const char* path)
+{
+#if defined(_WIN32)
+	// Getting the file index needs an open handle, which costs more than the
+	// seek it would save; NTFS keeps a directory's files close anyway.
+	return 0;
+#else
+	// Filesystems allocate inodes, and mostly the blocks after them, in
+	// creation order, and assets are usually written together.
+	struct stat info;
+	return stat(path, &info) == 0 ? (uint64_t)info.st_ino : 0;
+#endif
+}
+
+static int fs_os_open_write(const char* path, fs_os_file_t* file)
+{
+#if defined(_WIN32)
+	wchar_t wide_path[1024];
+	if (MultiByteToWideChar(CP_UTF8, 0, path, -1, wide_path, _countof(wide_path)) <= 0)
+	{
+		return -1;
+	}
+
+	HANDLE handle = CreateFile(wide_path, GENERIC_WRITE, FILE_SHARE_WRITE, NULL,
+		CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (handle == INVALID_HANDLE_VALUE)
+	{
+		return GetLastError();
+	}
+
+	*file = handle;
+	return 0;
+#else
+	int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0)
+	{
+		return errno;
+	}
+
+	*file = fd;
+	return 0;
+#endif
+}
+
+// Opens for writing at the end, keeping what is there.
+static int fs_os_open_append(const char* path, fs_os_file_t* file)
+{
+#if defined(_WIN32)
+	wchar_t wide_path[1024];
+	if (MultiByteToWideChar(CP_UTF8, 0, path, -1, wide_path, _countof(wide_path)) <= 0)
+	{
+		return -1;
+	}
+
+	HANDLE handle = CreateFile(wide_path, FILE_APPEND_DATA, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL,
+		OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (handle == INVALID_HANDLE_VALUE)
+	{
+		return GetLastError();
+	}
+
+	*file = handle;
+	return 0;
+#else
+	int fd = open(path, O_WRONLY | O_CREAT | O_APPEND, 0644);
+	if (fd < 0)
+	{
+		return errno;
+	}
+
+	*file = fd;
+	return 0;
+#endif
+}
+
+// Waits until the file's data has reached the disk.
+static int fs_os_flush(fs_os_file_t file)
+{
+#if defined(_WIN32)
+	return FlushFileBuffers(file) ? 0 : GetLastError();
+#else
+	return fsync(file) == 0 ? 0 : errno;
+#endif
+}
+
+// Renames from over to, replacing it in one step.
+static int fs_os_replace(const char* from, const char* to)
+{
+#if defined(_WIN32)
+	wchar_t wide_from[1024];
+	wchar_t wide_to[1024];
+	if (MultiByteToWideChar(CP_UTF8, 0, from, -1, wide_from, _countof(wide_from)) <= 0 ||
+		MultiByteToWideChar(CP_UTF8, 0, to, -1, wide_to, _countof(wide_to)) <= 0)
+	{
+		return -1;
+	}
+	return MoveFileEx(wide_from, wide_to, MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH) ? 0 : GetLastError();
+#else
+	if (rename(from, to) != 0)
+	{
+		return errno;
+	}
+	// The rename itself lives in the directory, which needs flushing too.
+	char directory[1024];
+	const char* slash = strrchr(to, '/');
+	snprintf(directory, sizeof(directory), "%.*s", slash ? (int)(slash - to) + 1 : 1, slash ? to : ".");
+	int fd = open(directory, O_RDONLY);
+	if (fd >= 0)
+	{
+		fsync(fd);
+		close(fd);
+	}
+	return 0;
+#endif
+}
+
+static uint32_t fs_os_process_id()
+{
+#if defined(_WIN32)
+	return GetCurrentProcessId();
+#else
+	return (uint32_t)getpid();
+#endif
+}
+
+static void fs_os_remove(const char* path)
+{
+#if defined(_WIN32)
+	wchar_t wide_path[1024];
+	if (MultiByteToWideChar(CP_UTF8, 0, path, -1, wide_path, _countof(wide_path)) > 0)
+	{
+		DeleteFile(wide_path);
+	}
+#else
+	unlink(path);
+#endif
+}
+
+// Reads until size bytes arrive or the file ends.
+static int fs_os_read(fs_os_file_t file, void* buffer, size_t size, size_t* bytes_read)
+{
+	*bytes_read = 0;
+	while (*bytes_read < size)
+	{
+		size_t remaining = size - *bytes_read;
+#if defined(_WIN32)
+		DWORD chunk = 0;
+		if (!ReadFile(file, (char*)buffer + *bytes_read, (DWORD)__min(remaining, 0x40000000), &chunk, NULL))
+		{
+			return GetLastError();
+		}
+#else
+		ssize_t chunk = read(file, (char*)buffer + *bytes_read, remaining);
+		if (chunk < 0)
+		{
+			if (errno == EINTR)
+			{
+				continue;
+			}
+			return errno;
+		}
+#endif
+		if (chunk == 0)
+		{
+			break;
+		}
+		*bytes_read += (size_t)chunk;
+	}
+	return 0;
+}
+
+// Reads size bytes at offset without moving the file pointer other reads depend on.
+static int fs_os_read_at(fs_os_file_t file, uint64_t offset, void* buffer, size_t size, size_t* bytes_read)
+{
+	*bytes_read = 0;
+	while (*bytes_read < size)
+	{
+		size_t remaining = size - *bytes_read;
+		uint64_t position = offset + *bytes_read;
+#if defined(_WIN32)
+		OVERLAPPED overlapped = { 0 };
+		overlapped.Offset = (DWORD)position;
+		overlapped.OffsetHigh = (DWORD)(position >> 32);
+		DWORD chunk = 0;
+		if (!ReadFile(file, (char*)buffer + *bytes_read, (DWORD)__min(remaining, 0x40000000), &chunk, &overlapped))
+		{
+			int result = GetLastError();
+			return result == ERROR_HANDLE_EOF ? 0 : result;
+		}
+#else
+		ssize_t chunk = pread(file, (char*)buffer + *bytes_read, remaining, (off_t)position);
+		if (chunk < 0)
+		{
+			if (errno == EINTR)
+			{
+				continue;
+			}
+			return errno;
+		}
+#endif
+		if (chunk == 0)
+		{
+			break;
+		}
+		*bytes_read += (size_t)chunk;
+	}
+	return 0;
+}
+
+static int fs_os_write(fs_os_file_t file, const void* buffer, size_t size, size_t* bytes_written)
+{
+	*bytes_written = 0;
+	while (*bytes_written < size)
+	{
+		size_t remaining = size - *bytes_written;
+#if defined(_WIN32)
+		DWORD chunk = 0;
+		if (!WriteFile(file, (const char*)buffer + *bytes_written, (DWORD)__min(remaining, 0x40000000), &chunk, NULL))
+		{
+			return GetLastError();
+		}
+#else
+		ssize_t chunk = write(file, (const char*)buffer + *bytes_written, remaining);
+		if (chunk < 0)
+		{
+			if (errno == EINTR)
+			{
+				continue;
+			}
+			return errno;
+		}
+#endif
+		*bytes_written += (size_t)chunk;
+	}
+	return 0;
+}
+
+static void fs_os_close(fs_os_file_t file)
+{
+#if defined(_WIN32)
+	CloseHandle(file);
+#else
+	close(file);
+#endif
+}
+
+// The dictionary a container was compressed against.
+// Returns false if it names one this file system doesn't have.
+static bool fs_dictionary_for(fs_t* fs, const fs_container_header_t* header, const void** dictionary, uint32_t* size)
+{
+	uint32_t id = fs_container_get_dictionary_id(header);
+	*dictionary = id ? fs->dictionary : NULL;
+	*size = id ? fs->dictionary_size : 0;
+	return id == 0 || id == fs->dictionary_id;
+}
+
+// Decompress one block of a work's file and, unless the work skips it, check
+// its checksum, tracing how long the check took. Then undo any record filter.
+// Returns zero or k_fs_result_corrupt.
+static int fs_decode_block(fs_work_t* work, const fs_container_header_t* header, const fs_container_block_t* block, const void* compressed,
+	void* destination, uint32_t raw_size, const void* dictionary, uint32_t dictionary_size)
+{
+	if (!fs_container_decompress_block(block, compressed, destination, raw_size, dictionary, dictionary_size))
+	{
+		return k_fs_result_corrupt;
+	}
+	fs_t* fs = work->fs;
+	if (!work->skip_verify)
+	{
+		uint64_t start = fs->trace ? timer_get_ticks() : 0;
+		bool ok = fs_container_verify_block(header->version, block, destination, raw_size);
+		if (fs->trace)
+		{
+			trace_duration_record(fs->trace, "fs verify", start, timer_get_ticks());
+		}
+		if (!ok)
+		{
+			return k_fs_result_corrupt;
+		}
+	}
+	fs_container_unfilter_block(header, destination, raw_size);
+	return 0;
+}
+
+// The file is in memory: decompress it or complete the work.
+static void file_read_finish(fs_work_t* work)
+{
+	if (fs_work_is_cancelled(work))
+	{
+		fs_work_try_drop(work);
+	}
+	else if (work->use_compression == k_fs_work_op_decompress)
+	{
+		// The compress pool finishes the work, so this thread is free for the next file.
+		fs_queue_push(work->fs->compress_queue, work->priority, &work->plan_task);
+	}
+	else
+	{
+		if (work->null_terminate)
+		{
+			((char*)work->buffer)[work->size] = 0;
+		}
+		fs_work_complete(work);
+	}
+}
+
+// Read an asset out of a mounted pak. The pak's codec, not the caller's flag,
+// decides whether it needs decompressing.
+static void file_read_pack(fs_work_t* work, fs_os_file_t file, const fs_pak_entry_t* entry)
+{
+	work->size = (size_t)entry->size;
+	work->use_compression = entry->codec == k_fs_pak_codec_container ? k_fs_work_op_decompress : k_fs_work_op_compress;
+	work->buffer = fs_work_alloc_file(work);
+	if (!work->buffer)
+	{
+		fs_work_complete(work);
+		return;
+	}
+
+	size_t bytes_read = 0;
+	work->result = fs_os_read_at(file, entry->offset, work->buffer, work->size, &bytes_read);
+	if (!work->result && bytes_read != work->size)
+	{
+		work->result = -1;
+	}
+	if (work->result)
+	{
+		fs_work_complete(work);
+		return;
+	}
+	file_read_finish(work);
+}
+
+static void file_read(fs_work_t* work)
+{
+	// Prefetched files looked themselves up when the manifest was read.
+	if (work->shared && !work->parent && fs_shared_try_hit(work))
+	{
+		return;
+	}
+
+	fs_os_file_t handle = 0;
+	fs_pak_entry_t entry;
+	if (fs_pack_resolve(work->fs, fs_path_get_hash(work->fs->paths, work->path), &handle, &entry) >= 0)
+	{
+		file_read_pack(work, handle, &entry);
+		return;
+	}
+
+	uint64_t file_size = 0;
+	work->result = fs_os_open_read(fs_work_path(work), &handle, &file_size);
+	if (work->result)
+	{
+		fs_work_complete(work);
+		return;
+	}
+	work->size = (size_t)file_size;
+
+	work->buffer = fs_work_alloc_file(work);
+	if (!work->buffer)
+	{
+		fs_os_close(handle);
+		fs_work_complete(work);
+		return;
+	}
+
+	size_t bytes_read = 0;
+	work->result = fs_os_read(handle, work->buffer, work->size, &bytes_read);
+	fs_os_close(handle);
+	if (work->result)
+	{
+		fs_work_complete(work);
+		return;
+	}
+
+	work->size = bytes_read;
+	file_read_finish(work);
+}
+
+// Reads the container header, one table entry and that block's data.
+// The compress pool decompresses it.
+static void file_read_block(fs_work_t* work)
+{
+	fs_os_file_t handle = 0;
+	uint64_t file_size = 0;
+	work->result = fs_os_open_read(fs_work_path(work), &handle, &file_size);
+	if (work->result)
+	{
+		fs_work_complete(work);
+		return;
+	}
+
+	fs_container_header_t header = { 0 };
+	size_t bytes_read = 0;
+	work->result = fs_os_read_at(handle, 0, &header, sizeof(header), &bytes_read);
+	if (!work->result && (bytes_read < k_fs_container_v1_header_size || !fs_container_check_header(&header) ||
+		bytes_read < fs_container_header_size(&header) || work->block_index >= header.block_count))
+	{
+		work->result = -1;
+	}
+	const void* dictionary;
+	uint32_t dictionary_size;
+	if (!work->result && !fs_dictionary_for(work->fs, &header, &dictionary, &dictionary_size))
+	{
+		work->result = -1;
+	}
+	if (!work->result)
+	{
+		work->use_dictionary = dictionary != NULL;
+		uint64_t entry_offset = fs_container_header_size(&header) + (uint64_t)work->block_index * sizeof(fs_container_block_t);
+		work->result = fs_os_read_at(handle, entry_offset, &work->block, sizeof(work->block), &bytes_read);
+		if (!work->result && (bytes_read != sizeof(work->block) || work->block.compressed_size > header.block_size))
+		{
+			work->result = -1;
+		}
+	}
+	if (!work->result)
+	{
+		work->block_raw_size = fs_container_block_raw_size(&header, work->block_index);
+		work->block_header = header;
+		work->size = work->block.compressed_size;
+		work->buffer = heap_alloc(work->heap, work->size ? work->size : 1, 8);
+		work->result = fs_os_read_at(handle, work->block.offset, work->buffer, work->size, &bytes_read);
+		if (!work->result && bytes_read != work->size)
+		{
+			work->result = -1;
+		}
+	}
+	fs_os_close(handle);
+
+	if (work->result)
+	{
+		if (work->buffer)
+		{
+			heap_free(work->heap, work->buffer);
+			work->buffer = NULL;
+		}
+		fs_work_complete(work);
+		return;
+	}
+	fs_queue_push(work->fs->compress_queue, work->priority, &work->plan_task);
+}
+
+// Hands data to the stream callback in slices of at most the chunk size.
+// Returns false once the callback asks to stop.
+static bool fs_stream_deliver(fs_work_t* work, const char* data, size_t size)
+{
+	for (size_t offset = 0; offset < size; offset += work->stream_chunk_size)
+	{
+		size_t chunk = __min(size - offset, work->stream_chunk_size);
+		if (fs_work_is_cancelled(work))
+		{
+			work->result = k_fs_result_cancelled;
+			return false;
+		}
+		if (!work->stream_function(data + offset, chunk, work->size, work->stream_user))
+		{
+			return false;
+		}
+		work->size += chunk;
+	}
+	return true;
+}
+
+static int fs_stream_uncompressed(fs_work_t* work, fs_os_file_t handle)
+{
+	fs_t* fs = work->fs;
+	char* chunk = heap_alloc(fs->heap, work->stream_chunk_size, 8);
+	int result = 0;
+	while (true)
+	{
+		size_t bytes_read = 0;
+		result = fs_os_read(handle, chunk, work->stream_chunk_size, &bytes_read);
+		if (result || bytes_read == 0 || !fs_stream_deliver(work, chunk, bytes_read))
+		{
+			break;
+		}
+	}
+	heap_free(fs->heap, chunk);
+	return result;
+}
+
+// Walks the block container one block at a time, so memory stays at one
+// compressed block, one decompressed block and a slice of the table.
+static int fs_stream_compressed(fs_work_t* work, fs_os_file_t handle)
+{
+	fs_container_header_t header = { 0 };
+	size_t bytes_read = 0;
+	int result = fs_os_read_at(handle, 0, &header, sizeof(header), &bytes_read);
+	if (result)
+	{
+		return result;
+	}
+	fs_t* fs = work->fs;
+	const void* dictionary;
+	uint32_t dictionary_size;
+	if (bytes_read < k_fs_container_v1_header_size || !fs_container_check_header(&header) ||
+		bytes_read < fs_container_header_size(&header) || !fs_dictionary_for(fs, &header, &dictionary, &dictionary_size))
+	{
+		return -1;
+	}
+
+	fs_container_block_t* table = heap_alloc(fs->heap, sizeof(fs_container_block_t) * k_fs_stream_table_batch, 8);
+	char* compressed = heap_alloc(fs->heap, header.block_size, 8);
+	char* block = heap_alloc(fs->heap, header.block_size, 8);
+
+	for (uint32_t i = 0; i < header.block_count && !result; ++i)
+	{
+		uint32_t slot = i % k_fs_stream_table_batch;
+		if (slot == 0)
+		{
+			uint32_t count = __min(header.block_count - i, (uint32_t)k_fs_stream_table_batch);
+			uint64_t offset = fs_container_header_size(&header) + (uint64_t)i * sizeof(fs_container_block_t);
+			result = fs_os_read_at(handle, offset, table, count * sizeof(fs_container_block_t), &bytes_read);
+			if (!result && bytes_read != count * sizeof(fs_container_block_t))
+			{
+				result = -1;
+			}
+			if (result)
+			{
+				break;
+			}
+		}
+
+		const fs_container_block_t* entry = &table[slot];
+		uint32_t raw_size = fs_container_block_raw_size(&header, i);
+		// Stored blocks are never larger than the block size.
+		if (entry->compressed_size > header.block_size)
+		{
+			result = -1;
+			break;
+		}
+		result = fs_os_read_at(handle, entry->offset, compressed, entry->compressed_size, &bytes_read);
+		if (!result && bytes_read != entry->compressed_size)
+		{
+			result = -1;
+		}
+		if (!result)
+		{
+			result = fs_decode_block(work, &header, entry, compressed, block, raw_size, dictionary, dictionary_size);
+		}
+		if (!result && !fs_stream_deliver(work, block, raw_size))
+		{
+			break;
+		}
+	}
+
+	heap_free(fs->heap, block);
+	heap_free(fs->heap, compressed);
+	heap_free(fs->heap, table);
+	return result;
+}
+
+static void file_read_stream(fs_work_t* work)
+{
+	fs_os_file_t handle = 0;
+	uint64_t file_size = 0;
+	work->result = fs_os_open_read(fs_work_path(work), &handle, &file_size);
+	if (work->result)
+	{
+		fs_work_complete(work);
+		return;
+	}
+
+	int result = work->use_compression == k_fs_work_op_decompress ? fs_stream_compressed(work, handle) : fs_stream_uncompressed(work, handle);
+	// Cancelling between chunks has already set the result.
+	if (!work->result)
+	{
+		work->result = result;
+	}
+	fs_os_close(handle);
+	fs_work_complete(work);
+}
+
+static void file_write(fs_work_t* work)
+{
+	// Atomic writes go to a temporary file, which replaces the target once
+	// it is safely on disk.
+	// The OS layer takes paths of up to 1024 characters.
+	const char* path = fs_work_path(work);
+	char temp_path[1024 + 32];
+	bool atomic = work->write_mode == k_fs_write_atomic;
+	if (atomic)
+	{
+		snprintf(temp_path, sizeof(temp_path), "%s.%u.%d.tmp", path, fs_os_process_id(), atomic_increment(&s_fs_temp_count));
+	}
+
+	fs_os_file_t handle = 0;
+	if (work->write_mode == k_fs_write_append)
+	{
+		work->result = fs_os_open_append(path, &handle);
+	}
+	else
+	{
+		work->result = fs_os_open_write(atomic ? temp_path : path, &handle);
+	}
+	if (work->result)
+	{
+		if (work->use_compression == k_fs_work_op_compress)
+		{
+			fs_work_free(work, work->buffer);
+		}
+		fs_work_complete(work);
+		return;
+	}
+
+	if (work->use_compression == k_fs_work_op_compress) {
+		size_t bytes_written = 0;
+		work->result = fs_os_write(handle, work->buffer, work->compression_size, &bytes_written);
+		work->compression_size = bytes_written;
+
+		fs_work_free(work, work->buffer);
+	}
+	else {
+		size_t bytes_written = 0;
+		work->result = fs_os_write(handle, work->buffer, work->size, &bytes_written);
+		work->size = bytes_written;
+	}
+	if (!work->result && (work->sync || atomic))
+	{
+		work->result = fs_os_flush(handle);
+	}
+	fs_os_close(handle);
+
+	if (atomic)
+	{
+		if (!work->result)
+		{
+			work->result = fs_os_replace(temp_path, path);
+		}
+		if (work->result)
+		{
+			fs_os_remove(temp_path);
+		}
+	}
+	fs_work_complete(work);
+}
+
+static int fs_batch_order_compare(const void* a, const void* b)
+{
+	const fs_batch_order_t* x = a;
+	const fs_batch_order_t* y = b;
+	if (x->pack != y->pack)
+	{
+		return x->pack < y->pack ? -1 : 1;
+	}
+	if (x->location != y->location)
+	{
+		return x->location < y->location ? -1 : 1;
+	}
+	int order = strcmp(x->path, y->path);
+	return order ? order : x->index - y->index;
+}
+
+// Sorts a batch's files by pak and offset, then loose files by locality,
+// so one pass over them moves forward through the disk.
+static void fs_batch_sort(fs_work_t* work)
+{
+	for (int i = 0; i < work->batch_count; ++i)
+	{
+		fs_work_t* child = &work->batch_children[i];
+		fs_batch_order_t* order = &work->batch_order[i];
+		fs_os_file_t file;
+		fs_pak_entry_t entry;
+		int pack = fs_pack_resolve(work->fs, fs_path_get_hash(work->fs->paths, child->path), &file, &entry);
+		order->pack = pack >= 0 ? (uint32_t)pack : UINT32_MAX;
+		order->path = fs_work_path(child);
+		order->location = pack >= 0 ? entry.offset : fs_os_locality(order->path);
+		order->index = i;
+	}
+	qsort(work->batch_order, work->batch_count, sizeof(fs_batch_order_t), fs_batch_order_compare);
+}
+
+static void file_read_many(fs_work_t* work)
+{
+	fs_batch_sort(work);
+	// The batch may be freed as soon as its last file is handed off, so don't
+	// touch it after that.
+	int count = work->batch_count;
+	fs_work_t* children = work->batch_children;
+	fs_batch_order_t* order = work->batch_order;
+	for (int i = 0; i < count; ++i)
+	{
+		fs_work_t* child = &children[order[i].index];
+		if (!fs_work_try_drop(child))
+		{
+			file_read(child);
+		}
+	}
+}
+
+// Parses one manifest line, ended by a zero in place of its newline.
+// Returns false if it is malformed; path is NULL if the line lists nothing.
+static bool fs_manifest_parse_line(char* line, uint64_t* size, bool* compressed, const char** path)
+{
+	*path = NULL;
+	size_t length = strlen(line);
+	if (length > 0 && line[length - 1] == '\r')
+	{
+		line[--length] = 0;
+	}
+	if (length == 0 || line[0] == '#')
+	{
+		return true;
+	}
+	char* end;
+	*size = strtoull(line, &end, 10);
+	if (end == line || *end != ' ')
+	{
+		return false;
+	}
+	if (strncmp(end + 1, "raw ", 4) == 0 || strncmp(end + 1, "lz4 ", 4) == 0)
+	{
+		*compressed = end[1] == 'l';
+		*path = end + 5;
+	}
+	return *path && **path;
+}
+
+// Reads and parses the manifest and turns the work into a batch of the files
+// not already cached. Returns false, having completed the work, if there is
+// nothing to read.
+static bool file_prefetch_plan(fs_work_t* work)
+{
+	fs_t* fs = work->fs;
+	fs_prefetch_t* prefetch = work->prefetch;
+	char* manifest = NULL;
+	size_t size = 0;
+	fs_os_file_t handle;
+	uint64_t file_size = 0;
+	work->result = fs_os_open_read(fs_work_path(work), &handle, &file_size);
+	if (!work->result)
+	{
+		size = (size_t)file_size;
+		manifest = heap_alloc(fs->heap, size + 1, 8);
+		size_t bytes_read = 0;
+		work->result = fs_os_read_at(handle, 0, manifest, size, &bytes_read);
+		if (!work->result && bytes_read != size)
+		{
+			work->result = -1;
+		}
+		fs_os_close(handle);
+	}
+
+	// Split into lines, then check them all before reading anything.
+	int count = 0;
+	uint64_t total = 0;
+	for (size_t i = 0; !work->result && i < size; ++i)
+	{
+		manifest[i] = manifest[i] == '\n' ? 0 : manifest[i];
+	}
+	for (char* line = manifest; !work->result && line < manifest + size; line += strlen(line) + 1)
+	{
+		uint64_t file_size;
+		bool compressed;
+		const char* path;
+		if (!fs_manifest_parse_line(line, &file_size, &compressed, &path))
+		{
+			work->result = -1;
+		}
+		count += path ? 1 : 0;
+		total += path ? file_size : 0;
+	}
+	if (work->result || count == 0)
+	{
+		heap_free(fs->heap, manifest);
+		fs_work_complete(work);
+		return false;
+	}
+
+	work->batch_children = heap_alloc(work->heap, (sizeof(fs_work_t) + sizeof(fs_batch_order_t) + sizeof(uint64_t)) * count, 8);
+	work->batch_order = (fs_batch_order_t*)(work->batch_children + count);
+	prefetch->sizes = (uint64_t*)(work->batch_order + count);
+	bool shared = prefetch->target == k_fs_prefetch_shared_cache;
+	int cached = 0;
+	uint64_t cached_bytes = 0;
+	for (char* line = manifest; line < manifest + size; line += strlen(line) + 1)
+	{
+		uint64_t file_size;
+		bool compressed;
+		const char* path;
+		fs_manifest_parse_line(line, &file_size, &compressed, &path);
+		if (!path)
+		{
+			continue;
+		}
+		fs_work_t* child = &work->batch_children[work->batch_count];
+		if (!shared)
+		{
+			// The stored bytes are what the OS caches, so skip decompressing.
+			fs_batch_child_init(work, child, fs_work_intern(fs, path), fs->heap, false, false);
+		}
+		else
+		{
+			// As fs_read_shared(), so later shared reads find the entry.
+			fs_batch_child_init(work, child, fs_work_intern(fs, path), fs_cache_get_heap(fs->cache), true, compressed);
+			child->shared = true;
+			fs_cache_entry_t* entry = child->path != k_fs_path_invalid && fs_source_key(child, compressed, &child->cache_key) ?
+				fs_cache_acquire(fs->cache, child->path, &child->cache_key) : NULL;
+			if (entry)
+			{
+				fs_cache_release(fs->cache, entry);
+				cached++;
+				cached_bytes += file_size;
+				continue;
+			}
+		}
+		prefetch->sizes[work->batch_count++] = file_size;
+	}
+	heap_free(fs->heap, manifest);
 
+	// No file has started, so nothing else touches the progress yet.
+	spinlock_lock(prefetch->lock);
+	prefetch->progress = (fs_prefetch_progress_t)
+	{
+		.file_count = count,
+		.files_done = cached,
+		.byte_count = total,
+		.bytes_done = cached_bytes,
+	};
+	spinlock_unlock(prefetch->lock);
+	work->batch_remaining = work->batch_count;
+	if (work->batch_count == 0)
+	{
+		fs_work_complete(work);
+		return false;
+	}
+	return true;
+}
 
+static int file_thread_func(void* user)
+{
 	fs_t* fs = user;
+	while (true)
+	{
+		fs_work_t* work = fs_queue_pop(fs->file_queue);
+		if (work == NULL)
+		{
+			break;
+		}
+		if (fs_work_try_drop(work))
+		{
+			continue;
+		}
 
-	while (true) {
-		fs_work_t* work = queue_pop(fs->compress_queue);
-		if (work == NULL) {
+		switch (work->op)
+		{
+		case k_fs_work_op_read:
+			file_read(work);
+			break;
+		case k_fs_work_op_write:
+			file_write(work);
+			break;
+		case k_fs_work_op_read_block:
+			file_read_block(work);
+			break;
+		case k_fs_work_op_read_stream:
+			file_read_stream(work);
+			break;
+		case k_fs_work_op_read_many:
+			file_read_many(work);
 			break;
+		case k_fs_work_op_prefetch:
+			if (file_prefetch_plan(work))
+			{
+				file_read_many(work);
+			}
+			break;
+		}
+	}
+	return 0;
+}
+
+#if !defined(_WIN32)
+
+// Bytes a ring work moves in total.
+static size_t fs_ring_work_size(fs_work_t* work)
+{
+	return work->op == k_fs_work_op_write && work->use_compression == k_fs_work_op_compress ? work->compression_size : work->size;
+}
+
+// Queue the next transfer for a work. Depth never exceeds the ring size, so there is always room.
+static void fs_ring_submit(fs_t* fs, fs_work_t* work)
+{
+	size_t remaining = fs_ring_work_size(work) - (size_t)work->ring_offset;
+	uint32_t size = (uint32_t)__min(remaining, (size_t)k_fs_ring_max_transfer);
+	if (work->op == k_fs_work_op_read)
+	{
+		bool fixed = work->ring_buffer >= 0;
+		char* destination = fixed ? fs->ring_buffers + (size_t)work->ring_buffer * k_fs_ring_buffer_size : (char*)work->buffer;
+		uring_prep_read(fs->ring, work->ring_file, destination + work->ring_offset, size, work->ring_base + work->ring_offset, work->ring_buffer, work);
+	}
+	else
+	{
+		uring_prep_write(fs->ring, work->ring_file, (const char*)work->buffer + work->ring_offset, size, work->ring_offset, work);
+	}
+}
+
+// Open the file and queue the first transfer.
+// Returns false if the work finished without going in flight.
+static bool fs_ring_start(fs_t* fs, fs_work_t* work)
+{
+	work->ring_offset = 0;
+	work->ring_base = 0;
+	work->ring_owns_file = true;
+	work->ring_buffer = -1;
+	if (work->op == k_fs_work_op_read)
+	{
+		// As in file_read().
+		if (work->shared && !work->parent && fs_shared_try_hit(work))
+		{
+			return false;
+		}
+		fs_pak_entry_t entry;
+		uint64_t file_size = 0;
+		if (fs_pack_resolve(fs, fs_path_get_hash(fs->paths, work->path), &work->ring_file, &entry) >= 0)
+		{
+			work->ring_owns_file = false;
+			work->ring_base = entry.offset;
+			work->use_compression = entry.codec == k_fs_pak_codec_container ? k_fs_work_op_decompress : k_fs_work_op_compress;
+			file_size = entry.size;
+		}
+		else
+		{
+			work->result = fs_os_open_read(fs_work_path(work), &work->ring_file, &file_size);
+			if (work->result)
+			{
+				fs_work_complete(work);
+				return false;
+			}
+		}
+		work->size = (size_t)file_size;
+		work->buffer = fs_work_alloc_file(work);
+		if (!work->buffer)
+		{
+			if (work->ring_owns_file)
+			{
+				fs_os_close(work->ring_file);
+			}
+			fs_work_complete(work);
+			return false;
+		}
+		// Caller memory is read into directly, without bouncing through a
+		// registered buffer.
+		if (work->size <= k_fs_ring_buffer_size && fs->ring_free_buffer_count > 0 && !fs_work_is_caller_memory(work, work->buffer))
+		{
+			work->ring_buffer = fs->ring_free_buffers[--fs->ring_free_buffer_count];
+		}
+	}
+	else
+	{
+		work->result = fs_os_open_write(fs_work_path(work), &work->ring_file);
+		if (work->result)
+		{
+			if (work->use_compression == k_fs_work_op_compress)
+			{
+				fs_work_free(work, work->buffer);
+			}
+			fs_work_complete(work);
+			return false;
+		}
+	}
+
+	if (fs_ring_work_size(work) == 0)
+	{
+		if (work->ring_owns_file)
+		{
+			fs_os_close(work->ring_file);
+		}
+		if (work->op == k_fs_work_op_read)
+		{
+			file_read_finish(work);
+		}
+		else
+		{
+			fs_work_complete(work);
+		}
+		return false;
+	}
+	fs_ring_submit(fs, work);
+	return true;
+}
+
+// Handle one completed transfer.
+// Returns true if the work is still in flight.
+static bool fs_ring_complete(fs_t* fs, fs_work_t* work, int result)
+{
+	if (result > 0)
+	{
+		work->ring_offset += (uint64_t)result;
+		if (work->ring_offset < fs_ring_work_size(work))
+		{
+			// Short transfer: queue the rest.
+			fs_ring_submit(fs, work);
+			return true;
+		}
+	}
+	else if (result < 0)
+	{
+		work->result = -result;
+	}
+	else if (work->op == k_fs_work_op_write)
+	{
+		// A write that moves nothing would never finish.
+		work->result = -1;
+	}
+	if (work->ring_owns_file)
+	{
+		fs_os_close(work->ring_file);
+	}
+
+	if (work->op == k_fs_work_op_read)
+	{
+		// A zero byte read means the file shrank; keep what arrived.
+		work->size = (size_t)work->ring_offset;
+		if (work->ring_buffer >= 0)
+		{
+			memcpy(work->buffer, fs->ring_buffers + (size_t)work->ring_buffer * k_fs_ring_buffer_size, work->size);
+			fs->ring_free_buffers[fs->ring_free_buffer_count++] = work->ring_buffer;
+		}
+		if (work->result)
+		{
+			fs_work_complete(work);
+		}
+		else
+		{
+			file_read_finish(work);
+		}
+	}
+	else
+	{
+		if (work->use_compression == k_fs_work_op_compress)
+		{
+			work->compression_size = (size_t)work->ring_offset;
+			fs_work_free(work, work->buffer);
+		}
+		else
+		{
+			work->size = (size_t)work->ring_offset;
+		}
+		fs_work_complete(work);
+	}
+	return false;
+}
+
+// A batch being fed into the ring, one file at a time.
+typedef struct fs_ring_batch_t
+{
+	fs_work_t* work;
+	int next;
+	// Batches that came off the queue while this one was being started,
+	// oldest first, chained through batch_next.
+	fs_work_t* waiting;
+} fs_ring_batch_t;
+
+// Sort a batch and start feeding it in, or line it up behind the current one.
+static void fs_ring_batch_start(fs_ring_batch_t* batch, fs_work_t* work)
+{
+	fs_batch_sort(work);
+	work->batch_next = NULL;
+	if (!batch->work)
+	{
+		batch->work = work;
+		batch->next = 0;
+		return;
+	}
+	fs_work_t** link = &batch->waiting;
+	while (*link)
+	{
+		link = &(*link)->batch_next;
+	}
+	*link = work;
+}
+
+// The next file of the current batch, else the next work off the queue.
+// A low priority batch, such as a prefetch, lets queued work go first.
+static fs_work_t* fs_ring_next(fs_t* fs, fs_ring_batch_t* batch, bool wait)
+{
+	if (batch->work && batch->work->priority == k_fs_priority_low)
+	{
+		fs_work_t* queued = fs_queue_try_pop(fs->file_queue);
+		if (queued)
+		{
+			return queued;
+		}
+	}
+	if (batch->work)
+	{
+		fs_work_t* work = batch->work;
+		fs_work_t* child = &work->batch_children[work->batch_order[batch->next++].index];
+		// Drop the batch before its last file goes out: that file may finish it.
+		if (batch->next == work->batch_count)
+		{
+			batch->work = batch->waiting;
+			batch->waiting = batch->waiting ? batch->waiting->batch_next : NULL;
+			batch->next = 0;
 		}
+		return child;
+	}
+	return wait ? fs_queue_pop(fs->file_queue) : fs_queue_try_pop(fs->file_queue);
+}
 
-		switch (work->use_compression) {
-		case k_fs_work_op_compress:
-			file_compress(work);
+// Pulls works off the file queue and keeps up to ring_depth reads and writes
+// in flight. Everything queued since the last wait goes to the kernel in one
+// submission. Block and stream reads are rare, as are writes that flush,
+// rename or append, so they run synchronously here.
+// A batch's files are started in sorted order as the ring has room.
+static int file_ring_func(void* user)
+{
+	fs_t* fs = user;
+	uint32_t in_flight = 0;
+	fs_ring_batch_t batch = { 0 };
+	while (true)
+	{
+		// Only block on the queue when nothing is in flight. While works are
+		// in flight fs_destroy() can't have stopped the queue, so an empty
+		// try_pop never hides the stop.
+		fs_work_t* work = fs_ring_next(fs, &batch, in_flight == 0);
+		if (work == NULL && in_flight == 0)
+		{
 			break;
-		case k_fs_work_op_decompress:
-			file_decompress(work);
+		}
+		while (work)
+		{
+			if (!fs_work_try_drop(work))
+			{
+				switch (work->op)
+				{
+				case k_fs_work_op_read:
+					in_flight += fs_ring_start(fs, work) ? 1 : 0;
+					break;
+				case k_fs_work_op_write:
+					if (work->write_mode == k_fs_write_in_place && !work->sync)
+					{
+						in_flight += fs_ring_start(fs, work) ? 1 : 0;
+					}
+					else
+					{
+						file_write(work);
+					}
+					break;
+				case k_fs_work_op_read_block:
+					file_read_block(work);
+					break;
+				case k_fs_work_op_read_stream:
+					file_read_stream(work);
+					break;
+				case k_fs_work_op_read_many:
+					fs_ring_batch_start(&batch, work);
+					break;
+				case k_fs_work_op_prefetch:
+					if (file_prefetch_plan(work))
+					{
+						fs_ring_batch_start(&batch, work);
+					}
+					break;
+				}
+			}
+			work = in_flight < fs->ring_depth ? fs_ring_next(fs, &batch, false) : NULL;
+		}
+		if (in_flight == 0)
+		{
+			continue;
+		}
+
+		int result = uring_submit_and_wait(fs->ring, 1);
+		if (result)
+		{
+			debug_print(k_print_error, "fs: io_uring submit failed (%d)\n", result);
+			thread_sleep(1);
+			continue;
+		}
+
+		uring_completion_t completion;
+		while (uring_pop_completion(fs->ring, &completion))
+		{
+			if (!fs_ring_complete(fs, completion.user, completion.result))
+			{
+				in_flight--;
+			}
+		}
+	}
+	return 0;
+}
+
+#else
+
+static int file_ring_func(void* user)
+{
+	// uring_create() never succeeds on Windows.
+	return 0;
+}
+
+#endif
+
+
+
+// Runs a codec task on this thread if the compress queue is full.
+// Pool threads must never block on their own queue.
+static void fs_codec_dispatch(fs_codec_task_t* task);
+
+// Fan blocks out across the pool. The last block to finish may free the tasks,
+// so nothing here touches them after the final dispatch.
+static void fs_codec_dispatch_blocks(fs_work_t* work, uint32_t block_count)
+{
+	// Tasks go in the caller's scratch after the data, when there is room.
+	size_t tasks_size = sizeof(fs_codec_task_t) * block_count;
+	size_t offset = (work->scratch_used + 7) & ~(size_t)7;
+	if (work->scratch && offset + tasks_size <= work->scratch_size)
+	{
+		work->tasks = (fs_codec_task_t*)(work->scratch + offset);
+		work->scratch_used = offset + tasks_size;
+	}
+	else
+	{
+		work->tasks = heap_alloc(work->fs->heap, tasks_size, 8);
+	}
+	work->blocks_remaining = (int)block_count;
+	for (uint32_t i = 0; i < block_count; ++i)
+	{
+		work->tasks[i] = (fs_codec_task_t) { .work = work, .block_index = (int)i };
+	}
+	for (uint32_t i = 0; i < block_count; ++i)
+	{
+		fs_codec_dispatch(&work->tasks[i]);
+	}
+}
+
+static void file_compress_finish(fs_work_t* work) {
+	if (work->tasks) {
+		if (!fs_work_is_caller_memory(work, work->tasks)) {
+			heap_free(work->fs->heap, work->tasks);
+		}
+		work->tasks = NULL;
+	}
+	heap_free(work->heap, work->filter_buffer);
+	work->filter_buffer = NULL;
+
+	if (work->result) {
+		// The caller's buffer is untouched, so fail the write here.
+		fs_work_free(work, work->codec_buffer);
+		fs_work_complete(work);
+		return;
+	}
+
+	work->compression_size = fs_container_compact(work->codec_buffer);
+	work->buffer = work->codec_buffer;
+
+	// Hand off to the write stage. If the file queue is full, write here instead:
+	// blocking would deadlock against file threads blocked pushing reads to us.
+	if (!fs_queue_try_push(work->fs->file_queue, work->priority, work)) {
+		file_write(work);
+	}
+}
+
+// The write's level and record coding, and the shared dictionary if it asked for one.
+static fs_container_codec_t fs_work_codec(fs_work_t* work) {
+	return (fs_container_codec_t) {
+		.level = work->compression_level,
+		.dictionary = work->use_dictionary ? work->fs->dictionary : NULL,
+		.dictionary_size = work->use_dictionary ? work->fs->dictionary_size : 0,
+		.filter = (fs_container_filter_t)work->record_coding,
+		.record_size = work->record_size,
+	};
+}
+
+static void file_compress(fs_work_t* work) {
+	uint32_t block_size = work->fs->block_size;
+	work->codec_buffer = fs_work_alloc(work, fs_container_bound(work->size, block_size), true);
+	if (!work->codec_buffer) {
+		fs_work_complete(work);
+		return;
+	}
+	fs_container_codec_t codec = fs_work_codec(work);
+	fs_container_init(work->codec_buffer, work->size, block_size, &codec);
+	if (fs_container_get_filter(work->codec_buffer) != k_fs_container_filter_none) {
+		work->filter_buffer = heap_alloc(work->heap, work->size ? work->size : 1, 8);
+	}
+
+	uint32_t block_count = fs_container_block_count(work->size, block_size);
+	if (block_count == 0) {
+		file_compress_finish(work);
+		return;
+	}
+	fs_codec_dispatch_blocks(work, block_count);
+}
+
+// Fails a compressed read. The compressed bytes are never the result: they
+// aren't what the caller asked for, and have no room for a terminator.
+static void file_decompress_fail(fs_work_t* work) {
+	if (!work->result) {
+		work->result = -1;
+	}
+	fs_work_free(work, work->buffer);
+	work->buffer = NULL;
+	work->size = 0;
+	fs_work_complete(work);
+}
+
+static void file_decompress_finish(fs_work_t* work) {
+	if (work->tasks) {
+		if (!fs_work_is_caller_memory(work, work->tasks)) {
+			heap_free(work->fs->heap, work->tasks);
+		}
+		work->tasks = NULL;
+	}
+
+	if (work->result) {
+		// Cancelled or corrupt: a partial decode is no use either.
+		fs_work_free(work, work->codec_buffer);
+		file_decompress_fail(work);
+		return;
+	}
+	size_t size = work->op == k_fs_work_op_read_block ? work->block_raw_size : (size_t)((const fs_container_header_t*)work->buffer)->size;
+	fs_work_free(work, work->buffer);
+	work->buffer = work->codec_buffer;
+	work->size = size;
+	if (work->null_terminate) {
+		((char*)work->buffer)[work->size] = 0;
+	}
+	fs_work_complete(work);
+}
+
+// Files written before the block container: a 4-byte size, then one LZ4 block.
+static void file_decompress_legacy(fs_work_t* work) {
+	int decompressed_size = work->size >= sizeof(int) ? *(int*)(work->buffer) : -1;
+	if (decompressed_size < 0) {
+		// Too short for the size header, or not written by fs_write.
+		file_decompress_fail(work);
+		return;
+	}
+	char* buffer_temp = fs_work_alloc(work, work->null_terminate ? (decompressed_size + 1) : decompressed_size, false);
+	if (!buffer_temp) {
+		file_decompress_fail(work);
+		return;
+	}
+	char* compressed = (char*)work->buffer + sizeof(int);
+	int compressed_size = (int)(work->size - sizeof(int));
+	int decompress_size = LZ4_decompress_safe(compressed, buffer_temp, compressed_size, decompressed_size);
+	if (decompress_size <= 0) {
+		fs_work_free(work, buffer_temp);
+		file_decompress_fail(work);
+		return;
+	}
+	work->size = decompress_size;
+	fs_work_free(work, work->buffer);
+	work->buffer = buffer_temp;
+	if (work->null_terminate) {
+		((char*)work->buffer)[work->size] = 0;
+	}
+	fs_work_complete(work);
+}
+
+static void file_decompress(fs_work_t* work) {
+	if (work->op == k_fs_work_op_read_block) {
+		// One block read on its own: nothing to fan out.
+		work->codec_buffer = heap_alloc(work->heap, work->null_terminate ? work->block_raw_size + 1 : work->block_raw_size, 8);
+		const void* dictionary = work->use_dictionary ? work->fs->dictionary : NULL;
+		work->result = fs_decode_block(work, &work->block_header, &work->block, work->buffer, work->codec_buffer, work->block_raw_size,
+			dictionary, work->fs->dictionary_size);
+		file_decompress_finish(work);
+		return;
+	}
+
+	const fs_container_header_t* header;
+	const fs_container_block_t* blocks;
+	if (!fs_container_parse(work->buffer, work->size, &header, &blocks)) {
+		file_decompress_legacy(work);
+		return;
+	}
+	const void* dictionary;
+	uint32_t dictionary_size;
+	if (!fs_dictionary_for(work->fs, header, &dictionary, &dictionary_size)) {
+		file_decompress_fail(work);
+		return;
+	}
+
+	size_t size = (size_t)header->size;
+	work->codec_buffer = fs_work_alloc(work, work->null_terminate ? size + 1 : size, false);
+	if (!work->codec_buffer) {
+		file_decompress_fail(work);
+		return;
+	}
+	if (header->block_count == 0) {
+		file_decompress_finish(work);
+		return;
+	}
+	fs_codec_dispatch_blocks(work, header->block_count);
+}
+
+static void file_code_block(fs_codec_task_t* task) {
+	fs_work_t* work = task->work;
+	uint32_t index = (uint32_t)task->block_index;
+	int result = 0;
+	if (fs_work_is_cancelled(work)) {
+		// Skip the coding; the last block still finishes the work.
+		result = k_fs_result_cancelled;
+	}
+	else if (work->use_compression == k_fs_work_op_compress) {
+		fs_container_codec_t codec = fs_work_codec(work);
+		const void* source = work->buffer;
+		if (work->filter_buffer) {
+			fs_container_filter_block(work->codec_buffer, work->buffer, work->filter_buffer, index);
+			source = work->filter_buffer;
+		}
+		result = fs_container_compress_block(work->codec_buffer, source, index, &codec) ? 0 : -1;
+	}
+	else {
+		// Parsed and matched to a dictionary before the blocks fanned out.
+		const fs_container_header_t* header = work->buffer;
+		const fs_container_block_t* block = (const fs_container_block_t*)((const char*)header + fs_container_header_size(header)) + index;
+		char* destination = (char*)work->codec_buffer + (size_t)index * header->block_size;
+		const void* dictionary;
+		uint32_t dictionary_size;
+		fs_dictionary_for(work->fs, header, &dictionary, &dictionary_size);
+		result = fs_decode_block(work, header, block, (char*)work->buffer + block->offset, destination,
+			fs_container_block_raw_size(header, index), dictionary, dictionary_size);
+	}
+	if (result) {
+		atomic_store(&work->result, result);
+	}
+
+	// The decrement publishes this block's output to whichever thread finishes last.
+	if (atomic_decrement(&work->blocks_remaining) != 1) {
+		return;
+	}
+	if (work->use_compression == k_fs_work_op_compress) {
+		file_compress_finish(work);
+	}
+	else {
+		file_decompress_finish(work);
+	}
+}
+
+static void fs_codec_run(fs_codec_task_t* task) {
+	if (task->block_index < 0 && fs_work_try_drop(task->work)) {
+		return;
+	}
+	if (task->block_index >= 0) {
+		file_code_block(task);
+	}
+	else if (task->work->use_compression == k_fs_work_op_compress) {
+		file_compress(task->work);
+	}
+	else {
+		file_decompress(task->work);
+	}
+}
+
+static void fs_codec_dispatch(fs_codec_task_t* task) {
+	if (!fs_queue_try_push(task->work->fs->compress_queue, task->work->priority, task)) {
+		fs_codec_run(task);
+	}
+}
+
+static int file_compress_func(void* user) {
+
+
+	fs_t* fs = user;
+
+	while (true) {
+		fs_codec_task_t* task = fs_queue_pop(fs->compress_queue);
+		if (task == NULL) {
 			break;
 		}
+		fs_codec_run(task);
 	}
 	return 0;
 }
@@ -1,6 +1,8 @@
 #pragma once
 
 #include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
 
 // Asynchronous read/write file system.
 
@@ -10,16 +12,202 @@ typedef struct fs_t fs_t;
 // Handle to file work.
 typedef struct fs_work_t fs_work_t;
 
+// Handle to a completion channel.
+// Finished work is pushed onto it so one thread can collect many results at once.
+typedef struct fs_completion_t fs_completion_t;
+
+// Handle to a read-only memory-mapped file.
+typedef struct fs_map_t fs_map_t;
+
 typedef struct heap_t heap_t;
+typedef struct trace_t trace_t;
+
+// Receives one chunk of a streamed read.
+// offset is where the chunk starts in the (uncompressed) file.
+// The data is only valid during the call. Return false to stop the stream early.
+typedef bool (*fs_stream_func_t)(const void* data, size_t size, uint64_t offset, void* user);
+
+// How urgently a work is scheduled.
+// File and codec threads always take the most urgent queued work first, so
+// low priority work only runs when nothing more urgent is waiting.
+typedef enum fs_priority_t
+{
+	k_fs_priority_normal,
+	// Latency-critical reads, e.g. what is on screen now.
+	k_fs_priority_high,
+	// Background work such as prefetching.
+	k_fs_priority_low,
+	k_fs_priority_count,
+} fs_priority_t;
+
+// Results of works that were stopped rather than run to the end.
+// Other non-zero results are OS error codes or -1.
+enum
+{
+	// fs_work_cancel() was called.
+	k_fs_result_cancelled = -2,
+	// The work was still queued when its deadline passed.
+	k_fs_result_expired = -3,
+	// A caller-provided destination or scratch buffer was too small.
+	k_fs_result_too_small = -4,
+	// A compressed file's block didn't decode, or decoded to bytes that don't
+	// match its checksum: the file is damaged.
+	k_fs_result_corrupt = -5,
+	// The file system already names fs_options_t.max_paths distinct paths, so
+	// the work's path has no ID and the work never ran.
+	k_fs_result_no_path = -6,
+};
+
+// How a write puts its bytes on disk.
+typedef enum fs_write_mode_t
+{
+	// Truncate the file and write it in place. A crash part way through
+	// leaves a partial file.
+	k_fs_write_in_place,
+	// Write a temporary file next to the target, flush it to disk, then
+	// rename it over the target. Readers, and the file after a crash, see
+	// either the old contents or the new, never a mix.
+	k_fs_write_atomic,
+	// Add to the end of the file, creating it if need be. Never compressed.
+	// See fs_journal.h for batching many small appends.
+	k_fs_write_append,
+} fs_write_mode_t;
+
+// How a compressed write codes fixed-size records before compressing them.
+// Replays and world snapshots are series of similar records; coding each one
+// against the record before it turns the fields that did not change into
+// zeros, which LZ4 compresses far better. Reads undo it themselves.
+// Values match fs_container_filter_t.
+typedef enum fs_record_coding_t
+{
+	k_fs_record_none,
+	// XOR with the previous record. Suits floats and flags.
+	k_fs_record_xor,
+	// Bytewise difference from the previous record. Suits counters and
+	// integer positions that move in small steps.
+	k_fs_record_delta,
+} fs_record_coding_t;
+
+// Optional settings for fs_read_ex() and fs_write_ex().
+// Zeroed fields keep the defaults.
+typedef struct fs_work_options_t
+{
+	// If set, the work is pushed onto this channel when it finishes.
+	// The work must not be destroyed until it has been popped from the channel.
+	fs_completion_t* completion;
+	// Arbitrary value returned by fs_work_get_user_data().
+	void* user_data;
+	// Defaults to normal.
+	fs_priority_t priority;
+	// If non-zero, milliseconds from now after which the result is no longer
+	// wanted. Work still waiting in a queue by then finishes with
+	// k_fs_result_expired instead of running.
+	uint32_t deadline_ms;
+	// For compressed writes. Zero for LZ4's default. Negative for faster LZ4
+	// with an acceleration of -level. 1 to 12 for LZ4 HC at that level: slower
+	// to write but smaller, and just as fast to read, so suits offline builds.
+	int compression_level;
+	// For compressed writes: compress against the fs_options_t dictionary.
+	// Ignored if the file system has none. Reads find the dictionary themselves.
+	bool use_dictionary;
+	// Caller-owned working memory for compressed reads and writes, in place
+	// of heap allocations: the compressed file on the way in, or the
+	// container on the way out. Block and stream reads don't use it. Size it with fs_get_read_size() or
+	// fs_get_write_scratch_size(). Too small and the work fails with
+	// k_fs_result_too_small. Must stay valid until the work is done.
+	void* scratch;
+	size_t scratch_size;
+	// For writes. Defaults to writing in place.
+	fs_write_mode_t write_mode;
+	// For writes: flush the file to disk before the work completes, so it
+	// survives a power cut. Atomic writes always do.
+	bool sync;
+	// For compressed reads: don't check decompressed blocks against their
+	// checksums, e.g. for paks already verified at install. Blocks that fail
+	// to decode still fail.
+	bool skip_verify;
+	// For compressed writes of fixed-size records: the coding, and the record
+	// size in bytes. Ignored unless the record size is non-zero and smaller
+	// than the block size. Coding needs a copy of the data, which comes from
+	// the work's heap even when scratch is given.
+	fs_record_coding_t record_coding;
+	uint32_t record_size;
+} fs_work_options_t;
+
+// How file threads perform I/O.
+typedef enum fs_backend_t
+{
+	// A pool of threads, each doing one blocking read or write at a time.
+	k_fs_backend_threads,
+	// One thread keeping many reads and writes in flight through io_uring,
+	// with batched submission and registered buffers for small reads.
+	// Falls back to threads where io_uring is unavailable.
+	k_fs_backend_io_uring,
+} fs_backend_t;
+
+// Settings for fs_create_ex().
+// Zeroed fields keep the defaults.
+typedef struct fs_options_t
+{
+	// Number of in-flight file operations per stage. Defaults to 64.
+	int queue_capacity;
+	// Threads that open, read and write files. Defaults to 2.
+	// The io_uring backend always uses one.
+	int file_thread_count;
+	// Threads that compress and decompress. Defaults to one per core, up to 8.
+	int compress_thread_count;
+	// Uncompressed bytes per independently compressed block, 64 KB to 256 KB.
+	// Defaults to 128 KB. Only affects writes; reads take it from the file.
+	uint32_t compress_block_size;
+	// I/O backend. Defaults to threads.
+	fs_backend_t backend;
+	// Reads and writes the io_uring backend keeps in flight. Defaults to 64.
+	uint32_t ring_depth;
+	// Bytes of fs_read_shared() data kept once no work holds it, evicting the
+	// least recently used first. Zero keeps nothing beyond what is held.
+	size_t cache_budget;
+	// Shared LZ4 dictionary, e.g. trained on many small similar assets, which
+	// is copied. Only the last 64 KB are used. Files written with it need the
+	// same dictionary to be read, and fail on a file system without it.
+	const void* dictionary;
+	uint32_t dictionary_size;
+	// If set, each checksum check is traced as an "fs verify" duration on the
+	// thread that ran it, which is normally a codec thread.
+	trace_t* trace;
+	// Distinct paths the file system can name, the empty path included. Path
+	// IDs are never freed, so a work on a path past the limit fails with
+	// k_fs_result_no_path. Defaults to 16 million, also the most allowed.
+	uint32_t max_paths;
+} fs_options_t;
 
 // Create a new file system.
 // Provided heap will be used to allocate space for queue and work buffers.
 // Provided queue size defines number of in-flight file operations.
+// Thread counts are the fs_create_ex() defaults.
+// Each file system interns the paths it is given, keeping every distinct one
+// until it is destroyed, up to fs_options_t.max_paths; the table starts at
+// about 165 KB (see fs_path.h).
 fs_t* fs_create(heap_t* heap, int queue_capacity);
 
+// Create a new file system with the given options.
+// Options may be NULL to use every default.
+// With more than one file thread, works on the same path may run in any order;
+// wait for one to finish before queuing another that depends on it.
+fs_t* fs_create_ex(heap_t* heap, const fs_options_t* options);
+
 // Destroy a previously created file system.
 void fs_destroy(fs_t* fs);
 
+// If true, the file system is running on the io_uring backend.
+bool fs_is_io_uring(fs_t* fs);
+
+// Mount a pak archive built with fs_pak_build().
+// From then on fs_read() looks paths up in mounted paks, newest first, before
+// going to disk, and decompresses packed assets whatever its use_compression flag.
+// Block, stream and mapped reads always go to disk.
+// Paks stay mounted until fs_destroy(). Returns false if the pak can't be read.
+bool fs_mount(fs_t* fs, const char* pak_path);
+
 // Queue a file read.
 // File at the specified path will be read in full.
 // Memory for the file will be allocated out of the provided heap.
@@ -27,17 +215,156 @@ void fs_destroy(fs_t* fs);
 // Returns a work object.
 fs_work_t* fs_read(fs_t* fs, const char* path, heap_t* heap, bool null_terminate, bool use_compression);
 
+// Queue a file read with extra options.
+// Options may be NULL, in which case this is the same as fs_read().
+fs_work_t* fs_read_ex(fs_t* fs, const char* path, heap_t* heap, bool null_terminate, bool use_compression, const fs_work_options_t* options);
+
+// Memory a read needs, from fs_get_read_size().
+typedef struct fs_read_size_t
+{
+	// Bytes of file contents, decompressed if need be. One more is needed to
+	// null terminate.
+	size_t size;
+	// Scratch bytes a compressed read needs; zero if it needs none.
+	size_t scratch_size;
+} fs_read_size_t;
+
+// Find how much memory reading a file needs, on the calling thread.
+// Reads the container header of compressed files; pak entries are looked up
+// as fs_read() would. Returns zero on success, as fs_work_get_result().
+int fs_get_read_size(fs_t* fs, const char* path, bool use_compression, fs_read_size_t* size);
+
+// Scratch bytes a compressed write of size bytes needs.
+size_t fs_get_write_scratch_size(fs_t* fs, size_t size);
+
+// Queue a file read into caller-owned memory, e.g. a staging buffer or a
+// frame arena. As fs_read_ex(), but the contents land in buffer, which must
+// hold capacity bytes and stay valid until the work is done. Compressed
+// files are read into the options' scratch memory if given, so with scratch
+// nothing but the work itself comes from the heap. fs_work_get_buffer()
+// returns buffer; nothing needs freeing.
+// Fails with k_fs_result_too_small if the file doesn't fit.
+fs_work_t* fs_read_into(fs_t* fs, const char* path, heap_t* heap, void* buffer, size_t capacity, bool null_terminate, bool use_compression,
+	const fs_work_options_t* options);
+
+// Outcome of one file in an fs_read_many() batch.
+typedef struct fs_read_result_t
+{
+	// As fs_work_get_buffer() after fs_read(): the caller frees it.
+	void* buffer;
+	size_t size;
+	// As fs_work_get_result().
+	int result;
+} fs_read_result_t;
+
+// Queue reads of count files as one work.
+// Each file is read as by fs_read() with the same settings, with results[i]
+// filled in for paths[i]. results must stay valid until the work is done.
+// File threads read the files in on-disk order (pak offset, or roughly the
+// file's position on disk) rather than the order given.
+// The work completes once, when every file is done; its result is the first
+// failing entry's result, or zero, and it has no buffer of its own.
+// Options apply to the whole batch, as does fs_work_cancel().
+fs_work_t* fs_read_many(fs_t* fs, const char* const* paths, int count, heap_t* heap, bool null_terminate, bool use_compression,
+	fs_read_result_t* results, const fs_work_options_t* options);
+
+// Queue a read of shared, read-only file contents.
+// Every shared read of the same unchanged file (same size and modification
+// time, or the same pak entry) gets the same buffer: while it is held or
+// cached, the work is done as soon as a file thread has checked the file's
+// size and modification time, without reading or decompressing it. That
+// check, like the read, never runs on the calling thread.
+// The buffer is null terminated and belongs to the file system: don't free or
+// modify it. It stays valid until the work is destroyed, which must happen
+// before fs_destroy(). Options may be NULL.
+fs_work_t* fs_read_shared(fs_t* fs, const char* path, bool use_compression, const fs_work_options_t* options);
+
+// Bytes of shared read data the file system holds, cached or in use, old
+// versions of changed files that works still hold included.
+size_t fs_get_cache_size(fs_t* fs);
+
+// Where fs_prefetch_manifest() leaves the files it reads.
+typedef enum fs_prefetch_target_t
+{
+	// Read each file and let it go, so the OS has it cached. Cheap in memory.
+	k_fs_prefetch_os_cache,
+	// Read each file as fs_read_shared() would, decompressed, and leave it in
+	// the shared cache. Only as much stays as the cache budget allows.
+	k_fs_prefetch_shared_cache,
+} fs_prefetch_target_t;
+
+// How far a prefetch has got. Sizes are the manifest's expected sizes.
+typedef struct fs_prefetch_progress_t
+{
+	// Files listed, and how many are done, read or not.
+	int file_count;
+	int files_done;
+	// Files that could not be read.
+	int failures;
+	uint64_t byte_count;
+	uint64_t bytes_done;
+} fs_prefetch_progress_t;
+
+// Queue a read of every file a manifest lists, to warm a cache ahead of use,
+// e.g. the assets of the next level while the current one plays.
+// A manifest is a text file with one file per line:
+//   <expected size in bytes> <raw|lz4> <path>
+// where lz4 marks files written compressed. Blank lines and lines starting
+// with '#' are skipped.
+// The manifest is read on a file thread, then its files are read as one
+// fs_read_many() batch, in on-disk order and at low priority whatever the
+// options say. Files already in the shared cache are not read again.
+// The work completes when every file is done, with the first failing file's
+// result, or -1 if the manifest can't be read or parsed. It has no buffer.
+// Options may be NULL.
+fs_work_t* fs_prefetch_manifest(fs_t* fs, const char* manifest_path, fs_prefetch_target_t target, const fs_work_options_t* options);
+
+// How far an fs_prefetch_manifest() work has got. May be called from any
+// thread while it runs; everything is zero until the manifest has been read.
+void fs_work_get_prefetch_progress(fs_work_t* work, fs_prefetch_progress_t* progress);
+
+// Queue a read of a single block of a compressed file.
+// Block i holds uncompressed bytes [i * block_size, (i + 1) * block_size) of the
+// original buffer, where block_size is the size the file was written with.
+// Only the header, the block's table entry and its data are read.
+// Fails if the file was not written compressed or the block does not exist.
+fs_work_t* fs_read_block(fs_t* fs, const char* path, heap_t* heap, uint32_t block_index);
+
+// Queue a streamed file read.
+// The file is handed to function in order, in chunks of at most chunk_size
+// bytes (64 KB if zero), on one of the file threads.
+// Memory use is bounded by the chunk size, or for compressed files by about
+// two container blocks, whatever the file size.
+// The work has no buffer; its size is the number of bytes delivered.
+// Stopping early from the callback is not an error.
+// Compressed streams need files in the block container format.
+fs_work_t* fs_read_stream(fs_t* fs, const char* path, bool use_compression, size_t chunk_size, fs_stream_func_t function, void* user);
+
 // Queue a file write.
 // File at the specified path will be written in full.
+// Compressed files are written as a block container, see fs_container.h.
+// The buffer must stay valid until the work is done.
 // Returns a work object.
 fs_work_t* fs_write(fs_t* fs, const char* path, const void* buffer, size_t size, bool use_compression);
 
+// Queue a file write with extra options.
+// Options may be NULL, in which case this is the same as fs_write().
+fs_work_t* fs_write_ex(fs_t* fs, const char* path, const void* buffer, size_t size, bool use_compression, const fs_work_options_t* options);
+
 // If true, the file work is complete.
 bool fs_work_is_done(fs_work_t* work);
 
 // Block for the file work to complete.
 void fs_work_wait(fs_work_t* work);
 
+// Ask the file work to stop.
+// Queued work is dropped without running; work in progress stops at its next
+// step, e.g. before decompressing or between stream chunks.
+// The work still completes, with k_fs_result_cancelled and, for reads, no
+// buffer, and must be destroyed as usual. Work past its last step may still
+// succeed, so check the result. Returns false if the work was already done.
+bool fs_work_cancel(fs_work_t* work);
+
 // Get the error code for the file work.
 // A value of zero generally indicates success.
 int fs_work_get_result(fs_work_t* work);
@@ -48,5 +375,43 @@ void* fs_work_get_buffer(fs_work_t* work);
 // Get the size associated with the file operation.
 size_t fs_work_get_size(fs_work_t* work);
 
+// Get the user data the work was queued with.
+void* fs_work_get_user_data(fs_work_t* work);
+
 // Free a file work object.
 void fs_work_destroy(fs_work_t* work);
+
+// Map a file into memory read-only.
+// Unlike fs_read() nothing is copied: pages load on first touch and are shared
+// with every other process mapping the same file. Use for large uncompressed
+// assets. Runs on the calling thread; returns NULL if the file can't be mapped.
+fs_map_t* fs_map(fs_t* fs, const char* path);
+
+// Get the mapped bytes. NULL for an empty file.
+// Valid until fs_unmap(). Writing to them faults.
+const void* fs_map_get_data(fs_map_t* map);
+
+// Get the size of the mapped file.
+size_t fs_map_get_size(fs_map_t* map);
+
+// Unmap a file mapped with fs_map().
+void fs_unmap(fs_map_t* map);
+
+// Create a completion channel.
+fs_completion_t* fs_completion_create(heap_t* heap);
+
+// Destroy a completion channel.
+// Work still on the channel is not freed.
+void fs_completion_destroy(fs_completion_t* completion);
+
+// Pop one finished work object, or NULL if none has finished.
+// Only one thread may pop from a channel.
+fs_work_t* fs_completion_pop(fs_completion_t* completion);
+
+// Block until a work object finishes, then pop it.
+// Only one thread may pop from a channel.
+fs_work_t* fs_completion_wait(fs_completion_t* completion);
+
+// Pop up to capacity finished work objects into works without blocking.
+// Returns the number popped. Only one thread may pop from a channel.
+int fs_completion_drain(fs_completion_t* completion, fs_work_t** works, int capacity);
@@ -0,0 +1,607 @@
+#include "fs_bench.h"
+
+#include "debug.h"
+#include "fs.h"
+#include "heap.h"
+#include "thread.h"
+#include "timer.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(_WIN32)
+#define FS_BENCH_BACKEND "win32"
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#define FS_BENCH_BACKEND "posix"
+#include <sys/resource.h>
+#endif
+
+enum
+{
+	k_fs_bench_queue_capacity = 8,
+	k_fs_bench_warmup_reps = 1,
+	k_fs_bench_reps = 9,
+	k_fs_bench_csv_capacity = 16 * 1024,
+	k_fs_bench_small_files = 2000,
+	k_fs_bench_small_file_size = 4 * 1024,
+	k_fs_bench_small_queue_capacity = 256,
+	k_fs_bench_corpus_files = 48,
+	k_fs_bench_corpus_min_size = 4 * 1024,
+	// Corpus sizes run from the minimum up to 4 MB in powers of two.
+	k_fs_bench_corpus_size_steps = 11,
+	k_fs_bench_corpus_max_size = k_fs_bench_corpus_min_size << (k_fs_bench_corpus_size_steps - 1),
+	k_fs_bench_throughput_reps = 3,
+	k_fs_bench_throughput_ops = k_fs_bench_corpus_files * k_fs_bench_throughput_reps,
+};
+
+// How well a corpus file compresses.
+typedef enum fs_bench_kind_t
+{
+	// Text-like, a few times over, like most assets.
+	k_fs_bench_kind_text,
+	// Random bytes, like already-compressed audio and textures.
+	k_fs_bench_kind_random,
+	// Long runs, like padded or mostly empty data.
+	k_fs_bench_kind_sparse,
+	k_fs_bench_kind_count,
+} fs_bench_kind_t;
+
+static const char* k_fs_bench_path = "fs_bench_write.bin";
+static const char* k_fs_bench_read_path = "fs_bench_read.bin";
+
+typedef struct fs_bench_result_t
+{
+	// Time the call held the caller.
+	double caller_us[k_fs_bench_reps];
+	// Time until the work was done and its data usable.
+	double total_us[k_fs_bench_reps];
+	bool ok;
+} fs_bench_result_t;
+
+static int fs_bench_compare_double(const void* a, const void* b)
+{
+	double x = *(const double*)a;
+	double y = *(const double*)b;
+	return (x > y) - (x < y);
+}
+
+// Nearest-rank percentile of a sorted array.
+static double fs_bench_percentile(const double* sorted, int count, int percentile)
+{
+	int rank = (percentile * count + 99) / 100;
+	rank = rank < 1 ? 1 : rank;
+	return sorted[rank - 1];
+}
+
+// Fill with text-like data that LZ4 compresses a few times over, like most assets.
+static void fs_bench_fill(char* buffer, size_t size)
+{
+	uint32_t state = 0x2545f491;
+	for (size_t i = 0; i < size; ++i)
+	{
+		state = state * 1664525 + 1013904223;
+		buffer[i] = (state >> 28) < 3 ? (char)('a' + (state >> 8) % 26) : (char)('a' + i % 16);
+	}
+}
+
+static double fs_bench_ticks_to_us(uint64_t ticks)
+{
+	return (double)ticks * 1000000.0 / (double)timer_get_ticks_per_second();
+}
+
+static void fs_bench_write_latency(fs_t* fs, const void* buffer, size_t size, bool use_compression, fs_bench_result_t* result)
+{
+	result->ok = true;
+	for (int i = -k_fs_bench_warmup_reps; i < k_fs_bench_reps; ++i)
+	{
+		uint64_t t0 = timer_get_ticks();
+		fs_work_t* work = fs_write(fs, k_fs_bench_path, buffer, size, use_compression);
+		uint64_t t1 = timer_get_ticks();
+		result->ok &= fs_work_get_result(work) == 0;
+		uint64_t t2 = timer_get_ticks();
+		fs_work_destroy(work);
+
+		if (i >= 0)
+		{
+			result->caller_us[i] = fs_bench_ticks_to_us(t1 - t0);
+			result->total_us[i] = fs_bench_ticks_to_us(t2 - t0);
+		}
+	}
+	qsort(result->caller_us, k_fs_bench_reps, sizeof(double), fs_bench_compare_double);
+	qsort(result->total_us, k_fs_bench_reps, sizeof(double), fs_bench_compare_double);
+}
+
+// Sums one byte per page so every page of the view is faulted in.
+static uint32_t fs_bench_touch(const void* data, size_t size)
+{
+	uint32_t sum = 0;
+	for (size_t i = 0; i < size; i += 4096)
+	{
+		sum += ((const unsigned char*)data)[i];
+	}
+	return sum;
+}
+
+// Time until size bytes are readable: fs_read() copying into the heap, or fs_map()
+// with every page touched. The file is warm in the page cache for both.
+static void fs_bench_read_latency(fs_t* fs, heap_t* heap, size_t size, bool use_map, fs_bench_result_t* result)
+{
+	result->ok = true;
+	volatile uint32_t sink = 0;
+	for (int i = -k_fs_bench_warmup_reps; i < k_fs_bench_reps; ++i)
+	{
+		uint64_t t0 = timer_get_ticks();
+		uint64_t t1;
+		if (use_map)
+		{
+			fs_map_t* map = fs_map(fs, k_fs_bench_read_path);
+			t1 = timer_get_ticks();
+			result->ok &= map && fs_map_get_size(map) == size;
+			sink += fs_bench_touch(fs_map_get_data(map), fs_map_get_size(map));
+			fs_unmap(map);
+		}
+		else
+		{
+			fs_work_t* work = fs_read(fs, k_fs_bench_read_path, heap, false, false);
+			t1 = timer_get_ticks();
+			result->ok &= fs_work_get_result(work) == 0 && fs_work_get_size(work) == size;
+			sink += fs_bench_touch(fs_work_get_buffer(work), fs_work_get_size(work));
+			heap_free(heap, fs_work_get_buffer(work));
+			fs_work_destroy(work);
+		}
+		uint64_t t2 = timer_get_ticks();
+
+		if (i >= 0)
+		{
+			result->caller_us[i] = fs_bench_ticks_to_us(t1 - t0);
+			result->total_us[i] = fs_bench_ticks_to_us(t2 - t0);
+		}
+	}
+	qsort(result->caller_us, k_fs_bench_reps, sizeof(double), fs_bench_compare_double);
+	qsort(result->total_us, k_fs_bench_reps, sizeof(double), fs_bench_compare_double);
+}
+
+static void fs_bench_small_path(char* path, size_t size, int index)
+{
+	snprintf(path, size, "fs_bench_small_%d.bin", index);
+}
+
+// Queue reads of every small file at once and wait for them all, either as
+// one fs_read() each or as a single fs_read_many() batch.
+// Caller time covers queuing; total time runs until the last read is done.
+static void fs_bench_small_files(heap_t* heap, fs_backend_t backend, bool batch, fs_bench_result_t* result, bool* io_uring)
+{
+	fs_options_t options = { .queue_capacity = k_fs_bench_small_queue_capacity, .backend = backend };
+	fs_t* fs = fs_create_ex(heap, &options);
+	*io_uring = fs_is_io_uring(fs);
+	fs_work_t** work = heap_alloc(heap, sizeof(fs_work_t*) * k_fs_bench_small_files, 8);
+	fs_read_result_t* results = heap_alloc(heap, sizeof(fs_read_result_t) * k_fs_bench_small_files, 8);
+	char (*paths)[32] = heap_alloc(heap, sizeof(*paths) * k_fs_bench_small_files, 8);
+	const char** path_list = heap_alloc(heap, sizeof(const char*) * k_fs_bench_small_files, 8);
+	for (int f = 0; f < k_fs_bench_small_files; ++f)
+	{
+		fs_bench_small_path(paths[f], sizeof(paths[f]), f);
+		path_list[f] = paths[f];
+	}
+
+	result->ok = true;
+	for (int i = -k_fs_bench_warmup_reps; i < k_fs_bench_reps; ++i)
+	{
+		uint64_t t0 = timer_get_ticks();
+		if (batch)
+		{
+			work[0] = fs_read_many(fs, path_list, k_fs_bench_small_files, heap, false, false, results, NULL);
+		}
+		else
+		{
+			for (int f = 0; f < k_fs_bench_small_files; ++f)
+			{
+				work[f] = fs_read(fs, path_list[f], heap, false, false);
+			}
+		}
+		uint64_t t1 = timer_get_ticks();
+		for (int f = 0; f < (batch ? 1 : k_fs_bench_small_files); ++f)
+		{
+			fs_work_wait(work[f]);
+		}
+		uint64_t t2 = timer_get_ticks();
+
+		if (batch)
+		{
+			result->ok &= fs_work_get_result(work[0]) == 0;
+			fs_work_destroy(work[0]);
+		}
+		for (int f = 0; f < k_fs_bench_small_files; ++f)
+		{
+			if (batch)
+			{
+				result->ok &= results[f].result == 0 && results[f].size == k_fs_bench_small_file_size;
+				heap_free(heap, results[f].buffer);
+			}
+			else
+			{
+				result->ok &= fs_work_get_result(work[f]) == 0 && fs_work_get_size(work[f]) == k_fs_bench_small_file_size;
+				heap_free(heap, fs_work_get_buffer(work[f]));
+				fs_work_destroy(work[f]);
+			}
+		}
+		if (i >= 0)
+		{
+			result->caller_us[i] = fs_bench_ticks_to_us(t1 - t0);
+			result->total_us[i] = fs_bench_ticks_to_us(t2 - t0);
+		}
+	}
+	qsort(result->caller_us, k_fs_bench_reps, sizeof(double), fs_bench_compare_double);
+	qsort(result->total_us, k_fs_bench_reps, sizeof(double), fs_bench_compare_double);
+
+	heap_free(heap, path_list);
+	heap_free(heap, paths);
+	heap_free(heap, results);
+	heap_free(heap, work);
+	fs_destroy(fs);
+}
+
+// Print a result and append it to the CSV.
+static void fs_bench_report(const char* name, size_t size, bool compressed, const fs_bench_result_t* result, char* csv, size_t* csv_size)
+{
+	double caller_p50 = fs_bench_percentile(result->caller_us, k_fs_bench_reps, 50);
+	double caller_p99 = fs_bench_percentile(result->caller_us, k_fs_bench_reps, 99);
+	double total_p50 = fs_bench_percentile(result->total_us, k_fs_bench_reps, 50);
+	double total_p99 = fs_bench_percentile(result->total_us, k_fs_bench_reps, 99);
+
+	debug_print(k_print_info, "%-20s %10zu %10s %14.1f %14.1f %14.1f\n",
+		name, size, compressed ? "yes" : "no", caller_p50, caller_p99, total_p50);
+
+	if (*csv_size < k_fs_bench_csv_capacity)
+	{
+		*csv_size += (size_t)snprintf(csv + *csv_size, k_fs_bench_csv_capacity - *csv_size,
+			"%s,%s,%zu,%d,%d,%.2f,%.2f,%.2f,%.2f,%.2f,%.2f\n",
+			FS_BENCH_BACKEND, name, size, compressed ? 1 : 0, k_fs_bench_reps,
+			result->caller_us[0], caller_p50, caller_p99, result->caller_us[k_fs_bench_reps - 1],
+			total_p50, total_p99);
+	}
+}
+
+// Process CPU time, user and kernel, across all threads.
+static double fs_bench_cpu_us()
+{
+#if defined(_WIN32)
+	FILETIME creation, exit, kernel, user;
+	GetProcessTimes(GetCurrentProcess(), &creation, &exit, &kernel, &user);
+	uint64_t kernel_100ns = ((uint64_t)kernel.dwHighDateTime << 32) | kernel.dwLowDateTime;
+	uint64_t user_100ns = ((uint64_t)user.dwHighDateTime << 32) | user.dwLowDateTime;
+	return (double)(kernel_100ns + user_100ns) / 10.0;
+#else
+	struct rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+	return (double)(usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1000000.0 + (double)(usage.ru_utime.tv_usec + usage.ru_stime.tv_usec);
+#endif
+}
+
+// Files of every size step and every kind, mixed so neither follows the
+// other. Contents are slices of one source buffer per kind.
+typedef struct fs_bench_corpus_t
+{
+	char* sources[k_fs_bench_kind_count];
+	size_t sizes[k_fs_bench_corpus_files];
+	size_t total;
+} fs_bench_corpus_t;
+
+static void fs_bench_corpus_create(heap_t* heap, fs_bench_corpus_t* corpus)
+{
+	for (int k = 0; k < k_fs_bench_kind_count; ++k)
+	{
+		corpus->sources[k] = heap_alloc(heap, k_fs_bench_corpus_max_size, 8);
+	}
+	fs_bench_fill(corpus->sources[k_fs_bench_kind_text], k_fs_bench_corpus_max_size);
+	uint32_t state = 0x9e3779b9;
+	for (size_t i = 0; i < k_fs_bench_corpus_max_size; ++i)
+	{
+		state = state * 1664525 + 1013904223;
+		corpus->sources[k_fs_bench_kind_random][i] = (char)(state >> 24);
+		corpus->sources[k_fs_bench_kind_sparse][i] = (i % 4096) < 64 ? (char)(state >> 24) : 0;
+	}
+
+	corpus->total = 0;
+	for (int i = 0; i < k_fs_bench_corpus_files; ++i)
+	{
+		corpus->sizes[i] = (size_t)k_fs_bench_corpus_min_size << ((i * 7) % k_fs_bench_corpus_size_steps);
+		corpus->total += corpus->sizes[i];
+	}
+}
+
+static void fs_bench_corpus_destroy(heap_t* heap, fs_bench_corpus_t* corpus)
+{
+	for (int k = 0; k < k_fs_bench_kind_count; ++k)
+	{
+		heap_free(heap, corpus->sources[k]);
+	}
+	for (int i = 0; i < k_fs_bench_corpus_files; ++i)
+	{
+		char path[64];
+		snprintf(path, sizeof(path), "fs_bench_corpus_%d.bin", i);
+		remove(path);
+	}
+}
+
+// Collects completions on its own thread, so each op's latency runs from
+// being queued to being done rather than to whenever the queuing thread
+// next looks.
+typedef struct fs_bench_drain_t
+{
+	fs_completion_t* completion;
+	heap_t* heap;
+	const size_t* sizes;
+	const uint64_t* queued;
+	double* latency_us;
+	uint64_t last_done;
+	bool ok;
+} fs_bench_drain_t;
+
+static int fs_bench_drain_func(void* user)
+{
+	fs_bench_drain_t* drain = user;
+	for (int i = 0; i < k_fs_bench_corpus_files; ++i)
+	{
+		fs_work_t* work = fs_completion_wait(drain->completion);
+		drain->last_done = timer_get_ticks();
+		int index = (int)(intptr_t)fs_work_get_user_data(work);
+		drain->latency_us[index] = fs_bench_ticks_to_us(drain->last_done - drain->queued[index]);
+		drain->ok &= fs_work_get_result(work) == 0;
+		if (drain->heap)
+		{
+			drain->ok &= fs_work_get_size(work) == drain->sizes[index];
+			heap_free(drain->heap, fs_work_get_buffer(work));
+		}
+		fs_work_destroy(work);
+	}
+	return 0;
+}
+
+// Throughput of one case: the median over its passes, every op's latency,
+// and the CPU the process spent per pass.
+typedef struct fs_bench_throughput_t
+{
+	double mb_per_s[k_fs_bench_throughput_reps];
+	double latency_us[k_fs_bench_throughput_ops];
+	double cpu_us;
+	double wall_us;
+	bool ok;
+} fs_bench_throughput_t;
+
+// Write or read the whole corpus with every op queued at once.
+// A negative rep is a warmup and records nothing.
+static void fs_bench_throughput_pass(fs_t* fs, heap_t* heap, fs_bench_corpus_t* corpus, bool write, bool compressed, int rep,
+	fs_bench_throughput_t* result)
+{
+	double latency_us[k_fs_bench_corpus_files];
+	uint64_t queued[k_fs_bench_corpus_files];
+	fs_bench_drain_t drain =
+	{
+		.completion = fs_completion_create(heap),
+		.heap = write ? NULL : heap,
+		.sizes = corpus->sizes,
+		.queued = queued,
+		.latency_us = latency_us,
+		.ok = true,
+	};
+	thread_t* thread = thread_create(fs_bench_drain_func, &drain);
+
+	double cpu_start = fs_bench_cpu_us();
+	uint64_t start = timer_get_ticks();
+	for (int i = 0; i < k_fs_bench_corpus_files; ++i)
+	{
+		char path[64];
+		snprintf(path, sizeof(path), "fs_bench_corpus_%d.bin", i);
+		fs_work_options_t options = { .completion = drain.completion, .user_data = (void*)(intptr_t)i };
+		queued[i] = timer_get_ticks();
+		if (write)
+		{
+			fs_write_ex(fs, path, corpus->sources[i % k_fs_bench_kind_count], corpus->sizes[i], compressed, &options);
+		}
+		else
+		{
+			fs_read_ex(fs, path, heap, false, compressed, &options);
+		}
+	}
+	thread_destroy(thread);
+	double cpu_us = fs_bench_cpu_us() - cpu_start;
+	double wall_us = fs_bench_ticks_to_us(drain.last_done - start);
+	fs_completion_destroy(drain.completion);
+
+	result->ok &= drain.ok;
+	if (rep >= 0)
+	{
+		result->mb_per_s[rep] = (double)corpus->total / wall_us;
+		memcpy(result->latency_us + rep * k_fs_bench_corpus_files, latency_us, sizeof(latency_us));
+		result->cpu_us += cpu_us / k_fs_bench_throughput_reps;
+		result->wall_us += wall_us / k_fs_bench_throughput_reps;
+	}
+}
+
+static void fs_bench_throughput_report(const char* backend, const char* op, int queue_capacity, bool compressed, fs_bench_throughput_t* result,
+	fs_bench_corpus_t* corpus, char* csv, size_t* csv_size)
+{
+	qsort(result->mb_per_s, k_fs_bench_throughput_reps, sizeof(double), fs_bench_compare_double);
+	qsort(result->latency_us, k_fs_bench_throughput_ops, sizeof(double), fs_bench_compare_double);
+	double mb_per_s = fs_bench_percentile(result->mb_per_s, k_fs_bench_throughput_reps, 50);
+	double p50 = fs_bench_percentile(result->latency_us, k_fs_bench_throughput_ops, 50);
+	double p90 = fs_bench_percentile(result->latency_us, k_fs_bench_throughput_ops, 90);
+	double p99 = fs_bench_percentile(result->latency_us, k_fs_bench_throughput_ops, 99);
+	double max = result->latency_us[k_fs_bench_throughput_ops - 1];
+	// CPU busy per unit of wall time: over 100% means more than one core.
+	double cpu_percent = result->cpu_us * 100.0 / result->wall_us;
+
+	debug_print(k_print_info, "%-8s %-5s %5d %10s %10.1f %12.1f %12.1f %12.1f %8.0f%%\n",
+		backend, op, queue_capacity, compressed ? "yes" : "no", mb_per_s, p50, p99, max, cpu_percent);
+
+	if (*csv_size < k_fs_bench_csv_capacity)
+	{
+		*csv_size += (size_t)snprintf(csv + *csv_size, k_fs_bench_csv_capacity - *csv_size,
+			"%s,%s,%s,%d,%d,%d,%zu,%.1f,%.2f,%.2f,%.2f,%.2f,%.0f,%.1f\n",
+			FS_BENCH_BACKEND, backend, op, queue_capacity, compressed ? 1 : 0, k_fs_bench_corpus_files, corpus->total,
+			mb_per_s, p50, p90, p99, max, result->cpu_us, cpu_percent);
+	}
+}
+
+// Writes and reads a corpus of varied files on each backend, queue capacity
+// and compression setting, and writes one CSV row per case.
+static bool fs_bench_throughput(heap_t* heap, const char* csv_path)
+{
+	static const int k_queue_capacities[] = { 2, 8, 64 };
+
+	fs_bench_corpus_t corpus;
+	fs_bench_corpus_create(heap, &corpus);
+
+	char* csv = heap_alloc(heap, k_fs_bench_csv_capacity, 8);
+	size_t csv_size = (size_t)snprintf(csv, k_fs_bench_csv_capacity,
+		"platform,backend,op,queue_capacity,compressed,files,bytes,mb_per_s,op_p50_us,op_p90_us,op_p99_us,op_max_us,cpu_us,cpu_percent\n");
+
+	debug_print(k_print_info, "\n%zu bytes in %d files\n", corpus.total, k_fs_bench_corpus_files);
+	debug_print(k_print_info, "%-8s %-5s %5s %10s %10s %12s %12s %12s %9s\n",
+		"backend", "op", "queue", "compressed", "MB/s", "op p50 us", "op p99 us", "op max us", "cpu");
+	bool ok = true;
+	for (int backend = k_fs_backend_threads; backend <= k_fs_backend_io_uring; ++backend)
+	{
+		for (int q = 0; q < (int)(sizeof(k_queue_capacities) / sizeof(k_queue_capacities[0])); ++q)
+		{
+			fs_t* fs = fs_create_ex(heap, &(fs_options_t) { .queue_capacity = k_queue_capacities[q], .backend = backend });
+			if (backend == k_fs_backend_io_uring && !fs_is_io_uring(fs))
+			{
+				debug_print(k_print_info, "io_uring unavailable\n");
+				fs_destroy(fs);
+				break;
+			}
+			const char* backend_name = backend == k_fs_backend_io_uring ? "io_uring" : "threads";
+			for (int compressed = 0; compressed < 2; ++compressed)
+			{
+				for (int write = 1; write >= 0; --write)
+				{
+					fs_bench_throughput_t result = { .ok = true };
+					for (int rep = -k_fs_bench_warmup_reps; rep < k_fs_bench_throughput_reps; ++rep)
+					{
+						fs_bench_throughput_pass(fs, heap, &corpus, write != 0, compressed != 0, rep, &result);
+					}
+					ok &= result.ok;
+					fs_bench_throughput_report(backend_name, write ? "write" : "read", k_queue_capacities[q], compressed != 0, &result,
+						&corpus, csv, &csv_size);
+				}
+			}
+			fs_destroy(fs);
+		}
+	}
+
+	if (csv_path)
+	{
+		fs_t* fs = fs_create(heap, k_fs_bench_queue_capacity);
+		fs_work_t* work = fs_write(fs, csv_path, csv, csv_size < k_fs_bench_csv_capacity ? csv_size : k_fs_bench_csv_capacity - 1, false);
+		ok &= fs_work_get_result(work) == 0;
+		fs_work_destroy(work);
+		fs_destroy(fs);
+	}
+	heap_free(heap, csv);
+	fs_bench_corpus_destroy(heap, &corpus);
+	return ok;
+}
+
+bool fs_bench_run(heap_t* heap, const char* csv_path)
+{
+	static const size_t k_sizes[] = { 1024 * 1024, 4 * 1024 * 1024, 16 * 1024 * 1024 };
+	const size_t max_size = k_sizes[sizeof(k_sizes) / sizeof(k_sizes[0]) - 1];
+
+	char* buffer = heap_alloc(heap, max_size, 8);
+	fs_bench_fill(buffer, max_size);
+
+	char* csv = heap_alloc(heap, k_fs_bench_csv_capacity, 8);
+	size_t csv_size = (size_t)snprintf(csv, k_fs_bench_csv_capacity,
+		"backend,benchmark,bytes,compressed,reps,caller_min_us,caller_p50_us,caller_p99_us,caller_max_us,total_p50_us,total_p99_us\n");
+
+	fs_t* fs = fs_create(heap, k_fs_bench_queue_capacity);
+	bool ok = true;
+
+	debug_print(k_print_info, "%-20s %10s %10s %14s %14s %14s\n", "benchmark", "bytes", "compressed", "caller p50 us", "caller p99 us", "total p50 us");
+	for (size_t s = 0; s < sizeof(k_sizes) / sizeof(k_sizes[0]); ++s)
+	{
+		for (int compressed = 1; compressed >= 0; --compressed)
+		{
+			fs_bench_result_t result;
+			fs_bench_write_latency(fs, buffer, k_sizes[s], compressed != 0, &result);
+			ok &= result.ok;
+			fs_bench_report("write_latency", k_sizes[s], compressed != 0, &result, csv, &csv_size);
+		}
+	}
+	remove(k_fs_bench_path);
+
+	for (size_t s = 0; s < sizeof(k_sizes) / sizeof(k_sizes[0]); ++s)
+	{
+		fs_work_destroy(fs_write(fs, k_fs_bench_read_path, buffer, k_sizes[s], false));
+		for (int use_map = 0; use_map < 2; ++use_map)
+		{
+			fs_bench_result_t result;
+			fs_bench_read_latency(fs, heap, k_sizes[s], use_map != 0, &result);
+			ok &= result.ok;
+			fs_bench_report(use_map ? "map_latency" : "read_latency", k_sizes[s], false, &result, csv, &csv_size);
+		}
+	}
+	remove(k_fs_bench_read_path);
+
+	for (int f = 0; f < k_fs_bench_small_files; ++f)
+	{
+		char path[64];
+		fs_bench_small_path(path, sizeof(path), f);
+		fs_work_destroy(fs_write(fs, path, buffer + f, k_fs_bench_small_file_size, false));
+	}
+	for (int backend = k_fs_backend_threads; backend <= k_fs_backend_io_uring; ++backend)
+	{
+		for (int batch = 0; batch < 2; ++batch)
+		{
+			static const char* k_names[2][2] =
+			{
+				{ "small_files_threads", "small_files_io_uring" },
+				{ "small_batch_threads", "small_batch_io_uring" },
+			};
+			fs_bench_result_t result;
+			bool io_uring = false;
+			fs_bench_small_files(heap, backend, batch != 0, &result, &io_uring);
+			ok &= result.ok;
+			if (backend == k_fs_backend_io_uring && !io_uring)
+			{
+				debug_print(k_print_info, "%-20s unavailable\n", k_names[batch][1]);
+				continue;
+			}
+			fs_bench_report(k_names[batch][io_uring], (size_t)k_fs_bench_small_files * k_fs_bench_small_file_size, false,
+				&result, csv, &csv_size);
+		}
+	}
+	for (int f = 0; f < k_fs_bench_small_files; ++f)
+	{
+		char path[64];
+		fs_bench_small_path(path, sizeof(path), f);
+		remove(path);
+	}
+
+	if (csv_path)
+	{
+		fs_work_t* work = fs_write(fs, csv_path, csv, csv_size < k_fs_bench_csv_capacity ? csv_size : k_fs_bench_csv_capacity - 1, false);
+		ok &= fs_work_get_result(work) == 0;
+		fs_work_destroy(work);
+	}
+	fs_destroy(fs);
+	heap_free(heap, csv);
+	heap_free(heap, buffer);
+
+	// Throughput rows have their own columns, so their own file beside the first.
+	char throughput_path[1024];
+	if (csv_path)
+	{
+		const char* extension = strrchr(csv_path, '.');
+		int stem = extension ? (int)(extension - csv_path) : (int)strlen(csv_path);
+		snprintf(throughput_path, sizeof(throughput_path), "%.*s_throughput%s", stem, csv_path, extension ? extension : "");
+	}
+	ok &= fs_bench_throughput(heap, csv_path ? throughput_path : NULL);
+	return ok;
+}
@@ -0,0 +1,26 @@
+#pragma once
+
+#include <stdbool.h>
+
+// File system benchmarks.
+//
+// Caller latency: how long fs_write() holds the calling thread for large
+// compressed and uncompressed writes, next to the time until the work is done.
+// Read latency: fs_read() copying a file into the heap against fs_map().
+// Small files: loading thousands of 4 KB files on the thread backend against io_uring,
+// with one fs_read() per file against a single fs_read_many() batch.
+// Throughput: writing then reading a corpus of files from 4 KB to 4 MB, some
+// text-like, some random and some sparse, with every op queued at once.
+// Runs on each backend, queue capacity and compression setting, reporting
+// MB/s, per-op latency percentiles and the process's CPU time.
+// Each case runs warmup passes, then timed repetitions, and reports
+// min/p50/p99/max over the repetitions.
+
+typedef struct heap_t heap_t;
+
+// Run every benchmark case and print a summary table.
+// If csv_path is not NULL, results are also written there as CSV, one row per case.
+// Throughput cases go to a second CSV named after the first, e.g.
+// fs_bench_throughput.csv beside fs_bench.csv.
+// Returns false if a write failed or the CSV could not be written.
+bool fs_bench_run(heap_t* heap, const char* csv_path);
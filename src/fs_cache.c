@@ -0,0 +1,259 @@
+#include "fs_cache.h"
+
+#include "fast_mutex.h"
+#include "heap.h"
+
+#include <string.h>
+
+enum
+{
+	k_fs_cache_bucket_count = 256,
+};
+
+typedef struct fs_cache_entry_t
+{
+	// Chains the entries of one hash bucket.
+	struct fs_cache_entry_t* next_in_bucket;
+	// Unreferenced entries only, most recently used at the head.
+	struct fs_cache_entry_t* lru_prev;
+	struct fs_cache_entry_t* lru_next;
+	fs_path_id_t path;
+	fs_cache_key_t key;
+	void* data;
+	size_t size;
+	int refs;
+	// Replaced by a newer version while referenced: out of the table, freed
+	// on the last release.
+	bool detached;
+} fs_cache_entry_t;
+
+typedef struct fs_cache_t
+{
+	heap_t* heap;
+	fast_mutex_t* lock;
+	fs_cache_entry_t* buckets[k_fs_cache_bucket_count];
+	fs_cache_entry_t* lru_head;
+	fs_cache_entry_t* lru_tail;
+	size_t budget;
+	// Bytes of entries in the table. Only these count against the budget.
+	size_t size;
+	// Bytes of detached entries, still held by readers.
+	size_t detached_size;
+} fs_cache_t;
+
+fs_cache_t* fs_cache_create(heap_t* heap, size_t budget)
+{
+	fs_cache_t* cache = heap_alloc(heap, sizeof(fs_cache_t), 8);
+	memset(cache, 0, sizeof(*cache));
+	cache->heap = heap;
+	cache->lock = fast_mutex_create(heap);
+	cache->budget = budget;
+	return cache;
+}
+
+static void fs_cache_free_entry(fs_cache_t* cache, fs_cache_entry_t* entry)
+{
+	heap_free(cache->heap, entry->data);
+	heap_free(cache->heap, entry);
+}
+
+void fs_cache_destroy(fs_cache_t* cache)
+{
+	for (int i = 0; i < k_fs_cache_bucket_count; ++i)
+	{
+		fs_cache_entry_t* entry = cache->buckets[i];
+		while (entry)
+		{
+			fs_cache_entry_t* next = entry->next_in_bucket;
+			fs_cache_free_entry(cache, entry);
+			entry = next;
+		}
+	}
+	fast_mutex_destroy(cache->lock);
+	heap_free(cache->heap, cache);
+}
+
+heap_t* fs_cache_get_heap(fs_cache_t* cache)
+{
+	return cache->heap;
+}
+
+static void fs_cache_lru_unlink(fs_cache_t* cache, fs_cache_entry_t* entry)
+{
+	if (entry->lru_prev)
+	{
+		entry->lru_prev->lru_next = entry->lru_next;
+	}
+	else
+	{
+		cache->lru_head = entry->lru_next;
+	}
+	if (entry->lru_next)
+	{
+		entry->lru_next->lru_prev = entry->lru_prev;
+	}
+	else
+	{
+		cache->lru_tail = entry->lru_prev;
+	}
+	entry->lru_prev = NULL;
+	entry->lru_next = NULL;
+}
+
+static void fs_cache_lru_push(fs_cache_t* cache, fs_cache_entry_t* entry)
+{
+	entry->lru_prev = NULL;
+	entry->lru_next = cache->lru_head;
+	if (cache->lru_head)
+	{
+		cache->lru_head->lru_prev = entry;
+	}
+	else
+	{
+		cache->lru_tail = entry;
+	}
+	cache->lru_head = entry;
+}
+
+// Takes the entry out of the table. It is freed now if unreferenced, or
+// on its last release otherwise.
+static void fs_cache_remove(fs_cache_t* cache, fs_cache_entry_t* entry)
+{
+	fs_cache_entry_t** link = &cache->buckets[entry->path % k_fs_cache_bucket_count];
+	while (*link != entry)
+	{
+		link = &(*link)->next_in_bucket;
+	}
+	*link = entry->next_in_bucket;
+	cache->size -= entry->size;
+
+	if (entry->refs == 0)
+	{
+		fs_cache_lru_unlink(cache, entry);
+		fs_cache_free_entry(cache, entry);
+	}
+	else
+	{
+		entry->detached = true;
+		cache->detached_size += entry->size;
+	}
+}
+
+// Evict unreferenced entries, least recently used first, until within budget.
+static void fs_cache_trim(fs_cache_t* cache)
+{
+	while (cache->size > cache->budget && cache->lru_tail)
+	{
+		fs_cache_remove(cache, cache->lru_tail);
+	}
+}
+
+// IDs are handed out in order, so consecutive ones spread across buckets.
+static fs_cache_entry_t* fs_cache_find(fs_cache_t* cache, fs_path_id_t path)
+{
+	fs_cache_entry_t* entry = cache->buckets[path % k_fs_cache_bucket_count];
+	while (entry && entry->path != path)
+	{
+		entry = entry->next_in_bucket;
+	}
+	return entry;
+}
+
+static bool fs_cache_key_equal(const fs_cache_key_t* a, const fs_cache_key_t* b)
+{
+	return a->version == b->version && a->file_size == b->file_size && a->decompressed == b->decompressed;
+}
+
+static void fs_cache_add_ref(fs_cache_t* cache, fs_cache_entry_t* entry)
+{
+	if (entry->refs++ == 0)
+	{
+		fs_cache_lru_unlink(cache, entry);
+	}
+}
+
+fs_cache_entry_t* fs_cache_acquire(fs_cache_t* cache, fs_path_id_t path, const fs_cache_key_t* key)
+{
+	fast_mutex_lock(cache->lock);
+	fs_cache_entry_t* entry = fs_cache_find(cache, path);
+	if (entry && !fs_cache_key_equal(&entry->key, key))
+	{
+		entry = NULL;
+	}
+	if (entry)
+	{
+		fs_cache_add_ref(cache, entry);
+	}
+	fast_mutex_unlock(cache->lock);
+	return entry;
+}
+
+fs_cache_entry_t* fs_cache_insert(fs_cache_t* cache, fs_path_id_t path, const fs_cache_key_t* key, void* data, size_t size)
+{
+	fast_mutex_lock(cache->lock);
+	fs_cache_entry_t* entry = fs_cache_find(cache, path);
+	if (entry && fs_cache_key_equal(&entry->key, key))
+	{
+		fs_cache_add_ref(cache, entry);
+		fast_mutex_unlock(cache->lock);
+		heap_free(cache->heap, data);
+		return entry;
+	}
+	if (entry)
+	{
+		fs_cache_remove(cache, entry);
+	}
+
+	entry = heap_alloc(cache->heap, sizeof(fs_cache_entry_t), 8);
+	memset(entry, 0, sizeof(*entry));
+	entry->path = path;
+	entry->key = *key;
+	entry->data = data;
+	entry->size = size;
+	entry->refs = 1;
+
+	fs_cache_entry_t** bucket = &cache->buckets[path % k_fs_cache_bucket_count];
+	entry->next_in_bucket = *bucket;
+	*bucket = entry;
+	cache->size += size;
+	fs_cache_trim(cache);
+	fast_mutex_unlock(cache->lock);
+	return entry;
+}
+
+void fs_cache_release(fs_cache_t* cache, fs_cache_entry_t* entry)
+{
+	fast_mutex_lock(cache->lock);
+	if (--entry->refs == 0)
+	{
+		if (entry->detached)
+		{
+			cache->detached_size -= entry->size;
+			fs_cache_free_entry(cache, entry);
+		}
+		else
+		{
+			fs_cache_lru_push(cache, entry);
+			fs_cache_trim(cache);
+		}
+	}
+	fast_mutex_unlock(cache->lock);
+}
+
+const void* fs_cache_entry_get_data(const fs_cache_entry_t* entry)
+{
+	return entry->data;
+}
+
+size_t fs_cache_entry_get_size(const fs_cache_entry_t* entry)
+{
+	return entry->size;
+}
+
+size_t fs_cache_get_size(fs_cache_t* cache)
+{
+	fast_mutex_lock(cache->lock);
+	size_t size = cache->size + cache->detached_size;
+	fast_mutex_unlock(cache->lock);
+	return size;
+}
@@ -0,0 +1,71 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "fs_path.h"
+
+// Cache of file contents, shared read-only between readers.
+//
+// Entries are keyed by interned path ID (see fs_path.h) plus a version (the
+// file's modification time and size), so a file that changes on disk simply
+// misses. IDs must all come from one path table. Each entry is
+// reference counted; unreferenced entries sit on an LRU list and are evicted
+// oldest first whenever the cache holds more bytes than its budget.
+// Referenced entries are never freed, so the budget can be exceeded while
+// readers hold data. All functions are thread-safe.
+//
+// fs_read_shared() is the usual way in; see fs.h.
+
+// Handle to a cache.
+typedef struct fs_cache_t fs_cache_t;
+
+// Handle to one cached buffer.
+typedef struct fs_cache_entry_t fs_cache_entry_t;
+
+typedef struct heap_t heap_t;
+
+// Identifies one version of a file's contents.
+typedef struct fs_cache_key_t
+{
+	// Modification time, or anything else that changes when the contents do.
+	uint64_t version;
+	// Size of the file as stored.
+	uint64_t file_size;
+	// Whether the data was decompressed on the way in.
+	bool decompressed;
+} fs_cache_key_t;
+
+// Create a cache that keeps at most budget bytes of unreferenced data.
+// Zero keeps nothing once the last reference is released.
+fs_cache_t* fs_cache_create(heap_t* heap, size_t budget);
+
+// Destroy a cache. Every entry must have been released.
+void fs_cache_destroy(fs_cache_t* cache);
+
+// Heap entry data must be allocated from.
+heap_t* fs_cache_get_heap(fs_cache_t* cache);
+
+// Find the entry for this path and key and take a reference to it.
+// Returns NULL on a miss.
+fs_cache_entry_t* fs_cache_acquire(fs_cache_t* cache, fs_path_id_t path, const fs_cache_key_t* key);
+
+// Add data, allocated from the cache's heap, and take a reference to it.
+// The cache owns data from then on. If another reader inserted the same path
+// and key first, data is freed and that entry is returned instead.
+// Any other version of the path is dropped.
+fs_cache_entry_t* fs_cache_insert(fs_cache_t* cache, fs_path_id_t path, const fs_cache_key_t* key, void* data, size_t size);
+
+// Release a reference taken by fs_cache_acquire() or fs_cache_insert().
+void fs_cache_release(fs_cache_t* cache, fs_cache_entry_t* entry);
+
+// The entry's data. Read-only; valid until the reference is released.
+const void* fs_cache_entry_get_data(const fs_cache_entry_t* entry);
+
+// Size of the entry's data in bytes.
+size_t fs_cache_entry_get_size(const fs_cache_entry_t* entry);
+
+// Bytes held by the cache: every entry, referenced or not, including replaced
+// versions that readers still hold. Those don't count against the budget.
+size_t fs_cache_get_size(fs_cache_t* cache);
@@ -0,0 +1,150 @@
+#include "fs_stress.h"
+
+#include "debug.h"
+#include "event.h"
+#include "fs.h"
+#include "heap.h"
+#include "thread.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+enum
+{
+	k_cache_stress_files = 4,
+	k_cache_stress_threads = 4,
+	k_cache_stress_reads = 64,
+};
+
+typedef struct fs_cache_stress_t
+{
+	fs_t* fs;
+	event_t* start;
+	char* const* paths;
+	char* const* contents;
+	int thread_index;
+	int failures;
+} fs_cache_stress_t;
+
+static bool fs_cache_check(fs_work_t* work, const char* expected, size_t size)
+{
+	const char* buffer = fs_work_get_buffer(work);
+	return fs_work_get_result(work) == 0 && fs_work_get_size(work) == size &&
+		memcmp(buffer, expected, size) == 0 && buffer[size] == 0;
+}
+
+static int fs_cache_stress_func(void* user)
+{
+	fs_cache_stress_t* stress = user;
+	event_wait(stress->start);
+	uint32_t state = (uint32_t)stress->thread_index + 1;
+	for (int i = 0; i < k_cache_stress_reads; ++i)
+	{
+		state = state * 1664525u + 1013904223u;
+		int file = (int)(state >> 24) % k_cache_stress_files;
+		fs_work_t* work = fs_read_shared(stress->fs, stress->paths[file], (file & 1) == 0, NULL);
+		stress->failures += !fs_cache_check(work, stress->contents[file], k_fs_stress_file_size);
+		fs_work_destroy(work);
+	}
+	return 0;
+}
+
+// Shared reads: repeats hit without I/O, the LRU file goes once the budget is
+// exceeded, a rewritten file is read again while holders keep the old data,
+// then threads hammer a cache smaller than the working set.
+static bool run_fs_cache_stress(heap_t* heap)
+{
+	const size_t size = k_fs_stress_file_size;
+	fs_t* fs = fs_create_ex(heap, &(fs_options_t) { .cache_budget = 3 * size });
+
+	char paths_storage[k_cache_stress_files][64];
+	char* paths[k_cache_stress_files];
+	char* contents[k_cache_stress_files];
+	for (int i = 0; i < k_cache_stress_files; ++i)
+	{
+		paths[i] = paths_storage[i];
+		snprintf(paths[i], 64, "stress_cache_%d.bin", i);
+		contents[i] = heap_alloc(heap, size + 1, 8);
+		fs_stress_fill_file(contents[i], size, 5, i);
+		fs_work_destroy(fs_write(fs, paths[i], contents[i], size, (i & 1) == 0));
+	}
+
+	int failures = 0;
+	fs_work_t* first = fs_read_shared(fs, paths[0], true, NULL);
+	failures += !fs_cache_check(first, contents[0], size);
+	const void* cached = fs_work_get_buffer(first);
+	fs_work_t* second = fs_read_shared(fs, paths[0], true, NULL);
+	failures += fs_work_get_buffer(second) != cached;
+	fs_work_destroy(first);
+	fs_work_destroy(second);
+
+	// Unreferenced, but within budget: still a hit.
+	second = fs_read_shared(fs, paths[0], true, NULL);
+	failures += fs_work_get_buffer(second) != cached || !fs_cache_check(second, contents[0], size);
+	fs_work_destroy(second);
+
+	// Three more files push the least recently used one out.
+	for (int i = 1; i < k_cache_stress_files; ++i)
+	{
+		fs_work_t* work = fs_read_shared(fs, paths[i], (i & 1) == 0, NULL);
+		failures += !fs_cache_check(work, contents[i], size);
+		fs_work_destroy(work);
+	}
+	failures += fs_get_cache_size(fs) != 3 * size;
+
+	// Rewrite a file while a holder has it; the holder's data must not change.
+	fs_work_t* holder = fs_read_shared(fs, paths[1], false, NULL);
+	fs_work_wait(holder);
+	char* rewritten = heap_alloc(heap, size / 2, 8);
+	fs_stress_fill_file(rewritten, size / 2, 6, 1);
+	fs_work_destroy(fs_write(fs, paths[1], rewritten, size / 2, false));
+	fs_work_t* fresh = fs_read_shared(fs, paths[1], false, NULL);
+	failures += !fs_cache_check(fresh, rewritten, size / 2);
+	failures += !fs_cache_check(holder, contents[1], size);
+	// The replaced version counts until its holder lets go.
+	failures += fs_get_cache_size(fs) != 3 * size + size / 2;
+	fs_work_destroy(fresh);
+	fs_work_destroy(holder);
+	failures += fs_get_cache_size(fs) != 2 * size + size / 2;
+	fs_work_destroy(fs_write(fs, paths[1], contents[1], size, false));
+
+	fs_work_t* missing = fs_read_shared(fs, "stress_cache_missing.bin", false, NULL);
+	failures += fs_work_get_result(missing) == 0 || fs_work_get_buffer(missing) != NULL;
+	fs_work_destroy(missing);
+
+	event_t* start = event_create();
+	fs_cache_stress_t stress[k_cache_stress_threads];
+	thread_t* threads[k_cache_stress_threads];
+	for (int i = 0; i < k_cache_stress_threads; ++i)
+	{
+		stress[i] = (fs_cache_stress_t) { .fs = fs, .start = start, .paths = paths, .contents = contents, .thread_index = i };
+		threads[i] = thread_create(fs_cache_stress_func, &stress[i]);
+	}
+	event_signal(start);
+	for (int i = 0; i < k_cache_stress_threads; ++i)
+	{
+		thread_destroy(threads[i]);
+		failures += stress[i].failures;
+	}
+	failures += fs_get_cache_size(fs) > 3 * size;
+	event_destroy(start);
+
+	fs_destroy(fs);
+	heap_free(heap, rewritten);
+	for (int i = 0; i < k_cache_stress_files; ++i)
+	{
+		remove(paths[i]);
+		heap_free(heap, contents[i]);
+	}
+
+	bool ok = failures == 0;
+	debug_print(ok ? k_print_info : k_print_error,
+		"[%s] fs cache: %s failures=%d\n", THREAD_STRESS_BACKEND, ok ? "ok" : "FAILED", failures);
+	return ok;
+}
+
+bool fs_cache_stress_run(heap_t* heap)
+{
+	return run_fs_cache_stress(heap);
+}
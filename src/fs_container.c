@@ -0,0 +1,283 @@
+#include "fs_container.h"
+
+#include "lz4/lz4.h"
+#include "lz4/lz4hc.h"
+#include "lz4/xxhash.h"
+
+#include <string.h>
+
+uint32_t fs_container_clamp_block_size(uint32_t block_size)
+{
+	if (block_size == 0)
+	{
+		return k_fs_container_default_block_size;
+	}
+	if (block_size < k_fs_container_min_block_size)
+	{
+		return k_fs_container_min_block_size;
+	}
+	return block_size > k_fs_container_max_block_size ? k_fs_container_max_block_size : block_size;
+}
+
+uint32_t fs_container_block_count(uint64_t size, uint32_t block_size)
+{
+	return (uint32_t)((size + block_size - 1) / block_size);
+}
+
+size_t fs_container_table_size(uint32_t block_count)
+{
+	return sizeof(fs_container_header_t) + (size_t)block_count * sizeof(fs_container_block_t);
+}
+
+size_t fs_container_bound(uint64_t size, uint32_t block_size)
+{
+	uint32_t count = fs_container_block_count(size, block_size);
+	return fs_container_table_size(count) + (size_t)count * LZ4_compressBound(block_size);
+}
+
+size_t fs_container_header_size(const fs_container_header_t* header)
+{
+	if (header->version == 1)
+	{
+		return k_fs_container_v1_header_size;
+	}
+	return header->version < 4 ? k_fs_container_v3_header_size : sizeof(fs_container_header_t);
+}
+
+uint32_t fs_container_get_dictionary_id(const fs_container_header_t* header)
+{
+	return header->version == 1 ? 0 : header->dictionary_id;
+}
+
+fs_container_filter_t fs_container_get_filter(const fs_container_header_t* header)
+{
+	return header->version < 4 ? k_fs_container_filter_none : (fs_container_filter_t)header->filter;
+}
+
+uint32_t fs_container_checksum(uint32_t version, const void* data, size_t size)
+{
+	return version < 3 ? XXH32(data, size, 0) : (uint32_t)XXH64(data, size, 0);
+}
+
+uint32_t fs_container_dictionary_id(const void* dictionary, uint32_t dictionary_size)
+{
+	if (!dictionary || dictionary_size == 0)
+	{
+		return 0;
+	}
+	// Zero means no dictionary, so no dictionary may hash to it.
+	uint32_t id = XXH32(dictionary, dictionary_size, 0);
+	return id ? id : 1;
+}
+
+uint32_t fs_container_block_raw_size(const fs_container_header_t* header, uint32_t index)
+{
+	uint64_t start = (uint64_t)index * header->block_size;
+	uint64_t remaining = header->size - start;
+	return remaining < header->block_size ? (uint32_t)remaining : header->block_size;
+}
+
+void fs_container_init(void* container, uint64_t size, uint32_t block_size, const fs_container_codec_t* codec)
+{
+	fs_container_header_t* header = container;
+	memset(header, 0, sizeof(*header));
+	header->magic = k_fs_container_magic;
+	header->version = k_fs_container_version;
+	header->size = size;
+	header->block_size = block_size;
+	header->block_count = fs_container_block_count(size, block_size);
+	header->dictionary_id = codec ? fs_container_dictionary_id(codec->dictionary, codec->dictionary_size) : 0;
+	if (codec && codec->filter != k_fs_container_filter_none && codec->record_size > 0 && codec->record_size < block_size)
+	{
+		header->filter = codec->filter;
+		header->record_size = codec->record_size;
+	}
+}
+
+// Compress with the codec's level and dictionary. Returns zero on failure.
+static int fs_container_compress(const fs_container_codec_t* codec, const char* raw, char* slot, int raw_size, int bound)
+{
+	bool dictionary = codec->dictionary && codec->dictionary_size > 0;
+	if (codec->level > 0)
+	{
+		if (!dictionary)
+		{
+			return LZ4_compress_HC(raw, slot, raw_size, bound, codec->level);
+		}
+		LZ4_streamHC_t* stream = LZ4_createStreamHC();
+		if (!stream)
+		{
+			return 0;
+		}
+		LZ4_resetStreamHC_fast(stream, codec->level);
+		LZ4_loadDictHC(stream, codec->dictionary, (int)codec->dictionary_size);
+		int size = LZ4_compress_HC_continue(stream, raw, slot, raw_size, bound);
+		LZ4_freeStreamHC(stream);
+		return size;
+	}
+
+	int acceleration = codec->level < 0 ? -codec->level : 1;
+	if (!dictionary)
+	{
+		return LZ4_compress_fast(raw, slot, raw_size, bound, acceleration);
+	}
+	LZ4_stream_t stream;
+	LZ4_initStream(&stream, sizeof(stream));
+	LZ4_loadDict(&stream, codec->dictionary, (int)codec->dictionary_size);
+	return LZ4_compress_fast_continue(&stream, raw, slot, raw_size, bound, acceleration);
+}
+
+bool fs_container_compress_block(void* container, const void* source, uint32_t index, const fs_container_codec_t* codec)
+{
+	const fs_container_header_t* header = container;
+	fs_container_block_t* block = (fs_container_block_t*)(header + 1) + index;
+	uint32_t raw_size = fs_container_block_raw_size(header, index);
+	int bound = LZ4_compressBound(header->block_size);
+	const char* raw = (const char*)source + (size_t)index * header->block_size;
+
+	// Until compacted, every block sits in its own worst case slot.
+	block->offset = fs_container_table_size(header->block_count) + (size_t)index * bound;
+	char* slot = (char*)container + block->offset;
+
+	fs_container_codec_t defaults = { 0 };
+	int compressed_size = fs_container_compress(codec ? codec : &defaults, raw, slot, (int)raw_size, bound);
+	if (compressed_size <= 0)
+	{
+		return false;
+	}
+	if ((uint32_t)compressed_size >= raw_size)
+	{
+		memcpy(slot, raw, raw_size);
+		compressed_size = (int)raw_size;
+	}
+	block->compressed_size = (uint32_t)compressed_size;
+	block->checksum = fs_container_checksum(header->version, raw, raw_size);
+	return true;
+}
+
+size_t fs_container_compact(void* container)
+{
+	const fs_container_header_t* header = container;
+	fs_container_block_t* blocks = (fs_container_block_t*)(header + 1);
+	size_t end = fs_container_table_size(header->block_count);
+	for (uint32_t i = 0; i < header->block_count; ++i)
+	{
+		// Slots only ever move down, so a forward pass never overwrites a block not yet moved.
+		memmove((char*)container + end, (char*)container + blocks[i].offset, blocks[i].compressed_size);
+		blocks[i].offset = end;
+		end += blocks[i].compressed_size;
+	}
+	return end;
+}
+
+bool fs_container_check_header(const fs_container_header_t* header)
+{
+	if (header->magic != k_fs_container_magic || header->version < 1 || header->version > k_fs_container_version ||
+		header->block_size < k_fs_container_min_block_size || header->block_size > k_fs_container_max_block_size ||
+		header->block_count != fs_container_block_count(header->size, header->block_size))
+	{
+		return false;
+	}
+	// Unfiltering trusts these, so an unknown filter or a record no smaller
+	// than a block is as bad as a broken header.
+	fs_container_filter_t filter = fs_container_get_filter(header);
+	return filter == k_fs_container_filter_none ||
+		(filter <= k_fs_container_filter_delta && header->record_size > 0 && header->record_size < header->block_size);
+}
+
+bool fs_container_parse(const void* data, size_t size, const fs_container_header_t** header, const fs_container_block_t** blocks)
+{
+	const fs_container_header_t* h = data;
+	if (size < k_fs_container_v1_header_size || !fs_container_check_header(h))
+	{
+		return false;
+	}
+	size_t header_size = fs_container_header_size(h);
+	if (size < header_size + (size_t)h->block_count * sizeof(fs_container_block_t))
+	{
+		return false;
+	}
+
+	const fs_container_block_t* b = (const fs_container_block_t*)((const char*)h + header_size);
+	for (uint32_t i = 0; i < h->block_count; ++i)
+	{
+		if (b[i].offset > size || b[i].compressed_size > size - b[i].offset)
+		{
+			return false;
+		}
+	}
+
+	*header = h;
+	*blocks = b;
+	return true;
+}
+
+bool fs_container_decompress_block(const fs_container_block_t* block, const void* compressed, void* destination, uint32_t raw_size,
+	const void* dictionary, uint32_t dictionary_size)
+{
+	if (block->compressed_size == raw_size)
+	{
+		memcpy(destination, compressed, raw_size);
+	}
+	else if (LZ4_decompress_safe_usingDict(compressed, destination, (int)block->compressed_size, (int)raw_size,
+		dictionary, dictionary ? (int)dictionary_size : 0) != (int)raw_size)
+	{
+		return false;
+	}
+	return true;
+}
+
+bool fs_container_verify_block(uint32_t version, const fs_container_block_t* block, const void* data, uint32_t raw_size)
+{
+	return fs_container_checksum(version, data, raw_size) == block->checksum;
+}
+
+void fs_container_filter_block(const void* container, const void* source, void* destination, uint32_t index)
+{
+	const fs_container_header_t* header = container;
+	size_t offset = (size_t)index * header->block_size;
+	const uint8_t* in = (const uint8_t*)source + offset;
+	uint8_t* out = (uint8_t*)destination + offset;
+	uint32_t raw_size = fs_container_block_raw_size(header, index);
+	fs_container_filter_t filter = fs_container_get_filter(header);
+	uint32_t stride = filter != k_fs_container_filter_none && header->record_size < raw_size ? header->record_size : raw_size;
+	memcpy(out, in, stride);
+	if (filter == k_fs_container_filter_xor)
+	{
+		for (uint32_t i = stride; i < raw_size; ++i)
+		{
+			out[i] = in[i] ^ in[i - stride];
+		}
+	}
+	else
+	{
+		for (uint32_t i = stride; i < raw_size; ++i)
+		{
+			out[i] = (uint8_t)(in[i] - in[i - stride]);
+		}
+	}
+}
+
+void fs_container_unfilter_block(const fs_container_header_t* header, void* data, uint32_t raw_size)
+{
+	// Front to back, so each byte's predecessor is already restored.
+	uint8_t* bytes = data;
+	uint32_t stride = header->record_size;
+	switch (fs_container_get_filter(header))
+	{
+	case k_fs_container_filter_none:
+		break;
+	case k_fs_container_filter_xor:
+		for (uint32_t i = stride; i < raw_size; ++i)
+		{
+			bytes[i] ^= bytes[i - stride];
+		}
+		break;
+	case k_fs_container_filter_delta:
+		for (uint32_t i = stride; i < raw_size; ++i)
+		{
+			bytes[i] += bytes[i - stride];
+		}
+		break;
+	}
+}
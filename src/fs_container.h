@@ -0,0 +1,168 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Block container for compressed files.
+//
+// Layout: a header, a table with one entry per block, then the block data.
+// Every block but the last holds block_size uncompressed bytes and is LZ4
+// compressed on its own, so blocks can be coded in parallel and any one of
+// them decoded without the rest. Each entry carries a checksum of the block's
+// uncompressed bytes: the low 32 bits of their XXH64, or in version 1 and 2
+// files their XXH32. Blocks LZ4 can't shrink are stored raw.
+// Blocks may be compressed with LZ4 or LZ4 HC, which decode the same way, and
+// against a shared dictionary named in the header.
+// Data made of fixed-size records may be filtered before compression, each
+// record coded against the one before it in the same block; the header names
+// the filter. Checksums cover the filtered bytes, as LZ4 sees them.
+// All fields are little-endian. Version 1 headers stop before dictionary_id,
+// and versions 2 and 3 before filter. All are still read.
+
+enum
+{
+	k_fs_container_magic = 0x345a4c43, // "CLZ4"
+	k_fs_container_version = 4,
+	k_fs_container_v1_header_size = 24,
+	k_fs_container_v3_header_size = 32,
+	k_fs_container_min_block_size = 64 * 1024,
+	k_fs_container_default_block_size = 128 * 1024,
+	k_fs_container_max_block_size = 256 * 1024,
+};
+
+typedef struct fs_container_header_t
+{
+	uint32_t magic;
+	uint32_t version;
+	// Total uncompressed size.
+	uint64_t size;
+	uint32_t block_size;
+	uint32_t block_count;
+	// XXH32 of the dictionary blocks were compressed against, or zero for none.
+	uint32_t dictionary_id;
+	uint32_t reserved;
+	// fs_container_filter_t applied before compression, and the record size
+	// it works in. Both zero for none.
+	uint32_t filter;
+	uint32_t record_size;
+} fs_container_header_t;
+
+// Reversible coding of fixed-size records, so that fields which change little
+// from one record to the next become runs of zeros LZ4 compresses well.
+// Each block's first record is stored as is.
+typedef enum fs_container_filter_t
+{
+	k_fs_container_filter_none,
+	// Each byte XORed with the byte one record before. Suits floats and flags.
+	k_fs_container_filter_xor,
+	// Each byte minus the byte one record before, modulo 256. Suits counters
+	// and integer positions that move in small steps.
+	k_fs_container_filter_delta,
+} fs_container_filter_t;
+
+// How blocks are compressed. Zeroed is LZ4's default with no dictionary.
+typedef struct fs_container_codec_t
+{
+	// Zero for LZ4's default. Negative for faster LZ4 with an acceleration of
+	// -level. 1 to 12 for LZ4 HC at that level: slower to write, smaller, and
+	// just as fast to read.
+	int level;
+	// Shared dictionary, or NULL. Only the last 64 KB matter.
+	const void* dictionary;
+	uint32_t dictionary_size;
+	// Record filter, and the record size in bytes. Ignored unless the record
+	// size is non-zero and smaller than a block.
+	fs_container_filter_t filter;
+	uint32_t record_size;
+} fs_container_codec_t;
+
+typedef struct fs_container_block_t
+{
+	// Offset of the block data from the start of the container.
+	uint64_t offset;
+	// Stored size. Equal to the block's uncompressed size if stored raw.
+	uint32_t compressed_size;
+	// Checksum of the uncompressed bytes; see fs_container_checksum().
+	uint32_t checksum;
+} fs_container_block_t;
+
+// Clamp a requested block size into the supported range.
+// Zero picks the default.
+uint32_t fs_container_clamp_block_size(uint32_t block_size);
+
+// Number of blocks needed for size bytes.
+uint32_t fs_container_block_count(uint64_t size, uint32_t block_size);
+
+// Bytes used by the header and block table of a container being written.
+size_t fs_container_table_size(uint32_t block_count);
+
+// Bytes of header, which depend on its version.
+// Only valid once fs_container_check_header() has passed.
+size_t fs_container_header_size(const fs_container_header_t* header);
+
+// The dictionary ID in a checked header; zero for version 1.
+uint32_t fs_container_get_dictionary_id(const fs_container_header_t* header);
+
+// Checksum of a block's uncompressed bytes in a container of that version.
+// XXH64 runs about twice as fast as XXH32 on 64-bit CPUs, so newer
+// containers keep the low half of it.
+uint32_t fs_container_checksum(uint32_t version, const void* data, size_t size);
+
+// The record filter in a checked header; none before version 4.
+fs_container_filter_t fs_container_get_filter(const fs_container_header_t* header);
+
+// Dictionary ID to store for a dictionary; zero if there is none.
+uint32_t fs_container_dictionary_id(const void* dictionary, uint32_t dictionary_size);
+
+// Worst case container size for size bytes of input.
+size_t fs_container_bound(uint64_t size, uint32_t block_size);
+
+// Uncompressed size of one block.
+uint32_t fs_container_block_raw_size(const fs_container_header_t* header, uint32_t index);
+
+// Write the header into a container of at least fs_container_bound() bytes.
+// Blocks are then compressed into it in any order, from any thread.
+// The header names the codec's dictionary, which must be used for every block.
+void fs_container_init(void* container, uint64_t size, uint32_t block_size, const fs_container_codec_t* codec);
+
+// Compress block index of source (the full uncompressed input) into its
+// worst case slot and fill in its table entry. Codec may be NULL for the default.
+// If the header names a filter, source must be the output of
+// fs_container_filter_block() instead.
+// Returns false if LZ4 failed.
+bool fs_container_compress_block(void* container, const void* source, uint32_t index, const fs_container_codec_t* codec);
+
+// Apply the header's record filter to block index of source, writing the
+// result to the same offset in destination, which is as large as source.
+// Blocks are independent, so any may be filtered in any order, from any thread.
+void fs_container_filter_block(const void* container, const void* source, void* destination, uint32_t index);
+
+// Undo the header's record filter on one decompressed, verified block, in place.
+// Does nothing if the header names no filter.
+void fs_container_unfilter_block(const fs_container_header_t* header, void* data, uint32_t raw_size);
+
+// Move the compressed blocks together once all have been written.
+// Returns the final container size.
+size_t fs_container_compact(void* container);
+
+// Check a header's magic, version and block fields agree.
+// Needs at least k_fs_container_v1_header_size bytes; the rest of a newer
+// header must follow.
+bool fs_container_check_header(const fs_container_header_t* header);
+
+// Check that data starts with a valid header and block table.
+// The block data itself is only checked when decompressed.
+bool fs_container_parse(const void* data, size_t size, const fs_container_header_t** header, const fs_container_block_t** blocks);
+
+// Decompress one block into destination, which must hold raw_size bytes.
+// compressed points at the block's stored data. dictionary must be the one
+// the header names, or NULL if it names none.
+// Returns false if the block doesn't decode to raw_size bytes. Its checksum
+// is not checked; see fs_container_verify_block().
+bool fs_container_decompress_block(const fs_container_block_t* block, const void* compressed, void* destination, uint32_t raw_size,
+	const void* dictionary, uint32_t dictionary_size);
+
+// Check decompressed block data against its table entry.
+// version is the container's, from its header.
+bool fs_container_verify_block(uint32_t version, const fs_container_block_t* block, const void* data, uint32_t raw_size);
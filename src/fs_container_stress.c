@@ -0,0 +1,226 @@
+#include "fs_stress.h"
+
+#include "debug.h"
+#include "fs.h"
+#include "fs_container.h"
+#include "heap.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+// Stored size of a file, read back without decompressing.
+static size_t fs_stored_size(fs_t* fs, heap_t* heap, const char* path)
+{
+	fs_work_t* work = fs_read(fs, path, heap, false, false);
+	size_t size = fs_work_get_result(work) == 0 ? fs_work_get_size(work) : 0;
+	heap_free(heap, fs_work_get_buffer(work));
+	fs_work_destroy(work);
+	return size;
+}
+
+// Writes the same data at several LZ4 levels, with and without a dictionary,
+// and reads each back whole, by block and streamed. HC must not come out
+// bigger than the default, a dictionary must shrink a small file that shares
+// its text, and a file system without the dictionary must refuse the file.
+static bool run_fs_codec_stress(heap_t* heap)
+{
+	enum { k_level_count = 5 };
+	const int levels[k_level_count] = { 0, -8, 3, 9, 12 };
+	const size_t dictionary_size = 16 * 1024;
+	const size_t small_size = 3000;
+	const size_t large_size = 3 * k_fs_container_min_block_size + 999;
+	const char* path = "stress_codec.bin";
+
+	// Text built from a small vocabulary, so the dictionary and the files share words.
+	char* dictionary = heap_alloc(heap, dictionary_size, 8);
+	char* large = heap_alloc(heap, large_size, 8);
+	uint32_t state = 77;
+	static const char* k_words[] = { "vertex ", "shader ", "uniform ", "texture ", "frog ", "traffic ", "lane ", "model " };
+	char* buffers[] = { dictionary, large };
+	size_t sizes[] = { dictionary_size, large_size };
+	for (int b = 0; b < 2; ++b)
+	{
+		for (size_t i = 0; i < sizes[b];)
+		{
+			state = state * 1664525u + 1013904223u;
+			const char* word = k_words[(state >> 24) & 7];
+			for (size_t j = 0; word[j] && i < sizes[b]; ++j)
+			{
+				buffers[b][i++] = word[j];
+			}
+		}
+	}
+
+	fs_options_t options =
+	{
+		.compress_block_size = k_fs_container_min_block_size,
+		.dictionary = dictionary,
+		.dictionary_size = (uint32_t)dictionary_size,
+	};
+	fs_t* fs = fs_create_ex(heap, &options);
+	fs_t* plain = fs_create_ex(heap, &(fs_options_t) { .compress_block_size = k_fs_container_min_block_size });
+
+	int failures = 0;
+	size_t default_size = 0;
+	for (int d = 0; d < 2; ++d)
+	{
+		for (int l = 0; l < k_level_count; ++l)
+		{
+			fs_work_options_t write_options = { .compression_level = levels[l], .use_dictionary = d == 1 };
+			fs_work_destroy(fs_write_ex(fs, path, large, large_size, true, &write_options));
+			size_t stored = fs_stored_size(fs, heap, path);
+			default_size = d == 0 && l == 0 ? stored : default_size;
+			failures += stored == 0 || (levels[l] >= 9 && stored > default_size);
+
+			fs_work_t* work = fs_read(fs, path, heap, false, true);
+			failures += fs_work_get_result(work) != 0 || fs_work_get_size(work) != large_size ||
+				memcmp(fs_work_get_buffer(work), large, large_size) != 0;
+			heap_free(heap, fs_work_get_buffer(work));
+			fs_work_destroy(work);
+
+			work = fs_read_block(fs, path, heap, 2);
+			failures += fs_work_get_result(work) != 0 || fs_work_get_size(work) != k_fs_container_min_block_size ||
+				memcmp(fs_work_get_buffer(work), large + 2 * k_fs_container_min_block_size, k_fs_container_min_block_size) != 0;
+			heap_free(heap, fs_work_get_buffer(work));
+			fs_work_destroy(work);
+
+			fs_stress_stream_t stream = { .expected = large, .chunk_size = 10000, .stop_after = large_size };
+			work = fs_read_stream(fs, path, true, stream.chunk_size, fs_stress_stream_func, &stream);
+			failures += fs_work_get_result(work) != 0 || stream.next_offset != large_size || stream.failures != 0;
+			fs_work_destroy(work);
+
+			// Without the dictionary the blocks can't be decoded.
+			work = fs_read(plain, path, heap, false, true);
+			failures += (fs_work_get_result(work) == 0) != (d == 0);
+			heap_free(heap, fs_work_get_buffer(work));
+			fs_work_destroy(work);
+		}
+	}
+
+	size_t small_stored[2];
+	for (int d = 0; d < 2; ++d)
+	{
+		fs_work_options_t write_options = { .compression_level = 9, .use_dictionary = d == 1 };
+		fs_work_destroy(fs_write_ex(fs, path, large + 5000, small_size, true, &write_options));
+		small_stored[d] = fs_stored_size(fs, heap, path);
+		fs_work_t* work = fs_read(fs, path, heap, false, true);
+		failures += fs_work_get_result(work) != 0 || fs_work_get_size(work) != small_size ||
+			memcmp(fs_work_get_buffer(work), large + 5000, small_size) != 0;
+		heap_free(heap, fs_work_get_buffer(work));
+		fs_work_destroy(work);
+	}
+	failures += small_stored[1] >= small_stored[0];
+
+	remove(path);
+	fs_destroy(plain);
+	fs_destroy(fs);
+	heap_free(heap, large);
+	heap_free(heap, dictionary);
+
+	bool ok = failures == 0;
+	debug_print(ok ? k_print_info : k_print_error,
+		"[%s] fs codec default=%u small=%u small_dictionary=%u: %s failures=%d\n", THREAD_STRESS_BACKEND,
+		(uint32_t)default_size, (uint32_t)small_stored[0], (uint32_t)small_stored[1], ok ? "ok" : "FAILED", failures);
+	return ok;
+}
+
+// One frame of a replay: fields that mostly move in small steps, with noise.
+typedef struct fs_stress_record_t
+{
+	uint32_t frame;
+	uint32_t entity;
+	int32_t position[3];
+	float velocity[3];
+	uint32_t health;
+	uint32_t flags;
+	uint32_t time_us;
+} fs_stress_record_t;
+
+// Writes a series of records plain and with each record coding, then reads
+// each back whole, by block and streamed. Records don't divide the block size,
+// so blocks start part way into a record. Coding must shrink the file.
+static bool run_fs_record_stress(heap_t* heap)
+{
+	const size_t record_count = 7 * k_fs_container_min_block_size / sizeof(fs_stress_record_t) + 13;
+	const size_t size = record_count * sizeof(fs_stress_record_t);
+	const char* path = "stress_record.bin";
+	fs_t* fs = fs_create_ex(heap, &(fs_options_t) { .compress_block_size = k_fs_container_min_block_size });
+
+	fs_stress_record_t* records = heap_alloc(heap, size, 8);
+	uint32_t state = 1234;
+	fs_stress_record_t record = { .entity = 42, .health = 100 };
+	for (size_t i = 0; i < record_count; ++i)
+	{
+		state = state * 1664525 + 1013904223;
+		record.frame = (uint32_t)i;
+		record.time_us += 16666 + (state >> 28);
+		for (int axis = 0; axis < 3; ++axis)
+		{
+			record.position[axis] += (int32_t)((state >> (axis * 4)) & 7) - 3;
+			record.velocity[axis] = (float)record.position[axis] * 0.25f;
+		}
+		record.health -= (state >> 20) % 97 == 0 && record.health > 0;
+		record.flags ^= (state >> 12) % 61 == 0 ? 1u << (state % 8) : 0;
+		records[i] = record;
+	}
+
+	int failures = 0;
+	size_t stored[3] = { 0 };
+	const fs_record_coding_t codings[3] = { k_fs_record_none, k_fs_record_xor, k_fs_record_delta };
+	for (int c = 0; c < 3; ++c)
+	{
+		fs_work_destroy(fs_write_ex(fs, path, records, size, true,
+			&(fs_work_options_t) { .record_coding = codings[c], .record_size = sizeof(fs_stress_record_t) }));
+		stored[c] = fs_stored_size(fs, heap, path);
+
+		fs_work_t* work = fs_read(fs, path, heap, false, true);
+		failures += fs_work_get_result(work) != 0 || fs_work_get_size(work) != size ||
+			memcmp(fs_work_get_buffer(work), records, size) != 0;
+		heap_free(heap, fs_work_get_buffer(work));
+		fs_work_destroy(work);
+
+		uint32_t block_count = fs_container_block_count(size, k_fs_container_min_block_size);
+		for (uint32_t i = 0; i < block_count; ++i)
+		{
+			size_t offset = (size_t)i * k_fs_container_min_block_size;
+			size_t expected = size - offset < k_fs_container_min_block_size ? size - offset : k_fs_container_min_block_size;
+			work = fs_read_block(fs, path, heap, i);
+			failures += fs_work_get_result(work) != 0 || fs_work_get_size(work) != expected ||
+				memcmp(fs_work_get_buffer(work), (const char*)records + offset, expected) != 0;
+			heap_free(heap, fs_work_get_buffer(work));
+			fs_work_destroy(work);
+		}
+
+		fs_stress_stream_t stream = { .expected = (const char*)records, .chunk_size = 5000, .stop_after = UINT64_MAX };
+		work = fs_read_stream(fs, path, true, stream.chunk_size, fs_stress_stream_func, &stream);
+		failures += fs_work_get_result(work) != 0 || stream.next_offset != size;
+		fs_work_destroy(work);
+		failures += stream.failures;
+	}
+	failures += stored[1] >= stored[0] || stored[2] >= stored[0];
+
+	// A record as big as a block can't be coded, so the write is plain.
+	fs_work_destroy(fs_write_ex(fs, path, records, size, true,
+		&(fs_work_options_t) { .record_coding = k_fs_record_delta, .record_size = k_fs_container_min_block_size }));
+	failures += fs_stored_size(fs, heap, path) != stored[0];
+
+	remove(path);
+	heap_free(heap, records);
+	fs_destroy(fs);
+
+	bool ok = failures == 0;
+	debug_print(ok ? k_print_info : k_print_error,
+		"[%s] fs records bytes=%u plain=%u xor=%u delta=%u: %s failures=%d\n", THREAD_STRESS_BACKEND, (uint32_t)size,
+		(uint32_t)stored[0], (uint32_t)stored[1], (uint32_t)stored[2], ok ? "ok" : "FAILED", failures);
+	return ok;
+}
+
+bool fs_container_stress_run(heap_t* heap)
+{
+	bool ok = true;
+	ok &= run_fs_codec_stress(heap);
+	ok &= run_fs_record_stress(heap);
+
+	return ok;
+}
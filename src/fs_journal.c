@@ -0,0 +1,235 @@
+#include "fs_journal.h"
+
+#include "fast_mutex.h"
+#include "fs.h"
+#include "heap.h"
+
+#include "lz4/xxhash.h"
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+enum
+{
+	k_fs_journal_default_batch_size = 64 * 1024,
+};
+
+// Precedes each record's data.
+typedef struct fs_journal_record_t
+{
+	uint32_t size;
+	// XXH32 of the data. Never zero for empty data, so a zeroed tail fails.
+	uint32_t checksum;
+} fs_journal_record_t;
+
+typedef struct fs_journal_t
+{
+	fs_t* fs;
+	heap_t* heap;
+	char path[1024];
+	bool sync;
+	fast_mutex_t* lock;
+	// Appends fill the active batch while the other one may be being written.
+	char* batches[2];
+	int active;
+	size_t used;
+	size_t batch_size;
+	// The batch write in flight, if any.
+	fs_work_t* writing;
+	int result;
+} fs_journal_t;
+
+// Walks the intact records at the start of data, calling function for each
+// if it is set. Returns the bytes they cover; count receives how many there were.
+static size_t fs_journal_scan(const char* data, size_t size, fs_journal_func_t function, void* user, int* count)
+{
+	size_t offset = 0;
+	*count = 0;
+	while (size - offset >= sizeof(fs_journal_record_t))
+	{
+		fs_journal_record_t record;
+		memcpy(&record, data + offset, sizeof(record));
+		const char* record_data = data + offset + sizeof(record);
+		if (record.size > size - offset - sizeof(record) || XXH32(record_data, record.size, 0) != record.checksum)
+		{
+			break;
+		}
+		offset += sizeof(record) + record.size;
+		(*count)++;
+		if (function && !function(record_data, record.size, user))
+		{
+			break;
+		}
+	}
+	return offset;
+}
+
+// Reads a whole journal file. A missing one reads as empty.
+// Returns false if the file exists but can't be read.
+static bool fs_journal_load(fs_t* fs, heap_t* heap, const char* path, fs_work_t** work)
+{
+	*work = fs_read(fs, path, heap, false, false);
+	int result = fs_work_get_result(*work);
+	// ENOENT and Windows' ERROR_FILE_NOT_FOUND are both 2.
+	if (result == 0 || result == ENOENT)
+	{
+		return true;
+	}
+	heap_free(heap, fs_work_get_buffer(*work));
+	fs_work_destroy(*work);
+	*work = NULL;
+	return false;
+}
+
+fs_journal_t* fs_journal_open(fs_t* fs, heap_t* heap, const char* path, const fs_journal_options_t* options)
+{
+	fs_work_t* work;
+	if (!fs_journal_load(fs, heap, path, &work))
+	{
+		return NULL;
+	}
+
+	// A torn tail from a crash would hide everything appended after it, so
+	// rewrite the file without it first.
+	bool ok = true;
+	if (fs_work_get_result(work) == 0)
+	{
+		int count;
+		size_t intact = fs_journal_scan(fs_work_get_buffer(work), fs_work_get_size(work), NULL, NULL, &count);
+		if (intact < fs_work_get_size(work))
+		{
+			fs_work_t* rewrite = fs_write_ex(fs, path, fs_work_get_buffer(work), intact, false,
+				&(fs_work_options_t) { .write_mode = k_fs_write_atomic });
+			ok = fs_work_get_result(rewrite) == 0;
+			fs_work_destroy(rewrite);
+		}
+	}
+	heap_free(heap, fs_work_get_buffer(work));
+	fs_work_destroy(work);
+	if (!ok)
+	{
+		return NULL;
+	}
+
+	fs_journal_t* journal = heap_alloc(heap, sizeof(fs_journal_t), 8);
+	memset(journal, 0, sizeof(*journal));
+	journal->fs = fs;
+	journal->heap = heap;
+	snprintf(journal->path, sizeof(journal->path), "%s", path);
+	journal->sync = options && options->sync;
+	journal->lock = fast_mutex_create(heap);
+	journal->batch_size = options && options->batch_size ? options->batch_size : k_fs_journal_default_batch_size;
+	journal->batches[0] = heap_alloc(heap, journal->batch_size * 2, 8);
+	journal->batches[1] = journal->batches[0] + journal->batch_size;
+	return journal;
+}
+
+// Waits for the batch write in flight and keeps its result.
+static void fs_journal_finish_write(fs_journal_t* journal)
+{
+	if (!journal->writing)
+	{
+		return;
+	}
+	int result = fs_work_get_result(journal->writing);
+	if (result && !journal->result)
+	{
+		journal->result = result;
+	}
+	fs_work_destroy(journal->writing);
+	journal->writing = NULL;
+}
+
+// Queues the active batch as one append and switches to the other batch.
+// Called with the lock held.
+static void fs_journal_submit(fs_journal_t* journal)
+{
+	if (journal->used == 0)
+	{
+		return;
+	}
+	// The other batch is the one being written; it must be done before it's refilled.
+	fs_journal_finish_write(journal);
+	fs_work_options_t options = { .write_mode = k_fs_write_append, .sync = journal->sync };
+	journal->writing = fs_write_ex(journal->fs, journal->path, journal->batches[journal->active], journal->used, false, &options);
+	journal->active ^= 1;
+	journal->used = 0;
+}
+
+int fs_journal_close(fs_journal_t* journal)
+{
+	fs_journal_flush(journal, true);
+	int result = journal->result;
+	fast_mutex_destroy(journal->lock);
+	heap_free(journal->heap, journal->batches[0]);
+	heap_free(journal->heap, journal);
+	return result;
+}
+
+bool fs_journal_append(fs_journal_t* journal, const void* data, size_t size)
+{
+	if (size > journal->batch_size - sizeof(fs_journal_record_t))
+	{
+		return false;
+	}
+	fs_journal_record_t record = { .size = (uint32_t)size, .checksum = XXH32(data, size, 0) };
+
+	fast_mutex_lock(journal->lock);
+	if (journal->result)
+	{
+		fast_mutex_unlock(journal->lock);
+		return false;
+	}
+	if (journal->used + sizeof(record) + size > journal->batch_size)
+	{
+		fs_journal_submit(journal);
+	}
+	char* batch = journal->batches[journal->active];
+	memcpy(batch + journal->used, &record, sizeof(record));
+	memcpy(batch + journal->used + sizeof(record), data, size);
+	journal->used += sizeof(record) + size;
+	fast_mutex_unlock(journal->lock);
+	return true;
+}
+
+void fs_journal_flush(fs_journal_t* journal, bool wait)
+{
+	fast_mutex_lock(journal->lock);
+	fs_journal_submit(journal);
+	if (wait)
+	{
+		fs_journal_finish_write(journal);
+	}
+	fast_mutex_unlock(journal->lock);
+}
+
+int fs_journal_get_result(fs_journal_t* journal)
+{
+	fast_mutex_lock(journal->lock);
+	if (journal->writing && fs_work_is_done(journal->writing))
+	{
+		fs_journal_finish_write(journal);
+	}
+	int result = journal->result;
+	fast_mutex_unlock(journal->lock);
+	return result;
+}
+
+int fs_journal_replay(fs_t* fs, heap_t* heap, const char* path, fs_journal_func_t function, void* user)
+{
+	fs_work_t* work;
+	if (!fs_journal_load(fs, heap, path, &work))
+	{
+		return -1;
+	}
+	int count = 0;
+	if (fs_work_get_result(work) == 0)
+	{
+		fs_journal_scan(fs_work_get_buffer(work), fs_work_get_size(work), function, user, &count);
+	}
+	heap_free(heap, fs_work_get_buffer(work));
+	fs_work_destroy(work);
+	return count;
+}
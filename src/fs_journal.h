@@ -0,0 +1,59 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+
+// Append-only journal for frequent small writes: telemetry, replays, autosaves.
+//
+// Records are copied into an in-memory batch and reach the file as one large
+// append when the batch fills or the journal is flushed, so thousands of
+// small writes cost a handful of sequential I/Os. Each record is framed with
+// its size and a checksum. A crash can only lose or tear the tail, and
+// replaying stops at the first record that doesn't check out; opening the
+// journal again cuts such a tail off before appending.
+//
+// Appends and flushes may come from any thread. One batch is written at a
+// time, in order; an append that finds both batches busy waits for the write.
+
+// Handle to an open journal.
+typedef struct fs_journal_t fs_journal_t;
+
+typedef struct fs_t fs_t;
+typedef struct heap_t heap_t;
+
+// Optional settings for fs_journal_open(). Zeroed fields keep the defaults.
+typedef struct fs_journal_options_t
+{
+	// Bytes per batch, framing included. Two are allocated. Defaults to 64 KB.
+	size_t batch_size;
+	// Flush each batch to disk before the next is written.
+	bool sync;
+} fs_journal_options_t;
+
+// Receives one record during a replay. The data is only valid during the
+// call. Return false to stop early.
+typedef bool (*fs_journal_func_t)(const void* data, size_t size, void* user);
+
+// Open a journal for appending, creating the file if needed.
+// Options may be NULL. Returns NULL if the file exists but can't be read.
+fs_journal_t* fs_journal_open(fs_t* fs, heap_t* heap, const char* path, const fs_journal_options_t* options);
+
+// Flush whatever is batched, wait for it, and free the journal.
+// Returns the first write error, as fs_journal_get_result().
+int fs_journal_close(fs_journal_t* journal);
+
+// Add a record. Returns false if it is bigger than a batch can hold or an
+// earlier write failed.
+bool fs_journal_append(fs_journal_t* journal, const void* data, size_t size);
+
+// Start writing the records batched so far. If wait is true, also block
+// until they are written, and flushed to disk if the journal syncs.
+void fs_journal_flush(fs_journal_t* journal, bool wait);
+
+// Zero, or the first error any batch write returned.
+int fs_journal_get_result(fs_journal_t* journal);
+
+// Call function for each intact record of a journal file, in order, on the
+// calling thread. Returns how many were delivered, or -1 if the file could
+// not be read. A missing file has no records.
+int fs_journal_replay(fs_t* fs, heap_t* heap, const char* path, fs_journal_func_t function, void* user);
@@ -0,0 +1,226 @@
+#include "fs_pak.h"
+
+#include "debug.h"
+#include "fs.h"
+#include "fs_container.h"
+#include "heap.h"
+
+#include "lz4/xxhash.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+uint64_t fs_pak_hash_path(const char* path)
+{
+	char normalized[k_fs_pak_max_path + 1];
+	size_t length = strlen(path);
+	length = length < sizeof(normalized) ? length : sizeof(normalized) - 1;
+	for (size_t i = 0; i < length; ++i)
+	{
+		normalized[i] = path[i] == '\\' ? '/' : path[i];
+	}
+	return XXH64(normalized, length, 0);
+}
+
+const fs_pak_entry_t* fs_pak_find(const fs_pak_entry_t* toc, uint32_t count, uint64_t path_hash)
+{
+	uint32_t low = 0;
+	uint32_t high = count;
+	while (low < high)
+	{
+		uint32_t middle = low + (high - low) / 2;
+		if (toc[middle].path_hash < path_hash)
+		{
+			low = middle + 1;
+		}
+		else
+		{
+			high = middle;
+		}
+	}
+	return low < count && toc[low].path_hash == path_hash ? &toc[low] : NULL;
+}
+
+bool fs_pak_check_header(const fs_pak_header_t* header)
+{
+	return header->magic == k_fs_pak_magic && header->version == k_fs_pak_version &&
+		header->alignment > 0 && (header->alignment & (header->alignment - 1)) == 0 &&
+		header->toc_offset >= sizeof(fs_pak_header_t);
+}
+
+static int fs_pak_compare_entries(const void* a, const void* b)
+{
+	uint64_t x = ((const fs_pak_entry_t*)a)->path_hash;
+	uint64_t y = ((const fs_pak_entry_t*)b)->path_hash;
+	return (x > y) - (x < y);
+}
+
+// Compress a whole buffer into a block container on this thread.
+// Returns NULL if the result would not be smaller.
+static void* fs_pak_compress(heap_t* heap, const fs_container_codec_t* codec, const void* data, size_t size, size_t* compressed_size)
+{
+	uint32_t block_size = k_fs_container_default_block_size;
+	void* container = heap_alloc(heap, fs_container_bound(size, block_size), 8);
+	fs_container_init(container, size, block_size, codec);
+
+	uint32_t block_count = fs_container_block_count(size, block_size);
+	// Record coding, if the codec asks for it, works from a coded copy.
+	void* filtered = fs_container_get_filter(container) != k_fs_container_filter_none ? heap_alloc(heap, size, 8) : NULL;
+	bool ok = true;
+	for (uint32_t i = 0; i < block_count && ok; ++i)
+	{
+		if (filtered)
+		{
+			fs_container_filter_block(container, data, filtered, i);
+		}
+		ok = fs_container_compress_block(container, filtered ? filtered : data, i, codec);
+	}
+	heap_free(heap, filtered);
+	*compressed_size = ok ? fs_container_compact(container) : 0;
+	if (!ok || *compressed_size >= size)
+	{
+		heap_free(heap, container);
+		return NULL;
+	}
+	return container;
+}
+
+// The pak is assembled in memory and written with one fs_write().
+typedef struct fs_pak_writer_t
+{
+	heap_t* heap;
+	char* data;
+	size_t size;
+	size_t capacity;
+} fs_pak_writer_t;
+
+static void fs_pak_append(fs_pak_writer_t* writer, const void* data, size_t size)
+{
+	if (writer->size + size > writer->capacity)
+	{
+		size_t capacity = writer->capacity ? writer->capacity : 64 * 1024;
+		while (capacity < writer->size + size)
+		{
+			capacity *= 2;
+		}
+		char* grown = heap_alloc(writer->heap, capacity, 8);
+		if (writer->size)
+		{
+			memcpy(grown, writer->data, writer->size);
+		}
+		heap_free(writer->heap, writer->data);
+		writer->data = grown;
+		writer->capacity = capacity;
+	}
+	if (data)
+	{
+		memcpy(writer->data + writer->size, data, size);
+	}
+	else
+	{
+		memset(writer->data + writer->size, 0, size);
+	}
+	writer->size += size;
+}
+
+// Pads with zeros up to the next multiple of alignment.
+static void fs_pak_pad(fs_pak_writer_t* writer, uint32_t alignment)
+{
+	fs_pak_append(writer, NULL, (alignment - (writer->size % alignment)) % alignment);
+}
+
+bool fs_pak_build(heap_t* heap, const char* pak_path, const char* const* names, const char* const* sources, int count,
+	const fs_container_codec_t* codec)
+{
+	fs_pak_entry_t* toc = heap_alloc(heap, sizeof(fs_pak_entry_t) * (count > 0 ? count : 1), 8);
+	fs_t* fs = fs_create(heap, 16);
+	fs_pak_writer_t writer = { .heap = heap };
+
+	// Header goes in last, once the table offset is known.
+	fs_pak_append(&writer, NULL, sizeof(fs_pak_header_t));
+
+	bool ok = true;
+	for (int i = 0; i < count && ok; ++i)
+	{
+		// Longer names would be truncated when hashed, and could collide.
+		if (strlen(names[i]) > k_fs_pak_max_path)
+		{
+			debug_print(k_print_error, "pak: path longer than %d bytes: %.64s...\n", k_fs_pak_max_path, names[i]);
+			ok = false;
+			break;
+		}
+
+		const char* source = sources && sources[i] ? sources[i] : names[i];
+		fs_work_t* work = fs_read(fs, source, heap, false, false);
+		if (fs_work_get_result(work) != 0)
+		{
+			debug_print(k_print_error, "pak: can't read %s\n", source);
+			heap_free(heap, fs_work_get_buffer(work));
+			fs_work_destroy(work);
+			ok = false;
+			break;
+		}
+		void* data = fs_work_get_buffer(work);
+		size_t size = fs_work_get_size(work);
+		fs_work_destroy(work);
+
+		size_t compressed_size = 0;
+		void* compressed = codec ? fs_pak_compress(heap, codec, data, size, &compressed_size) : NULL;
+
+		fs_pak_pad(&writer, k_fs_pak_default_alignment);
+		toc[i] = (fs_pak_entry_t)
+		{
+			.path_hash = fs_pak_hash_path(names[i]),
+			.offset = writer.size,
+			.size = compressed ? compressed_size : size,
+			.raw_size = size,
+			.codec = compressed ? k_fs_pak_codec_container : k_fs_pak_codec_raw,
+		};
+		fs_pak_append(&writer, compressed ? compressed : data, (size_t)toc[i].size);
+
+		if (compressed)
+		{
+			heap_free(heap, compressed);
+		}
+		heap_free(heap, data);
+	}
+
+	qsort(toc, count, sizeof(fs_pak_entry_t), fs_pak_compare_entries);
+	for (int i = 1; i < count && ok; ++i)
+	{
+		if (toc[i].path_hash == toc[i - 1].path_hash)
+		{
+			debug_print(k_print_error, "pak: two paths share hash %016llx\n", (unsigned long long)toc[i].path_hash);
+			ok = false;
+		}
+	}
+
+	if (ok)
+	{
+		fs_pak_pad(&writer, 8);
+		fs_pak_header_t header =
+		{
+			.magic = k_fs_pak_magic,
+			.version = k_fs_pak_version,
+			.entry_count = (uint32_t)count,
+			.alignment = k_fs_pak_default_alignment,
+			.toc_offset = writer.size,
+		};
+		fs_pak_append(&writer, toc, sizeof(fs_pak_entry_t) * count);
+		memcpy(writer.data, &header, sizeof(header));
+
+		// Replaced atomically, so a failed build leaves any previous pak intact.
+		fs_work_t* work = fs_write_ex(fs, pak_path, writer.data, writer.size, false, &(fs_work_options_t) { .write_mode = k_fs_write_atomic });
+		ok = fs_work_get_result(work) == 0;
+		fs_work_destroy(work);
+		if (!ok)
+		{
+			debug_print(k_print_error, "pak: failed writing %s\n", pak_path);
+		}
+	}
+
+	heap_free(heap, writer.data);
+	fs_destroy(fs);
+	heap_free(heap, toc);
+	return ok;
+}
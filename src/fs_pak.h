@@ -0,0 +1,76 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Packed asset archive.
+//
+// Layout: a header, then blobs each starting on an alignment boundary, then a
+// table of contents sorted by path hash. A path's hash is the XXH64 of the path
+// with backslashes turned into forward slashes, so lookups are a binary search
+// with no string compares. Blobs are stored raw or as an fs block container
+// (see fs_container.h). All fields are little-endian.
+//
+// Mount a pak with fs_mount(); fs_read() then finds assets in it before disk.
+
+enum
+{
+	k_fs_pak_magic = 0x4b415043, // "CPAK"
+	k_fs_pak_version = 1,
+	k_fs_pak_default_alignment = 4096,
+	// Longest path, in bytes, that hashes in full. fs_pak_build() rejects
+	// longer names.
+	k_fs_pak_max_path = 1023,
+};
+
+typedef enum fs_pak_codec_t
+{
+	k_fs_pak_codec_raw,
+	// An fs block container, as written by fs_write() with compression.
+	k_fs_pak_codec_container,
+} fs_pak_codec_t;
+
+typedef struct fs_pak_header_t
+{
+	uint32_t magic;
+	uint32_t version;
+	uint32_t entry_count;
+	uint32_t alignment;
+	uint64_t toc_offset;
+} fs_pak_header_t;
+
+typedef struct fs_pak_entry_t
+{
+	uint64_t path_hash;
+	uint64_t offset;
+	// Bytes stored in the pak.
+	uint64_t size;
+	// Bytes once decoded.
+	uint64_t raw_size;
+	uint32_t codec;
+	uint32_t reserved;
+} fs_pak_entry_t;
+
+typedef struct fs_container_codec_t fs_container_codec_t;
+typedef struct heap_t heap_t;
+
+// Hash a path the way pak tables of contents are keyed.
+// Only the first k_fs_pak_max_path bytes count.
+uint64_t fs_pak_hash_path(const char* path);
+
+// Binary search a sorted table of contents. Returns NULL if the path is not there.
+const fs_pak_entry_t* fs_pak_find(const fs_pak_entry_t* toc, uint32_t count, uint64_t path_hash);
+
+// Check a header read from disk is one we understand.
+bool fs_pak_check_header(const fs_pak_header_t* header);
+
+// Offline packer.
+// Writes count files into a pak at pak_path. names[i] is the path the asset is
+// looked up by; sources[i] is where to read it now (names are used if NULL).
+// With a codec, blobs that shrink are stored as block containers coded with
+// it; offline builds can afford LZ4 HC. NULL stores every blob raw.
+// Returns false, printing why, if a source can't be read, two names hash the
+// same, or the pak can't be written.
+bool fs_pak_build(heap_t* heap, const char* pak_path, const char* const* names, const char* const* sources, int count,
+	const fs_container_codec_t* codec);
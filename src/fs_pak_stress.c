@@ -0,0 +1,117 @@
+#include "fs_stress.h"
+
+#include "debug.h"
+#include "fs.h"
+#include "fs_container.h"
+#include "fs_pak.h"
+#include "heap.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+// Packs compressible and random files, mounts the pak on both backends and
+// reads them back by name; a name missing from the pak still reads from disk.
+static bool run_fs_pak_stress(heap_t* heap, fs_backend_t backend)
+{
+	enum { k_file_count = 4 };
+	const char* names[k_file_count] = { "stress_pak\\a.bin", "stress_pak/b.bin", "stress_pak/c.bin", "stress_pak/empty.bin" };
+	const char* sources[k_file_count] = { "stress_pak_a.bin", "stress_pak_b.bin", "stress_pak_c.bin", "stress_pak_empty.bin" };
+	const size_t sizes[k_file_count] = { 5 * k_fs_stress_file_size, k_fs_stress_file_size + 3, 200000, 0 };
+	const char* pak_path = "stress.pak";
+	const char* loose_path = "stress_pak_loose.bin";
+
+	fs_t* fs = fs_create_ex(heap, &(fs_options_t) { .backend = backend });
+	char* contents[k_file_count];
+	for (int i = 0; i < k_file_count; ++i)
+	{
+		contents[i] = heap_alloc(heap, sizes[i] + 1, 8);
+		fs_stress_fill_file(contents[i], sizes[i], 3, i);
+		if (i == 2)
+		{
+			// Incompressible, so it is stored raw even in a compressed pak.
+			uint32_t seed = 12345;
+			for (size_t j = 0; j < sizes[i]; ++j)
+			{
+				seed = seed * 1664525 + 1013904223;
+				contents[i][j] = (char)(seed >> 24);
+			}
+		}
+		fs_work_destroy(fs_write(fs, sources[i], contents[i], sizes[i], false));
+	}
+	fs_work_destroy(fs_write(fs, loose_path, contents[1], sizes[1], false));
+
+	int failures = 0;
+	failures += !fs_pak_build(heap, pak_path, names, sources, k_file_count, &(fs_container_codec_t) { .level = 9 });
+	failures += !fs_mount(fs, pak_path);
+	for (int i = 0; i < k_file_count; ++i)
+	{
+		remove(sources[i]);
+	}
+
+	for (int i = 0; i < k_file_count; ++i)
+	{
+		// Separators don't matter, and neither does the caller's compression flag.
+		char lookup[64];
+		snprintf(lookup, sizeof(lookup), "%s", names[i]);
+		for (char* c = lookup; *c; ++c)
+		{
+			*c = *c == '\\' ? '/' : *c;
+		}
+		fs_work_t* work = fs_read(fs, lookup, heap, true, i & 1);
+		fs_work_wait(work);
+		if (fs_work_get_result(work) != 0 ||
+			fs_work_get_size(work) != sizes[i] ||
+			memcmp(fs_work_get_buffer(work), contents[i], sizes[i]) != 0 ||
+			((char*)fs_work_get_buffer(work))[sizes[i]] != 0)
+		{
+			failures++;
+		}
+		heap_free(heap, fs_work_get_buffer(work));
+		fs_work_destroy(work);
+	}
+
+	fs_work_t* work = fs_read(fs, loose_path, heap, false, false);
+	if (fs_work_get_result(work) != 0 || fs_work_get_size(work) != sizes[1] ||
+		memcmp(fs_work_get_buffer(work), contents[1], sizes[1]) != 0)
+	{
+		failures++;
+	}
+	heap_free(heap, fs_work_get_buffer(work));
+	fs_work_destroy(work);
+
+	work = fs_read(fs, "stress_pak/missing.bin", heap, false, false);
+	failures += fs_work_get_result(work) == 0;
+	fs_work_destroy(work);
+
+	failures += fs_mount(fs, loose_path);
+
+	// A name too long to hash in full is refused, leaving the pak as it was.
+	char long_name[k_fs_pak_max_path + 2];
+	memset(long_name, 'a', sizeof(long_name) - 1);
+	long_name[sizeof(long_name) - 1] = 0;
+	const char* long_names[] = { long_name };
+	failures += fs_pak_build(heap, pak_path, long_names, &loose_path, 1, NULL);
+
+	fs_destroy(fs);
+	remove(pak_path);
+	remove(loose_path);
+	for (int i = 0; i < k_file_count; ++i)
+	{
+		heap_free(heap, contents[i]);
+	}
+
+	bool ok = failures == 0;
+	debug_print(ok ? k_print_info : k_print_error,
+		"[%s] fs pak io_uring=%d: %s failures=%d\n", THREAD_STRESS_BACKEND, backend == k_fs_backend_io_uring, ok ? "ok" : "FAILED", failures);
+	return ok;
+}
+
+bool fs_pak_stress_run(heap_t* heap)
+{
+	bool ok = true;
+	ok &= run_fs_pak_stress(heap, k_fs_backend_threads);
+	ok &= run_fs_pak_stress(heap, k_fs_backend_io_uring);
+
+	return ok;
+}
@@ -0,0 +1,204 @@
+#include "fs_path.h"
+
+#include "fast_mutex.h"
+#include "fs_pak.h"
+#include "heap.h"
+
+#include <stdbool.h>
+#include <string.h>
+
+enum
+{
+	// Entries are kept in fixed chunks that never move, so lookups need no lock.
+	k_fs_path_chunk_bits = 12,
+	k_fs_path_chunk_size = 1 << k_fs_path_chunk_bits,
+	k_fs_path_max_chunks = 4096,
+	k_fs_path_initial_slots = 1024,
+	// Strings are packed into blocks of this size; longer ones get their own.
+	k_fs_path_block_size = 64 * 1024,
+};
+
+typedef struct fs_path_entry_t
+{
+	uint64_t hash;
+	const char* string;
+} fs_path_entry_t;
+
+// Storage for strings. Blocks are chained so the table can free them.
+typedef struct fs_path_block_t
+{
+	struct fs_path_block_t* next;
+} fs_path_block_t;
+
+typedef struct fs_path_table_t
+{
+	heap_t* heap;
+	fast_mutex_t* lock;
+	fs_path_entry_t* chunks[k_fs_path_max_chunks];
+	uint32_t count;
+	uint32_t max_count;
+	// Open addressing hash of IDs, for interning. Zero marks an empty slot,
+	// which works because the empty path is never looked up here.
+	fs_path_id_t* slots;
+	uint32_t slot_count;
+	fs_path_block_t* blocks;
+	size_t block_used;
+} fs_path_table_t;
+
+static fs_path_entry_t* fs_path_entry(fs_path_table_t* table, fs_path_id_t id)
+{
+	id = id == k_fs_path_invalid ? 0 : id;
+	return &table->chunks[id >> k_fs_path_chunk_bits][id & (k_fs_path_chunk_size - 1)];
+}
+
+// Copy a string into block storage. Called with the lock held.
+static const char* fs_path_store(fs_path_table_t* table, const char* path, size_t size)
+{
+	if (size > k_fs_path_block_size / 4)
+	{
+		fs_path_block_t* own = heap_alloc(table->heap, sizeof(fs_path_block_t) + size, 8);
+		// Behind the current block, so packing carries on where it was.
+		own->next = table->blocks->next;
+		table->blocks->next = own;
+		memcpy(own + 1, path, size);
+		return (const char*)(own + 1);
+	}
+	if (table->block_used + size > k_fs_path_block_size)
+	{
+		fs_path_block_t* block = heap_alloc(table->heap, sizeof(fs_path_block_t) + k_fs_path_block_size, 8);
+		block->next = table->blocks;
+		table->blocks = block;
+		table->block_used = 0;
+	}
+	char* string = (char*)(table->blocks + 1) + table->block_used;
+	memcpy(string, path, size);
+	table->block_used += size;
+	return string;
+}
+
+// Double the slots and rehash. Called with the lock held.
+static void fs_path_grow(fs_path_table_t* table)
+{
+	uint32_t slot_count = table->slot_count * 2;
+	fs_path_id_t* slots = heap_alloc(table->heap, sizeof(fs_path_id_t) * slot_count, 8);
+	memset(slots, 0, sizeof(fs_path_id_t) * slot_count);
+	for (uint32_t i = 0; i < table->slot_count; ++i)
+	{
+		fs_path_id_t id = table->slots[i];
+		if (id)
+		{
+			uint32_t slot = (uint32_t)fs_path_entry(table, id)->hash & (slot_count - 1);
+			while (slots[slot])
+			{
+				slot = (slot + 1) & (slot_count - 1);
+			}
+			slots[slot] = id;
+		}
+	}
+	heap_free(table->heap, table->slots);
+	table->slots = slots;
+	table->slot_count = slot_count;
+}
+
+fs_path_table_t* fs_path_table_create(heap_t* heap, uint32_t max_count)
+{
+	fs_path_table_t* table = heap_alloc(heap, sizeof(fs_path_table_t), 8);
+	memset(table, 0, sizeof(*table));
+	table->heap = heap;
+	uint32_t capacity = (uint32_t)k_fs_path_max_chunks << k_fs_path_chunk_bits;
+	table->max_count = max_count > 0 && max_count < capacity ? max_count : capacity;
+	table->lock = fast_mutex_create(heap);
+	table->slot_count = k_fs_path_initial_slots;
+	table->slots = heap_alloc(heap, sizeof(fs_path_id_t) * table->slot_count, 8);
+	memset(table->slots, 0, sizeof(fs_path_id_t) * table->slot_count);
+	table->blocks = heap_alloc(heap, sizeof(fs_path_block_t) + k_fs_path_block_size, 8);
+	table->blocks->next = NULL;
+
+	// ID zero is the empty path.
+	table->chunks[0] = heap_alloc(heap, sizeof(fs_path_entry_t) * k_fs_path_chunk_size, 8);
+	table->chunks[0][0] = (fs_path_entry_t) { .hash = fs_pak_hash_path(""), .string = fs_path_store(table, "", 1) };
+	table->count = 1;
+	return table;
+}
+
+void fs_path_table_destroy(fs_path_table_t* table)
+{
+	for (int i = 0; i < k_fs_path_max_chunks && table->chunks[i]; ++i)
+	{
+		heap_free(table->heap, table->chunks[i]);
+	}
+	fs_path_block_t* block = table->blocks;
+	while (block)
+	{
+		fs_path_block_t* next = block->next;
+		heap_free(table->heap, block);
+		block = next;
+	}
+	heap_free(table->heap, table->slots);
+	fast_mutex_destroy(table->lock);
+	heap_free(table->heap, table);
+}
+
+fs_path_id_t fs_path_intern(fs_path_table_t* table, const char* path)
+{
+	if (!path[0])
+	{
+		return 0;
+	}
+	// Hashed before taking the lock; equal strings always hash the same.
+	uint64_t hash = fs_pak_hash_path(path);
+
+	fast_mutex_lock(table->lock);
+	uint32_t slot = (uint32_t)hash & (table->slot_count - 1);
+	while (table->slots[slot])
+	{
+		fs_path_id_t id = table->slots[slot];
+		const fs_path_entry_t* entry = fs_path_entry(table, id);
+		if (entry->hash == hash && strcmp(entry->string, path) == 0)
+		{
+			fast_mutex_unlock(table->lock);
+			return id;
+		}
+		slot = (slot + 1) & (table->slot_count - 1);
+	}
+
+	fs_path_id_t id = table->count;
+	if (id == table->max_count)
+	{
+		fast_mutex_unlock(table->lock);
+		return k_fs_path_invalid;
+	}
+	uint32_t chunk = id >> k_fs_path_chunk_bits;
+	if (!table->chunks[chunk])
+	{
+		table->chunks[chunk] = heap_alloc(table->heap, sizeof(fs_path_entry_t) * k_fs_path_chunk_size, 8);
+	}
+	*fs_path_entry(table, id) = (fs_path_entry_t) { .hash = hash, .string = fs_path_store(table, path, strlen(path) + 1) };
+	table->slots[slot] = id;
+	table->count++;
+	// Keep the slots at most half full, so probes stay short.
+	if (table->count * 2 > table->slot_count)
+	{
+		fs_path_grow(table);
+	}
+	fast_mutex_unlock(table->lock);
+	return id;
+}
+
+const char* fs_path_get_string(fs_path_table_t* table, fs_path_id_t id)
+{
+	return fs_path_entry(table, id)->string;
+}
+
+uint64_t fs_path_get_hash(fs_path_table_t* table, fs_path_id_t id)
+{
+	return fs_path_entry(table, id)->hash;
+}
+
+uint32_t fs_path_table_get_count(fs_path_table_t* table)
+{
+	fast_mutex_lock(table->lock);
+	uint32_t count = table->count;
+	fast_mutex_unlock(table->lock);
+	return count;
+}
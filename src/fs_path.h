@@ -0,0 +1,52 @@
+#pragma once
+
+#include <stdint.h>
+
+// Interned paths.
+//
+// Each distinct path string gets a 32-bit ID, stored once along with its pak
+// path hash (see fs_pak_hash_path()), so queued work carries four bytes
+// instead of a copy of the path, and pak and cache lookups hash nothing.
+// Paths are compared exactly: "a\b" and "a/b" get different IDs but the same
+// hash.
+//
+// IDs are never released; a table grows with the number of distinct paths it
+// has seen, which for a game's assets is bounded, up to its limit. An empty
+// table already holds about 165 KB: the chunk directory, the first chunk of
+// entries, the hash slots and the first string block. Interning takes a lock.
+// Looking an ID up does not, and is safe from any thread the ID was handed to.
+
+// Handle to a table of interned paths.
+typedef struct fs_path_table_t fs_path_table_t;
+
+typedef struct heap_t heap_t;
+
+// Compact name for an interned path. Zero is always the empty path.
+typedef uint32_t fs_path_id_t;
+
+enum
+{
+	// What fs_path_intern() returns when the table is full. Larger than any
+	// ID a table hands out; looking it up gives the empty path.
+	k_fs_path_invalid = 0x7fffffff,
+};
+
+// Create an empty table that holds up to max_count paths, the empty path
+// included. Zero, or more than 16 million, means 16 million.
+fs_path_table_t* fs_path_table_create(heap_t* heap, uint32_t max_count);
+
+// Free a table and every path in it.
+void fs_path_table_destroy(fs_path_table_t* table);
+
+// The ID of path, adding it if it is new.
+// Returns k_fs_path_invalid if the table is full.
+fs_path_id_t fs_path_intern(fs_path_table_t* table, const char* path);
+
+// The path an ID stands for. Valid until the table is destroyed.
+const char* fs_path_get_string(fs_path_table_t* table, fs_path_id_t id);
+
+// The path's hash, as fs_pak_hash_path() computes it.
+uint64_t fs_path_get_hash(fs_path_table_t* table, fs_path_id_t id);
+
+// Number of paths interned, counting the empty path.
+uint32_t fs_path_table_get_count(fs_path_table_t* table);
@@ -0,0 +1,1506 @@
+#include "fs_stress.h"
+
+#include "debug.h"
+#include "event.h"
+#include "fs.h"
+#include "fs_container.h"
+#include "fs_journal.h"
+#include "fs_pak.h"
+#include "fs_path.h"
+#include "fs_watch.h"
+#include "heap.h"
+#include "thread.h"
+#include "timer.h"
+#include "trace.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+enum
+{
+	k_fs_stress_max_threads = 16,
+	k_fs_stress_files = 16,
+};
+
+typedef struct fs_stress_t
+{
+	heap_t* heap;
+	fs_t* fs;
+	event_t* start;
+	int thread_index;
+	int failures;
+} fs_stress_t;
+
+// Deterministic file contents. Compressible when the file index is even.
+void fs_stress_fill_file(char* buffer, size_t size, int thread_index, int file_index)
+{
+	uint32_t state = (uint32_t)(thread_index * 7919 + file_index * 104729 + 1);
+	for (size_t i = 0; i < size; ++i)
+	{
+		if (file_index & 1)
+		{
+			state = state * 1664525u + 1013904223u;
+			buffer[i] = (char)(state >> 24);
+		}
+		else
+		{
+			buffer[i] = (char)('a' + ((i / 64 + thread_index + file_index) % 26));
+		}
+	}
+}
+
+static int fs_stress_func(void* user)
+{
+	fs_stress_t* stress = user;
+	event_wait(stress->start);
+
+	char path[k_fs_stress_files][64];
+	char* contents[k_fs_stress_files];
+	fs_work_t* work[k_fs_stress_files];
+
+	// Write everything, alternating compression, then read it all back.
+	for (int i = 0; i < k_fs_stress_files; ++i)
+	{
+		snprintf(path[i], sizeof(path[i]), "stress_%d_%d.bin", stress->thread_index, i);
+		contents[i] = heap_alloc(stress->heap, k_fs_stress_file_size, 8);
+		fs_stress_fill_file(contents[i], k_fs_stress_file_size, stress->thread_index, i);
+		work[i] = fs_write(stress->fs, path[i], contents[i], k_fs_stress_file_size, (i & 2) != 0);
+	}
+	for (int i = 0; i < k_fs_stress_files; ++i)
+	{
+		if (fs_work_get_result(work[i]) != 0)
+		{
+			stress->failures++;
+		}
+		fs_work_destroy(work[i]);
+	}
+	for (int i = 0; i < k_fs_stress_files; ++i)
+	{
+		work[i] = fs_read(stress->fs, path[i], stress->heap, false, (i & 2) != 0);
+	}
+	for (int i = 0; i < k_fs_stress_files; ++i)
+	{
+		void* buffer = fs_work_get_buffer(work[i]);
+		if (fs_work_get_result(work[i]) != 0 ||
+			fs_work_get_size(work[i]) != k_fs_stress_file_size ||
+			memcmp(buffer, contents[i], k_fs_stress_file_size) != 0)
+		{
+			stress->failures++;
+		}
+		if (buffer)
+		{
+			heap_free(stress->heap, buffer);
+		}
+		fs_work_destroy(work[i]);
+		heap_free(stress->heap, contents[i]);
+		remove(path[i]);
+	}
+	return 0;
+}
+
+static bool run_fs_stress(heap_t* heap, int thread_count, int queue_capacity, int pool_threads, fs_backend_t backend)
+{
+	fs_options_t options =
+	{
+		.queue_capacity = queue_capacity,
+		.file_thread_count = pool_threads,
+		.compress_thread_count = pool_threads,
+		.backend = backend,
+	};
+	fs_t* fs = fs_create_ex(heap, &options);
+	event_t* start = event_create();
+
+	fs_stress_t stress[k_fs_stress_max_threads];
+	thread_t* threads[k_fs_stress_max_threads];
+	for (int i = 0; i < thread_count; ++i)
+	{
+		stress[i] = (fs_stress_t)
+		{
+			.heap = heap,
+			.fs = fs,
+			.start = start,
+			.thread_index = i,
+		};
+		threads[i] = thread_create(fs_stress_func, &stress[i]);
+	}
+
+	uint64_t t0 = timer_get_ticks();
+	event_signal(start);
+	int failures = 0;
+	for (int i = 0; i < thread_count; ++i)
+	{
+		thread_destroy(threads[i]);
+		failures += stress[i].failures;
+	}
+	uint64_t t1 = timer_get_ticks();
+
+	bool io_uring = fs_is_io_uring(fs);
+	event_destroy(start);
+	fs_destroy(fs);
+
+	bool ok = failures == 0;
+	debug_print(ok ? k_print_info : k_print_error,
+		"[%s] fs%s threads=%d cap=%d pool=%d files=%d: %s failures=%d time=%uus\n",
+		THREAD_STRESS_BACKEND, io_uring ? " io_uring" : "", thread_count, queue_capacity, pool_threads, thread_count * k_fs_stress_files,
+		ok ? "ok" : "FAILED", failures, (uint32_t)timer_ticks_to_us(t1 - t0));
+	return ok;
+}
+
+// Writes a batch of files, then reads them all back through one completion channel.
+static bool run_fs_completion_stress(heap_t* heap, int queue_capacity)
+{
+	fs_t* fs = fs_create(heap, queue_capacity);
+	fs_completion_t* completion = fs_completion_create(heap);
+
+	char path[k_fs_stress_files][64];
+	char* contents = heap_alloc(heap, k_fs_stress_file_size, 8);
+	for (int i = 0; i < k_fs_stress_files; ++i)
+	{
+		snprintf(path[i], sizeof(path[i]), "stress_completion_%d.bin", i);
+		fs_stress_fill_file(contents, k_fs_stress_file_size, 0, i);
+		fs_work_destroy(fs_write(fs, path[i], contents, k_fs_stress_file_size, false));
+	}
+
+	uint64_t t0 = timer_get_ticks();
+	bool seen[k_fs_stress_files] = { 0 };
+	for (int i = 0; i < k_fs_stress_files; ++i)
+	{
+		fs_work_options_t options = { .completion = completion, .user_data = &seen[i] };
+		fs_read_ex(fs, path[i], heap, false, false, &options);
+	}
+
+	int received = 0;
+	int failures = 0;
+	while (received < k_fs_stress_files)
+	{
+		fs_work_t* batch[k_fs_stress_files];
+		int count = fs_completion_drain(completion, batch, k_fs_stress_files);
+		if (count == 0)
+		{
+			batch[0] = fs_completion_wait(completion);
+			count = 1;
+		}
+		for (int i = 0; i < count; ++i)
+		{
+			bool* flag = fs_work_get_user_data(batch[i]);
+			if (*flag || fs_work_get_result(batch[i]) != 0 || fs_work_get_size(batch[i]) != k_fs_stress_file_size)
+			{
+				failures++;
+			}
+			*flag = true;
+			heap_free(heap, fs_work_get_buffer(batch[i]));
+			fs_work_destroy(batch[i]);
+		}
+		received += count;
+	}
+	uint64_t t1 = timer_get_ticks();
+
+	for (int i = 0; i < k_fs_stress_files; ++i)
+	{
+		remove(path[i]);
+	}
+	heap_free(heap, contents);
+	fs_completion_destroy(completion);
+	fs_destroy(fs);
+
+	bool ok = failures == 0;
+	debug_print(ok ? k_print_info : k_print_error,
+		"[%s] fs completion cap=%d files=%d: %s failures=%d time=%uus\n",
+		THREAD_STRESS_BACKEND, queue_capacity, k_fs_stress_files,
+		ok ? "ok" : "FAILED", failures, (uint32_t)timer_ticks_to_us(t1 - t0));
+	return ok;
+}
+
+bool fs_stress_stream_func(const void* data, size_t size, uint64_t offset, void* user)
+{
+	fs_stress_stream_t* stream = user;
+	if (offset != stream->next_offset || size == 0 || size > stream->chunk_size ||
+		memcmp(data, stream->expected + offset, size) != 0)
+	{
+		stream->failures++;
+	}
+	stream->next_offset = offset + size;
+	return stream->next_offset < stream->stop_after;
+}
+
+// Round-trips a multi-block compressed file, reads each block on its own,
+// then corrupts blocks and expects whole, block and stream reads to report
+// k_fs_result_corrupt, unless verification is skipped.
+static bool run_fs_block_stress(heap_t* heap, int queue_capacity, int pool_threads)
+{
+	fs_options_t options =
+	{
+		.queue_capacity = queue_capacity,
+		.file_thread_count = pool_threads,
+		.compress_thread_count = pool_threads,
+		.compress_block_size = k_fs_container_min_block_size,
+	};
+	fs_t* fs = fs_create_ex(heap, &options);
+	const char* path = "stress_blocks.bin";
+	const size_t size = 9 * k_fs_container_min_block_size + 12345;
+	const uint32_t block_count = fs_container_block_count(size, k_fs_container_min_block_size);
+
+	// Compressible first half, incompressible second half, so both block kinds are stored.
+	char* contents = heap_alloc(heap, size, 8);
+	fs_stress_fill_file(contents, size / 2, 0, 0);
+	fs_stress_fill_file(contents + size / 2, size - size / 2, 0, 1);
+
+	uint64_t t0 = timer_get_ticks();
+	int failures = 0;
+	fs_work_t* work = fs_write(fs, path, contents, size, true);
+	failures += fs_work_get_result(work) != 0;
+	fs_work_destroy(work);
+
+	work = fs_read(fs, path, heap, false, true);
+	if (fs_work_get_result(work) != 0 || fs_work_get_size(work) != size || memcmp(fs_work_get_buffer(work), contents, size) != 0)
+	{
+		failures++;
+	}
+	heap_free(heap, fs_work_get_buffer(work));
+	fs_work_destroy(work);
+
+	fs_work_t* blocks[16];
+	for (uint32_t i = 0; i < block_count; ++i)
+	{
+		blocks[i] = fs_read_block(fs, path, heap, i);
+	}
+	for (uint32_t i = 0; i < block_count; ++i)
+	{
+		size_t offset = (size_t)i * k_fs_container_min_block_size;
+		size_t expected = size - offset < k_fs_container_min_block_size ? size - offset : k_fs_container_min_block_size;
+		if (fs_work_get_result(blocks[i]) != 0 || fs_work_get_size(blocks[i]) != expected ||
+			memcmp(fs_work_get_buffer(blocks[i]), contents + offset, expected) != 0)
+		{
+			failures++;
+		}
+		heap_free(heap, fs_work_get_buffer(blocks[i]));
+		fs_work_destroy(blocks[i]);
+	}
+
+	work = fs_read_block(fs, path, heap, block_count);
+	failures += fs_work_get_result(work) == 0;
+	fs_work_destroy(work);
+
+	// Flip a byte inside block 1's stored data and write the file back raw.
+	work = fs_read(fs, path, heap, false, false);
+	char* raw = fs_work_get_buffer(work);
+	size_t raw_size = fs_work_get_size(work);
+	const fs_container_header_t* header;
+	const fs_container_block_t* table;
+	if (fs_work_get_result(work) == 0 && fs_container_parse(raw, raw_size, &header, &table))
+	{
+		// The last block is incompressible, so stored raw: a flipped byte
+		// still decodes and only the checksum can catch it.
+		const fs_container_block_t* last = &table[block_count - 1];
+		uint32_t last_size = fs_container_block_raw_size(header, block_count - 1);
+		failures += last->compressed_size != last_size;
+		raw[last->offset + last_size / 2] ^= 0x5a;
+		fs_work_destroy(fs_write(fs, path, raw, raw_size, false));
+
+		// Failed reads hand back nothing, not the compressed bytes.
+		fs_work_t* corrupt = fs_read(fs, path, heap, true, true);
+		failures += fs_work_get_result(corrupt) != k_fs_result_corrupt || fs_work_get_buffer(corrupt) != NULL;
+		fs_work_destroy(corrupt);
+
+		corrupt = fs_read_block(fs, path, heap, block_count - 1);
+		failures += fs_work_get_result(corrupt) != k_fs_result_corrupt || fs_work_get_buffer(corrupt) != NULL;
+		fs_work_destroy(corrupt);
+		corrupt = fs_read_block(fs, path, heap, 0);
+		failures += fs_work_get_result(corrupt) != 0;
+		heap_free(heap, fs_work_get_buffer(corrupt));
+		fs_work_destroy(corrupt);
+
+		fs_stress_stream_t stream = { .expected = contents, .chunk_size = 10000, .stop_after = UINT64_MAX };
+		corrupt = fs_read_stream(fs, path, true, stream.chunk_size, fs_stress_stream_func, &stream);
+		failures += fs_work_get_result(corrupt) != k_fs_result_corrupt || stream.failures != 0;
+		fs_work_destroy(corrupt);
+
+		// Skipping verification hands back the damaged bytes.
+		corrupt = fs_read_ex(fs, path, heap, false, true, &(fs_work_options_t) { .skip_verify = true });
+		char* damaged = fs_work_get_buffer(corrupt);
+		if (fs_work_get_result(corrupt) != 0 || fs_work_get_size(corrupt) != size || memcmp(damaged, contents, size) == 0)
+		{
+			failures++;
+		}
+		else
+		{
+			damaged[size - last_size + last_size / 2] ^= 0x5a;
+			failures += memcmp(damaged, contents, size) != 0;
+		}
+		heap_free(heap, damaged);
+		fs_work_destroy(corrupt);
+
+		// A traced file system records each check, and still catches the damage.
+		const char* trace_path = "stress_blocks_trace.json";
+		trace_t* trace = trace_create(heap, 16);
+		options.trace = trace;
+		fs_t* traced = fs_create_ex(heap, &options);
+		trace_capture_start(trace, trace_path);
+		corrupt = fs_read(traced, path, heap, false, true);
+		failures += fs_work_get_result(corrupt) != k_fs_result_corrupt;
+		fs_work_destroy(corrupt);
+		failures += trace_capture_stop(trace) != 0;
+		fs_destroy(traced);
+		trace_destroy(trace);
+		fs_work_t* capture = fs_read(fs, trace_path, heap, true, false);
+		failures += fs_work_get_result(capture) != 0 || !strstr(fs_work_get_buffer(capture), "\"fs verify\"");
+		heap_free(heap, fs_work_get_buffer(capture));
+		fs_work_destroy(capture);
+		remove(trace_path);
+
+		raw[table[1].offset + table[1].compressed_size / 2] ^= 0x5a;
+		fs_work_destroy(fs_write(fs, path, raw, raw_size, false));
+
+		corrupt = fs_read(fs, path, heap, false, true);
+		failures += fs_work_get_result(corrupt) != k_fs_result_corrupt;
+		heap_free(heap, fs_work_get_buffer(corrupt));
+		fs_work_destroy(corrupt);
+	}
+	else
+	{
+		failures++;
+	}
+	heap_free(heap, raw);
+	fs_work_destroy(work);
+
+	// Garbage that passes for the legacy format's size header, read with
+	// a terminator: the failure must not write past the compressed bytes.
+	const char garbage[16] = { 0x40, 0, 0, 0, 'n', 'o', 't', ' ', 'l', 'z', '4', '!', 0x11, 0x22, 0x33, 0x44 };
+	fs_work_destroy(fs_write(fs, path, garbage, sizeof(garbage), false));
+	for (int i = 0; i < 8; ++i)
+	{
+		work = fs_read(fs, path, heap, true, true);
+		failures += fs_work_get_result(work) == 0 || fs_work_get_buffer(work) != NULL || fs_work_get_size(work) != 0;
+		fs_work_destroy(work);
+		heap_free(heap, heap_alloc(heap, 16 + i, 8));
+	}
+	uint64_t t1 = timer_get_ticks();
+
+	remove(path);
+	heap_free(heap, contents);
+	fs_destroy(fs);
+
+	bool ok = failures == 0;
+	debug_print(ok ? k_print_info : k_print_error,
+		"[%s] fs blocks cap=%d pool=%d blocks=%u: %s failures=%d time=%uus\n",
+		THREAD_STRESS_BACKEND, queue_capacity, pool_threads, block_count,
+		ok ? "ok" : "FAILED", failures, (uint32_t)timer_ticks_to_us(t1 - t0));
+	return ok;
+}
+
+// Streams a multi-block file both raw and compressed, checking order, chunk
+// bounds and contents, then stops one stream part way.
+static bool run_fs_stream_stress(heap_t* heap)
+{
+	fs_t* fs = fs_create_ex(heap, &(fs_options_t) { .compress_block_size = k_fs_container_min_block_size });
+	const char* raw_path = "stress_stream_raw.bin";
+	const char* compressed_path = "stress_stream_lz4.bin";
+	const size_t size = 7 * k_fs_container_min_block_size + 4321;
+
+	char* contents = heap_alloc(heap, size, 8);
+	fs_stress_fill_file(contents, size / 2, 1, 0);
+	fs_stress_fill_file(contents + size / 2, size - size / 2, 1, 1);
+	fs_work_destroy(fs_write(fs, raw_path, contents, size, false));
+	fs_work_destroy(fs_write(fs, compressed_path, contents, size, true));
+
+	uint64_t t0 = timer_get_ticks();
+	int failures = 0;
+	for (int compressed = 0; compressed < 2; ++compressed)
+	{
+		const char* path = compressed ? compressed_path : raw_path;
+
+		fs_stress_stream_t stream = { .expected = contents, .chunk_size = 10000, .stop_after = UINT64_MAX };
+		fs_work_t* work = fs_read_stream(fs, path, compressed != 0, stream.chunk_size, fs_stress_stream_func, &stream);
+		if (fs_work_get_result(work) != 0 || fs_work_get_size(work) != size || stream.next_offset != size)
+		{
+			failures++;
+		}
+		fs_work_destroy(work);
+		failures += stream.failures;
+
+		stream = (fs_stress_stream_t) { .expected = contents, .chunk_size = 4096, .stop_after = size / 3 };
+		work = fs_read_stream(fs, path, compressed != 0, stream.chunk_size, fs_stress_stream_func, &stream);
+		if (fs_work_get_result(work) != 0 || fs_work_get_size(work) >= size || stream.next_offset < size / 3)
+		{
+			failures++;
+		}
+		fs_work_destroy(work);
+		failures += stream.failures;
+	}
+	uint64_t t1 = timer_get_ticks();
+
+	remove(raw_path);
+	remove(compressed_path);
+	heap_free(heap, contents);
+	fs_destroy(fs);
+
+	bool ok = failures == 0;
+	debug_print(ok ? k_print_info : k_print_error,
+		"[%s] fs stream bytes=%u: %s failures=%d time=%uus\n",
+		THREAD_STRESS_BACKEND, (uint32_t)size, ok ? "ok" : "FAILED", failures, (uint32_t)timer_ticks_to_us(t1 - t0));
+	return ok;
+}
+
+// Maps a written file and an empty one, and checks a missing file fails.
+static bool run_fs_map_stress(heap_t* heap)
+{
+	fs_t* fs = fs_create(heap, 8);
+	const char* path = "stress_map.bin";
+	const char* empty_path = "stress_map_empty.bin";
+	const size_t size = 3 * k_fs_stress_file_size + 17;
+
+	char* contents = heap_alloc(heap, size, 8);
+	fs_stress_fill_file(contents, size, 2, 1);
+	fs_work_destroy(fs_write(fs, path, contents, size, false));
+	fs_work_destroy(fs_write(fs, empty_path, contents, 0, false));
+
+	int failures = 0;
+	fs_map_t* map = fs_map(fs, path);
+	if (!map || fs_map_get_size(map) != size || memcmp(fs_map_get_data(map), contents, size) != 0)
+	{
+		failures++;
+	}
+	fs_unmap(map);
+
+	map = fs_map(fs, empty_path);
+	if (!map || fs_map_get_size(map) != 0)
+	{
+		failures++;
+	}
+	fs_unmap(map);
+
+	failures += fs_map(fs, "stress_map_missing.bin") != NULL;
+
+	remove(path);
+	remove(empty_path);
+	heap_free(heap, contents);
+	fs_destroy(fs);
+
+	bool ok = failures == 0;
+	debug_print(ok ? k_print_info : k_print_error,
+		"[%s] fs map: %s failures=%d\n", THREAD_STRESS_BACKEND, ok ? "ok" : "FAILED", failures);
+	return ok;
+}
+
+typedef struct fs_gate_stress_t
+{
+	event_t* entered;
+	event_t* open;
+} fs_gate_stress_t;
+
+// Holds the only file thread inside a stream callback until the gate opens.
+static bool fs_gate_stream_func(const void* data, size_t size, uint64_t offset, void* user)
+{
+	(void)data;
+	(void)size;
+	(void)offset;
+	fs_gate_stress_t* gate = user;
+	event_signal(gate->entered);
+	event_wait(gate->open);
+	return true;
+}
+
+// With the only file thread held, queues low priority reads, then a high one,
+// normal ones with some cancelled and one with a short deadline. Once released,
+// high must succeed first and every normal before any low. The held stream is
+// cancelled part way, and cancelled or expired reads must come back empty.
+static bool run_fs_priority_stress(heap_t* heap, bool use_compression)
+{
+	enum { k_low = 8, k_normal = 4, k_work_count = k_low + 1 + k_normal + 1 };
+	fs_t* fs = fs_create_ex(heap, &(fs_options_t) { .file_thread_count = 1, .compress_thread_count = 1 });
+	fs_completion_t* completion = fs_completion_create(heap);
+	const char* gate_path = "stress_priority_gate.bin";
+	const char* path = "stress_priority.bin";
+
+	char* contents = heap_alloc(heap, k_fs_stress_file_size, 8);
+	fs_stress_fill_file(contents, k_fs_stress_file_size, 4, 0);
+	fs_work_destroy(fs_write(fs, gate_path, contents, k_fs_stress_file_size, false));
+	fs_work_destroy(fs_write(fs, path, contents, k_fs_stress_file_size, use_compression));
+
+	fs_gate_stress_t gate = { .entered = event_create(), .open = event_create() };
+	fs_work_t* gate_work = fs_read_stream(fs, gate_path, false, k_fs_stress_file_size / 4, fs_gate_stream_func, &gate);
+	event_wait(gate.entered);
+
+	// Index order is the order of queuing; expected[] is the result each should get.
+	int expected[k_work_count];
+	fs_priority_t priority[k_work_count];
+	int index = 0;
+	for (int i = 0; i < k_low; ++i, ++index)
+	{
+		priority[index] = k_fs_priority_low;
+		expected[index] = 0;
+	}
+	priority[index] = k_fs_priority_high;
+	expected[index++] = 0;
+	for (int i = 0; i < k_normal; ++i, ++index)
+	{
+		priority[index] = k_fs_priority_normal;
+		expected[index] = (i & 1) ? k_fs_result_cancelled : 0;
+	}
+	priority[index] = k_fs_priority_normal;
+	expected[index++] = k_fs_result_expired;
+
+	int ids[k_work_count];
+	fs_work_t* works[k_work_count];
+	for (int i = 0; i < k_work_count; ++i)
+	{
+		ids[i] = i;
+		fs_work_options_t options =
+		{
+			.completion = completion,
+			.user_data = &ids[i],
+			.priority = priority[i],
+			.deadline_ms = expected[i] == k_fs_result_expired ? 1 : 0,
+		};
+		works[i] = fs_read_ex(fs, path, heap, false, use_compression, &options);
+	}
+	for (int i = 0; i < k_work_count; ++i)
+	{
+		if (expected[i] == k_fs_result_cancelled)
+		{
+			fs_work_cancel(works[i]);
+		}
+	}
+	fs_work_cancel(gate_work);
+	thread_sleep(20);
+	event_signal(gate.open);
+
+	// Dropped works finish as soon as they are popped, so only reads that
+	// succeed show the order.
+	int failures = 0;
+	bool high_seen = false;
+	bool low_seen = false;
+	for (int received = 0; received < k_work_count; ++received)
+	{
+		fs_work_t* work = fs_completion_wait(completion);
+		int i = *(int*)fs_work_get_user_data(work);
+		int result = fs_work_get_result(work);
+		void* buffer = fs_work_get_buffer(work);
+		if (result != expected[i] ||
+			(result == 0 && priority[i] != k_fs_priority_high && !high_seen) ||
+			(result == 0 && priority[i] == k_fs_priority_normal && low_seen))
+		{
+			failures++;
+		}
+		high_seen |= result == 0 && priority[i] == k_fs_priority_high;
+		low_seen |= result == 0 && priority[i] == k_fs_priority_low;
+		if (result == 0 && (fs_work_get_size(work) != k_fs_stress_file_size || memcmp(buffer, contents, k_fs_stress_file_size) != 0))
+		{
+			failures++;
+		}
+		if (result != 0 && buffer != NULL)
+		{
+			failures++;
+		}
+		heap_free(heap, buffer);
+		fs_work_destroy(work);
+	}
+
+	// The gate stream delivered its first chunk, then saw the cancel.
+	if (fs_work_get_result(gate_work) != k_fs_result_cancelled || fs_work_get_size(gate_work) != k_fs_stress_file_size / 4)
+	{
+		failures++;
+	}
+	fs_work_destroy(gate_work);
+	failures += fs_work_cancel(NULL);
+
+	event_destroy(gate.entered);
+	event_destroy(gate.open);
+	remove(gate_path);
+	remove(path);
+	heap_free(heap, contents);
+	fs_completion_destroy(completion);
+	fs_destroy(fs);
+
+	bool ok = failures == 0;
+	debug_print(ok ? k_print_info : k_print_error,
+		"[%s] fs priority compressed=%d: %s failures=%d\n", THREAD_STRESS_BACKEND, use_compression, ok ? "ok" : "FAILED", failures);
+	return ok;
+}
+
+// Reads into caller memory: sized up front by fs_get_read_size(), with
+// scratch for compressed files, including multi-block and pak ones, and
+// k_fs_result_too_small when either buffer is short. Compressed writes
+// build their container in caller scratch.
+static bool run_fs_into_stress(heap_t* heap, fs_backend_t backend)
+{
+	enum { k_file_count = 5 };
+	const char* paths[k_file_count] =
+	{
+		"stress_into_raw.bin", "stress_into_small.lz4", "stress_into_large.lz4", "stress_into_empty.lz4", "stress_into/packed.bin",
+	};
+	const size_t sizes[k_file_count] = { 70000, 3000, 3 * k_fs_container_min_block_size + 321, 0, 2 * k_fs_container_min_block_size };
+	const bool compressed[k_file_count] = { false, true, true, true, true };
+	const char* pak_path = "stress_into.pak";
+	const char* pak_source = "stress_into_source.bin";
+
+	fs_t* fs = fs_create_ex(heap, &(fs_options_t) { .backend = backend, .compress_block_size = k_fs_container_min_block_size });
+	char* contents[k_file_count];
+	int failures = 0;
+	for (int i = 0; i < k_file_count; ++i)
+	{
+		contents[i] = heap_alloc(heap, sizes[i] + 1, 8);
+		fs_stress_fill_file(contents[i], sizes[i], 6, i * 2);
+		bool packed = i == k_file_count - 1;
+		fs_work_destroy(fs_write(fs, packed ? pak_source : paths[i], contents[i], sizes[i], compressed[i] && !packed));
+	}
+	failures += !fs_pak_build(heap, pak_path, &paths[k_file_count - 1], &pak_source, 1, &(fs_container_codec_t) { 0 });
+	failures += !fs_mount(fs, pak_path);
+	remove(pak_source);
+
+	for (int round = 0; round < 4; ++round)
+	{
+		for (int i = 0; i < k_file_count; ++i)
+		{
+			fs_read_size_t size;
+			failures += fs_get_read_size(fs, paths[i], compressed[i], &size) != 0;
+			failures += size.size != sizes[i] || (size.scratch_size != 0) != compressed[i];
+
+			char* destination = heap_alloc(heap, size.size + 1, 8);
+			char* scratch = size.scratch_size ? heap_alloc(heap, size.scratch_size, 8) : NULL;
+			fs_work_options_t options = { .scratch = scratch, .scratch_size = size.scratch_size };
+			fs_work_t* work = fs_read_into(fs, paths[i], heap, destination, size.size + 1, true, compressed[i], &options);
+			failures += fs_work_get_result(work) != 0 || fs_work_get_buffer(work) != destination ||
+				fs_work_get_size(work) != sizes[i] || memcmp(destination, contents[i], sizes[i]) != 0 || destination[sizes[i]] != 0;
+			fs_work_destroy(work);
+
+			// No room for the terminator.
+			work = fs_read_into(fs, paths[i], heap, destination, size.size, true, compressed[i], &options);
+			failures += fs_work_get_result(work) != k_fs_result_too_small;
+			fs_work_destroy(work);
+
+			// Scratch too small for even the header.
+			if (scratch)
+			{
+				options.scratch_size = 8;
+				work = fs_read_into(fs, paths[i], heap, destination, size.size + 1, true, compressed[i], &options);
+				failures += fs_work_get_result(work) != k_fs_result_too_small;
+				fs_work_destroy(work);
+			}
+
+			// Without scratch the compressed file comes from the heap as usual.
+			memset(destination, 0, size.size + 1);
+			work = fs_read_into(fs, paths[i], heap, destination, size.size + 1, false, compressed[i], NULL);
+			failures += fs_work_get_result(work) != 0 || memcmp(destination, contents[i], sizes[i]) != 0;
+			fs_work_destroy(work);
+
+			heap_free(heap, scratch);
+			heap_free(heap, destination);
+		}
+	}
+
+	fs_read_size_t size;
+	failures += fs_get_read_size(fs, "stress_into_missing.bin", false, &size) == 0;
+
+	// Compressed writes with the container built in caller scratch.
+	size_t scratch_size = fs_get_write_scratch_size(fs, sizes[2]);
+	char* scratch = heap_alloc(heap, scratch_size, 8);
+	fs_work_t* work = fs_write_ex(fs, "stress_into_write.lz4", contents[2], sizes[2], true,
+		&(fs_work_options_t) { .scratch = scratch, .scratch_size = scratch_size });
+	failures += fs_work_get_result(work) != 0;
+	fs_work_destroy(work);
+	work = fs_read(fs, "stress_into_write.lz4", heap, false, true);
+	failures += fs_work_get_result(work) != 0 || fs_work_get_size(work) != sizes[2] ||
+		memcmp(fs_work_get_buffer(work), contents[2], sizes[2]) != 0;
+	heap_free(heap, fs_work_get_buffer(work));
+	fs_work_destroy(work);
+	work = fs_write_ex(fs, "stress_into_write.lz4", contents[2], sizes[2], true,
+		&(fs_work_options_t) { .scratch = scratch, .scratch_size = 1024 });
+	failures += fs_work_get_result(work) != k_fs_result_too_small;
+	fs_work_destroy(work);
+	heap_free(heap, scratch);
+	remove("stress_into_write.lz4");
+
+	fs_destroy(fs);
+	remove(pak_path);
+	for (int i = 0; i < k_file_count; ++i)
+	{
+		remove(paths[i]);
+		heap_free(heap, contents[i]);
+	}
+
+	bool ok = failures == 0;
+	debug_print(ok ? k_print_info : k_print_error,
+		"[%s] fs into io_uring=%d: %s failures=%d\n", THREAD_STRESS_BACKEND, backend == k_fs_backend_io_uring, ok ? "ok" : "FAILED", failures);
+	return ok;
+}
+
+typedef struct fs_journal_stress_t
+{
+	fs_journal_t* journal;
+	int thread_index;
+	int failures;
+} fs_journal_stress_t;
+
+enum
+{
+	k_journal_stress_threads = 4,
+	k_journal_stress_records = 600,
+};
+
+// Records carry their thread, their sequence number and a size that varies.
+static int fs_journal_stress_func(void* user)
+{
+	fs_journal_stress_t* stress = user;
+	for (int i = 0; i < k_journal_stress_records; ++i)
+	{
+		char record[256];
+		size_t size = 8 + (size_t)((i * 37 + stress->thread_index * 11) % 200);
+		memcpy(record, &stress->thread_index, sizeof(int));
+		memcpy(record + sizeof(int), &i, sizeof(int));
+		memset(record + 8, 'a' + (i % 26), size - 8);
+		stress->failures += !fs_journal_append(stress->journal, record, size);
+		if (i % 97 == 0)
+		{
+			fs_journal_flush(stress->journal, false);
+		}
+	}
+	return 0;
+}
+
+typedef struct fs_journal_replay_t
+{
+	int next[k_journal_stress_threads];
+	int failures;
+} fs_journal_replay_t;
+
+static bool fs_journal_replay_func(const void* data, size_t size, void* user)
+{
+	fs_journal_replay_t* replay = user;
+	int thread_index;
+	int sequence;
+	memcpy(&thread_index, data, sizeof(int));
+	memcpy(&sequence, (const char*)data + sizeof(int), sizeof(int));
+	if (size < 8 || thread_index < 0 || thread_index >= k_journal_stress_threads || sequence != replay->next[thread_index])
+	{
+		replay->failures++;
+		return true;
+	}
+	replay->next[thread_index]++;
+	size_t expected = 8 + (size_t)((sequence * 37 + thread_index * 11) % 200);
+	const char* body = (const char*)data + 8;
+	for (size_t i = 0; i < size - 8; ++i)
+	{
+		replay->failures += body[i] != 'a' + (sequence % 26);
+	}
+	replay->failures += size != expected;
+	return true;
+}
+
+// Atomic replaces, appends, and a journal filled from several threads in
+// small batches, replayed in per-thread order, then torn and reopened.
+static bool run_fs_journal_stress(heap_t* heap, fs_backend_t backend)
+{
+	const char* path = "stress_journal.bin";
+	const char* atomic_path = "stress_atomic.bin";
+	fs_t* fs = fs_create_ex(heap, &(fs_options_t) { .backend = backend });
+	int failures = 0;
+
+	// Atomic replaces, and one into a missing directory that must fail.
+	char contents[3000];
+	for (int round = 0; round < 4; ++round)
+	{
+		size_t size = sizeof(contents) - round * 500;
+		memset(contents, 'A' + round, size);
+		fs_work_t* work = fs_write_ex(fs, atomic_path, contents, size, round & 1,
+			&(fs_work_options_t) { .write_mode = k_fs_write_atomic });
+		failures += fs_work_get_result(work) != 0;
+		fs_work_destroy(work);
+		work = fs_read(fs, atomic_path, heap, false, round & 1);
+		failures += fs_work_get_result(work) != 0 || fs_work_get_size(work) != size || memcmp(fs_work_get_buffer(work), contents, size) != 0;
+		heap_free(heap, fs_work_get_buffer(work));
+		fs_work_destroy(work);
+	}
+	fs_work_t* work = fs_write_ex(fs, "stress_missing_dir/atomic.bin", contents, 10, false,
+		&(fs_work_options_t) { .write_mode = k_fs_write_atomic });
+	failures += fs_work_get_result(work) == 0;
+	fs_work_destroy(work);
+
+	// Plain appends, synced, ignoring the compression flag.
+	remove(path);
+	for (int i = 0; i < 3; ++i)
+	{
+		work = fs_write_ex(fs, path, contents, 100, i == 1, &(fs_work_options_t) { .write_mode = k_fs_write_append, .sync = i == 2 });
+		failures += fs_work_get_result(work) != 0;
+		fs_work_destroy(work);
+	}
+	work = fs_read(fs, path, heap, false, false);
+	failures += fs_work_get_result(work) != 0 || fs_work_get_size(work) != 300;
+	heap_free(heap, fs_work_get_buffer(work));
+	fs_work_destroy(work);
+	remove(path);
+
+	// Small batches, so appends keep catching the other batch mid-write.
+	fs_journal_t* journal = fs_journal_open(fs, heap, path, &(fs_journal_options_t) { .batch_size = 4096 });
+	failures += journal == NULL || fs_journal_append(journal, contents, 4096);
+	fs_journal_stress_t stress[k_journal_stress_threads];
+	thread_t* threads[k_journal_stress_threads];
+	for (int i = 0; i < k_journal_stress_threads; ++i)
+	{
+		stress[i] = (fs_journal_stress_t) { .journal = journal, .thread_index = i };
+		threads[i] = thread_create(fs_journal_stress_func, &stress[i]);
+	}
+	for (int i = 0; i < k_journal_stress_threads; ++i)
+	{
+		thread_destroy(threads[i]);
+		failures += stress[i].failures;
+	}
+	failures += fs_journal_close(journal) != 0;
+
+	fs_journal_replay_t replay = { 0 };
+	int total = k_journal_stress_threads * k_journal_stress_records;
+	failures += fs_journal_replay(fs, heap, path, fs_journal_replay_func, &replay) != total;
+	for (int i = 0; i < k_journal_stress_threads; ++i)
+	{
+		failures += replay.next[i] != k_journal_stress_records;
+	}
+	failures += replay.failures;
+
+	// Tear the tail as a crash would: a record header whose data never arrived.
+	uint32_t torn[4] = { 100, 12345, 0, 0 };
+	work = fs_write_ex(fs, path, torn, sizeof(torn), false, &(fs_work_options_t) { .write_mode = k_fs_write_append });
+	fs_work_destroy(work);
+	replay = (fs_journal_replay_t) { 0 };
+	failures += fs_journal_replay(fs, heap, path, fs_journal_replay_func, &replay) != total;
+
+	// Reopening cuts the tail off, so new records replay after the old ones.
+	// Thread 0's next record.
+	journal = fs_journal_open(fs, heap, path, NULL);
+	failures += journal == NULL;
+	int thread_index = 0;
+	int sequence = k_journal_stress_records;
+	char record[256];
+	size_t record_size = 8 + (size_t)((sequence * 37) % 200);
+	memcpy(record, &thread_index, sizeof(int));
+	memcpy(record + sizeof(int), &sequence, sizeof(int));
+	memset(record + 8, 'a' + (sequence % 26), record_size - 8);
+	failures += !fs_journal_append(journal, record, record_size);
+	failures += fs_journal_close(journal) != 0;
+	replay = (fs_journal_replay_t) { 0 };
+	failures += fs_journal_replay(fs, heap, path, fs_journal_replay_func, &replay) != total + 1;
+	failures += replay.failures;
+
+	failures += fs_journal_replay(fs, heap, "stress_journal_missing.bin", fs_journal_replay_func, &replay) != 0;
+
+	fs_destroy(fs);
+	remove(path);
+	remove(atomic_path);
+
+	bool ok = failures == 0;
+	debug_print(ok ? k_print_info : k_print_error,
+		"[%s] fs journal io_uring=%d: %s records=%d failures=%d\n", THREAD_STRESS_BACKEND, backend == k_fs_backend_io_uring,
+		ok ? "ok" : "FAILED", total, failures);
+	return ok;
+}
+
+typedef struct fs_watch_stress_t
+{
+	const char* path;
+	int count;
+} fs_watch_stress_t;
+
+static void fs_watch_stress_func(const char* path, void* user)
+{
+	fs_watch_stress_t* stress = user;
+	stress->count += strcmp(path, stress->path) == 0;
+}
+
+// Updates the watch until count notifications arrive or a second passes,
+// then a little longer to catch any extras.
+static void fs_watch_stress_settle(fs_watch_t* watch, int* total, int count)
+{
+	uint64_t start = timer_get_ticks();
+	uint64_t limit = timer_get_ticks_per_second();
+	while (*total < count && timer_get_ticks() - start < limit)
+	{
+		*total += fs_watch_update(watch);
+		thread_sleep(5);
+	}
+	for (int i = 0; i < 20; ++i)
+	{
+		*total += fs_watch_update(watch);
+		thread_sleep(5);
+	}
+}
+
+enum
+{
+	k_path_stress_threads = 4,
+	// More than one chunk of the table, so it grows while threads race.
+	k_path_stress_paths = 6000,
+};
+
+typedef struct fs_path_stress_t
+{
+	fs_path_table_t* table;
+	int thread_index;
+	fs_path_id_t* ids;
+} fs_path_stress_t;
+
+// Each thread interns every path, starting at a different one.
+static int fs_path_stress_func(void* user)
+{
+	fs_path_stress_t* stress = user;
+	for (int i = 0; i < k_path_stress_paths; ++i)
+	{
+		int index = (i + stress->thread_index * (k_path_stress_paths / k_path_stress_threads)) % k_path_stress_paths;
+		char path[64];
+		snprintf(path, sizeof(path), "assets/level%d/mesh_%d.bin", index % 7, index);
+		stress->ids[index] = fs_path_intern(stress->table, path);
+	}
+	return 0;
+}
+
+// Threads interning the same paths at once agree on one ID per path, each
+// ID names its path and hashes as paks do, and long paths survive.
+static bool run_fs_path_stress(heap_t* heap)
+{
+	fs_path_table_t* table = fs_path_table_create(heap, 0);
+	fs_path_id_t* ids = heap_alloc(heap, sizeof(fs_path_id_t) * k_path_stress_paths * k_path_stress_threads, 8);
+
+	uint64_t t0 = timer_get_ticks();
+	fs_path_stress_t stress[k_path_stress_threads];
+	thread_t* threads[k_path_stress_threads];
+	for (int i = 0; i < k_path_stress_threads; ++i)
+	{
+		stress[i] = (fs_path_stress_t) { .table = table, .thread_index = i, .ids = ids + i * k_path_stress_paths };
+		threads[i] = thread_create(fs_path_stress_func, &stress[i]);
+	}
+	for (int i = 0; i < k_path_stress_threads; ++i)
+	{
+		thread_destroy(threads[i]);
+	}
+	uint64_t t1 = timer_get_ticks();
+
+	int failures = fs_path_table_get_count(table) != k_path_stress_paths + 1;
+	for (int i = 0; i < k_path_stress_paths; ++i)
+	{
+		char path[64];
+		snprintf(path, sizeof(path), "assets/level%d/mesh_%d.bin", i % 7, i);
+		fs_path_id_t id = ids[i];
+		for (int t = 1; t < k_path_stress_threads; ++t)
+		{
+			failures += ids[t * k_path_stress_paths + i] != id;
+		}
+		failures += id == 0 || strcmp(fs_path_get_string(table, id), path) != 0;
+		failures += fs_path_get_hash(table, id) != fs_pak_hash_path(path);
+	}
+
+	failures += fs_path_intern(table, "") != 0 || strcmp(fs_path_get_string(table, 0), "") != 0;
+	fs_path_id_t forward = fs_path_intern(table, "a/b.txt");
+	fs_path_id_t back = fs_path_intern(table, "a\\b.txt");
+	failures += forward == back || fs_path_get_hash(table, forward) != fs_path_get_hash(table, back);
+
+	char* long_path = heap_alloc(heap, 20000, 8);
+	memset(long_path, 'x', 19999);
+	long_path[19999] = 0;
+	fs_path_id_t long_id = fs_path_intern(table, long_path);
+	failures += strcmp(fs_path_get_string(table, long_id), long_path) != 0 || fs_path_intern(table, long_path) != long_id;
+	heap_free(heap, long_path);
+
+	heap_free(heap, ids);
+	fs_path_table_destroy(table);
+
+	// A full table hands out no more IDs, and an fs_t fails works on new paths.
+	table = fs_path_table_create(heap, 2);
+	fs_path_id_t first = fs_path_intern(table, "a.bin");
+	failures += first != 1 || fs_path_intern(table, "b.bin") != k_fs_path_invalid || fs_path_intern(table, "a.bin") != first;
+	failures += strcmp(fs_path_get_string(table, k_fs_path_invalid), "") != 0;
+	fs_path_table_destroy(table);
+
+	fs_t* fs = fs_create_ex(heap, &(fs_options_t) { .max_paths = 3 });
+	const char* known[] = { "stress_paths_a.bin", "stress_paths_b.bin" };
+	for (int i = 0; i < 2; ++i)
+	{
+		fs_work_destroy(fs_write(fs, known[i], known[i], strlen(known[i]), false));
+	}
+	fs_work_t* work = fs_read(fs, "stress_paths_c.bin", heap, true, false);
+	failures += fs_work_get_result(work) != k_fs_result_no_path || fs_work_get_buffer(work) != NULL;
+	fs_work_destroy(work);
+	work = fs_read_shared(fs, "stress_paths_c.bin", false, NULL);
+	failures += fs_work_get_result(work) != k_fs_result_no_path || fs_work_get_buffer(work) != NULL;
+	fs_work_destroy(work);
+
+	// In a batch only the file without an ID fails.
+	const char* batch[] = { known[0], "stress_paths_c.bin", known[1] };
+	fs_read_result_t results[3];
+	work = fs_read_many(fs, batch, 3, heap, true, false, results, NULL);
+	fs_work_wait(work);
+	for (int i = 0; i < 3; ++i)
+	{
+		failures += i == 1 ?
+			results[i].result != k_fs_result_no_path || results[i].buffer != NULL :
+			results[i].result != 0 || strcmp(results[i].buffer, batch[i]) != 0;
+		heap_free(heap, results[i].buffer);
+	}
+	fs_work_destroy(work);
+	fs_destroy(fs);
+	for (int i = 0; i < 2; ++i)
+	{
+		remove(known[i]);
+	}
+
+	bool ok = failures == 0;
+	debug_print(ok ? k_print_info : k_print_error,
+		"[%s] fs paths threads=%d paths=%d: %s failures=%d time=%uus\n",
+		THREAD_STRESS_BACKEND, k_path_stress_threads, k_path_stress_paths,
+		ok ? "ok" : "FAILED", failures, (uint32_t)timer_ticks_to_us(t1 - t0));
+	return ok;
+}
+
+// A burst of writes to one file notifies its subscribers once, a file
+// replaced by rename is seen, and files nobody watches stay quiet.
+static bool run_fs_watch_stress(heap_t* heap)
+{
+	fs_t* fs = fs_create(heap, 8);
+	fs_watch_stress_t a = { .path = "stress_watch_a.bin" };
+	fs_watch_stress_t a2 = { .path = "stress_watch_a.bin" };
+	fs_watch_stress_t b = { .path = "stress_watch_b.bin" };
+	char contents[1024];
+	memset(contents, 'w', sizeof(contents));
+	fs_work_destroy(fs_write(fs, a.path, contents, sizeof(contents), false));
+	fs_work_destroy(fs_write(fs, b.path, contents, sizeof(contents), false));
+
+	int failures = 0;
+	fs_watch_t* watch = fs_watch_create(heap, 50);
+	failures += !fs_watch_add(watch, a.path, fs_watch_stress_func, &a);
+	failures += !fs_watch_add(watch, a.path, fs_watch_stress_func, &a2);
+	failures += !fs_watch_add(watch, b.path, fs_watch_stress_func, &b);
+	failures += fs_watch_add(watch, "stress_watch_missing_dir/c.bin", fs_watch_stress_func, &b);
+
+	int total = 0;
+	for (int i = 0; i < 10; ++i)
+	{
+		fs_work_destroy(fs_write(fs, a.path, contents, sizeof(contents) - i, false));
+		fs_work_destroy(fs_write(fs, "stress_watch_other.bin", contents, 10, false));
+		total += fs_watch_update(watch);
+	}
+	fs_watch_stress_settle(watch, &total, 2);
+	failures += a.count != 1 || a2.count != 1 || b.count != 0 || total != 2;
+
+	fs_work_t* work = fs_write_ex(fs, b.path, contents, 100, false, &(fs_work_options_t) { .write_mode = k_fs_write_atomic });
+	fs_work_destroy(work);
+	fs_watch_stress_settle(watch, &total, 3);
+	failures += a.count != 1 || b.count != 1 || total != 3;
+
+	fs_watch_destroy(watch);
+	fs_destroy(fs);
+	remove(a.path);
+	remove(b.path);
+	remove("stress_watch_other.bin");
+
+	bool ok = failures == 0;
+	debug_print(ok ? k_print_info : k_print_error,
+		"[%s] fs watch: %s notifications=%d failures=%d\n", THREAD_STRESS_BACKEND, ok ? "ok" : "FAILED", total, failures);
+	return ok;
+}
+
+// Batched reads: loose, pak and missing files in one fs_read_many() call,
+// compressed batches, one completion per batch, and cancelling a batch.
+static bool run_fs_batch_stress(heap_t* heap, fs_backend_t backend)
+{
+	enum { k_file_count = 24, k_pak_count = 4, k_batch_count = k_file_count + k_pak_count + 2 };
+	const size_t file_size = 4096 + 17;
+	const char* pak_path = "stress_batch.pak";
+
+	fs_t* fs = fs_create_ex(heap, &(fs_options_t) { .backend = backend });
+	char* contents[k_file_count];
+	char loose[k_file_count][64];
+	char compressed[k_file_count][64];
+	for (int i = 0; i < k_file_count; ++i)
+	{
+		contents[i] = heap_alloc(heap, file_size, 8);
+		fs_stress_fill_file(contents[i], file_size, 5, i);
+		snprintf(loose[i], sizeof(loose[i]), "stress_batch_%d.bin", i);
+		snprintf(compressed[i], sizeof(compressed[i]), "stress_batch_%d.lz4", i);
+		fs_work_destroy(fs_write(fs, loose[i], contents[i], file_size, false));
+		fs_work_destroy(fs_write(fs, compressed[i], contents[i], file_size, true));
+	}
+
+	// The pak holds copies of the first few loose files under other names.
+	const char* pak_names[k_pak_count] = { "batch/d.bin", "batch/a.bin", "batch/c.bin", "batch/b.bin" };
+	const char* pak_sources[k_pak_count] = { loose[3], loose[0], loose[2], loose[1] };
+	const int pak_contents[k_pak_count] = { 3, 0, 2, 1 };
+	int failures = 0;
+	failures += !fs_pak_build(heap, pak_path, pak_names, pak_sources, k_pak_count, NULL);
+	failures += !fs_mount(fs, pak_path);
+
+	// Loose files in reverse, pak files, a missing file and a repeat.
+	const char* paths[k_batch_count];
+	int expected[k_batch_count];
+	for (int i = 0; i < k_file_count; ++i)
+	{
+		paths[i] = loose[k_file_count - 1 - i];
+		expected[i] = k_file_count - 1 - i;
+	}
+	for (int i = 0; i < k_pak_count; ++i)
+	{
+		paths[k_file_count + i] = pak_names[i];
+		expected[k_file_count + i] = pak_contents[i];
+	}
+	paths[k_file_count + k_pak_count] = "stress_batch_missing.bin";
+	expected[k_file_count + k_pak_count] = -1;
+	paths[k_file_count + k_pak_count + 1] = loose[7];
+	expected[k_file_count + k_pak_count + 1] = 7;
+
+	fs_completion_t* completion = fs_completion_create(heap);
+	fs_read_result_t results[k_batch_count];
+	for (int round = 0; round < 8; ++round)
+	{
+		fs_work_t* work = fs_read_many(fs, paths, k_batch_count, heap, true, false, results,
+			&(fs_work_options_t) { .completion = completion, .user_data = &results });
+		failures += fs_completion_wait(completion) != work || fs_work_get_user_data(work) != &results;
+		failures += fs_completion_pop(completion) != NULL;
+		failures += fs_work_get_result(work) == 0 || fs_work_get_buffer(work) != NULL;
+		for (int i = 0; i < k_batch_count; ++i)
+		{
+			if (expected[i] < 0)
+			{
+				failures += results[i].result == 0;
+			}
+			else
+			{
+				failures += results[i].result != 0 || results[i].size != file_size ||
+					memcmp(results[i].buffer, contents[expected[i]], file_size) != 0 ||
+					((char*)results[i].buffer)[file_size] != 0;
+			}
+			heap_free(heap, results[i].buffer);
+		}
+		fs_work_destroy(work);
+	}
+
+	// Every file compressed: each decompresses on the pool, and the batch
+	// finishes with whichever one is last.
+	const char* compressed_paths[k_file_count];
+	for (int i = 0; i < k_file_count; ++i)
+	{
+		compressed_paths[i] = compressed[i];
+	}
+	for (int round = 0; round < 8; ++round)
+	{
+		fs_work_t* work = fs_read_many(fs, compressed_paths, k_file_count, heap, false, true, results, NULL);
+		failures += fs_work_get_result(work) != 0;
+		for (int i = 0; i < k_file_count; ++i)
+		{
+			failures += results[i].result != 0 || results[i].size != file_size ||
+				memcmp(results[i].buffer, contents[i], file_size) != 0;
+			heap_free(heap, results[i].buffer);
+		}
+		fs_work_destroy(work);
+	}
+
+	// Cancelled batches still report every file: read, or cancelled.
+	int cancelled = 0;
+	for (int round = 0; round < 16; ++round)
+	{
+		fs_work_t* work = fs_read_many(fs, compressed_paths, k_file_count, heap, false, round & 1, results, NULL);
+		fs_work_cancel(work);
+		fs_work_wait(work);
+		int batch_result = fs_work_get_result(work);
+		failures += batch_result != 0 && batch_result != k_fs_result_cancelled && !(round & 1);
+		for (int i = 0; i < k_file_count; ++i)
+		{
+			if (results[i].result == k_fs_result_cancelled)
+			{
+				cancelled++;
+				failures += results[i].buffer != NULL;
+			}
+			else if (round & 1)
+			{
+				failures += results[i].result != 0 || results[i].size != file_size ||
+					memcmp(results[i].buffer, contents[i], file_size) != 0;
+			}
+			heap_free(heap, results[i].buffer);
+		}
+		fs_work_destroy(work);
+	}
+
+	// An empty batch is done at once.
+	fs_work_t* work = fs_read_many(fs, NULL, 0, heap, false, false, NULL, NULL);
+	failures += !fs_work_is_done(work) || fs_work_get_result(work) != 0;
+	fs_work_destroy(work);
+
+	fs_completion_destroy(completion);
+	fs_destroy(fs);
+	remove(pak_path);
+	for (int i = 0; i < k_file_count; ++i)
+	{
+		remove(loose[i]);
+		remove(compressed[i]);
+		heap_free(heap, contents[i]);
+	}
+
+	bool ok = failures == 0;
+	debug_print(ok ? k_print_info : k_print_error,
+		"[%s] fs batch io_uring=%d: %s cancelled=%d failures=%d\n", THREAD_STRESS_BACKEND, backend == k_fs_backend_io_uring,
+		ok ? "ok" : "FAILED", cancelled, failures);
+	return ok;
+}
+
+static bool run_fs_prefetch_stress(heap_t* heap, fs_backend_t backend)
+{
+	enum { k_file_count = 16 };
+	const size_t file_size = 8192 + 5;
+	const char* manifest_path = "stress_prefetch.manifest";
+	const char* bad_manifest_path = "stress_prefetch_bad.manifest";
+
+	fs_t* fs = fs_create_ex(heap, &(fs_options_t) { .backend = backend, .cache_budget = 2 * k_file_count * file_size });
+	char* contents[k_file_count];
+	char paths[k_file_count][64];
+	char manifest[k_file_count * 96 + 256];
+	int length = snprintf(manifest, sizeof(manifest), "# stress manifest\r\n\n");
+	for (int i = 0; i < k_file_count; ++i)
+	{
+		contents[i] = heap_alloc(heap, file_size, 8);
+		fs_stress_fill_file(contents[i], file_size, 6, i);
+		bool compressed = i & 1;
+		snprintf(paths[i], sizeof(paths[i]), "stress_prefetch_%d.%s", i, compressed ? "lz4" : "bin");
+		fs_work_destroy(fs_write(fs, paths[i], contents[i], file_size, compressed));
+		length += snprintf(manifest + length, sizeof(manifest) - length, "%zu %s %s\n", file_size, compressed ? "lz4" : "raw", paths[i]);
+	}
+	int failures = 0;
+	fs_work_destroy(fs_write(fs, manifest_path, manifest, length, false));
+	const char* bad_manifest = "100 raw stress_prefetch_0.bin\n100 zip stress_prefetch_1.bin\n";
+	fs_work_destroy(fs_write(fs, bad_manifest_path, bad_manifest, strlen(bad_manifest), false));
+
+	// Into the OS cache, with a plain read queued behind it that must not wait
+	// for the whole manifest.
+	for (int round = 0; round < 4; ++round)
+	{
+		fs_work_t* work = fs_prefetch_manifest(fs, manifest_path, k_fs_prefetch_os_cache, NULL);
+		fs_work_t* read = fs_read(fs, paths[0], heap, false, false);
+		failures += fs_work_get_result(read) != 0 || fs_work_get_size(read) != file_size;
+		heap_free(heap, fs_work_get_buffer(read));
+		fs_work_destroy(read);
+		fs_work_wait(work);
+		fs_prefetch_progress_t progress;
+		fs_work_get_prefetch_progress(work, &progress);
+		failures += fs_work_get_result(work) != 0 || progress.failures != 0;
+		failures += progress.file_count != k_file_count || progress.files_done != k_file_count;
+		failures += progress.byte_count != k_file_count * file_size || progress.bytes_done != progress.byte_count;
+		fs_work_destroy(work);
+	}
+	failures += fs_get_cache_size(fs) != 0;
+
+	// Into the shared cache: the second time everything is already there.
+	for (int round = 0; round < 2; ++round)
+	{
+		fs_work_t* work = fs_prefetch_manifest(fs, manifest_path, k_fs_prefetch_shared_cache, NULL);
+		fs_work_wait(work);
+		fs_prefetch_progress_t progress;
+		fs_work_get_prefetch_progress(work, &progress);
+		failures += fs_work_get_result(work) != 0 || progress.failures != 0 || progress.files_done != k_file_count;
+		failures += fs_get_cache_size(fs) < k_file_count * file_size;
+		fs_work_destroy(work);
+	}
+	for (int i = 0; i < k_file_count; ++i)
+	{
+		fs_work_t* work = fs_read_shared(fs, paths[i], i & 1, NULL);
+		failures += fs_work_get_size(work) != file_size || memcmp(fs_work_get_buffer(work), contents[i], file_size) != 0;
+		fs_work_destroy(work);
+	}
+
+	// A missing file fails on its own; a bad or missing manifest fails it all.
+	remove(paths[3]);
+	fs_work_t* work = fs_prefetch_manifest(fs, manifest_path, k_fs_prefetch_os_cache, NULL);
+	fs_work_wait(work);
+	fs_prefetch_progress_t progress;
+	fs_work_get_prefetch_progress(work, &progress);
+	failures += fs_work_get_result(work) == 0 || progress.failures != 1 || progress.files_done != k_file_count;
+	fs_work_destroy(work);
+	const char* bad_paths[] = { bad_manifest_path, "stress_prefetch_missing.manifest" };
+	for (int i = 0; i < 2; ++i)
+	{
+		work = fs_prefetch_manifest(fs, bad_paths[i], k_fs_prefetch_os_cache, NULL);
+		fs_work_wait(work);
+		fs_work_get_prefetch_progress(work, &progress);
+		failures += fs_work_get_result(work) == 0 || progress.file_count != 0;
+		fs_work_destroy(work);
+	}
+
+	fs_destroy(fs);
+	remove(manifest_path);
+	remove(bad_manifest_path);
+	for (int i = 0; i < k_file_count; ++i)
+	{
+		remove(paths[i]);
+		heap_free(heap, contents[i]);
+	}
+
+	bool ok = failures == 0;
+	debug_print(ok ? k_print_info : k_print_error,
+		"[%s] fs prefetch io_uring=%d: %s failures=%d\n", THREAD_STRESS_BACKEND, backend == k_fs_backend_io_uring,
+		ok ? "ok" : "FAILED", failures);
+	return ok;
+}
+
+enum
+{
+	k_trace_stress_threads = 4,
+	k_trace_stress_events = 5000,
+};
+
+typedef struct fs_trace_stress_t
+{
+	trace_t* trace;
+	event_t* start;
+} fs_trace_stress_t;
+
+static int fs_trace_stress_func(void* user)
+{
+	fs_trace_stress_t* stress = user;
+	event_wait(stress->start);
+	for (int i = 0; i < k_trace_stress_events; ++i)
+	{
+		uint64_t ticks = timer_get_ticks();
+		trace_duration_record(stress->trace, "stress", ticks, ticks);
+	}
+	return 0;
+}
+
+// Decodes a streamed capture and counts its events. Returns -1 unless the
+// result is a closed Chrome trace: events, then "]" and "}" with no comma
+// left dangling before them.
+static int fs_trace_stress_decode(fs_t* fs, heap_t* heap, const char* path, const char* json_path)
+{
+	if (!trace_stream_decode(heap, path, json_path))
+	{
+		return -1;
+	}
+	fs_work_t* work = fs_read(fs, json_path, heap, true, false);
+	const char* json = fs_work_get_buffer(work);
+	size_t size = fs_work_get_size(work);
+	int count = -1;
+	if (fs_work_get_result(work) == 0)
+	{
+		while (size && strchr(" \t\n", json[size - 1]))
+		{
+			size--;
+		}
+		const char* close = size ? strrchr(json, ']') : NULL;
+		bool closed = json[0] == '{' && close && json[size - 1] == '}' && close > json;
+		// Only whitespace may sit between the "]" and the final "}".
+		for (const char* c = close ? close + 1 : json; closed && c < json + size - 1; ++c)
+		{
+			closed = strchr(" \t\n", *c) != NULL;
+		}
+		const char* last = close;
+		while (closed && last > json && strchr(" \t\n", last[-1]))
+		{
+			last--;
+		}
+		closed = closed && last > json && (last[-1] == '}' || last[-1] == '[');
+		count = closed ? 0 : -1;
+		for (const char* c = json; closed && (c = strstr(c, "\"ph\" : \"X\"")) != NULL; ++c)
+		{
+			count++;
+		}
+	}
+	heap_free(heap, fs_work_get_buffer(work));
+	fs_work_destroy(work);
+	remove(json_path);
+	return count;
+}
+
+// Streams a capture from several threads through small chunks, so some events
+// are dropped, and checks that every event not dropped is in the decoded
+// trace. A copy of a capture taken while it still ran decodes to a closed
+// trace too.
+static bool run_fs_trace_stream_stress(heap_t* heap)
+{
+	const char* path = "stress_trace.lz4";
+	const char* running_path = "stress_trace_running.lz4";
+	const char* json_path = "stress_trace.json";
+	fs_t* fs = fs_create(heap, 8);
+	trace_t* trace = trace_create(heap, 16);
+	trace_capture_options_t options = { .stream = true, .chunk_size = 4096, .chunk_count = 4, .flush_interval_ms = 10 };
+
+	int failures = 0;
+	trace_capture_start_ex(trace, path, &options);
+	fs_trace_stress_t stress = { .trace = trace, .start = event_create() };
+	thread_t* threads[k_trace_stress_threads];
+	for (int i = 0; i < k_trace_stress_threads; ++i)
+	{
+		threads[i] = thread_create(fs_trace_stress_func, &stress);
+	}
+	event_signal(stress.start);
+	for (int i = 0; i < k_trace_stress_threads; ++i)
+	{
+		thread_destroy(threads[i]);
+	}
+
+	// Long enough for the writer to flush the last part-filled chunk.
+	thread_sleep(200);
+	fs_work_t* work = fs_read(fs, path, heap, false, false);
+	failures += fs_work_get_result(work) != 0;
+	fs_work_destroy(fs_write(fs, running_path, fs_work_get_buffer(work), fs_work_get_size(work), false));
+	heap_free(heap, fs_work_get_buffer(work));
+	fs_work_destroy(work);
+
+	failures += trace_capture_stop(trace) != 0;
+	int dropped = trace_get_dropped_count(trace);
+	int count = fs_trace_stress_decode(fs, heap, path, json_path);
+	failures += count < 0 || count + dropped != k_trace_stress_threads * k_trace_stress_events || count == 0;
+
+	// The capture was idle when copied, so the copy has every event kept.
+	int running_count = fs_trace_stress_decode(fs, heap, running_path, json_path);
+	failures += running_count != count;
+
+	// A file that can't be written is reported when the capture stops.
+	trace_capture_start_ex(trace, "stress_trace_missing/trace.lz4", &options);
+	trace_duration_record(trace, "stress", timer_get_ticks(), timer_get_ticks());
+	failures += trace_capture_stop(trace) == 0;
+
+	// Destroying a trace mid-capture stops it, and the file still decodes.
+	trace_capture_start_ex(trace, path, &options);
+	trace_duration_record(trace, "stress", timer_get_ticks(), timer_get_ticks());
+	trace_destroy(trace);
+	failures += fs_trace_stress_decode(fs, heap, path, json_path) != 1;
+
+	event_destroy(stress.start);
+	fs_destroy(fs);
+	remove(path);
+	remove(running_path);
+
+	bool ok = failures == 0;
+	debug_print(ok ? k_print_info : k_print_error,
+		"[%s] fs trace stream threads=%d: %s events=%d dropped=%d failures=%d\n", THREAD_STRESS_BACKEND, k_trace_stress_threads,
+		ok ? "ok" : "FAILED", count, dropped, failures);
+	return ok;
+}
+
+bool fs_stress_run(heap_t* heap)
+{
+	bool ok = true;
+
+	ok &= run_fs_stress(heap, 1, 8, 1, k_fs_backend_threads);
+	ok &= run_fs_stress(heap, 4, 8, 4, k_fs_backend_threads);
+	ok &= run_fs_stress(heap, 8, 64, 8, k_fs_backend_threads);
+	// Tiny queues force the compress pool to write inline when the file queue is full.
+	ok &= run_fs_stress(heap, 8, 2, 2, k_fs_backend_threads);
+	// Falls back to threads where io_uring is unavailable.
+	ok &= run_fs_stress(heap, 4, 8, 4, k_fs_backend_io_uring);
+	ok &= run_fs_stress(heap, 8, 64, 2, k_fs_backend_io_uring);
+	ok &= run_fs_completion_stress(heap, 8);
+	ok &= run_fs_block_stress(heap, 64, 4);
+	// Fewer queue slots than blocks, so the pool codes overflow blocks inline.
+	ok &= run_fs_block_stress(heap, 2, 2);
+	ok &= run_fs_stream_stress(heap);
+	ok &= run_fs_map_stress(heap);
+	ok &= run_fs_priority_stress(heap, false);
+	ok &= run_fs_priority_stress(heap, true);
+	ok &= run_fs_batch_stress(heap, k_fs_backend_threads);
+	ok &= run_fs_batch_stress(heap, k_fs_backend_io_uring);
+	ok &= run_fs_into_stress(heap, k_fs_backend_threads);
+	ok &= run_fs_into_stress(heap, k_fs_backend_io_uring);
+	ok &= run_fs_journal_stress(heap, k_fs_backend_threads);
+	ok &= run_fs_journal_stress(heap, k_fs_backend_io_uring);
+	ok &= run_fs_watch_stress(heap);
+	ok &= run_fs_path_stress(heap);
+	ok &= run_fs_prefetch_stress(heap, k_fs_backend_threads);
+	ok &= run_fs_prefetch_stress(heap, k_fs_backend_io_uring);
+	ok &= run_fs_trace_stream_stress(heap);
+
+	return ok;
+}
@@ -0,0 +1,47 @@
+#pragma once
+
+#include "thread_stress.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// File system stress workloads, run by thread_stress_run().
+//
+// Each subsystem's cases live in their own file and share the helpers below.
+// Files are written to and removed from the working directory.
+
+enum
+{
+	k_fs_stress_file_size = 64 * 1024,
+};
+
+// Checks streamed chunks against the expected contents: in order, none empty
+// or over chunk_size. The stream stops once stop_after bytes have arrived.
+typedef struct fs_stress_stream_t
+{
+	const char* expected;
+	size_t chunk_size;
+	uint64_t stop_after;
+	uint64_t next_offset;
+	int failures;
+} fs_stress_stream_t;
+
+// Deterministic file contents. Compressible when the file index is even.
+void fs_stress_fill_file(char* buffer, size_t size, int thread_index, int file_index);
+
+// An fs_stream_func_t whose user data is an fs_stress_stream_t.
+bool fs_stress_stream_func(const void* data, size_t size, uint64_t offset, void* user);
+
+// Reads, writes, blocks, streams, maps, priorities, batches, caller memory,
+// journals, watches, path interning and prefetch (fs_stress.c).
+bool fs_stress_run(heap_t* heap);
+
+// Codec levels, dictionaries and record coding (fs_container_stress.c).
+bool fs_container_stress_run(heap_t* heap);
+
+// Paks built, mounted and read on both backends (fs_pak_stress.c).
+bool fs_pak_stress_run(heap_t* heap);
+
+// The shared read cache (fs_cache_stress.c).
+bool fs_cache_stress_run(heap_t* heap);
@@ -0,0 +1,338 @@
+#include "fs_watch.h"
+
+#include "heap.h"
+#include "timer.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#elif defined(__linux__)
+#include <errno.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+enum
+{
+	k_fs_watch_max_directories = 16,
+	k_fs_watch_max_files = 64,
+	k_fs_watch_default_debounce_ms = 100,
+	k_fs_watch_buffer_size = 16 * 1024,
+};
+
+typedef struct fs_watch_directory_t
+{
+	char path[1024];
+#if defined(_WIN32)
+	HANDLE handle;
+	OVERLAPPED overlapped;
+	// ReadDirectoryChangesW needs DWORD alignment.
+	DWORD buffer[k_fs_watch_buffer_size / sizeof(DWORD)];
+#elif defined(__linux__)
+	int descriptor;
+#endif
+} fs_watch_directory_t;
+
+typedef struct fs_watch_file_t
+{
+	int directory;
+	char path[1024];
+	// File name within the directory; points into path.
+	const char* name;
+	fs_watch_func_t function;
+	void* user;
+	// Ticks of the latest change not yet reported, or zero.
+	uint64_t changed;
+} fs_watch_file_t;
+
+typedef struct fs_watch_t
+{
+	heap_t* heap;
+	uint64_t debounce;
+#if defined(__linux__)
+	int inotify;
+#endif
+	fs_watch_directory_t directories[k_fs_watch_max_directories];
+	int directory_count;
+	fs_watch_file_t files[k_fs_watch_max_files];
+	int file_count;
+} fs_watch_t;
+
+// Marks subscribers of a file, or of every file in the directory if name is
+// NULL, as changed just now.
+static void fs_watch_changed(fs_watch_t* watch, int directory, const char* name)
+{
+	uint64_t now = timer_get_ticks();
+	for (int i = 0; i < watch->file_count; ++i)
+	{
+		fs_watch_file_t* file = &watch->files[i];
+		if (file->directory == directory && (!name || strcmp(file->name, name) == 0))
+		{
+			file->changed = now ? now : 1;
+		}
+	}
+}
+
+#if defined(_WIN32)
+
+// Queue the next batch of change records for a directory.
+static bool fs_watch_os_read(fs_watch_directory_t* directory)
+{
+	return ReadDirectoryChangesW(directory->handle, directory->buffer, sizeof(directory->buffer), FALSE,
+		FILE_NOTIFY_CHANGE_FILE_NAME | FILE_NOTIFY_CHANGE_LAST_WRITE | FILE_NOTIFY_CHANGE_SIZE, NULL, &directory->overlapped, NULL);
+}
+
+static bool fs_watch_os_open(fs_watch_t* watch, fs_watch_directory_t* directory)
+{
+	wchar_t wide_path[1024];
+	if (MultiByteToWideChar(CP_UTF8, 0, directory->path, -1, wide_path, _countof(wide_path)) <= 0)
+	{
+		return false;
+	}
+	directory->handle = CreateFile(wide_path, FILE_LIST_DIRECTORY, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, NULL,
+		OPEN_EXISTING, FILE_FLAG_BACKUP_SEMANTICS | FILE_FLAG_OVERLAPPED, NULL);
+	if (directory->handle == INVALID_HANDLE_VALUE)
+	{
+		return false;
+	}
+	memset(&directory->overlapped, 0, sizeof(directory->overlapped));
+	directory->overlapped.hEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+	if (!fs_watch_os_read(directory))
+	{
+		CloseHandle(directory->overlapped.hEvent);
+		CloseHandle(directory->handle);
+		return false;
+	}
+	return true;
+}
+
+static void fs_watch_os_close(fs_watch_t* watch, fs_watch_directory_t* directory)
+{
+	CancelIoEx(directory->handle, &directory->overlapped);
+	DWORD bytes;
+	GetOverlappedResult(directory->handle, &directory->overlapped, &bytes, TRUE);
+	CloseHandle(directory->overlapped.hEvent);
+	CloseHandle(directory->handle);
+}
+
+static void fs_watch_os_poll(fs_watch_t* watch)
+{
+	for (int i = 0; i < watch->directory_count; ++i)
+	{
+		fs_watch_directory_t* directory = &watch->directories[i];
+		DWORD bytes = 0;
+		while (GetOverlappedResult(directory->handle, &directory->overlapped, &bytes, FALSE))
+		{
+			if (bytes == 0)
+			{
+				// The records overflowed the buffer: assume everything changed.
+				fs_watch_changed(watch, i, NULL);
+			}
+			const char* record = (const char*)directory->buffer;
+			while (bytes > 0)
+			{
+				const FILE_NOTIFY_INFORMATION* info = (const FILE_NOTIFY_INFORMATION*)record;
+				char name[1024];
+				int length = WideCharToMultiByte(CP_UTF8, 0, info->FileName, info->FileNameLength / sizeof(WCHAR), name, sizeof(name) - 1, NULL, NULL);
+				if (length > 0)
+				{
+					name[length] = 0;
+					fs_watch_changed(watch, i, name);
+				}
+				if (!info->NextEntryOffset)
+				{
+					break;
+				}
+				record += info->NextEntryOffset;
+			}
+			ResetEvent(directory->overlapped.hEvent);
+			if (!fs_watch_os_read(directory))
+			{
+				break;
+			}
+		}
+	}
+}
+
+#elif defined(__linux__)
+
+static bool fs_watch_os_open(fs_watch_t* watch, fs_watch_directory_t* directory)
+{
+	// Writes in place raise modify and close events; saves that rename a new
+	// file into place raise moved-to.
+	directory->descriptor = inotify_add_watch(watch->inotify, directory->path, IN_MODIFY | IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE);
+	return directory->descriptor >= 0;
+}
+
+static void fs_watch_os_close(fs_watch_t* watch, fs_watch_directory_t* directory)
+{
+	inotify_rm_watch(watch->inotify, directory->descriptor);
+}
+
+static void fs_watch_os_poll(fs_watch_t* watch)
+{
+	// Aligned for struct inotify_event.
+	uint64_t buffer[k_fs_watch_buffer_size / sizeof(uint64_t)];
+	while (true)
+	{
+		ssize_t size = read(watch->inotify, buffer, sizeof(buffer));
+		if (size <= 0)
+		{
+			// EAGAIN: nothing more queued.
+			break;
+		}
+		for (const char* record = (const char*)buffer; record < (const char*)buffer + size;)
+		{
+			const struct inotify_event* event = (const struct inotify_event*)record;
+			record += sizeof(struct inotify_event) + event->len;
+			if (event->mask & IN_Q_OVERFLOW)
+			{
+				for (int i = 0; i < watch->directory_count; ++i)
+				{
+					fs_watch_changed(watch, i, NULL);
+				}
+				continue;
+			}
+			for (int i = 0; i < watch->directory_count; ++i)
+			{
+				if (watch->directories[i].descriptor == event->wd && event->len > 0)
+				{
+					fs_watch_changed(watch, i, event->name);
+				}
+			}
+		}
+	}
+}
+
+#else
+
+static bool fs_watch_os_open(fs_watch_t* watch, fs_watch_directory_t* directory)
+{
+	return false;
+}
+
+static void fs_watch_os_close(fs_watch_t* watch, fs_watch_directory_t* directory)
+{
+}
+
+static void fs_watch_os_poll(fs_watch_t* watch)
+{
+}
+
+#endif
+
+fs_watch_t* fs_watch_create(heap_t* heap, uint32_t debounce_ms)
+{
+	fs_watch_t* watch = heap_alloc(heap, sizeof(fs_watch_t), 8);
+	memset(watch, 0, sizeof(*watch));
+	watch->heap = heap;
+	uint32_t ms = debounce_ms ? debounce_ms : k_fs_watch_default_debounce_ms;
+	watch->debounce = ms * timer_get_ticks_per_second() / 1000;
+#if defined(__linux__)
+	watch->inotify = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+#endif
+	return watch;
+}
+
+void fs_watch_destroy(fs_watch_t* watch)
+{
+	for (int i = 0; i < watch->directory_count; ++i)
+	{
+		fs_watch_os_close(watch, &watch->directories[i]);
+	}
+#if defined(__linux__)
+	if (watch->inotify >= 0)
+	{
+		close(watch->inotify);
+	}
+#endif
+	heap_free(watch->heap, watch);
+}
+
+// Index of the watched directory holding path, watching it first if need be.
+// Returns -1 if it can't be watched.
+static int fs_watch_directory(fs_watch_t* watch, const char* path, size_t length)
+{
+	char directory_path[1024];
+	if (length == 0)
+	{
+		snprintf(directory_path, sizeof(directory_path), ".");
+	}
+	else
+	{
+		snprintf(directory_path, sizeof(directory_path), "%.*s", (int)length, path);
+	}
+
+	for (int i = 0; i < watch->directory_count; ++i)
+	{
+		if (strcmp(watch->directories[i].path, directory_path) == 0)
+		{
+			return i;
+		}
+	}
+	if (watch->directory_count == k_fs_watch_max_directories)
+	{
+		return -1;
+	}
+	fs_watch_directory_t* directory = &watch->directories[watch->directory_count];
+	snprintf(directory->path, sizeof(directory->path), "%s", directory_path);
+	if (!fs_watch_os_open(watch, directory))
+	{
+		return -1;
+	}
+	return watch->directory_count++;
+}
+
+bool fs_watch_add(fs_watch_t* watch, const char* path, fs_watch_func_t function, void* user)
+{
+	if (watch->file_count == k_fs_watch_max_files)
+	{
+		return false;
+	}
+	const char* name = path;
+	for (const char* c = path; *c; ++c)
+	{
+		if (*c == '/' || *c == '\\')
+		{
+			name = c + 1;
+		}
+	}
+	// Keep the separator for files at the root, so "/a" watches "/".
+	size_t directory_length = name == path ? 0 : (size_t)(name - path - 1);
+	int directory = fs_watch_directory(watch, path, directory_length ? directory_length : (size_t)(name - path));
+	if (directory < 0)
+	{
+		return false;
+	}
+
+	fs_watch_file_t* file = &watch->files[watch->file_count++];
+	memset(file, 0, sizeof(*file));
+	file->directory = directory;
+	snprintf(file->path, sizeof(file->path), "%s", path);
+	file->name = file->path + (name - path);
+	file->function = function;
+	file->user = user;
+	return true;
+}
+
+int fs_watch_update(fs_watch_t* watch)
+{
+	fs_watch_os_poll(watch);
+
+	int count = 0;
+	uint64_t now = timer_get_ticks();
+	for (int i = 0; i < watch->file_count; ++i)
+	{
+		fs_watch_file_t* file = &watch->files[i];
+		if (file->changed && now - file->changed >= watch->debounce)
+		{
+			file->changed = 0;
+			file->function(file->path, file->user);
+			count++;
+		}
+	}
+	return count;
+}
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Watches files for changes, for hot reloading assets.
+//
+// Each watched file's directory is watched (inotify on Linux,
+// ReadDirectoryChangesW on Windows), so editors that save by writing a new
+// file and renaming it over the old one are still seen. Changes are
+// debounced: a file is reported once it has gone debounce_ms without
+// another change, so a save that arrives as many writes notifies once.
+//
+// Nothing happens in the background. fs_watch_update() collects OS events
+// and calls subscribers on the calling thread, typically once a frame.
+// Not thread-safe: one thread drives a watch.
+
+// Handle to a watch.
+typedef struct fs_watch_t fs_watch_t;
+
+typedef struct heap_t heap_t;
+
+// Called from fs_watch_update() once a file has changed and settled.
+typedef void (*fs_watch_func_t)(const char* path, void* user);
+
+// Create a watch. A debounce of zero uses the default of 100 ms.
+fs_watch_t* fs_watch_create(heap_t* heap, uint32_t debounce_ms);
+
+// Stop watching and free the watch.
+void fs_watch_destroy(fs_watch_t* watch);
+
+// Call function whenever the file at path changes. A file may have several
+// subscribers. Returns false if its directory can't be watched, the limit of
+// watched files is reached, or this platform has no watching.
+bool fs_watch_add(fs_watch_t* watch, const char* path, fs_watch_func_t function, void* user);
+
+// Collect changes and notify subscribers of files that have settled.
+// Returns how many notifications were made.
+int fs_watch_update(fs_watch_t* watch);
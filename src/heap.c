@@ -9,15 +9,24 @@
 #include <stddef.h>
 #include <stdio.h>
 
+#if defined(_WIN32)
 #define WIN32_LEAN_AND_MEAN
 #include <windows.h>
 #include "dbghelp.h"
+#else
+#include <sys/mman.h>
+#endif
 
 #define CALLSTACK_DEPTH 10
 
+#if !defined(__max)
+#define __max(a, b) (((a) > (b)) ? (a) : (b))
+#endif
+
 typedef struct arena_t
 {
 	pool_t pool;
+	size_t size;
 	struct arena_t* next;
 } arena_t;
 
@@ -29,10 +38,30 @@ typedef struct heap_t
 	mutex_t* mutex;
 } heap_t;
 
+// Reserve and commit pages directly from the OS.
+static void* heap_os_alloc(size_t size)
+{
+#if defined(_WIN32)
+	return VirtualAlloc(NULL, size, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+#else
+	void* address = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	return address == MAP_FAILED ? NULL : address;
+#endif
+}
+
+// Return pages from heap_os_alloc() to the OS.
+static void heap_os_free(void* address, size_t size)
+{
+#if defined(_WIN32)
+	VirtualFree(address, 0, MEM_RELEASE);
+#else
+	munmap(address, size);
+#endif
+}
+
 heap_t* heap_create(size_t grow_increment)
 {
-	heap_t* heap = VirtualAlloc(NULL, sizeof(heap_t) + tlsf_size(),
-		MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+	heap_t* heap = heap_os_alloc(sizeof(heap_t) + tlsf_size());
 	if (!heap)
 	{
 		debug_print(
@@ -61,9 +90,7 @@ void* heap_alloc(heap_t* heap, size_t size, size_t alignment)
 		size_t arena_size =
 			__max(heap->grow_increment, real_size * 2) +
 			sizeof(arena_t);
-		arena_t* arena = VirtualAlloc(NULL,
-			arena_size + tlsf_pool_overhead(),
-			MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+		arena_t* arena = heap_os_alloc(arena_size + tlsf_pool_overhead());
 		if (!arena)
 		{
 			debug_print(
@@ -73,6 +100,7 @@ void* heap_alloc(heap_t* heap, size_t size, size_t alignment)
 		}
 
 		arena->pool = tlsf_add_pool(heap->tlsf, arena + 1, arena_size);
+		arena->size = arena_size + tlsf_pool_overhead();
 
 		arena->next = heap->arena;
 		heap->arena = arena;
@@ -80,7 +108,7 @@ void* heap_alloc(heap_t* heap, size_t size, size_t alignment)
 		address = tlsf_memalign(heap->tlsf, alignment, real_size);
 	}
 	
-	int traces = debug_backtrace((void**) address, CALLSTACK_DEPTH);
+	debug_backtrace((void**) address, CALLSTACK_DEPTH);
 	
 	mutex_unlock(heap->mutex);
 	return ((char*)address + sizeof(void*) * CALLSTACK_DEPTH);
@@ -88,6 +116,10 @@ void* heap_alloc(heap_t* heap, size_t size, size_t alignment)
 
 void heap_free(heap_t* heap, void* address)
 {
+	if (!address)
+	{
+		return;
+	}
 	mutex_lock(heap->mutex);
 	tlsf_free(heap->tlsf, (char*)address - sizeof(void*) * CALLSTACK_DEPTH);
 	mutex_unlock(heap->mutex);
@@ -95,8 +127,6 @@ void heap_free(heap_t* heap, void* address)
 
 static void leak_walker(void* ptr, size_t size, int used, void* user) {
 	if (used) {
-		heap_t* heap = (heap_t*)user;
-
 		debug_print(k_print_warning, "Memory leak of size %u bytes with callstack:\n", (uint32_t)(size - sizeof(void*) * CALLSTACK_DEPTH));
 		callstack_printer(k_print_warning,  (void**)ptr, CALLSTACK_DEPTH);
 
@@ -116,11 +146,11 @@ void heap_destroy(heap_t* heap)
 		arena_t* next = arena->next;
 		tlsf_walk_pool(arena->pool, leak_walker, heap);
 		
-		VirtualFree(arena, 0, MEM_RELEASE);
+		heap_os_free(arena, arena->size);
 		arena = next;
 	}
 
 	mutex_destroy(heap->mutex);
 
-	VirtualFree(heap, 0, MEM_RELEASE);
+	heap_os_free(heap, sizeof(heap_t) + tlsf_size());
 }
@@ -23,4 +23,5 @@ void heap_destroy(heap_t* heap);
 void* heap_alloc(heap_t* heap, size_t size, size_t alignment);
 
 // Free memory previously allocated from a heap.
+// Freeing NULL does nothing.
 void heap_free(heap_t* heap, void* address);
@@ -1,8 +1,12 @@
 #include "atomic.h"
 #include "debug.h"
 #include "event.h"
+#include "fast_mutex.h"
+#include "heap.h"
 #include "mutex.h"
+#include "rwlock.h"
 #include "semaphore.h"
+#include "spinlock.h"
 #include "thread.h"
 
 #include <windows.h>
@@ -11,6 +15,9 @@ typedef struct thread_data_t
 {
 	int* counter;
 	mutex_t* mutex;
+	fast_mutex_t* fast_mutex;
+	spinlock_t* spinlock;
+	rwlock_t* rwlock;
 	event_t* start;
 } thread_data_t;
 
@@ -76,13 +83,128 @@ static int mutex_func(void* user)
 	return timeGetTime() - t0;
 }
 
-static void run_timed_test(int (*thread_func)(void*), const char* name)
+static int fast_mutex_func(void* user)
+{
+	thread_data_t* thread_data = user;
+	event_wait(thread_data->start);
+
+	DWORD t0 = timeGetTime();
+
+	for (int i = 0; i < 100000; ++i)
+	{
+		fast_mutex_lock(thread_data->fast_mutex);
+		*thread_data->counter = *thread_data->counter + 1;
+		fast_mutex_unlock(thread_data->fast_mutex);
+	}
+
+	return timeGetTime() - t0;
+}
+
+static int spinlock_func(void* user)
+{
+	thread_data_t* thread_data = user;
+	event_wait(thread_data->start);
+
+	DWORD t0 = timeGetTime();
+
+	for (int i = 0; i < 100000; ++i)
+	{
+		spinlock_lock(thread_data->spinlock);
+		*thread_data->counter = *thread_data->counter + 1;
+		spinlock_unlock(thread_data->spinlock);
+	}
+
+	return timeGetTime() - t0;
+}
+
+static int rwlock_exclusive_func(void* user)
+{
+	thread_data_t* thread_data = user;
+	event_wait(thread_data->start);
+
+	DWORD t0 = timeGetTime();
+
+	for (int i = 0; i < 100000; ++i)
+	{
+		rwlock_lock_exclusive(thread_data->rwlock);
+		*thread_data->counter = *thread_data->counter + 1;
+		rwlock_unlock_exclusive(thread_data->rwlock);
+	}
+
+	return timeGetTime() - t0;
+}
+
+// The read-mostly tests store what they read here, so the reads can't be
+// optimized out of the timing.
+static int s_read_sink;
+
+// Read-mostly workload: one write for every 64 reads.
+// Counter only reflects the writes.
+static int rwlock_read_mostly_func(void* user)
+{
+	thread_data_t* thread_data = user;
+	event_wait(thread_data->start);
+
+	DWORD t0 = timeGetTime();
+
+	int sum = 0;
+	for (int i = 0; i < 100000; ++i)
+	{
+		if ((i & 63) == 0)
+		{
+			rwlock_lock_exclusive(thread_data->rwlock);
+			*thread_data->counter = *thread_data->counter + 1;
+			rwlock_unlock_exclusive(thread_data->rwlock);
+		}
+		else
+		{
+			rwlock_lock_shared(thread_data->rwlock);
+			sum += *thread_data->counter;
+			rwlock_unlock_shared(thread_data->rwlock);
+		}
+	}
+	atomic_store(&s_read_sink, sum);
+
+	return timeGetTime() - t0;
+}
+
+// Same read-mostly workload as above but every access takes the recursive mutex.
+static int mutex_read_mostly_func(void* user)
+{
+	thread_data_t* thread_data = user;
+	event_wait(thread_data->start);
+
+	DWORD t0 = timeGetTime();
+
+	int sum = 0;
+	for (int i = 0; i < 100000; ++i)
+	{
+		mutex_lock(thread_data->mutex);
+		if ((i & 63) == 0)
+		{
+			*thread_data->counter = *thread_data->counter + 1;
+		}
+		else
+		{
+			sum += *thread_data->counter;
+		}
+		mutex_unlock(thread_data->mutex);
+	}
+	atomic_store(&s_read_sink, sum);
+
+	return timeGetTime() - t0;
+}
+
+static void run_timed_test(heap_t* heap, int (*thread_func)(void*), const char* name)
 {
 	int counter = 0;
 	thread_data_t thread_data =
 	{
 		.counter = &counter,
 		.mutex = mutex_create(),
+		.fast_mutex = fast_mutex_create(heap),
+		.spinlock = spinlock_create(heap),
+		.rwlock = rwlock_create(heap),
 		.start = event_create(),
 	};
 
@@ -103,6 +225,9 @@ static void run_timed_test(int (*thread_func)(void*), const char* name)
 		duration += thread_destroy(threads[i]);
 	}
 	mutex_destroy(thread_data.mutex);
+	fast_mutex_destroy(thread_data.fast_mutex);
+	spinlock_destroy(thread_data.spinlock);
+	rwlock_destroy(thread_data.rwlock);
 	event_destroy(thread_data.start);
 
 	debug_print(k_print_warning, "%s duration=%dms, counter=%d\n", name, duration, counter);
@@ -110,8 +235,17 @@ static void run_timed_test(int (*thread_func)(void*), const char* name)
 
 void lecture7_thread_test()
 {
-	run_timed_test(no_synchronization_func, "no_synchronization");
-	run_timed_test(atomic_load_store_func, "atomic_load_store");
-	run_timed_test(atomic_increment_func, "atomic_increment");
-	run_timed_test(mutex_func, "mutex");
+	heap_t* heap = heap_create(4096);
+
+	run_timed_test(heap, no_synchronization_func, "no_synchronization");
+	run_timed_test(heap, atomic_load_store_func, "atomic_load_store");
+	run_timed_test(heap, atomic_increment_func, "atomic_increment");
+	run_timed_test(heap, mutex_func, "mutex");
+	run_timed_test(heap, fast_mutex_func, "fast_mutex");
+	run_timed_test(heap, spinlock_func, "spinlock");
+	run_timed_test(heap, rwlock_exclusive_func, "rwlock_exclusive");
+	run_timed_test(heap, mutex_read_mostly_func, "mutex_read_mostly");
+	run_timed_test(heap, rwlock_read_mostly_func, "rwlock_read_mostly");
+
+	heap_destroy(heap);
 }
@@ -1,24 +1,85 @@
 #include "debug.h"
 #include "fs.h"
+#include "fs_bench.h"
+#include "fs_container.h"
+#include "fs_pak.h"
 #include "heap.h"
+#include "thread.h"
+#include "thread_bench.h"
+#include "thread_stress.h"
+#include "timer.h"
+#include "trace.h"
+
+// The window, renderer and game are Win32 and Vulkan only. Elsewhere only the
+// headless runs below are built; see the Makefile.
+#if defined(_WIN32)
 #include "net.h"
 #include "render.h"
 #include "frogger_game.h"
-#include "timer.h"
 #include "wm.h"
 #include "c_test.h"
+#endif
+
+#include <stdlib.h>
+#include <string.h>
 
 int main(int argc, const char* argv[])
 {
 	debug_set_print_mask(k_print_info | k_print_warning | k_print_error);
 	debug_install_exception_handler();
+	thread_set_name("main");
 
 	//soloud_test();
 
 	timer_startup();
 
 	heap_t* heap = heap_create(2 * 1024 * 1024);
-	fs_t* fs = fs_create(heap, 8);
+
+	// Headless diagnostic run: no window, renderer or game.
+	if (argc > 1 && strcmp(argv[1], "--stress") == 0)
+	{
+		bool ok = thread_stress_run(heap);
+		heap_destroy(heap);
+		return ok ? 0 : 1;
+	}
+	if (argc > 1 && strcmp(argv[1], "--bench-fs") == 0)
+	{
+		bool ok = fs_bench_run(heap, argc > 2 ? argv[2] : "fs_bench.csv");
+		heap_destroy(heap);
+		return ok ? 0 : 1;
+	}
+	// Offline packer: --pack out.pak [--compress[=level]] files...
+	// Compression defaults to LZ4 HC level 9; see fs_work_options_t for levels.
+	if (argc > 2 && strcmp(argv[1], "--pack") == 0)
+	{
+		bool compress = argc > 3 && strncmp(argv[3], "--compress", 10) == 0;
+		fs_container_codec_t codec = { .level = 9 };
+		if (compress && argv[3][10] == '=')
+		{
+			codec.level = atoi(argv[3] + 11);
+		}
+		int first = compress ? 4 : 3;
+		bool ok = fs_pak_build(heap, argv[2], (const char* const*)argv + first, NULL, argc - first, compress ? &codec : NULL);
+		heap_destroy(heap);
+		return ok ? 0 : 1;
+	}
+	// Convert a streamed trace capture for chrome://tracing: --trace-decode in out.json
+	if (argc > 3 && strcmp(argv[1], "--trace-decode") == 0)
+	{
+		bool ok = trace_stream_decode(heap, argv[2], argv[3]);
+		heap_destroy(heap);
+		return ok ? 0 : 1;
+	}
+	if (argc > 1 && strcmp(argv[1], "--bench-threads") == 0)
+	{
+		bool ok = thread_bench_run(heap, argc > 2 ? argv[2] : "thread_bench.csv");
+		heap_destroy(heap);
+		return ok ? 0 : 1;
+	}
+
+#if defined(_WIN32)
+	// Shared reads keep a few MB of assets around, so reloading costs no I/O.
+	fs_t* fs = fs_create_ex(heap, &(fs_options_t) { .queue_capacity = 8, .cache_budget = 8 * 1024 * 1024 });
 	wm_window_t* window = wm_create(heap);
 	render_t* render = render_create(heap, window);
 
@@ -39,4 +100,10 @@ int main(int argc, const char* argv[])
 	heap_destroy(heap);
 
 	return 0;
+#else
+	debug_print(k_print_error,
+		"Headless build: run with --stress, --bench-fs, --bench-threads, --pack or --trace-decode.\n");
+	heap_destroy(heap);
+	return 1;
+#endif
 }
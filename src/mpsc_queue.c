@@ -0,0 +1,92 @@
+#include "mpsc_queue.h"
+
+#include "atomic.h"
+#include "heap.h"
+
+#include <stddef.h>
+
+// Dmitry Vyukov's intrusive MPSC queue.
+// Producers swap themselves into head and then link the previous head to them.
+// The consumer walks from tail. A stub node keeps the list non-empty so
+// producers never have to touch tail.
+// Producer and consumer ends sit on separate cache lines.
+typedef struct mpsc_queue_t
+{
+	mpsc_node_t* head;
+	char head_pad[64 - sizeof(mpsc_node_t*)];
+	mpsc_node_t* tail;
+	mpsc_node_t stub;
+	heap_t* heap;
+} mpsc_queue_t;
+
+mpsc_queue_t* mpsc_queue_create(heap_t* heap)
+{
+	mpsc_queue_t* queue = heap_alloc(heap, sizeof(mpsc_queue_t), 64);
+	queue->heap = heap;
+	queue->stub.next = NULL;
+	queue->head = &queue->stub;
+	queue->tail = &queue->stub;
+	return queue;
+}
+
+void mpsc_queue_destroy(mpsc_queue_t* queue)
+{
+	heap_free(queue->heap, queue);
+}
+
+void mpsc_queue_push(mpsc_queue_t* queue, mpsc_node_t* node)
+{
+	node->next = NULL;
+	mpsc_node_t* prev = atomic_exchange_pointer((void**)&queue->head, node);
+	// Between the exchange and this store the list is briefly split;
+	// the consumer sees that as empty and retries later.
+	atomic_store_pointer((void**)&prev->next, node);
+}
+
+mpsc_node_t* mpsc_queue_pop(mpsc_queue_t* queue)
+{
+	mpsc_node_t* tail = queue->tail;
+	mpsc_node_t* next = atomic_load_pointer((void**)&tail->next);
+
+	// Skip over the stub.
+	if (tail == &queue->stub)
+	{
+		if (!next)
+		{
+			return NULL;
+		}
+		queue->tail = next;
+		tail = next;
+		next = atomic_load_pointer((void**)&tail->next);
+	}
+
+	if (next)
+	{
+		queue->tail = next;
+		return tail;
+	}
+
+	// tail looks like the last node. If a producer has already swapped in a
+	// newer head it is mid-push; leave tail until it links up.
+	mpsc_node_t* head = atomic_load_pointer((void**)&queue->head);
+	if (tail != head)
+	{
+		return NULL;
+	}
+
+	// tail really is last. Push the stub behind it so tail can be handed out.
+	mpsc_queue_push(queue, &queue->stub);
+	next = atomic_load_pointer((void**)&tail->next);
+	if (next)
+	{
+		queue->tail = next;
+		return tail;
+	}
+	return NULL;
+}
+
+bool mpsc_queue_is_empty(mpsc_queue_t* queue)
+{
+	mpsc_node_t* tail = queue->tail;
+	return tail == &queue->stub && !atomic_load_pointer((void**)&tail->next);
+}
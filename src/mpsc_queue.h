@@ -0,0 +1,46 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+
+// Lock-free multi-producer, single-consumer intrusive queue
+//
+// Items embed an mpsc_node_t and are linked through it, so pushing never allocates.
+// Any number of threads may push. Only one thread at a time may pop.
+
+// Link embedded in every item pushed onto an mpsc_queue_t.
+// Owned by the queue from push until the item is popped.
+typedef struct mpsc_node_t
+{
+	struct mpsc_node_t* next;
+} mpsc_node_t;
+
+// Handle to an MPSC queue.
+typedef struct mpsc_queue_t mpsc_queue_t;
+
+typedef struct heap_t heap_t;
+
+// Recover a pointer to the item that embeds a node.
+#define mpsc_node_container(node, type, member) \
+	((type*)((char*)(node) - offsetof(type, member)))
+
+// Create an empty queue.
+mpsc_queue_t* mpsc_queue_create(heap_t* heap);
+
+// Destroy a previously created queue.
+// Items still on the queue are not touched.
+void mpsc_queue_destroy(mpsc_queue_t* queue);
+
+// Push an item onto the queue. Never blocks.
+// Safe for multiple threads to push at the same time.
+void mpsc_queue_push(mpsc_queue_t* queue, mpsc_node_t* node);
+
+// Pop an item off the queue (FIFO order).
+// Returns NULL if the queue is empty, or if the next item's producer has not
+// finished linking it yet; in that case the item is returned by a later pop.
+// Only the single consumer thread may call this.
+mpsc_node_t* mpsc_queue_pop(mpsc_queue_t* queue);
+
+// Determines if the queue has nothing to pop.
+// Only the single consumer thread may call this.
+bool mpsc_queue_is_empty(mpsc_queue_t* queue);
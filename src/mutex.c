@@ -1,5 +1,7 @@
 #include "mutex.h"
 
+#if defined(_WIN32)
+
 #define WIN32_LEAN_AND_MEAN
 #include <windows.h>
 
@@ -22,3 +24,43 @@ void mutex_unlock(mutex_t* mutex)
 {
 	ReleaseMutex(mutex);
 }
+
+#else
+
+#include <pthread.h>
+#include <stdlib.h>
+
+typedef struct mutex_t
+{
+	pthread_mutex_t mutex;
+} mutex_t;
+
+mutex_t* mutex_create()
+{
+	// Heaps lock with a mutex_t, so it can't come from a heap.
+	mutex_t* mutex = calloc(1, sizeof(mutex_t));
+	pthread_mutexattr_t attr;
+	pthread_mutexattr_init(&attr);
+	pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+	pthread_mutex_init(&mutex->mutex, &attr);
+	pthread_mutexattr_destroy(&attr);
+	return mutex;
+}
+
+void mutex_destroy(mutex_t* mutex)
+{
+	pthread_mutex_destroy(&mutex->mutex);
+	free(mutex);
+}
+
+void mutex_lock(mutex_t* mutex)
+{
+	pthread_mutex_lock(&mutex->mutex);
+}
+
+void mutex_unlock(mutex_t* mutex)
+{
+	pthread_mutex_unlock(&mutex->mutex);
+}
+
+#endif
@@ -2,8 +2,8 @@
 
 #include "debug.h"
 #include "heap.h"
-#include "mutex.h"
 #include "queue.h"
+#include "rwlock.h"
 #include "thread.h"
 #include "timer.h"
 
@@ -95,7 +95,7 @@ typedef struct net_t
 	SOCKET sock;
 	thread_t* recv_thread;
 
-	mutex_t* connections_mutex;
+	rwlock_t* connections_lock;
 	connection_t connections[3];
 
 	entity_type_t entity_types[k_max_entity_types];
@@ -122,7 +122,7 @@ net_t* net_create(heap_t* heap, ecs_t* ecs)
 	WSAStartup(MAKEWORD(2, 2), &data);
 
 	net->sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
-	net->connections_mutex = mutex_create();
+	net->connections_lock = rwlock_create(heap);
 
 	struct sockaddr_in address;
 	address.sin_family = AF_INET;
@@ -134,7 +134,7 @@ net_t* net_create(heap_t* heap, ecs_t* ecs)
 	getsockname(net->sock, (struct sockaddr*)&address, &address_len);
 	debug_print(k_print_info, "Net bound port %d\n", ntohs(address.sin_port));
 
-	net->recv_thread = thread_create(recv_thread_func, net);
+	net->recv_thread = thread_create_ex(recv_thread_func, net, &(thread_options_t) { .name = "net recv" });
 
 	return net;
 }
@@ -145,7 +145,7 @@ void net_destroy(net_t* net)
 	closesocket(net->sock);
 	thread_destroy(net->recv_thread);
 	WSACleanup();
-	mutex_destroy(net->connections_mutex);
+	rwlock_destroy(net->connections_lock);
 	heap_free(net->heap, net);
 }
 
@@ -172,7 +172,7 @@ void net_connect(net_t* net, const net_address_t* address)
 
 void net_disconnect_all(net_t* net)
 {
-	mutex_lock(net->connections_mutex);
+	rwlock_lock_exclusive(net->connections_lock);
 
 	for (int i = 0; i < _countof(net->connections); ++i)
 	{
@@ -187,7 +187,7 @@ void net_disconnect_all(net_t* net)
 	}
 	memset(net->connections, 0, sizeof(net->connections));
 
-	mutex_unlock(net->connections_mutex);
+	rwlock_unlock_exclusive(net->connections_lock);
 }
 
 void net_state_register_entity_type(net_t* net, int type, uint64_t component_mask, uint64_t replicated_component_mask, net_configure_entity_callback_t configure_callback, void* configure_callback_data)
@@ -304,21 +304,35 @@ static int send_thread_func(void* user)
 	return 0;
 }
 
-static connection_t* find_or_create_connection(net_t* net, const net_address_t* address)
+static connection_t* find_connection(net_t* net, const net_address_t* address)
 {
-	connection_t* result = NULL;
-
-	mutex_lock(net->connections_mutex);
-
 	for (int i = 0; i < _countof(net->connections); ++i)
 	{
 		connection_t* c = &net->connections[i];
 		if (memcmp(&c->address, address, sizeof(net_address_t)) == 0)
 		{
-			result = c;
-			break;
+			return c;
 		}
 	}
+	return NULL;
+}
+
+static connection_t* find_or_create_connection(net_t* net, const net_address_t* address)
+{
+	// Every received packet lands here, and nearly always for a known connection.
+	// Look it up under a shared lock and only go exclusive to create one.
+	rwlock_lock_shared(net->connections_lock);
+	connection_t* result = find_connection(net, address);
+	rwlock_unlock_shared(net->connections_lock);
+	if (result)
+	{
+		return result;
+	}
+
+	rwlock_lock_exclusive(net->connections_lock);
+
+	// Another thread may have created it while we were unlocked.
+	result = find_connection(net, address);
 	if (!result)
 	{
 		for (int i = 0; i < _countof(net->connections); ++i)
@@ -333,7 +347,7 @@ static connection_t* find_or_create_connection(net_t* net, const net_address_t*
 				c->last_recv_ms = timer_ticks_to_ms(timer_get_ticks());
 				c->send_queue = queue_create(net->heap, 3);
 				c->recv_queue = queue_create(net->heap, 3);
-				c->send_thread = thread_create(send_thread_func, c);
+				c->send_thread = thread_create_ex(send_thread_func, c, &(thread_options_t) { .name = "net send" });
 
 				result = c;
 				break;
@@ -341,7 +355,7 @@ static connection_t* find_or_create_connection(net_t* net, const net_address_t*
 		}
 	}
 
-	mutex_unlock(net->connections_mutex);
+	rwlock_unlock_exclusive(net->connections_lock);
 
 	return result;
 }
@@ -391,7 +405,7 @@ static int recv_thread_func(void* user)
 
 static void timeout_old_connections(net_t* net)
 {
-	mutex_lock(net->connections_mutex);
+	rwlock_lock_exclusive(net->connections_lock);
 
 	uint32_t now = timer_ticks_to_ms(timer_get_ticks());
 	for (int i = 0; i < _countof(net->connections); ++i)
@@ -409,7 +423,7 @@ static void timeout_old_connections(net_t* net)
 		}
 	}
 
-	mutex_unlock(net->connections_mutex);
+	rwlock_unlock_exclusive(net->connections_lock);
 }
 
 static void snapshot_entities(net_t* net)
@@ -1,12 +1,15 @@
-#include "atomic.h"
 #include "heap.h"
 #include "semaphore.h"
+#include "spinlock.h"
 
 typedef struct queue_t
 {
 	heap_t* heap;
 	semaphore_t* used_items;
 	semaphore_t* free_items;
+	// Guards the indices and slots. The semaphores only count items, so without
+	// it a consumer could read a slot a slower producer has claimed but not filled.
+	spinlock_t* lock;
 	void** items;
 	int capacity;
 	int head_index;
@@ -19,6 +22,7 @@ queue_t* queue_create(heap_t* heap, int capacity)
 	queue->items = heap_alloc(heap, sizeof(void*) * capacity, 8);
 	queue->used_items = semaphore_create(0, capacity);
 	queue->free_items = semaphore_create(capacity, capacity);
+	queue->lock = spinlock_create(heap);
 	queue->heap = heap;
 	queue->capacity = capacity;
 	queue->head_index = 0;
@@ -30,6 +34,7 @@ void queue_destroy(queue_t* queue)
 {
 	semaphore_destroy(queue->used_items);
 	semaphore_destroy(queue->free_items);
+	spinlock_destroy(queue->lock);
 	heap_free(queue->heap, queue->items);
 	heap_free(queue->heap, queue);
 }
@@ -37,16 +42,20 @@ void queue_destroy(queue_t* queue)
 void queue_push(queue_t* queue, void* item)
 {
 	semaphore_acquire(queue->free_items);
-	int index = atomic_increment(&queue->tail_index) % queue->capacity;
-	queue->items[index] = item;
+	spinlock_lock(queue->lock);
+	queue->items[queue->tail_index] = item;
+	queue->tail_index = (queue->tail_index + 1) % queue->capacity;
+	spinlock_unlock(queue->lock);
 	semaphore_release(queue->used_items);
 }
 
 void* queue_pop(queue_t* queue)
 {
 	semaphore_acquire(queue->used_items);
-	int index = atomic_increment(&queue->head_index) % queue->capacity;
-	void* item = queue->items[index];
+	spinlock_lock(queue->lock);
+	void* item = queue->items[queue->head_index];
+	queue->head_index = (queue->head_index + 1) % queue->capacity;
+	spinlock_unlock(queue->lock);
 	semaphore_release(queue->free_items);
 	return item;
 }
@@ -55,8 +64,10 @@ bool queue_try_push(queue_t* queue, void* item)
 {
 	if (semaphore_try_acquire(queue->free_items))
 	{
-		int index = atomic_increment(&queue->tail_index) % queue->capacity;
-		queue->items[index] = item;
+		spinlock_lock(queue->lock);
+		queue->items[queue->tail_index] = item;
+		queue->tail_index = (queue->tail_index + 1) % queue->capacity;
+		spinlock_unlock(queue->lock);
 		semaphore_release(queue->used_items);
 		return true;
 	}
@@ -67,8 +78,10 @@ void* queue_try_pop(queue_t* queue)
 {
 	if (semaphore_try_acquire(queue->used_items))
 	{
-		int index = atomic_increment(&queue->head_index) % queue->capacity;
-		void* item = queue->items[index];
+		spinlock_lock(queue->lock);
+		void* item = queue->items[queue->head_index];
+		queue->head_index = (queue->head_index + 1) % queue->capacity;
+		spinlock_unlock(queue->lock);
 		semaphore_release(queue->free_items);
 		return item;
 	}
@@ -93,7 +93,11 @@ render_t* render_create(heap_t* heap, wm_window_t* window)
 	render->instance_count = 0;
 	render->mesh_count = 0;
 	render->shader_count = 0;
-	render->thread = thread_create(render_thread_func, render);
+	render->thread = thread_create_ex(render_thread_func, render, &(thread_options_t)
+	{
+		.name = "render",
+		.priority = k_thread_priority_high,
+	});
 	return render;
 }
 
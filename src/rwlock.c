@@ -0,0 +1,103 @@
+#include "rwlock.h"
+
+#include "heap.h"
+
+#if defined(_WIN32)
+
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+
+typedef struct rwlock_t
+{
+	heap_t* heap;
+	SRWLOCK lock;
+} rwlock_t;
+
+rwlock_t* rwlock_create(heap_t* heap)
+{
+	rwlock_t* lock = heap_alloc(heap, sizeof(rwlock_t), 8);
+	lock->heap = heap;
+	InitializeSRWLock(&lock->lock);
+	return lock;
+}
+
+void rwlock_destroy(rwlock_t* lock)
+{
+	heap_free(lock->heap, lock);
+}
+
+void rwlock_lock_shared(rwlock_t* lock)
+{
+	AcquireSRWLockShared(&lock->lock);
+}
+
+void rwlock_unlock_shared(rwlock_t* lock)
+{
+	ReleaseSRWLockShared(&lock->lock);
+}
+
+void rwlock_lock_exclusive(rwlock_t* lock)
+{
+	AcquireSRWLockExclusive(&lock->lock);
+}
+
+bool rwlock_try_lock_exclusive(rwlock_t* lock)
+{
+	return TryAcquireSRWLockExclusive(&lock->lock) != 0;
+}
+
+void rwlock_unlock_exclusive(rwlock_t* lock)
+{
+	ReleaseSRWLockExclusive(&lock->lock);
+}
+
+#else
+
+#include <pthread.h>
+
+typedef struct rwlock_t
+{
+	heap_t* heap;
+	pthread_rwlock_t lock;
+} rwlock_t;
+
+rwlock_t* rwlock_create(heap_t* heap)
+{
+	rwlock_t* lock = heap_alloc(heap, sizeof(rwlock_t), 8);
+	lock->heap = heap;
+	pthread_rwlock_init(&lock->lock, NULL);
+	return lock;
+}
+
+void rwlock_destroy(rwlock_t* lock)
+{
+	pthread_rwlock_destroy(&lock->lock);
+	heap_free(lock->heap, lock);
+}
+
+void rwlock_lock_shared(rwlock_t* lock)
+{
+	pthread_rwlock_rdlock(&lock->lock);
+}
+
+void rwlock_unlock_shared(rwlock_t* lock)
+{
+	pthread_rwlock_unlock(&lock->lock);
+}
+
+void rwlock_lock_exclusive(rwlock_t* lock)
+{
+	pthread_rwlock_wrlock(&lock->lock);
+}
+
+bool rwlock_try_lock_exclusive(rwlock_t* lock)
+{
+	return pthread_rwlock_trywrlock(&lock->lock) == 0;
+}
+
+void rwlock_unlock_exclusive(rwlock_t* lock)
+{
+	pthread_rwlock_unlock(&lock->lock);
+}
+
+#endif
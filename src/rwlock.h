@@ -0,0 +1,35 @@
+#pragma once
+
+#include <stdbool.h>
+
+// Reader-writer lock thread synchronization
+//
+// Any number of threads may hold the lock shared, or a single thread may hold it exclusive.
+// Suited to read-mostly data. Not recursive, and a shared lock cannot be upgraded in place.
+
+// Handle to a reader-writer lock.
+typedef struct rwlock_t rwlock_t;
+
+typedef struct heap_t heap_t;
+
+// Creates a new reader-writer lock.
+rwlock_t* rwlock_create(heap_t* heap);
+
+// Destroys a previously created reader-writer lock.
+void rwlock_destroy(rwlock_t* lock);
+
+// Locks for reading. May block while another thread holds the lock exclusive.
+void rwlock_lock_shared(rwlock_t* lock);
+
+// Unlocks a lock previously taken with rwlock_lock_shared().
+void rwlock_unlock_shared(rwlock_t* lock);
+
+// Locks for writing. May block while any other thread holds the lock.
+void rwlock_lock_exclusive(rwlock_t* lock);
+
+// Attempts to lock for writing without blocking.
+// Returns true if the lock was acquired.
+bool rwlock_try_lock_exclusive(rwlock_t* lock);
+
+// Unlocks a lock previously taken with rwlock_lock_exclusive().
+void rwlock_unlock_exclusive(rwlock_t* lock);
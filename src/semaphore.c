@@ -1,5 +1,7 @@
 #include "semaphore.h"
 
+#if defined(_WIN32)
+
 #define WIN32_LEAN_AND_MEAN
 #include <windows.h>
 
@@ -29,3 +31,71 @@ void semaphore_release(semaphore_t* semaphore)
 {
 	ReleaseSemaphore(semaphore, 1, NULL);
 }
+
+#else
+
+#include <pthread.h>
+#include <stdlib.h>
+
+// Built from a mutex and condition variable rather than sem_t, which
+// is missing on some POSIX systems and does not enforce a maximum.
+typedef struct semaphore_t
+{
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	int count;
+	int max_count;
+} semaphore_t;
+
+semaphore_t* semaphore_create(int initial_count, int max_count)
+{
+	semaphore_t* semaphore = calloc(1, sizeof(semaphore_t));
+	pthread_mutex_init(&semaphore->mutex, NULL);
+	pthread_cond_init(&semaphore->cond, NULL);
+	semaphore->count = initial_count;
+	semaphore->max_count = max_count;
+	return semaphore;
+}
+
+void semaphore_destroy(semaphore_t* semaphore)
+{
+	pthread_cond_destroy(&semaphore->cond);
+	pthread_mutex_destroy(&semaphore->mutex);
+	free(semaphore);
+}
+
+void semaphore_acquire(semaphore_t* semaphore)
+{
+	pthread_mutex_lock(&semaphore->mutex);
+	while (semaphore->count == 0)
+	{
+		pthread_cond_wait(&semaphore->cond, &semaphore->mutex);
+	}
+	semaphore->count--;
+	pthread_mutex_unlock(&semaphore->mutex);
+}
+
+bool semaphore_try_acquire(semaphore_t* semaphore)
+{
+	pthread_mutex_lock(&semaphore->mutex);
+	bool acquired = semaphore->count > 0;
+	if (acquired)
+	{
+		semaphore->count--;
+	}
+	pthread_mutex_unlock(&semaphore->mutex);
+	return acquired;
+}
+
+void semaphore_release(semaphore_t* semaphore)
+{
+	pthread_mutex_lock(&semaphore->mutex);
+	if (semaphore->count < semaphore->max_count)
+	{
+		semaphore->count++;
+		pthread_cond_signal(&semaphore->cond);
+	}
+	pthread_mutex_unlock(&semaphore->mutex);
+}
+
+#endif
@@ -133,8 +133,8 @@ void simple_game_update(simple_game_t* game)
 
 static void load_resources(simple_game_t* game)
 {
-	game->vertex_shader_work = fs_read(game->fs, "shaders/triangle.vert.spv", game->heap, false, false);
-	game->fragment_shader_work = fs_read(game->fs, "shaders/triangle.frag.spv", game->heap, false, false);
+	game->vertex_shader_work = fs_read_shared(game->fs, "shaders/triangle.vert.spv", false, NULL);
+	game->fragment_shader_work = fs_read_shared(game->fs, "shaders/triangle.frag.spv", false, NULL);
 	game->cube_shader = (gpu_shader_info_t)
 	{
 		.vertex_shader_data = fs_work_get_buffer(game->vertex_shader_work),
@@ -182,8 +182,7 @@ static void load_resources(simple_game_t* game)
 
 static void unload_resources(simple_game_t* game)
 {
-	heap_free(game->heap, fs_work_get_buffer(game->vertex_shader_work));
-	heap_free(game->heap, fs_work_get_buffer(game->fragment_shader_work));
+	// Shader data is shared; destroying the works releases it.
 	fs_work_destroy(game->fragment_shader_work);
 	fs_work_destroy(game->vertex_shader_work);
 }
@@ -0,0 +1,88 @@
+#include "spinlock.h"
+
+#include "atomic.h"
+#include "heap.h"
+
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#define spinlock_pause() YieldProcessor()
+#define spinlock_yield() SwitchToThread()
+#else
+#include <sched.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define spinlock_pause() _mm_pause()
+#elif defined(__aarch64__)
+#define spinlock_pause() __asm__ __volatile__("yield")
+#else
+#define spinlock_pause() ((void)0)
+#endif
+#define spinlock_yield() sched_yield()
+#endif
+
+enum
+{
+	// Spin rounds before giving the rest of the time slice away,
+	// in case the holder was preempted.
+	k_spinlock_yield_rounds = 16,
+};
+
+typedef struct spinlock_t
+{
+	heap_t* heap;
+	int next_ticket;
+	int now_serving;
+} spinlock_t;
+
+spinlock_t* spinlock_create(heap_t* heap)
+{
+	// Cache line aligned so two locks never share a line.
+	spinlock_t* lock = heap_alloc(heap, sizeof(spinlock_t), 64);
+	lock->heap = heap;
+	lock->next_ticket = 0;
+	lock->now_serving = 0;
+	return lock;
+}
+
+void spinlock_destroy(spinlock_t* lock)
+{
+	heap_free(lock->heap, lock);
+}
+
+void spinlock_lock(spinlock_t* lock)
+{
+	int ticket = atomic_increment(&lock->next_ticket);
+	for (int round = 0; true; ++round)
+	{
+		int distance = ticket - atomic_load(&lock->now_serving);
+		if (distance == 0)
+		{
+			break;
+		}
+
+		if (round >= k_spinlock_yield_rounds)
+		{
+			spinlock_yield();
+			continue;
+		}
+
+		// Back off proportionally to our place in line.
+		for (int i = 0; i < distance * 32; ++i)
+		{
+			spinlock_pause();
+		}
+	}
+}
+
+bool spinlock_try_lock(spinlock_t* lock)
+{
+	int serving = atomic_load(&lock->now_serving);
+	return atomic_compare_and_exchange(&lock->next_ticket, serving, serving + 1) == serving;
+}
+
+void spinlock_unlock(spinlock_t* lock)
+{
+	// Only the owner writes now_serving, so a plain increment is enough.
+	atomic_store(&lock->now_serving, lock->now_serving + 1);
+}
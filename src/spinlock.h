@@ -0,0 +1,30 @@
+#pragma once
+
+#include <stdbool.h>
+
+// Ticket spinlock thread synchronization
+//
+// Intended for very small critical sections (a handful of instructions).
+// Waiters busy-wait instead of sleeping, and are granted the lock in FIFO order.
+// Not recursive: a thread must not lock a spinlock it already holds.
+
+// Handle to a spinlock.
+typedef struct spinlock_t spinlock_t;
+
+typedef struct heap_t heap_t;
+
+// Creates a new spinlock.
+spinlock_t* spinlock_create(heap_t* heap);
+
+// Destroys a previously created spinlock.
+void spinlock_destroy(spinlock_t* lock);
+
+// Locks a spinlock. Spins until the lock is available.
+void spinlock_lock(spinlock_t* lock);
+
+// Attempts to lock a spinlock without spinning.
+// Returns true if the lock was acquired.
+bool spinlock_try_lock(spinlock_t* lock);
+
+// Unlocks a spinlock.
+void spinlock_unlock(spinlock_t* lock);
@@ -1,19 +1,108 @@
+// For CPU_SET, pthread_setaffinity_np and pthread_setname_np. Must come
+// before the first include, system headers included.
+#if !defined(_WIN32) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE
+#endif
+
 #include "thread.h"
 
 #include "debug.h"
+#include "event.h"
+
+#include <string.h>
+
+#if defined(_WIN32)
 
 #define WIN32_LEAN_AND_MEAN
 #include <windows.h>
 
+// Handed from the creating thread to the new thread.
+// Lives on the creator's stack until the new thread signals started.
+typedef struct thread_start_t
+{
+	int (*function)(void*);
+	void* data;
+	const char* name;
+	event_t* started;
+} thread_start_t;
+
+static __declspec(thread) char s_thread_name[64];
+
+static DWORD WINAPI thread_start_func(void* user)
+{
+	thread_start_t* start = user;
+	int (*function)(void*) = start->function;
+	void* data = start->data;
+	if (start->name)
+	{
+		thread_set_name(start->name);
+	}
+	event_signal(start->started);
+
+	return function(data);
+}
+
+static int thread_priority_to_win32(thread_priority_t priority)
+{
+	switch (priority)
+	{
+	case k_thread_priority_low: return THREAD_PRIORITY_BELOW_NORMAL;
+	case k_thread_priority_high: return THREAD_PRIORITY_ABOVE_NORMAL;
+	case k_thread_priority_critical: return THREAD_PRIORITY_TIME_CRITICAL;
+	default: return THREAD_PRIORITY_NORMAL;
+	}
+}
+
 thread_t* thread_create(int (*function)(void*), void* data)
 {
-	HANDLE h = CreateThread(NULL, 0, function, data, CREATE_SUSPENDED, NULL);
-	if (h == INVALID_HANDLE_VALUE)
+	return thread_create_ex(function, data, NULL);
+}
+
+thread_t* thread_create_ex(int (*function)(void*), void* data, const thread_options_t* options)
+{
+	thread_options_t defaults = { 0 };
+	if (!options)
+	{
+		options = &defaults;
+	}
+
+	thread_start_t start =
+	{
+		.function = function,
+		.data = data,
+		.name = options->name,
+		.started = event_create(),
+	};
+
+	DWORD flags = CREATE_SUSPENDED;
+	if (options->stack_size)
+	{
+		flags |= STACK_SIZE_PARAM_IS_A_RESERVATION;
+	}
+
+	HANDLE h = CreateThread(NULL, options->stack_size, thread_start_func, &start, flags, NULL);
+	if (h == NULL)
 	{
 		debug_print(k_print_warning, "Thread failed to create!\n");
+		event_destroy(start.started);
 		return NULL;
 	}
+
+	if (options->affinity_mask && !SetThreadAffinityMask(h, (DWORD_PTR)options->affinity_mask))
+	{
+		debug_print(k_print_warning, "Thread affinity mask rejected: %llx\n", options->affinity_mask);
+	}
+	if (options->priority != k_thread_priority_normal)
+	{
+		SetThreadPriority(h, thread_priority_to_win32(options->priority));
+	}
+
 	ResumeThread(h);
+
+	// Start data is on our stack; wait for the thread to be done with it.
+	event_wait(start.started);
+	event_destroy(start.started);
+
 	return (thread_t*)h;
 }
 
@@ -30,3 +119,215 @@ void thread_sleep(uint32_t ms)
 {
 	Sleep(ms);
 }
+
+void thread_set_name(const char* name)
+{
+	strncpy_s(s_thread_name, sizeof(s_thread_name), name, _TRUNCATE);
+
+	wchar_t wide_name[64];
+	if (MultiByteToWideChar(CP_UTF8, 0, s_thread_name, -1, wide_name, _countof(wide_name)) > 0)
+	{
+		SetThreadDescription(GetCurrentThread(), wide_name);
+	}
+}
+
+const char* thread_get_name()
+{
+	return s_thread_name[0] ? s_thread_name : NULL;
+}
+
+uint64_t thread_get_id()
+{
+	return GetCurrentThreadId();
+}
+
+int thread_get_core_count()
+{
+	SYSTEM_INFO info;
+	GetSystemInfo(&info);
+	return info.dwNumberOfProcessors > 0 ? (int)info.dwNumberOfProcessors : 1;
+}
+
+#else
+
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+typedef struct thread_t
+{
+	pthread_t thread;
+} thread_t;
+
+// Handed from the creating thread to the new thread.
+// Lives on the creator's stack until the new thread signals started.
+typedef struct thread_start_t
+{
+	int (*function)(void*);
+	void* data;
+	const char* name;
+	thread_priority_t priority;
+	event_t* started;
+} thread_start_t;
+
+static __thread char s_thread_name[64];
+
+static int thread_priority_to_nice(thread_priority_t priority)
+{
+	switch (priority)
+	{
+	case k_thread_priority_low: return 5;
+	case k_thread_priority_high: return -5;
+	case k_thread_priority_critical: return -15;
+	default: return 0;
+	}
+}
+
+static void* thread_start_func(void* user)
+{
+	thread_start_t* start = user;
+	int (*function)(void*) = start->function;
+	void* data = start->data;
+	if (start->name)
+	{
+		thread_set_name(start->name);
+	}
+	if (start->priority != k_thread_priority_normal)
+	{
+		// Linux applies nice values per thread. Raising priority needs CAP_SYS_NICE.
+		if (setpriority(PRIO_PROCESS, (id_t)thread_get_id(), thread_priority_to_nice(start->priority)) != 0)
+		{
+			debug_print(k_print_warning, "Thread priority rejected: %d\n", errno);
+		}
+	}
+	event_signal(start->started);
+
+	return (void*)(intptr_t)function(data);
+}
+
+thread_t* thread_create(int (*function)(void*), void* data)
+{
+	return thread_create_ex(function, data, NULL);
+}
+
+thread_t* thread_create_ex(int (*function)(void*), void* data, const thread_options_t* options)
+{
+	thread_options_t defaults = { 0 };
+	if (!options)
+	{
+		options = &defaults;
+	}
+
+	// Threads are created before and by heaps, so they can't come from one.
+	thread_t* thread = calloc(1, sizeof(thread_t));
+
+	thread_start_t start =
+	{
+		.function = function,
+		.data = data,
+		.name = options->name,
+		.priority = options->priority,
+		.started = event_create(),
+	};
+
+	pthread_attr_t attr;
+	pthread_attr_init(&attr);
+	if (options->stack_size)
+	{
+		pthread_attr_setstacksize(&attr, options->stack_size);
+	}
+
+	int result = pthread_create(&thread->thread, &attr, thread_start_func, &start);
+	pthread_attr_destroy(&attr);
+	if (result != 0)
+	{
+		debug_print(k_print_warning, "Thread failed to create!\n");
+		event_destroy(start.started);
+		free(thread);
+		return NULL;
+	}
+
+#if defined(__linux__)
+	if (options->affinity_mask)
+	{
+		cpu_set_t cpus;
+		CPU_ZERO(&cpus);
+		for (int i = 0; i < 64 && i < CPU_SETSIZE; ++i)
+		{
+			if (options->affinity_mask & (1ULL << i))
+			{
+				CPU_SET(i, &cpus);
+			}
+		}
+		if (pthread_setaffinity_np(thread->thread, sizeof(cpus), &cpus) != 0)
+		{
+			debug_print(k_print_warning, "Thread affinity mask rejected: %llx\n", (unsigned long long)options->affinity_mask);
+		}
+	}
+#endif
+
+	// Start data is on our stack; wait for the thread to be done with it.
+	event_wait(start.started);
+	event_destroy(start.started);
+
+	return thread;
+}
+
+int thread_destroy(thread_t* thread)
+{
+	void* code = NULL;
+	pthread_join(thread->thread, &code);
+	free(thread);
+	return (int)(intptr_t)code;
+}
+
+void thread_sleep(uint32_t ms)
+{
+	struct timespec duration =
+	{
+		.tv_sec = ms / 1000,
+		.tv_nsec = (long)(ms % 1000) * 1000000L,
+	};
+	while (nanosleep(&duration, &duration) != 0 && errno == EINTR)
+	{
+	}
+}
+
+void thread_set_name(const char* name)
+{
+	snprintf(s_thread_name, sizeof(s_thread_name), "%s", name);
+
+#if defined(__linux__)
+	// Linux limits thread names to 15 characters.
+	char short_name[16] = { 0 };
+	memcpy(short_name, s_thread_name, sizeof(short_name) - 1);
+	pthread_setname_np(pthread_self(), short_name);
+#endif
+}
+
+const char* thread_get_name()
+{
+	return s_thread_name[0] ? s_thread_name : NULL;
+}
+
+uint64_t thread_get_id()
+{
+#if defined(__linux__)
+	return (uint64_t)syscall(SYS_gettid);
+#else
+	return (uint64_t)(uintptr_t)pthread_self();
+#endif
+}
+
+int thread_get_core_count()
+{
+	long count = sysconf(_SC_NPROCESSORS_ONLN);
+	return count > 0 ? (int)count : 1;
+}
+
+#endif
@@ -1,5 +1,6 @@
 #pragma once
 
+#include <stddef.h>
 #include <stdint.h>
 
 // Threading support.
@@ -7,14 +8,57 @@
 // Handle to a thread.
 typedef struct thread_t thread_t;
 
+// Scheduling priority class for a thread.
+typedef enum thread_priority_t
+{
+	k_thread_priority_normal,
+	k_thread_priority_low,
+	k_thread_priority_high,
+	k_thread_priority_critical,
+} thread_priority_t;
+
+// Optional settings for thread_create_ex().
+// Zeroed fields keep the OS defaults.
+typedef struct thread_options_t
+{
+	// Debug name shown in debuggers, profilers and trace captures.
+	const char* name;
+	// Bit N allows the thread to run on logical core N. Zero for any core.
+	uint64_t affinity_mask;
+	// Scheduling priority class.
+	thread_priority_t priority;
+	// Stack size in bytes. Zero for the default.
+	size_t stack_size;
+} thread_options_t;
+
 // Creates a new thread.
 // Thread begins running function with data on return.
 thread_t* thread_create(int (*function)(void*), void* data);
 
+// Creates a new thread with the specified options.
+// Options may be NULL, in which case this is the same as thread_create().
+// Thread begins running function with data on return.
+thread_t* thread_create_ex(int (*function)(void*), void* data, const thread_options_t* options);
+
 // Waits for a thread to complete and destroys it.
 // Returns the thread's exit code.
-int thread_destroy(thread);
+int thread_destroy(thread_t* thread);
 
 // Puts the calling thread to sleep for the specified number of milliseconds.
 // Thread will sleep for *approximately* the specified time.
 void thread_sleep(uint32_t ms);
+
+// Sets the debug name of the calling thread.
+// Threads started with thread_create_ex() are named already.
+void thread_set_name(const char* name);
+
+// Gets the debug name of the calling thread.
+// Returns NULL if the thread was never named.
+const char* thread_get_name();
+
+// Gets the OS identifier of the calling thread.
+uint64_t thread_get_id();
+
+// Gets the number of logical processors available to the process.
+// Always at least one.
+int thread_get_core_count();
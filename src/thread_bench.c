@@ -0,0 +1,383 @@
+#include "thread_bench.h"
+
+#include "atomic.h"
+#include "debug.h"
+#include "event.h"
+#include "fast_mutex.h"
+#include "fs.h"
+#include "heap.h"
+#include "mutex.h"
+#include "queue.h"
+#include "rwlock.h"
+#include "semaphore.h"
+#include "spinlock.h"
+#include "thread.h"
+#include "timer.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(_WIN32)
+#define THREAD_BENCH_BACKEND "win32"
+#else
+#define THREAD_BENCH_BACKEND "posix"
+#endif
+
+enum
+{
+	k_bench_max_threads = 8,
+	k_bench_ops_per_thread = 5000,
+	k_bench_warmup_reps = 2,
+	k_bench_reps = 9,
+	// Private work between operations under low contention.
+	k_bench_low_contention_work = 256,
+	k_bench_csv_capacity = 64 * 1024,
+};
+
+// How hard threads fight over the primitive.
+typedef enum bench_contention_t
+{
+	// Every thread hammers one shared primitive.
+	k_bench_contention_high,
+	// One shared primitive, with private work between operations.
+	k_bench_contention_low,
+	// Each thread has its own primitive.
+	k_bench_contention_none,
+} bench_contention_t;
+
+static const char* k_bench_contention_names[] = { "high", "low", "none" };
+
+typedef enum bench_kind_t
+{
+	k_bench_unsynchronized,
+	k_bench_atomic_increment,
+	k_bench_atomic_compare_and_exchange,
+	k_bench_mutex,
+	k_bench_fast_mutex,
+	k_bench_spinlock,
+	k_bench_rwlock_exclusive,
+	k_bench_rwlock_shared,
+	k_bench_semaphore,
+	k_bench_queue,
+	k_bench_event_wake,
+	k_bench_count,
+} bench_kind_t;
+
+static const char* k_bench_kind_names[] =
+{
+	"unsynchronized",
+	"atomic_increment",
+	"atomic_compare_and_exchange",
+	"mutex",
+	"fast_mutex",
+	"spinlock",
+	"rwlock_exclusive",
+	"rwlock_shared",
+	"semaphore",
+	"queue",
+	"event_wake",
+};
+
+// One padded slot per thread so per-thread primitives never share a cache line.
+typedef struct bench_slot_t
+{
+	int counter;
+	mutex_t* mutex;
+	fast_mutex_t* fast_mutex;
+	spinlock_t* spinlock;
+	rwlock_t* rwlock;
+	semaphore_t* semaphore;
+	queue_t* queue;
+	char pad[64];
+} bench_slot_t;
+
+typedef struct bench_case_t
+{
+	bench_kind_t kind;
+	bench_contention_t contention;
+	int thread_count;
+	event_t* start;
+	bench_slot_t slots[k_bench_max_threads];
+	uint64_t thread_ticks[k_bench_max_threads];
+	uint64_t signal_ticks;
+} bench_case_t;
+
+typedef struct bench_thread_t
+{
+	bench_case_t* bench;
+	int index;
+} bench_thread_t;
+
+typedef struct bench_result_t
+{
+	double min_ns;
+	double p50_ns;
+	double p90_ns;
+	double p99_ns;
+	double max_ns;
+} bench_result_t;
+
+static void bench_private_work(int iterations)
+{
+	volatile int sink = 0;
+	for (int i = 0; i < iterations; ++i)
+	{
+		sink += i;
+	}
+}
+
+static bench_slot_t* bench_slot(bench_case_t* bench, int index)
+{
+	return &bench->slots[bench->contention == k_bench_contention_none ? index : 0];
+}
+
+static int bench_thread_func(void* user)
+{
+	bench_thread_t* thread = user;
+	bench_case_t* bench = thread->bench;
+	bench_slot_t* slot = bench_slot(bench, thread->index);
+	int work = bench->contention == k_bench_contention_low ? k_bench_low_contention_work : 0;
+
+	event_wait(bench->start);
+
+	if (bench->kind == k_bench_event_wake)
+	{
+		// Woken by the signal itself; record when we noticed.
+		bench->thread_ticks[thread->index] = timer_get_ticks() - bench->signal_ticks;
+		return 0;
+	}
+
+	uint64_t t0 = timer_get_ticks();
+	for (int i = 0; i < k_bench_ops_per_thread; ++i)
+	{
+		switch (bench->kind)
+		{
+		case k_bench_unsynchronized:
+			slot->counter = slot->counter + 1;
+			break;
+		case k_bench_atomic_increment:
+			atomic_increment(&slot->counter);
+			break;
+		case k_bench_atomic_compare_and_exchange:
+		{
+			int old_value;
+			do
+			{
+				old_value = atomic_load(&slot->counter);
+			} while (atomic_compare_and_exchange(&slot->counter, old_value, old_value + 1) != old_value);
+			break;
+		}
+		case k_bench_mutex:
+			mutex_lock(slot->mutex);
+			slot->counter++;
+			mutex_unlock(slot->mutex);
+			break;
+		case k_bench_fast_mutex:
+			fast_mutex_lock(slot->fast_mutex);
+			slot->counter++;
+			fast_mutex_unlock(slot->fast_mutex);
+			break;
+		case k_bench_spinlock:
+			spinlock_lock(slot->spinlock);
+			slot->counter++;
+			spinlock_unlock(slot->spinlock);
+			break;
+		case k_bench_rwlock_exclusive:
+			rwlock_lock_exclusive(slot->rwlock);
+			slot->counter++;
+			rwlock_unlock_exclusive(slot->rwlock);
+			break;
+		case k_bench_rwlock_shared:
+		{
+			rwlock_lock_shared(slot->rwlock);
+			volatile int value = slot->counter;
+			(void)value;
+			rwlock_unlock_shared(slot->rwlock);
+			break;
+		}
+		case k_bench_semaphore:
+			// Binary semaphore used as a lock.
+			semaphore_acquire(slot->semaphore);
+			slot->counter++;
+			semaphore_release(slot->semaphore);
+			break;
+		case k_bench_queue:
+			// Each thread both produces and consumes, so the queue never deadlocks.
+			queue_push(slot->queue, (void*)(intptr_t)(i + 1));
+			queue_pop(slot->queue);
+			break;
+		default:
+			break;
+		}
+		bench_private_work(work);
+	}
+	bench->thread_ticks[thread->index] = timer_get_ticks() - t0;
+	return 0;
+}
+
+// Run one repetition. Returns nanoseconds per operation for the slowest thread.
+static double bench_run_once(heap_t* heap, bench_case_t* bench)
+{
+	// Only the slots threads will touch get primitives.
+	int slot_count = bench->contention == k_bench_contention_none ? bench->thread_count : 1;
+	for (int i = 0; i < k_bench_max_threads; ++i)
+	{
+		bench->thread_ticks[i] = 0;
+	}
+	for (int i = 0; i < slot_count; ++i)
+	{
+		bench_slot_t* slot = &bench->slots[i];
+		memset(slot, 0, sizeof(*slot));
+		slot->mutex = mutex_create();
+		slot->fast_mutex = fast_mutex_create(heap);
+		slot->spinlock = spinlock_create(heap);
+		slot->rwlock = rwlock_create(heap);
+		slot->semaphore = semaphore_create(1, 1);
+		slot->queue = queue_create(heap, 64);
+	}
+	bench->start = event_create();
+
+	bench_thread_t thread_data[k_bench_max_threads];
+	thread_t* threads[k_bench_max_threads];
+	for (int i = 0; i < bench->thread_count; ++i)
+	{
+		thread_data[i] = (bench_thread_t) { .bench = bench, .index = i };
+		threads[i] = thread_create(bench_thread_func, &thread_data[i]);
+	}
+
+	// Give event waiters a moment to block so we time a real wake.
+	if (bench->kind == k_bench_event_wake)
+	{
+		thread_sleep(1);
+	}
+	bench->signal_ticks = timer_get_ticks();
+	event_signal(bench->start);
+
+	for (int i = 0; i < bench->thread_count; ++i)
+	{
+		thread_destroy(threads[i]);
+	}
+
+	uint64_t slowest = 0;
+	for (int i = 0; i < bench->thread_count; ++i)
+	{
+		slowest = bench->thread_ticks[i] > slowest ? bench->thread_ticks[i] : slowest;
+	}
+
+	for (int i = 0; i < slot_count; ++i)
+	{
+		bench_slot_t* slot = &bench->slots[i];
+		mutex_destroy(slot->mutex);
+		fast_mutex_destroy(slot->fast_mutex);
+		spinlock_destroy(slot->spinlock);
+		rwlock_destroy(slot->rwlock);
+		semaphore_destroy(slot->semaphore);
+		queue_destroy(slot->queue);
+	}
+	event_destroy(bench->start);
+
+	int ops = bench->kind == k_bench_event_wake ? 1 : k_bench_ops_per_thread;
+	return (double)slowest * 1000000000.0 / (double)timer_get_ticks_per_second() / ops;
+}
+
+static int bench_compare_double(const void* a, const void* b)
+{
+	double x = *(const double*)a;
+	double y = *(const double*)b;
+	return (x > y) - (x < y);
+}
+
+// Nearest-rank percentile of a sorted array.
+static double bench_percentile(const double* sorted, int count, int percentile)
+{
+	int rank = (percentile * count + 99) / 100;
+	rank = rank < 1 ? 1 : rank;
+	return sorted[rank - 1];
+}
+
+static bench_result_t bench_run_case(heap_t* heap, bench_case_t* bench)
+{
+	for (int i = 0; i < k_bench_warmup_reps; ++i)
+	{
+		bench_run_once(heap, bench);
+	}
+
+	double samples[k_bench_reps];
+	for (int i = 0; i < k_bench_reps; ++i)
+	{
+		samples[i] = bench_run_once(heap, bench);
+	}
+	qsort(samples, k_bench_reps, sizeof(samples[0]), bench_compare_double);
+
+	bench_result_t result =
+	{
+		.min_ns = samples[0],
+		.p50_ns = bench_percentile(samples, k_bench_reps, 50),
+		.p90_ns = bench_percentile(samples, k_bench_reps, 90),
+		.p99_ns = bench_percentile(samples, k_bench_reps, 99),
+		.max_ns = samples[k_bench_reps - 1],
+	};
+	return result;
+}
+
+bool thread_bench_run(heap_t* heap, const char* csv_path)
+{
+	static const int k_thread_counts[] = { 1, 2, 4, 8 };
+
+	char* csv = heap_alloc(heap, k_bench_csv_capacity, 8);
+	size_t csv_size = (size_t)snprintf(csv, k_bench_csv_capacity,
+		"backend,benchmark,threads,contention,ops_per_thread,reps,min_ns,p50_ns,p90_ns,p99_ns,max_ns\n");
+
+	bench_case_t* bench = heap_alloc(heap, sizeof(bench_case_t), 64);
+
+	debug_print(k_print_info, "%-28s %7s %10s %10s %10s %10s\n", "benchmark", "threads", "contention", "p50 ns", "p99 ns", "max ns");
+	for (int kind = 0; kind < k_bench_count; ++kind)
+	{
+		for (size_t t = 0; t < sizeof(k_thread_counts) / sizeof(k_thread_counts[0]); ++t)
+		{
+			for (int contention = 0; contention <= k_bench_contention_none; ++contention)
+			{
+				// Waking waiters has no contention dimension.
+				if (kind == k_bench_event_wake && contention != k_bench_contention_high)
+				{
+					continue;
+				}
+
+				memset(bench, 0, sizeof(*bench));
+				bench->kind = kind;
+				bench->contention = contention;
+				bench->thread_count = k_thread_counts[t];
+				bench_result_t result = bench_run_case(heap, bench);
+
+				debug_print(k_print_info, "%-28s %7d %10s %10.1f %10.1f %10.1f\n",
+					k_bench_kind_names[kind], bench->thread_count, k_bench_contention_names[contention],
+					result.p50_ns, result.p99_ns, result.max_ns);
+
+				if (csv_size < k_bench_csv_capacity)
+				{
+					csv_size += (size_t)snprintf(csv + csv_size, k_bench_csv_capacity - csv_size,
+						"%s,%s,%d,%s,%d,%d,%.2f,%.2f,%.2f,%.2f,%.2f\n",
+						THREAD_BENCH_BACKEND, k_bench_kind_names[kind], bench->thread_count,
+						k_bench_contention_names[contention],
+						kind == k_bench_event_wake ? 1 : k_bench_ops_per_thread, k_bench_reps,
+						result.min_ns, result.p50_ns, result.p90_ns, result.p99_ns, result.max_ns);
+				}
+			}
+		}
+	}
+	heap_free(heap, bench);
+
+	bool ok = true;
+	if (csv_path)
+	{
+		fs_t* fs = fs_create(heap, 1);
+		fs_work_t* work = fs_write(fs, csv_path, csv, csv_size < k_bench_csv_capacity ? csv_size : k_bench_csv_capacity - 1, false);
+		ok = fs_work_get_result(work) == 0;
+		fs_work_destroy(work);
+		fs_destroy(fs);
+	}
+	heap_free(heap, csv);
+	return ok;
+}
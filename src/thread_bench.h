@@ -0,0 +1,17 @@
+#pragma once
+
+#include <stdbool.h>
+
+// Thread primitive benchmarks.
+//
+// Times mutex_t, fast_mutex_t, spinlock_t, rwlock_t, atomic_*, semaphore_t,
+// event_t and queue_t across thread counts and contention levels.
+// Each case runs warmup passes, then timed repetitions, and reports
+// nanoseconds per operation as min/p50/p90/p99/max over the repetitions.
+
+typedef struct heap_t heap_t;
+
+// Run every benchmark case and print a summary table.
+// If csv_path is not NULL, results are also written there as CSV, one row per case.
+// Returns false if the CSV could not be written.
+bool thread_bench_run(heap_t* heap, const char* csv_path);
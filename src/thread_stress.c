@@ -0,0 +1,239 @@
+#include "thread_stress.h"
+
+#include "debug.h"
+#include "event.h"
+#include "fs_stress.h"
+#include "heap.h"
+#include "mpsc_queue.h"
+#include "queue.h"
+#include "thread.h"
+#include "timer.h"
+
+#include <stdint.h>
+
+enum
+{
+	k_stress_max_threads = 16,
+	k_stress_queue_items = 100000,
+};
+
+typedef struct queue_stress_t
+{
+	queue_t* queue;
+	event_t* start;
+	int items_per_producer;
+} queue_stress_t;
+
+// Per-consumer results, summed after the threads are joined.
+typedef struct queue_consumer_t
+{
+	queue_stress_t* stress;
+	int popped;
+	int64_t sum;
+} queue_consumer_t;
+
+typedef struct mpsc_item_t
+{
+	mpsc_node_t node;
+	int producer;
+	int sequence;
+} mpsc_item_t;
+
+typedef struct mpsc_stress_t
+{
+	mpsc_queue_t* queue;
+	event_t* start;
+	mpsc_item_t* items;
+	int items_per_producer;
+} mpsc_stress_t;
+
+typedef struct mpsc_producer_t
+{
+	mpsc_stress_t* stress;
+	int producer;
+} mpsc_producer_t;
+
+// Producers push 1..items_per_producer encoded as pointers.
+static int queue_producer_func(void* user)
+{
+	queue_stress_t* stress = user;
+	event_wait(stress->start);
+	for (int i = 1; i <= stress->items_per_producer; ++i)
+	{
+		queue_push(stress->queue, (void*)(intptr_t)i);
+	}
+	return 0;
+}
+
+// Consumers pop until they see NULL and accumulate what they saw.
+static int queue_consumer_func(void* user)
+{
+	queue_consumer_t* consumer = user;
+	event_wait(consumer->stress->start);
+	while (true)
+	{
+		intptr_t value = (intptr_t)queue_pop(consumer->stress->queue);
+		if (value == 0)
+		{
+			break;
+		}
+		consumer->popped++;
+		consumer->sum += value;
+	}
+	return 0;
+}
+
+static bool run_queue_stress(heap_t* heap, int producers, int consumers, int capacity)
+{
+	queue_stress_t stress =
+	{
+		.queue = queue_create(heap, capacity),
+		.start = event_create(),
+		.items_per_producer = k_stress_queue_items / producers,
+	};
+
+	queue_consumer_t consumer_data[k_stress_max_threads];
+	thread_t* threads[k_stress_max_threads];
+	int thread_count = 0;
+	for (int i = 0; i < producers; ++i)
+	{
+		threads[thread_count++] = thread_create(queue_producer_func, &stress);
+	}
+	for (int i = 0; i < consumers; ++i)
+	{
+		consumer_data[i] = (queue_consumer_t) { .stress = &stress };
+		threads[thread_count++] = thread_create(queue_consumer_func, &consumer_data[i]);
+	}
+
+	uint64_t t0 = timer_get_ticks();
+	event_signal(stress.start);
+	for (int i = 0; i < producers; ++i)
+	{
+		thread_destroy(threads[i]);
+	}
+	for (int i = 0; i < consumers; ++i)
+	{
+		queue_push(stress.queue, NULL);
+	}
+	for (int i = producers; i < thread_count; ++i)
+	{
+		thread_destroy(threads[i]);
+	}
+	uint64_t t1 = timer_get_ticks();
+
+	queue_destroy(stress.queue);
+	event_destroy(stress.start);
+
+	int popped = 0;
+	int64_t actual_sum = 0;
+	for (int i = 0; i < consumers; ++i)
+	{
+		popped += consumer_data[i].popped;
+		actual_sum += consumer_data[i].sum;
+	}
+
+	int64_t n = stress.items_per_producer;
+	int64_t expected_sum = producers * (n * (n + 1) / 2);
+	int expected_count = producers * stress.items_per_producer;
+	bool ok = popped == expected_count && actual_sum == expected_sum;
+
+	debug_print(ok ? k_print_info : k_print_error,
+		"[%s] queue %dx%d cap=%d: %s items=%d/%d time=%uus\n",
+		THREAD_STRESS_BACKEND, producers, consumers, capacity, ok ? "ok" : "FAILED",
+		popped, expected_count, (uint32_t)timer_ticks_to_us(t1 - t0));
+	return ok;
+}
+
+static int mpsc_producer_func(void* user)
+{
+	mpsc_producer_t* producer = user;
+	mpsc_stress_t* stress = producer->stress;
+	event_wait(stress->start);
+	mpsc_item_t* items = &stress->items[producer->producer * stress->items_per_producer];
+	for (int i = 0; i < stress->items_per_producer; ++i)
+	{
+		items[i].producer = producer->producer;
+		items[i].sequence = i;
+		mpsc_queue_push(stress->queue, &items[i].node);
+	}
+	return 0;
+}
+
+// The calling thread is the single consumer.
+// Every item must arrive once, and in order for its producer.
+static bool run_mpsc_stress(heap_t* heap, int producers)
+{
+	mpsc_stress_t stress =
+	{
+		.queue = mpsc_queue_create(heap),
+		.start = event_create(),
+		.items_per_producer = k_stress_queue_items / producers,
+	};
+	stress.items = heap_alloc(heap, sizeof(mpsc_item_t) * stress.items_per_producer * producers, 8);
+
+	mpsc_producer_t producer_data[k_stress_max_threads];
+	int next_sequence[k_stress_max_threads] = { 0 };
+	thread_t* threads[k_stress_max_threads];
+	for (int i = 0; i < producers; ++i)
+	{
+		producer_data[i] = (mpsc_producer_t) { .stress = &stress, .producer = i };
+		threads[i] = thread_create(mpsc_producer_func, &producer_data[i]);
+	}
+
+	uint64_t t0 = timer_get_ticks();
+	event_signal(stress.start);
+	int expected_count = producers * stress.items_per_producer;
+	int popped = 0;
+	int out_of_order = 0;
+	while (popped < expected_count)
+	{
+		mpsc_node_t* node = mpsc_queue_pop(stress.queue);
+		if (!node)
+		{
+			thread_sleep(0);
+			continue;
+		}
+		mpsc_item_t* item = mpsc_node_container(node, mpsc_item_t, node);
+		if (item->sequence != next_sequence[item->producer]++)
+		{
+			out_of_order++;
+		}
+		popped++;
+	}
+	uint64_t t1 = timer_get_ticks();
+
+	for (int i = 0; i < producers; ++i)
+	{
+		thread_destroy(threads[i]);
+	}
+	bool ok = out_of_order == 0 && mpsc_queue_pop(stress.queue) == NULL;
+
+	heap_free(heap, stress.items);
+	mpsc_queue_destroy(stress.queue);
+	event_destroy(stress.start);
+
+	debug_print(ok ? k_print_info : k_print_error,
+		"[%s] mpsc %dx1: %s items=%d out_of_order=%d time=%uus\n",
+		THREAD_STRESS_BACKEND, producers, ok ? "ok" : "FAILED",
+		popped, out_of_order, (uint32_t)timer_ticks_to_us(t1 - t0));
+	return ok;
+}
+bool thread_stress_run(heap_t* heap)
+{
+	bool ok = true;
+
+	ok &= run_queue_stress(heap, 1, 1, 16);
+	ok &= run_queue_stress(heap, 4, 4, 16);
+	ok &= run_queue_stress(heap, 8, 2, 16);
+	ok &= run_queue_stress(heap, 2, 8, 256);
+
+	ok &= run_mpsc_stress(heap, 1);
+	ok &= run_mpsc_stress(heap, 8);
+
+	ok &= fs_stress_run(heap);
+	ok &= fs_container_stress_run(heap);
+	ok &= fs_pak_stress_run(heap);
+	ok &= fs_cache_stress_run(heap);
+
+	return ok;
+}
@@ -0,0 +1,25 @@
+#pragma once
+
+#include <stdbool.h>
+
+// Concurrency stress test.
+//
+// Drives queue_t and fs_t from many threads at once and checks the results.
+// The workloads only use the engine's portable thread primitives, so running
+// them on each platform backend confirms the backends behave the same and
+// gives comparable timings.
+
+// Tags each printed result with the thread backend.
+#if defined(_WIN32)
+#define THREAD_STRESS_BACKEND "win32"
+#else
+#define THREAD_STRESS_BACKEND "posix"
+#endif
+
+typedef struct heap_t heap_t;
+
+// Runs all stress workloads, the fs ones from fs_stress.h included, and prints
+// timings.
+// Files are written to and removed from the working directory.
+// Returns true if every workload produced the expected results.
+bool thread_stress_run(heap_t* heap);
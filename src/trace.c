@@ -1,8 +1,13 @@
 #include "trace.h"
+#include "atomic.h"
 #include "heap.h"
 #include "fs.h"
 #include "timer.h"
 #include "mutex.h"
+#include "queue.h"
+#include "thread.h"
+
+#include "lz4/lz4frame.h"
 
 #include <stddef.h>
 #include <stdbool.h>
@@ -11,8 +16,12 @@
 #include <stdint.h>
 #include <inttypes.h>
 
+#if defined(_WIN32)
 #define WIN32_LEAN_AND_MEAN
 #include <windows.h>
+#else
+#include <unistd.h>
+#endif
 
 typedef struct event_t 
 {
@@ -23,6 +32,43 @@ typedef struct event_t
 } event_t;
 
 
+// How often an idle writer checks for a chunk that has waited too long.
+enum { k_trace_stream_poll_ms = 10 };
+
+// Events gathered for the writer. The text starts one byte into data, leaving
+// room for the comma the previous chunk held back.
+typedef struct trace_chunk_t
+{
+	char* data;
+	size_t size;
+} trace_chunk_t;
+
+// A capture being compressed to disk as it runs.
+typedef struct trace_stream_t
+{
+	thread_t* thread;
+	// Chunks waiting to be written, oldest first, and chunks free to fill.
+	queue_t* full;
+	queue_t* free;
+	trace_chunk_t* chunks;
+	// Chunk being filled, under the trace mutex. NULL while none is free.
+	trace_chunk_t* current;
+	uint64_t current_ticks;
+	size_t chunk_size;
+	uint64_t flush_ticks;
+	int stopping;
+	// Owned by the writer thread.
+	LZ4F_cctx* cctx;
+	char* out;
+	size_t out_capacity;
+	size_t out_size;
+	bool comma;
+	bool appending;
+	// First compression or write error. Once set, nothing more is written, so
+	// the file still decodes up to the last block that made it out.
+	int error;
+} trace_stream_t;
+
 typedef struct trace_t 
 {
 	
@@ -35,8 +81,94 @@ typedef struct trace_t
 	char path[1024];
 	char info[5120];
 	bool started;
+	// Threads whose name metadata has been written this capture.
+	uint64_t named_tids[64];
+	int named_tid_count;
+	int dropped;
+	trace_stream_t* stream;
 } trace_t;
 
+static uint64_t trace_get_process_id()
+{
+#if defined(_WIN32)
+	return GetCurrentProcessId();
+#else
+	return (uint64_t)getpid();
+#endif
+}
+
+// Add event text to the capture, or drop it and return false if there's no
+// room. Must be called with the trace mutex held.
+static bool trace_write(trace_t* trace, const char* text)
+{
+	// Checked again here, as the capture may have stopped while waiting for the lock.
+	if (!trace->started)
+	{
+		return false;
+	}
+	size_t length = strlen(text);
+	trace_stream_t* stream = trace->stream;
+	if (!stream)
+	{
+		if (strlen(trace->info) + length >= sizeof(trace->info))
+		{
+			trace->dropped++;
+			return false;
+		}
+		memcpy(trace->info + strlen(trace->info), text, length + 1);
+		return true;
+	}
+
+	if (stream->current && stream->current->size + length > stream->chunk_size)
+	{
+		queue_push(stream->full, stream->current);
+		stream->current = NULL;
+	}
+	if (!stream->current)
+	{
+		stream->current = queue_try_pop(stream->free);
+	}
+	if (!stream->current || length > stream->chunk_size)
+	{
+		trace->dropped++;
+		return false;
+	}
+	if (stream->current->size == 0)
+	{
+		stream->current_ticks = timer_get_ticks();
+	}
+	memcpy(stream->current->data + 1 + stream->current->size, text, length);
+	stream->current->size += length;
+	return true;
+}
+
+// Emit a Chrome "thread_name" metadata event the first time a named thread traces.
+// Must be called with the trace mutex held.
+static void trace_name_thread(trace_t* trace, uint64_t pid, uint64_t tid)
+{
+	const char* name = thread_get_name();
+	if (!name)
+	{
+		return;
+	}
+	for (int i = 0; i < trace->named_tid_count; ++i)
+	{
+		if (trace->named_tids[i] == tid)
+		{
+			return;
+		}
+	}
+	if (trace->named_tid_count >= (int)(sizeof(trace->named_tids) / sizeof(trace->named_tids[0])))
+	{
+		return;
+	}
+	trace->named_tids[trace->named_tid_count++] = tid;
+
+	char buffer[512];
+	snprintf(buffer, sizeof(buffer), "\n\t\t{\"name\": \"thread_name\",\"ph\" : \"M\",\"pid\" : %" PRIu64 ",\"tid\" : \"%"PRIu64"\",\"args\" : { \"name\" : \"%s\" } },", pid, tid, name);
+	trace_write(trace, buffer);
+}
+
 trace_t* trace_create(heap_t* heap, int event_capacity)
 {
 	trace_t* result = heap_alloc(heap, sizeof(trace_t), 8);
@@ -44,6 +176,9 @@ trace_t* trace_create(heap_t* heap, int event_capacity)
 	result->started = false;
 	result->events = NULL;
 	result->event_num = 0;
+	result->named_tid_count = 0;
+	result->dropped = 0;
+	result->stream = NULL;
 	result->heap = heap;
 	result->fs = fs_create(heap, 100);
 	result->mutex = mutex_create();
@@ -52,6 +187,12 @@ trace_t* trace_create(heap_t* heap, int event_capacity)
 
 void trace_destroy(trace_t* trace)
 {
+	// A streaming capture's writer thread and chunks go with it.
+	if (trace->stream)
+	{
+		trace_capture_stop(trace);
+	}
+
 	//free every event(if any!)
 	event_t* eventa = trace->events;
 	while (eventa != NULL) {
@@ -73,16 +214,17 @@ void trace_duration_push(trace_t* trace, const char* name)
 		mutex_lock(trace->mutex);
 		if (trace->event_num < trace->capacity) {
 			event_t* current = heap_alloc(trace->heap, sizeof(event_t), 8);
-			strcpy_s(current->name, sizeof(current->name), name);
-			current->pid = GetCurrentProcessId();
-			current->tid = GetCurrentThreadId();
+			snprintf(current->name, sizeof(current->name), "%s", name);
+			current->pid = trace_get_process_id();
+			current->tid = thread_get_id();
 			current->next = trace->events;
 			trace->events = current;
 			trace->event_num++;
+			trace_name_thread(trace, current->pid, current->tid);
 			//finished making the trace. write to the buffer.
 			char buffer[512];
-			sprintf_s(buffer, 512, "\n\t\t{\"name\": \"%s\",\"ph\" : \"B\",\"pid\" : %" PRIu64 ",\"tid\" : \"%"PRIu64"\",\"ts\" : %" PRIu64 " },", name, current->pid, current->tid, us);
-			strcat_s(trace->info, sizeof(trace->info), buffer);
+			snprintf(buffer, sizeof(buffer), "\n\t\t{\"name\": \"%s\",\"ph\" : \"B\",\"pid\" : %" PRIu64 ",\"tid\" : \"%"PRIu64"\",\"ts\" : %" PRIu64 " },", name, current->pid, current->tid, us);
+			trace_write(trace, buffer);
 
 		}
 		mutex_unlock(trace->mutex);
@@ -100,8 +242,8 @@ void trace_duration_pop(trace_t* trace)
 			trace->events = popping->next;
 			trace->event_num--;
 			char buffer[512];
-			sprintf_s(buffer, 512, "\n\t\t{\"name\": \"%s\",\"ph\" : \"E\",\"pid\" : %" PRIu64 ",\"tid\" : \"%"PRIu64"\",\"ts\" : %" PRIu64 " },", popping->name, popping->pid, popping->tid, us);
-			strcat_s(trace->info, sizeof(trace->info), buffer);
+			snprintf(buffer, sizeof(buffer), "\n\t\t{\"name\": \"%s\",\"ph\" : \"E\",\"pid\" : %" PRIu64 ",\"tid\" : \"%"PRIu64"\",\"ts\" : %" PRIu64 " },", popping->name, popping->pid, popping->tid, us);
+			trace_write(trace, buffer);
 			heap_free(trace->heap, popping);
 
 		}
@@ -109,21 +251,267 @@ void trace_duration_pop(trace_t* trace)
 	}
 }
 
+void trace_duration_record(trace_t* trace, const char* name, uint64_t start_ticks, uint64_t end_ticks)
+{
+	if (trace->started) {
+		uint64_t us = timer_ticks_to_us(start_ticks);
+		uint64_t duration_us = timer_ticks_to_us(end_ticks - start_ticks);
+		uint64_t pid = trace_get_process_id();
+		uint64_t tid = thread_get_id();
+		char buffer[512];
+		snprintf(buffer, sizeof(buffer), "\n\t\t{\"name\": \"%s\",\"ph\" : \"X\",\"pid\" : %" PRIu64 ",\"tid\" : \"%"PRIu64"\",\"ts\" : %" PRIu64 ",\"dur\" : %" PRIu64 " },", name, pid, tid, us, duration_us);
+		mutex_lock(trace->mutex);
+		// Workers may report many of these; they are dropped once the capture is full.
+		if (trace->started) {
+			trace_name_thread(trace, pid, tid);
+			trace_write(trace, buffer);
+		}
+		mutex_unlock(trace->mutex);
+	}
+}
+
+// Compress text into the frame and write out everything compressed so far.
+// Called on the writer thread. Does nothing once an error has been recorded.
+static void trace_stream_write(trace_t* trace, const char* text, size_t size, bool end)
+{
+	trace_stream_t* stream = trace->stream;
+	if (stream->error)
+	{
+		return;
+	}
+	size_t written = LZ4F_compressUpdate(stream->cctx, stream->out + stream->out_size, stream->out_capacity - stream->out_size, text, size, NULL);
+	if (!LZ4F_isError(written) && end)
+	{
+		stream->out_size += written;
+		written = LZ4F_compressEnd(stream->cctx, stream->out + stream->out_size, stream->out_capacity - stream->out_size, NULL);
+	}
+	if (LZ4F_isError(written))
+	{
+		stream->error = -1;
+		return;
+	}
+	stream->out_size += written;
+	// The first write replaces whatever was at path before.
+	fs_work_t* work = fs_write_ex(trace->fs, trace->path, stream->out, stream->out_size, false,
+		&(fs_work_options_t) { .write_mode = stream->appending ? k_fs_write_append : k_fs_write_in_place });
+	stream->error = fs_work_get_result(work);
+	fs_work_destroy(work);
+	stream->appending = true;
+	stream->out_size = 0;
+}
+
+// Writer thread for a streaming capture: compresses chunks as they fill, and
+// flushes chunks left part-filled for too long.
+static int trace_stream_func(void* user)
+{
+	trace_t* trace = user;
+	trace_stream_t* stream = trace->stream;
+	LZ4F_preferences_t preferences = LZ4F_INIT_PREFERENCES;
+	// Every chunk makes it into the file as soon as it is written.
+	preferences.autoFlush = 1;
+	size_t begun = LZ4F_createCompressionContext(&stream->cctx, LZ4F_VERSION);
+	begun = LZ4F_isError(begun) ? begun : LZ4F_compressBegin(stream->cctx, stream->out, stream->out_capacity, &preferences);
+	stream->out_size = LZ4F_isError(begun) ? 0 : begun;
+	stream->error = LZ4F_isError(begun) ? -1 : 0;
+
+	while (true)
+	{
+		// Read before popping: once stopping is set, the last chunk is queued.
+		bool stopping = atomic_load(&stream->stopping);
+		trace_chunk_t* chunk = queue_try_pop(stream->full);
+		if (chunk)
+		{
+			// Every event ends in a comma, but the last one of the file must not,
+			// so each chunk holds its last one back for the next chunk to write.
+			char* text = chunk->data + 1;
+			size_t size = chunk->size;
+			if (size && text[size - 1] == ',')
+			{
+				size--;
+				if (stream->comma)
+				{
+					*--text = ',';
+					size++;
+				}
+				stream->comma = true;
+			}
+			trace_stream_write(trace, text, size, false);
+			chunk->size = 0;
+			queue_push(stream->free, chunk);
+			continue;
+		}
+		if (stopping)
+		{
+			break;
+		}
+
+		thread_sleep(k_trace_stream_poll_ms);
+		mutex_lock(trace->mutex);
+		if (stream->current && stream->current->size && timer_get_ticks() - stream->current_ticks >= stream->flush_ticks)
+		{
+			queue_push(stream->full, stream->current);
+			stream->current = NULL;
+		}
+		mutex_unlock(trace->mutex);
+	}
+
+	const char* final = "\n\t] \n}";
+	trace_stream_write(trace, final, strlen(final), true);
+	LZ4F_freeCompressionContext(stream->cctx);
+	return 0;
+}
+
 void trace_capture_start(trace_t* trace, const char* path)
 {
-	trace->started = true;
-	strcpy_s(trace->path, sizeof(trace->path), path);
+	trace_capture_start_ex(trace, path, NULL);
+}
+
+void trace_capture_start_ex(trace_t* trace, const char* path, const trace_capture_options_t* options)
+{
+	trace->named_tid_count = 0;
+	trace->dropped = 0;
+	snprintf(trace->path, sizeof(trace->path), "%s", path);
 	char* write = "{\n\t\"displayTimeUnit\": \"ns\", \"traceEvents\" : [";
-	strcpy_s(trace->info, sizeof(trace->info), write);
+	if (!options || !options->stream)
+	{
+		snprintf(trace->info, sizeof(trace->info), "%s", write);
+		trace->started = true;
+		return;
+	}
+
+	trace_stream_t* stream = heap_alloc(trace->heap, sizeof(trace_stream_t), 8);
+	memset(stream, 0, sizeof(*stream));
+	stream->chunk_size = options->chunk_size ? options->chunk_size : 64 * 1024;
+	int chunk_count = options->chunk_count ? options->chunk_count : 4;
+	uint32_t flush_interval_ms = options->flush_interval_ms ? options->flush_interval_ms : 500;
+	stream->flush_ticks = flush_interval_ms * timer_get_ticks_per_second() / 1000;
+	stream->full = queue_create(trace->heap, chunk_count);
+	stream->free = queue_create(trace->heap, chunk_count);
+	stream->chunks = heap_alloc(trace->heap, (sizeof(trace_chunk_t) + stream->chunk_size + 1) * chunk_count, 8);
+	char* data = (char*)(stream->chunks + chunk_count);
+	for (int i = 0; i < chunk_count; ++i)
+	{
+		stream->chunks[i] = (trace_chunk_t) { .data = data + i * (stream->chunk_size + 1) };
+		queue_push(stream->free, &stream->chunks[i]);
+	}
+	// Room for any one chunk, and the frame header and end.
+	stream->out_capacity = LZ4F_compressBound(stream->chunk_size + 1, NULL) + LZ4F_HEADER_SIZE_MAX;
+	stream->out = heap_alloc(trace->heap, stream->out_capacity, 8);
+	mutex_lock(trace->mutex);
+	trace->stream = stream;
+	trace->started = true;
+	trace_write(trace, write);
+	mutex_unlock(trace->mutex);
+	stream->thread = thread_create_ex(trace_stream_func, trace, &(thread_options_t) { .name = "trace writer", .priority = k_thread_priority_low });
 }
 
-void trace_capture_stop(trace_t* trace)
+int trace_capture_stop(trace_t* trace)
 {
+	mutex_lock(trace->mutex);
 	trace->started = false;
+	trace_stream_t* stream = trace->stream;
+	if (stream)
+	{
+		if (stream->current)
+		{
+			queue_push(stream->current->size ? stream->full : stream->free, stream->current);
+			stream->current = NULL;
+		}
+		atomic_store(&stream->stopping, 1);
+	}
+	mutex_unlock(trace->mutex);
+	if (stream)
+	{
+		thread_destroy(stream->thread);
+		trace->stream = NULL;
+		int error = stream->error;
+		queue_destroy(stream->full);
+		queue_destroy(stream->free);
+		heap_free(trace->heap, stream->chunks);
+		heap_free(trace->heap, stream->out);
+		heap_free(trace->heap, stream);
+		return error;
+	}
 	//ready the output file
 	trace->info[strlen(trace->info) - 1] = '\0';
 	char* final = "\n\t] \n}";
-	strcat_s(trace->info, sizeof(trace->info), final);
-	fs_work_t* writework = fs_write(trace->fs, trace->path, trace->info, strlen(trace->info), false);
+	size_t length = strlen(trace->info);
+	snprintf(trace->info + length, sizeof(trace->info) - length, "%s", final);
+	// Atomic, so a crash while saving never leaves a half-written trace.
+	fs_work_t* writework = fs_write_ex(trace->fs, trace->path, trace->info, strlen(trace->info), false,
+		&(fs_work_options_t) { .write_mode = k_fs_write_atomic });
+	int error = fs_work_get_result(writework);
 	fs_work_destroy(writework);
+	return error;
+}
+
+int trace_get_dropped_count(trace_t* trace)
+{
+	mutex_lock(trace->mutex);
+	int dropped = trace->dropped;
+	mutex_unlock(trace->mutex);
+	return dropped;
+}
+
+bool trace_stream_decode(heap_t* heap, const char* path, const char* json_path)
+{
+	fs_t* fs = fs_create(heap, 8);
+	fs_work_t* read = fs_read(fs, path, heap, false, false);
+	bool ok = fs_work_get_result(read) == 0;
+	const char* source = fs_work_get_buffer(read);
+	size_t source_size = fs_work_get_size(read);
+
+	// Output grows as needed; JSON this regular compresses several times over.
+	// Allocations leave room past capacity to close an unfinished capture.
+	const char* final = "\n\t] \n}";
+	size_t capacity = source_size * 8 + 64 * 1024;
+	char* json = heap_alloc(heap, capacity + strlen(final), 8);
+	size_t size = 0;
+	LZ4F_dctx* dctx = NULL;
+	ok = ok && !LZ4F_isError(LZ4F_createDecompressionContext(&dctx, LZ4F_VERSION));
+	size_t hint = 1;
+	while (ok && source_size && hint)
+	{
+		if (capacity - size < 64 * 1024)
+		{
+			capacity *= 2;
+			char* grown = heap_alloc(heap, capacity + strlen(final), 8);
+			memcpy(grown, json, size);
+			heap_free(heap, json);
+			json = grown;
+		}
+		size_t out_size = capacity - size;
+		size_t in_size = source_size;
+		hint = LZ4F_decompress(dctx, json + size, &out_size, source, &in_size, NULL);
+		ok = !LZ4F_isError(hint);
+		size += out_size;
+		source += in_size;
+		source_size -= in_size;
+	}
+	LZ4F_freeDecompressionContext(dctx);
+
+	// A frame with no end is a capture that never stopped. Its blocks end on
+	// whole events, so closing the event list makes it a complete trace.
+	if (ok && hint)
+	{
+		while (size && (json[size - 1] == ',' || json[size - 1] == '\n' || json[size - 1] == '\t'))
+		{
+			size--;
+		}
+		ok = size > 0;
+		memcpy(json + size, final, strlen(final));
+		size += strlen(final);
+	}
+	if (ok)
+	{
+		fs_work_t* write = fs_write_ex(fs, json_path, json, size, false, &(fs_work_options_t) { .write_mode = k_fs_write_atomic });
+		ok = fs_work_get_result(write) == 0;
+		fs_work_destroy(write);
+	}
+
+	heap_free(heap, json);
+	heap_free(heap, (void*)fs_work_get_buffer(read));
+	fs_work_destroy(read);
+	fs_destroy(fs);
+	return ok;
 }
@@ -1,5 +1,9 @@
 #pragma once
 
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
 typedef struct heap_t heap_t;
 
 typedef struct trace_t trace_t;
@@ -10,6 +14,7 @@ typedef struct event_t event_t;
 trace_t* trace_create(heap_t* heap, int event_capacity);
 
 // Destroys a CPU performance tracing system.
+// A streaming capture still running is stopped first.
 void trace_destroy(trace_t* trace);
 
 // Begin tracing a named duration on the current thread.
@@ -19,9 +24,50 @@ void trace_duration_push(trace_t* trace, const char* name);
 // End tracing the currently active duration on the current thread.
 void trace_duration_pop(trace_t* trace);
 
+// Trace a duration that has already finished on the current thread, from
+// start to end in timer ticks. Unlike push and pop it needs no pairing, so
+// worker threads can report work as they finish it.
+void trace_duration_record(trace_t* trace, const char* name, uint64_t start_ticks, uint64_t end_ticks);
+
+// Optional settings for trace_capture_start_ex().
+// Zeroed fields keep the defaults.
+typedef struct trace_capture_options_t
+{
+	// Stream events to path as the capture runs, compressed into one LZ4
+	// frame by a writer thread, instead of holding them all until the capture
+	// stops. Memory stays bounded however long the capture, and a capture cut
+	// short still holds everything up to its last flush.
+	// Convert the file with trace_stream_decode() to load it in chrome://tracing.
+	bool stream;
+	// Bytes of events gathered before they go to the writer. Default 64KB.
+	size_t chunk_size;
+	// Chunks allocated for the capture. While all of them are waiting to be
+	// written, new events are dropped. Default 4.
+	int chunk_count;
+	// Longest events wait in a part-filled chunk before it is written anyway,
+	// in milliseconds. Default 500.
+	uint32_t flush_interval_ms;
+} trace_capture_options_t;
+
 // Start recording trace events.
 // A Chrome trace file will be written to path.
 void trace_capture_start(trace_t* trace, const char* path);
 
+// Start recording trace events with the specified options.
+// Options may be NULL, in which case this is the same as trace_capture_start().
+void trace_capture_start_ex(trace_t* trace, const char* path, const trace_capture_options_t* options);
+
 // Stop recording trace events.
-void trace_capture_stop(trace_t* trace);
+// A streaming capture waits here for the writer to finish the file.
+// Returns zero, or the first error compressing or writing the file. A
+// streaming capture writes nothing after an error, so what reached the file
+// still decodes, as a capture that never stopped.
+int trace_capture_stop(trace_t* trace);
+
+// Number of events dropped by the current or last capture for lack of room.
+int trace_get_dropped_count(trace_t* trace);
+
+// Decompress a streamed capture into a Chrome trace file at json_path.
+// A capture that never stopped is closed off after its last complete event.
+// Returns false if the capture can't be read or decompressed.
+bool trace_stream_decode(heap_t* heap, const char* path, const char* json_path);
@@ -0,0 +1,259 @@
+#include "uring.h"
+
+#include "heap.h"
+
+#if defined(__linux__)
+#include <sys/syscall.h>
+#endif
+
+#if defined(__linux__) && defined(__NR_io_uring_setup)
+
+#include <errno.h>
+#include <linux/io_uring.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+typedef struct uring_t
+{
+	heap_t* heap;
+	int fd;
+
+	void* sq_ring;
+	size_t sq_ring_size;
+	unsigned* sq_head;
+	unsigned* sq_tail;
+	unsigned* sq_mask;
+	unsigned* sq_array;
+	unsigned sq_entries;
+	struct io_uring_sqe* sqes;
+	size_t sqes_size;
+	// Tail up to which entries are prepared; published on submit.
+	unsigned sq_prepared_tail;
+	unsigned to_submit;
+
+	void* cq_ring;
+	size_t cq_ring_size;
+	unsigned* cq_head;
+	unsigned* cq_tail;
+	unsigned* cq_mask;
+	struct io_uring_cqe* cqes;
+} uring_t;
+
+uring_t* uring_create(heap_t* heap, uint32_t entries)
+{
+	struct io_uring_params params;
+	memset(&params, 0, sizeof(params));
+	int fd = (int)syscall(__NR_io_uring_setup, entries, &params);
+	if (fd < 0)
+	{
+		return NULL;
+	}
+
+	uring_t* ring = heap_alloc(heap, sizeof(uring_t), 8);
+	memset(ring, 0, sizeof(*ring));
+	ring->heap = heap;
+	ring->fd = fd;
+
+	ring->sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+	ring->cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+	bool single_mmap = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+	if (single_mmap)
+	{
+		size_t size = ring->sq_ring_size > ring->cq_ring_size ? ring->sq_ring_size : ring->cq_ring_size;
+		ring->sq_ring_size = size;
+		ring->cq_ring_size = size;
+	}
+
+	ring->sq_ring = mmap(NULL, ring->sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+	ring->cq_ring = single_mmap ? ring->sq_ring :
+		mmap(NULL, ring->cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+	ring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+	ring->sqes = mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+	if (ring->sq_ring == MAP_FAILED || ring->cq_ring == MAP_FAILED || ring->sqes == MAP_FAILED)
+	{
+		if (ring->sqes != MAP_FAILED)
+		{
+			munmap(ring->sqes, ring->sqes_size);
+		}
+		if (!single_mmap && ring->cq_ring != MAP_FAILED)
+		{
+			munmap(ring->cq_ring, ring->cq_ring_size);
+		}
+		if (ring->sq_ring != MAP_FAILED)
+		{
+			munmap(ring->sq_ring, ring->sq_ring_size);
+		}
+		close(fd);
+		heap_free(heap, ring);
+		return NULL;
+	}
+
+	char* sq = ring->sq_ring;
+	ring->sq_head = (unsigned*)(sq + params.sq_off.head);
+	ring->sq_tail = (unsigned*)(sq + params.sq_off.tail);
+	ring->sq_mask = (unsigned*)(sq + params.sq_off.ring_mask);
+	ring->sq_array = (unsigned*)(sq + params.sq_off.array);
+	ring->sq_entries = params.sq_entries;
+	ring->sq_prepared_tail = *ring->sq_tail;
+
+	char* cq = ring->cq_ring;
+	ring->cq_head = (unsigned*)(cq + params.cq_off.head);
+	ring->cq_tail = (unsigned*)(cq + params.cq_off.tail);
+	ring->cq_mask = (unsigned*)(cq + params.cq_off.ring_mask);
+	ring->cqes = (struct io_uring_cqe*)(cq + params.cq_off.cqes);
+	return ring;
+}
+
+void uring_destroy(uring_t* ring)
+{
+	if (!ring)
+	{
+		return;
+	}
+	munmap(ring->sqes, ring->sqes_size);
+	if (ring->cq_ring != ring->sq_ring)
+	{
+		munmap(ring->cq_ring, ring->cq_ring_size);
+	}
+	munmap(ring->sq_ring, ring->sq_ring_size);
+	close(ring->fd);
+	heap_free(ring->heap, ring);
+}
+
+bool uring_register_buffers(uring_t* ring, void* base, size_t buffer_size, int count)
+{
+	struct iovec* iovecs = heap_alloc(ring->heap, sizeof(struct iovec) * count, 8);
+	for (int i = 0; i < count; ++i)
+	{
+		iovecs[i].iov_base = (char*)base + (size_t)i * buffer_size;
+		iovecs[i].iov_len = buffer_size;
+	}
+	int result = (int)syscall(__NR_io_uring_register, ring->fd, IORING_REGISTER_BUFFERS, iovecs, count);
+	heap_free(ring->heap, iovecs);
+	return result == 0;
+}
+
+// Claim the next submission entry, or NULL if the ring is full.
+static struct io_uring_sqe* uring_get_sqe(uring_t* ring)
+{
+	unsigned head = __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+	if (ring->sq_prepared_tail - head >= ring->sq_entries)
+	{
+		return NULL;
+	}
+	unsigned index = ring->sq_prepared_tail & *ring->sq_mask;
+	struct io_uring_sqe* sqe = &ring->sqes[index];
+	memset(sqe, 0, sizeof(*sqe));
+	ring->sq_array[index] = index;
+	ring->sq_prepared_tail++;
+	ring->to_submit++;
+	return sqe;
+}
+
+bool uring_prep_read(uring_t* ring, int fd, void* buffer, uint32_t size, uint64_t offset, int fixed_buffer, void* user)
+{
+	struct io_uring_sqe* sqe = uring_get_sqe(ring);
+	if (!sqe)
+	{
+		return false;
+	}
+	sqe->opcode = fixed_buffer >= 0 ? IORING_OP_READ_FIXED : IORING_OP_READ;
+	sqe->fd = fd;
+	sqe->addr = (uint64_t)(uintptr_t)buffer;
+	sqe->len = size;
+	sqe->off = offset;
+	sqe->buf_index = fixed_buffer >= 0 ? (uint16_t)fixed_buffer : 0;
+	sqe->user_data = (uint64_t)(uintptr_t)user;
+	return true;
+}
+
+bool uring_prep_write(uring_t* ring, int fd, const void* buffer, uint32_t size, uint64_t offset, void* user)
+{
+	struct io_uring_sqe* sqe = uring_get_sqe(ring);
+	if (!sqe)
+	{
+		return false;
+	}
+	sqe->opcode = IORING_OP_WRITE;
+	sqe->fd = fd;
+	sqe->addr = (uint64_t)(uintptr_t)buffer;
+	sqe->len = size;
+	sqe->off = offset;
+	sqe->user_data = (uint64_t)(uintptr_t)user;
+	return true;
+}
+
+int uring_submit_and_wait(uring_t* ring, uint32_t wait_count)
+{
+	// Publish the prepared entries before the kernel looks at the tail.
+	__atomic_store_n(ring->sq_tail, ring->sq_prepared_tail, __ATOMIC_RELEASE);
+	while (true)
+	{
+		unsigned flags = wait_count ? IORING_ENTER_GETEVENTS : 0;
+		int submitted = (int)syscall(__NR_io_uring_enter, ring->fd, ring->to_submit, wait_count, flags, NULL, 0);
+		if (submitted >= 0)
+		{
+			ring->to_submit -= (unsigned)submitted;
+			return 0;
+		}
+		if (errno != EINTR)
+		{
+			return errno;
+		}
+	}
+}
+
+bool uring_pop_completion(uring_t* ring, uring_completion_t* completion)
+{
+	unsigned head = *ring->cq_head;
+	if (head == __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE))
+	{
+		return false;
+	}
+	struct io_uring_cqe* cqe = &ring->cqes[head & *ring->cq_mask];
+	completion->user = (void*)(uintptr_t)cqe->user_data;
+	completion->result = cqe->res;
+	// Hand the slot back only after reading it.
+	__atomic_store_n(ring->cq_head, head + 1, __ATOMIC_RELEASE);
+	return true;
+}
+
+#else
+
+uring_t* uring_create(heap_t* heap, uint32_t entries)
+{
+	return NULL;
+}
+
+void uring_destroy(uring_t* ring)
+{
+}
+
+bool uring_register_buffers(uring_t* ring, void* base, size_t buffer_size, int count)
+{
+	return false;
+}
+
+bool uring_prep_read(uring_t* ring, int fd, void* buffer, uint32_t size, uint64_t offset, int fixed_buffer, void* user)
+{
+	return false;
+}
+
+bool uring_prep_write(uring_t* ring, int fd, const void* buffer, uint32_t size, uint64_t offset, void* user)
+{
+	return false;
+}
+
+int uring_submit_and_wait(uring_t* ring, uint32_t wait_count)
+{
+	return -1;
+}
+
+bool uring_pop_completion(uring_t* ring, uring_completion_t* completion)
+{
+	return false;
+}
+
+#endif
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Thin wrapper over a Linux io_uring submission/completion ring.
+//
+// Requests are prepared into the submission ring, then handed to the kernel
+// in one batch by uring_submit_and_wait(). Results are collected with
+// uring_pop_completion(). Not thread-safe: one thread drives a ring.
+// On platforms without io_uring, uring_create() returns NULL.
+
+// Handle to a ring.
+typedef struct uring_t uring_t;
+
+typedef struct heap_t heap_t;
+
+// One finished request.
+typedef struct uring_completion_t
+{
+	// Value passed when the request was prepared.
+	void* user;
+	// Bytes transferred, or a negated errno.
+	int result;
+} uring_completion_t;
+
+// Create a ring with room for entries requests in flight.
+// Returns NULL if io_uring is not available.
+uring_t* uring_create(heap_t* heap, uint32_t entries);
+
+// Destroy a ring. Requests still in flight are abandoned.
+void uring_destroy(uring_t* ring);
+
+// Register count buffers of buffer_size bytes, laid out back to back from base,
+// for use with a fixed buffer index. The kernel pins them once, up front.
+// Returns false if registration failed.
+bool uring_register_buffers(uring_t* ring, void* base, size_t buffer_size, int count);
+
+// Prepare a read of size bytes at offset into buffer.
+// fixed_buffer is a registered buffer index holding buffer, or -1.
+// Returns false if the submission ring is full.
+bool uring_prep_read(uring_t* ring, int fd, void* buffer, uint32_t size, uint64_t offset, int fixed_buffer, void* user);
+
+// Prepare a write of size bytes at offset from buffer.
+// Returns false if the submission ring is full.
+bool uring_prep_write(uring_t* ring, int fd, const void* buffer, uint32_t size, uint64_t offset, void* user);
+
+// Submit everything prepared in one system call, then block until at least
+// wait_count completions are available.
+// Returns zero on success, otherwise an errno.
+int uring_submit_and_wait(uring_t* ring, uint32_t wait_count);
+
+// Pop one completion. Returns false if none are ready.
+bool uring_pop_completion(uring_t* ring, uring_completion_t* completion);